@@ -1453,6 +1453,40 @@ void C_BaseAnimating::GetCachedBoneMatrix( int boneIndex, matrix3x4_t &out )
 }
 
 
+static ConVar cl_jiggle_bone_lod_distance( "cl_jiggle_bone_lod_distance", "768", 0, "Simulate the jiggle bones of models further than this from the view at cl_jiggle_bone_lod_rate (0 = always every frame)" );
+static ConVar cl_jiggle_bone_lod_rate( "cl_jiggle_bone_lod_rate", "40", 0, "Jiggle bone simulation rate beyond cl_jiggle_bone_lod_distance (updates/second, never below twice cl_jiggle_bone_framerate_cutoff)" );
+static ConVar cl_jiggle_bone_lod_cull_distance( "cl_jiggle_bone_lod_cull_distance", "2048", 0, "Don't simulate the jiggle bones of models further than this from the view (0 = never)" );
+extern ConVar cl_jiggle_bone_framerate_cutoff;
+
+//-----------------------------------------------------------------------------
+// Purpose: How often to simulate jiggle bones at the given position, see CJiggleBones::SetUpdateInterval()
+//-----------------------------------------------------------------------------
+static float GetJiggleBoneUpdateInterval( const Vector &vecOrigin, bool bIsViewModel )
+{
+	if ( bIsViewModel )
+		return 0.0f;
+
+	float flDistSqr = MainViewOrigin().DistToSqr( vecOrigin );
+
+	float flCullDist = cl_jiggle_bone_lod_cull_distance.GetFloat();
+	if ( flCullDist > 0.0f && flDistSqr > Square( flCullDist ) )
+		return -1.0f;
+
+	float flLodDist = cl_jiggle_bone_lod_distance.GetFloat();
+	float flRate = cl_jiggle_bone_lod_rate.GetFloat();
+	if ( flLodDist <= 0.0f || flRate <= 0.0f || flDistSqr <= Square( flLodDist ) )
+		return 0.0f;
+
+	// stay at half the framerate cutoff interval or less, so the frame the next update lands on can run
+	// late without the bones giving up and snapping to their goal
+	float flInterval = 1.0f / flRate;
+	if ( cl_jiggle_bone_framerate_cutoff.GetFloat() > 0.0f )
+	{
+		flInterval = MIN( flInterval, 0.5f / cl_jiggle_bone_framerate_cutoff.GetFloat() );
+	}
+	return flInterval;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose:	move position and rotation transforms into global matrices
 //-----------------------------------------------------------------------------
@@ -1582,6 +1616,8 @@ void C_BaseAnimating::BuildTransformations( CStudioHdr *hdr, Vector *pos, Quater
 					m_pJiggleBones = new CJiggleBones;
 				}
 
+				m_pJiggleBones->SetUpdateInterval( GetJiggleBoneUpdateInterval( GetAbsOrigin(), IsViewModel() ) );
+
 				// do jiggle physics
 				m_pJiggleBones->BuildJiggleTransformations( i, gpGlobals->realtime, jiggleInfo, goalMX, GetBoneForWrite( i ), this->ShouldFlipViewModel() );
 
@@ -2445,8 +2481,14 @@ void C_BaseAnimating::CalculateIKLocks( float currentTime )
 	// In TF, we might be attaching a player's view to a walking model that's using IK. If we are, it can
 	// get in here during the view setup code, and it's not normally supposed to be able to access the spatial
 	// partition that early in the rendering loop. So we allow access right here for that special case.
-	SpatialPartitionListMask_t curSuppressed = ::partition->GetSuppressedLists();
-	::partition->SuppressLists( PARTITION_ALL_CLIENT_EDICTS, false );
+	// The threaded bone setup allows it for the job threads before they start.
+	bool bMainThread = ThreadInMainThread();
+	SpatialPartitionListMask_t curSuppressed = 0;
+	if ( bMainThread )
+	{
+		curSuppressed = ::partition->GetSuppressedLists();
+		::partition->SuppressLists( PARTITION_ALL_CLIENT_EDICTS, false );
+	}
 	CBaseEntity::PushEnableAbsRecomputations( false );
 
 	Ray_t ray;
@@ -2666,7 +2708,10 @@ void C_BaseAnimating::CalculateIKLocks( float currentTime )
 #endif
 
 	CBaseEntity::PopEnableAbsRecomputations();
-	::partition->SuppressLists( curSuppressed, true );
+	if ( bMainThread )
+	{
+		::partition->SuppressLists( curSuppressed, true );
+	}
 }
 
 bool C_BaseAnimating::GetPoseParameterRange( int index_, float &minValue, float &maxValue )
@@ -2738,19 +2783,97 @@ CMouthInfo *C_BaseAnimating::GetMouth( void )
 ConVar cl_warn_thread_contested_bone_setup("cl_warn_thread_contested_bone_setup", "0" );
 #endif
 
-// Marked this developmentonly because it currently crashes, and users are enabling it and complaining because of
-// course.  Once this actually works it should just be FCVAR_INTERNAL_USE.
+// When enabled, the entities that set up their bones last frame have them set up ahead of time
+// on the job pool. Entities that follow or are attached to another set up the bones of their move
+// parent from within their own SetupBones(), so each hierarchy is set up as one chain, parents
+// before followers, on one thread; independent chains run in parallel.
+// Still off and development only: an entity reached from two chains loses the TryLock() in
+// SetupBones() and gets no bones that frame, and the chains haven't been shown not to crash.
 ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "0", FCVAR_DEVELOPMENTONLY | FCVAR_INTERNAL_USE,
                               "Enable parallel processing of C_BaseAnimating::SetupBones()" );
+ConVar cl_threaded_bone_setup_stats( "cl_threaded_bone_setup_stats", "0", FCVAR_DEVELOPMENTONLY, "Show the entities, chains and time of the threaded bone setup of each frame." );
 
 //-----------------------------------------------------------------------------
-// Purpose: Do the default sequence blending rules as done in HL1
+// Purpose: The entities of one move hierarchy, set up in order on one thread
 //-----------------------------------------------------------------------------
+struct BoneSetupEntry_t
+{
+	C_BaseEntity		*pRoot;			// top of the move hierarchy
+	int					nDepth;			// move parents above the entity
+	C_BaseAnimating		*pEntity;
+};
 
-static void SetupBonesOnBaseAnimating( C_BaseAnimating *&pBaseAnimating )
+struct BoneSetupChain_t
 {
-	if ( !pBaseAnimating->GetMoveParent() )
-		pBaseAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime );
+	int					nFirst;			// into g_BoneSetupOrder
+	int					nCount;
+};
+
+static CUtlVector< BoneSetupEntry_t >	g_BoneSetupOrder;
+static CUtlVector< BoneSetupChain_t >	g_BoneSetupChains;
+
+static int __cdecl CompareBoneSetupEntries( const BoneSetupEntry_t *a, const BoneSetupEntry_t *b )
+{
+	if ( a->pRoot != b->pRoot )
+		return ( a->pRoot < b->pRoot ) ? -1 : 1;
+
+	return a->nDepth - b->nDepth;
+}
+
+static int __cdecl CompareBoneSetupChains( const BoneSetupChain_t *a, const BoneSetupChain_t *b )
+{
+	// longest first, so the long chains don't start last
+	return b->nCount - a->nCount;
+}
+
+static void SetupBonesOnChain( BoneSetupChain_t &chain )
+{
+	for ( int i = 0; i < chain.nCount; i++ )
+	{
+		g_BoneSetupOrder[ chain.nFirst + i ].pEntity->SetupBones( NULL, -1, -1, gpGlobals->curtime );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Group the entities of g_PreviousBoneSetups by move hierarchy
+//-----------------------------------------------------------------------------
+static void BuildBoneSetupChains()
+{
+	g_BoneSetupOrder.RemoveAll();
+	g_BoneSetupChains.RemoveAll();
+
+	for ( int i = 0; i < g_PreviousBoneSetups.Count(); i++ )
+	{
+		C_BaseAnimating *pEntity = g_PreviousBoneSetups[i];
+		if ( pEntity->IsDormant() )
+			continue;
+
+		BoneSetupEntry_t &entry = g_BoneSetupOrder[ g_BoneSetupOrder.AddToTail() ];
+		entry.pRoot = pEntity;
+		entry.nDepth = 0;
+		entry.pEntity = pEntity;
+
+		for ( C_BaseEntity *pParent = pEntity->GetMoveParent(); pParent; pParent = pParent->GetMoveParent() )
+		{
+			entry.pRoot = pParent;
+			entry.nDepth++;
+		}
+	}
+
+	g_BoneSetupOrder.Sort( CompareBoneSetupEntries );
+
+	for ( int i = 0; i < g_BoneSetupOrder.Count(); i++ )
+	{
+		if ( i == 0 || g_BoneSetupOrder[i].pRoot != g_BoneSetupOrder[i - 1].pRoot )
+		{
+			BoneSetupChain_t &chain = g_BoneSetupChains[ g_BoneSetupChains.AddToTail() ];
+			chain.nFirst = i;
+			chain.nCount = 0;
+		}
+		g_BoneSetupChains.Tail().nCount++;
+	}
+
+	g_BoneSetupChains.Sort( CompareBoneSetupChains );
 }
 
 static void PreThreadedBoneSetup()
@@ -2779,14 +2902,36 @@ void C_BaseAnimating::ThreadedBoneSetup()
 	g_bDoThreadedBoneSetup = cl_threaded_bone_setup.GetBool();
 	if ( g_bDoThreadedBoneSetup )
 	{
-		int nCount = g_PreviousBoneSetups.Count();
-		if ( nCount > 1 )
+		VPROF_BUDGET( "C_BaseAnimating::ThreadedBoneSetup", VPROF_BUDGETGROUP_CLIENT_ANIMATION );
+
+		CFastTimer timer;
+		timer.Start();
+
+		BuildBoneSetupChains();
+
+		int nChains = g_BoneSetupChains.Count();
+		if ( nChains > 1 )
 		{
+			// IK locks trace against the client entities, see CalculateIKLocks()
+			SpatialPartitionListMask_t curSuppressed = ::partition->GetSuppressedLists();
+			::partition->SuppressLists( PARTITION_ALL_CLIENT_EDICTS, false );
+
 			g_bInThreadedBoneSetup = true;
 
-			ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", g_PreviousBoneSetups.Base(), nCount, &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+			ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", g_BoneSetupChains.Base(), nChains, &SetupBonesOnChain, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
 
 			g_bInThreadedBoneSetup = false;
+
+			::partition->SuppressLists( curSuppressed, true );
+		}
+
+		timer.End();
+
+		if ( cl_threaded_bone_setup_stats.GetBool() )
+		{
+			int nEntities = ( nChains > 1 ) ? g_BoneSetupOrder.Count() : 0;
+			int nLongest = ( nChains > 1 ) ? g_BoneSetupChains[0].nCount : 0;
+			engine->Con_NPrintf( 0, "Threaded bone setup: %d entities in %d chains (longest %d), %.2f ms", nEntities, ( nChains > 1 ) ? nChains : 0, nLongest, timer.GetDuration().GetMillisecondsF() );
 		}
 	}
 	g_iPreviousBoneCounter++;
@@ -2894,7 +3039,7 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 	}
 
 	int nBoneCount = m_CachedBoneData.Count();
-	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && ( nBoneCount >= 16 ) && !GetMoveParent() && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
+	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && ( nBoneCount >= 16 || GetMoveParent() ) && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
 	{
 		m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
 		Assert( g_PreviousBoneSetups.Find( this ) == -1 );
@@ -5827,12 +5972,10 @@ int C_BaseAnimating::LookupPoseParameter( CStudioHdr *pstudiohdr, const char *sz
 	if ( !pstudiohdr )
 		return 0;
 
-	for (int i = 0; i < pstudiohdr->GetNumPoseParameters(); i++)
+	int iParameter = pstudiohdr->FindPoseParameter( szName );
+	if ( iParameter >= 0 )
 	{
-		if (stricmp( pstudiohdr->pPoseParameter( i ).pszName(), szName ) == 0)
-		{
-			return i;
-		}
+		return iParameter;
 	}
 
 	// AssertMsg( 0, UTIL_VarArgs( "poseparameter %s couldn't be mapped!!!\n", szName ) );
@@ -436,6 +436,28 @@ void CAnimationLayer::DispatchAnimEvents( CBaseAnimating *eventHandler, CBaseAni
 
 
 
+//-----------------------------------------------------------------------------
+// Purpose: add the layers GetSkeleton() blends to the bone setup state
+//-----------------------------------------------------------------------------
+bool CBaseAnimatingOverlay::HashBoneSetup( CRC32_t *pCRC )
+{
+	if ( !BaseClass::HashBoneSetup( pCRC ) )
+		return false;
+
+	for ( int i = 0; i < m_AnimOverlay.Count(); i++ )
+	{
+		CAnimationLayer &pLayer = m_AnimOverlay[i];
+		if ( (pLayer.m_flWeight > 0) && pLayer.IsActive() )
+		{
+			int layer[3] = { i, pLayer.m_nSequence, pLayer.m_nOrder };
+			float flLayer[2] = { pLayer.m_flCycle, pLayer.m_flWeight };
+			CRC32_ProcessBuffer( pCRC, layer, sizeof( layer ) );
+			CRC32_ProcessBuffer( pCRC, flLayer, sizeof( flLayer ) );
+		}
+	}
+	return true;
+}
+
 void CBaseAnimatingOverlay::GetSkeleton( CStudioHdr *pStudioHdr, Vector pos[], Quaternion q[], int boneMask )
 {
 	if(!pStudioHdr)
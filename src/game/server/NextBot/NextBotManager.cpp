@@ -269,6 +269,9 @@ void NextBotManager::Reset( void )
 		i = iNext;
 	}
 
+	m_pathQueue.Reset();
+	m_visionBatch.Reset();
+
 	m_selectedBot = NULL;
 }
 
@@ -313,6 +316,9 @@ void NextBotManager::Update( void )
 		m_botList[ u ]->Upkeep();
 	}
 
+	// start the path searches requested last tick, to be delivered after entity think
+	m_pathQueue.Dispatch();
+
 	// schedule full updates
 	if ( m_botList.Count() )
 	{
@@ -391,6 +397,17 @@ void NextBotManager::Update( void )
 			nScheduled = m_botList.Count();
 		}
 
+		// update the vision of every bot that is due for it, at the same rate as their full updates
+		m_liveBots.RemoveAll();
+		for( int u=m_botList.Head(); u != m_botList.InvalidIndex(); u = m_botList.Next( u ) )
+		{
+			if ( !IsDead( m_botList[ u ] ) )
+			{
+				m_liveBots.AddToTail( m_botList[ u ] );
+			}
+		}
+		m_visionBatch.Update( m_liveBots, m_iUpdateTickrate );
+
 		if ( nb_update_debug.GetBool() )
 		{
 			int nIntentionalSliders = 0;
@@ -515,6 +532,8 @@ void NextBotManager::UnRegister( INextBot *bot )
 {
 	m_botList.Remove( bot->GetBotId() );
 
+	m_pathQueue.Cancel( bot );
+
 	if ( bot == m_selectedBot)
 	{
 		// we can't access virtual methods because this is called from a destructor, so just clear it
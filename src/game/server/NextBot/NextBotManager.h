@@ -6,6 +6,8 @@
 #define _NEXT_BOT_MANAGER_H_
 
 #include "NextBotInterface.h"
+#include "Path/NextBotPathQueue.h"
+#include "NextBotVisionBatch.h"
 
 class CTerrorPlayer;
 
@@ -28,6 +30,9 @@ public:
 
 	int GetNextBotCount( void ) const;				// How many nextbots are alive right now?
 
+	NextBotPathQueue &GetPathQueue( void )			{ return m_pathQueue; }	// asynchronous path requests, see Path::ComputeAsync()
+	NextBotVisionBatch &GetVisionBatch( void )		{ return m_visionBatch; }	// updates the vision of all bots, see IVision::Update()
+
 
 	/**
 	 * Populate given vector with all bots in the system
@@ -162,6 +167,10 @@ protected:
 	CUtlVector< DebugFilter > m_debugFilterList;
 
 	INextBot *m_selectedBot;						// selected bot for further debug operations
+
+	NextBotPathQueue m_pathQueue;
+	NextBotVisionBatch m_visionBatch;
+	CUtlVector< INextBot * > m_liveBots;			// scratch for the vision pass
 };
 
 inline int NextBotManager::GetNextBotCount( void ) const
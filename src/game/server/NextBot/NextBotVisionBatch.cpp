@@ -0,0 +1,497 @@
+// NextBotVisionBatch.cpp
+// Update the vision of every NextBot in one pass per tick
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#include "cbase.h"
+
+#include "nav_area.h"
+#include "mathlib/ssemath.h"
+#include "tier0/vprof.h"
+#include "vstdlib/jobthread.h"
+
+#include "NextBot.h"
+#include "NextBotManager.h"
+#include "NextBotVisionInterface.h"
+#include "NextBotBodyInterface.h"
+#include "NextBotUtil.h"
+#include "NextBotVisionBatch.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+extern ConVar nb_blind;
+extern ConVar NextBotPlayerStop;
+
+ConVar nb_vision_batch( "nb_vision_batch", "1", FCVAR_CHEAT, "Update the vision of all NextBots in one pass at the start of the tick, instead of in each bot's update" );
+ConVar nb_vision_ray_budget( "nb_vision_ray_budget", "256", FCVAR_CHEAT, "Maximum number of line of sight rays traced per tick by the NextBot vision pass (0 = no limit)" );
+ConVar nb_vision_share_rays( "nb_vision_share_rays", "1", FCVAR_CHEAT, "Trace the eye to eye ray between two bots looking for each other only once per tick" );
+// Off until the trace filter's entity callbacks (ShouldHitEntity, the game rules' ShouldCollide) are known to be safe
+// to call from worker threads mid-tick
+ConVar nb_vision_threaded( "nb_vision_threaded", "0", FCVAR_CHEAT, "Trace the rays of the NextBot vision pass on worker threads (experimental)" );
+
+
+//--------------------------------------------------------------------------------------------------------------
+NextBotVisionBatch::NextBotVisionBatch( void ) : m_sharedRays( DefLessFunc( unsigned int ) )
+{
+	m_rayCount = 0;
+	ResetStats();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool NextBotVisionBatch::IsEnabled( void ) const
+{
+	return nb_vision_batch.GetBool();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotVisionBatch::Reset( void )
+{
+	m_due.RemoveAll();
+	m_viewers.RemoveAll();
+	m_sightings.RemoveAll();
+	m_rays.RemoveAll();
+	m_sharedRays.RemoveAll();
+	m_rayCount = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int NextBotVisionBatch::CompareBatchTick( IVision * const *a, IVision * const *b )
+{
+	if ( (*a)->m_batchTick != (*b)->m_batchTick )
+	{
+		return ( (*a)->m_batchTick < (*b)->m_batchTick ) ? -1 : 1;
+	}
+
+	return (*a)->GetBot()->GetEntity()->entindex() - (*b)->GetBot()->GetEntity()->entindex();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Update the known entities of the given bots whose vision hasn't been updated for updateInterval ticks,
+ * oldest first, until the ray budget runs out. At least one bot is updated every tick.
+ * The budget is checked against the first ray of each sighting, since the rays are traced after the bots
+ * are chosen; sightings blocked by the first ray trace up to two more.
+ */
+void NextBotVisionBatch::Update( const CUtlVector< INextBot * > &bots, int updateInterval )
+{
+	if ( !IsEnabled() || nb_blind.GetBool() || NextBotStop.GetBool() )
+		return;
+
+	VPROF_BUDGET( "NextBotVisionBatch::Update", "NextBot" );
+
+	updateInterval = MAX( updateInterval, 1 );
+
+	m_due.RemoveAll();
+	FOR_EACH_VEC( bots, it )
+	{
+		INextBot *bot = bots[ it ];
+		IVision *vision = bot->GetVisionInterface();
+		if ( !vision || !bot->GetEntity() )
+			continue;
+
+		if ( bot->GetEntity()->IsPlayer() && NextBotPlayerStop.GetBool() )
+			continue;
+
+		if ( vision->m_batchTick < 0 || gpGlobals->tickcount - vision->m_batchTick >= updateInterval )
+		{
+			m_due.AddToTail( vision );
+		}
+	}
+
+	if ( m_due.Count() == 0 )
+		return;
+
+	// bots left over by the budget last tick have waited longest, and go first
+	m_due.Sort( CompareBatchTick );
+
+	m_viewers.RemoveAll();
+	m_sightings.RemoveAll();
+	m_rayCount = 0;
+
+	int budget = nb_vision_ray_budget.GetInt();
+	int i;
+	for( i=0; i<m_due.Count(); ++i )
+	{
+		if ( budget > 0 && m_sightings.Count() >= budget && i > 0 )
+			break;
+
+		AddViewer( m_due[i] );
+	}
+
+	TraceSightings();
+
+	FOR_EACH_VEC( m_viewers, v )
+	{
+		ApplyVision( v );
+	}
+
+	++m_ticks;
+	m_tracedRays += m_rayCount;
+
+	if ( i < m_due.Count() )
+	{
+		++m_deferredTicks;
+		m_deferred += m_due.Count() - i;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Do the tests of IVision::IsAbleToSee() that come before line of sight for every candidate of the bot,
+ * and add a sighting for each one that passes
+ */
+void NextBotVisionBatch::AddViewer( IVision *vision )
+{
+	VPROF_BUDGET( "NextBotVisionBatch::AddViewer", "NextBot" );
+
+	INextBot *bot = vision->GetBot();
+	CBaseCombatCharacter *me = bot->GetEntity();
+
+	CollectCandidates( vision );
+
+	Viewer viewer;
+	viewer.vision = vision;
+	viewer.eye = bot->GetBodyInterface()->GetEyePosition();		// copy, since GetEyePosition() may return a static
+	viewer.firstSighting = m_sightings.Count();
+
+	float maxRange = vision->GetMaxVisionRange();
+	CNavArea *myArea = me->GetLastKnownArea();
+
+	FOR_EACH_VEC( m_candidates, it )
+	{
+		CBaseEntity *subject = m_candidates[ it ];
+
+		if ( bot->IsRangeGreaterThan( subject, maxRange ) || me->IsHiddenByFog( subject ) )
+		{
+			++m_culledPairs;
+			continue;
+		}
+
+		CBaseCombatCharacter *combat = subject->MyCombatCharacterPointer();
+		if ( combat && myArea )
+		{
+			CNavArea *subjectArea = combat->GetLastKnownArea();
+			if ( subjectArea && !myArea->IsPotentiallyVisible( subjectArea ) )
+			{
+				++m_culledPairs;
+				continue;
+			}
+		}
+
+		Sighting &sighting = m_sightings[ m_sightings.AddToTail() ];
+		sighting.viewer = m_viewers.Count();
+		sighting.subject = subject;
+		sighting.center = subject->WorldSpaceCenter();
+		sighting.eye = subject->EyePosition();
+		sighting.origin = subject->GetAbsOrigin();
+		sighting.ray = -1;
+		sighting.isClear = false;
+	}
+
+	viewer.sightingCount = m_sightings.Count() - viewer.firstSighting;
+	m_viewers.AddToTail( viewer );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Update the known entities of the bot from its sightings. Main thread only, since this raises
+ * OnSight() and OnLostSight() events.
+ */
+void NextBotVisionBatch::ApplyVision( int v )
+{
+	VPROF_BUDGET( "NextBotVisionBatch::ApplyVision", "NextBot" );
+
+	const Viewer &viewer = m_viewers[ v ];
+	IVision *vision = viewer.vision;
+
+	m_visible.RemoveAll();
+	for( int it = viewer.firstSighting; it < viewer.firstSighting + viewer.sightingCount; ++it )
+	{
+		const Sighting &sighting = m_sightings[ it ];
+
+		if ( sighting.isClear && vision->IsVisibleEntityNoticed( sighting.subject ) )
+		{
+			m_visible.AddToTail( sighting.subject );
+		}
+	}
+
+	if ( vision->m_batchTick >= 0 )
+	{
+		m_maxStaleness = MAX( m_maxStaleness, gpGlobals->tickcount - vision->m_batchTick );
+	}
+
+	vision->UpdateKnownEntities( m_visible );
+	vision->m_lastVisionUpdateTimestamp = gpGlobals->curtime;
+	vision->m_batchTick = gpGlobals->tickcount;
+
+	++m_updated;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Collect the entities the bot could see, and keep those within range and field of view.
+ * The tests are done four candidates at a time: range conservatively with bounding spheres (the exact
+ * test is done afterwards), and field of view the way PointWithinViewAngle() does it, for the center
+ * and eyes of each candidate as IVision::IsInFieldOfView() does.
+ */
+void NextBotVisionBatch::CollectCandidates( IVision *vision )
+{
+	INextBot *bot = vision->GetBot();
+	CBaseCombatCharacter *me = bot->GetEntity();
+	IBody *body = bot->GetBodyInterface();
+
+	// the same candidates IVision::UpdateKnownEntities() tests
+	vision->CollectPotentiallyVisibleEntities( &m_potentiallyVisible );
+
+	m_candidates.RemoveAll();
+	m_center.RemoveAll();
+	m_eye.RemoveAll();
+	m_radius.RemoveAll();
+
+	FOR_EACH_VEC( m_potentiallyVisible, it )
+	{
+		CBaseEntity *entity = m_potentiallyVisible[ it ];
+
+		if ( entity && !vision->IsIgnored( entity ) && entity->IsAlive() && entity != me )
+		{
+			m_candidates.AddToTail( entity );
+			m_center.AddToTail( entity->WorldSpaceCenter() );
+			m_eye.AddToTail( entity->EyePosition() );
+			m_radius.AddToTail( entity->CollisionProp()->BoundingRadius() );
+		}
+	}
+
+	int count = m_candidates.Count();
+	m_candidatePairs += count;
+
+	FourVectors myEye;
+	myEye.DuplicateVector( body->GetEyePosition() );
+
+	FourVectors myCenter;
+	myCenter.DuplicateVector( me->WorldSpaceCenter() );
+
+	const Vector &view = body->GetViewVector();
+	fltx4 cosHalfFOV = ReplicateX4( vision->m_cosHalfFOV );
+	fltx4 reach = ReplicateX4( vision->GetMaxVisionRange() + me->CollisionProp()->BoundingRadius() );
+
+	int kept = 0;
+	for( int i=0; i<count; i += 4 )
+	{
+		// the lanes past the end repeat the last candidate
+		int last = count - 1;
+		int a = i, b = MIN( i+1, last ), c = MIN( i+2, last ), d = MIN( i+3, last );
+
+		FourVectors center;
+		center.LoadAndSwizzle( m_center[a], m_center[b], m_center[c], m_center[d] );
+
+		FourVectors subjectEye;
+		subjectEye.LoadAndSwizzle( m_eye[a], m_eye[b], m_eye[c], m_eye[d] );
+
+		float radius[4] = { m_radius[a], m_radius[b], m_radius[c], m_radius[d] };
+
+		// beyond max range even between the nearest points of the bounding spheres
+		FourVectors toCenter = center;
+		toCenter -= myCenter;
+		fltx4 limit = AddSIMD( reach, LoadUnalignedSIMD( radius ) );
+		fltx4 inRange = CmpLeSIMD( toCenter.length2(), MulSIMD( limit, limit ) );
+
+		FourVectors toTarget = center;
+		toTarget -= myEye;
+		fltx4 dot = toTarget * view;
+		fltx4 inFOV = AndSIMD( CmpGeSIMD( dot, Four_Zeros ), CmpGtSIMD( MulSIMD( dot, dot ), MulSIMD( MulSIMD( toTarget.length2(), cosHalfFOV ), cosHalfFOV ) ) );
+
+		toTarget = subjectEye;
+		toTarget -= myEye;
+		dot = toTarget * view;
+		inFOV = OrSIMD( inFOV, AndSIMD( CmpGeSIMD( dot, Four_Zeros ), CmpGtSIMD( MulSIMD( dot, dot ), MulSIMD( MulSIMD( toTarget.length2(), cosHalfFOV ), cosHalfFOV ) ) ) );
+
+		int mask = TestSignSIMD( AndSIMD( inRange, inFOV ) );
+
+		for( int k=0; k<4 && i+k<count; ++k )
+		{
+			if ( mask & ( 1 << k ) )
+			{
+				m_candidates[ kept++ ] = m_candidates[ i+k ];
+			}
+		}
+	}
+
+	m_culledPairs += count - kept;
+	m_candidates.SetCountNonDestructively( kept );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The rays of IVision::IsLineOfSightClearToEntity() for every sighting. Each wave traces the next ray
+ * of the sightings all previous rays were blocked for: the subject's center, then its eyes, then its feet.
+ */
+void NextBotVisionBatch::TraceSightings( void )
+{
+	VPROF_BUDGET( "NextBotVisionBatch::TraceSightings", "NextBot" );
+
+#ifdef TERROR
+	FOR_EACH_VEC( m_sightings, it )
+	{
+		Sighting &sighting = m_sightings[ it ];
+		sighting.isClear = m_viewers[ sighting.viewer ].vision->IsLineOfSightClearToEntity( sighting.subject );
+		++m_rayCount;
+	}
+#else
+	enum { CENTER_WAVE, EYE_WAVE, FEET_WAVE, WAVE_COUNT };
+
+	bool isShared = nb_vision_share_rays.GetBool();
+
+	for( int wave=0; wave<WAVE_COUNT; ++wave )
+	{
+		m_rays.RemoveAll();
+		m_sharedRays.RemoveAll();
+
+		FOR_EACH_VEC( m_sightings, it )
+		{
+			Sighting &sighting = m_sightings[ it ];
+			if ( sighting.isClear )
+				continue;
+
+			const Viewer &viewer = m_viewers[ sighting.viewer ];
+			unsigned int key = 0;
+
+			if ( wave == EYE_WAVE && isShared )
+			{
+				// the eye to eye ray is the same ray in reverse when the subject is a bot that is looking for us too
+				unsigned int me = viewer.vision->GetBot()->GetEntity()->entindex();
+				unsigned int target = sighting.subject->entindex();
+				key = ( me << 16 ) | target;
+
+				unsigned short reverse = m_sharedRays.Find( ( target << 16 ) | me );
+				if ( reverse != m_sharedRays.InvalidIndex() )
+				{
+					const Ray &ray = m_rays[ m_sharedRays[ reverse ] ];
+					if ( ray.from == sighting.eye && ray.to == viewer.eye )
+					{
+						sighting.ray = m_sharedRays[ reverse ];
+						++m_sharedRayHits;
+						continue;
+					}
+				}
+			}
+
+			Ray ray;
+			ray.from = viewer.eye;
+			ray.to = ( wave == CENTER_WAVE ) ? sighting.center : ( wave == EYE_WAVE ) ? sighting.eye : sighting.origin;
+			ray.subject = sighting.subject;
+			ray.isClear = false;
+			sighting.ray = m_rays.AddToTail( ray );
+
+			if ( wave == EYE_WAVE && isShared )
+			{
+				m_sharedRays.InsertOrReplace( key, sighting.ray );
+			}
+		}
+
+		if ( m_rays.Count() == 0 )
+			break;
+
+		TraceWave();
+
+		FOR_EACH_VEC( m_sightings, it )
+		{
+			Sighting &sighting = m_sightings[ it ];
+			if ( sighting.ray >= 0 )
+			{
+				sighting.isClear = m_rays[ sighting.ray ].isClear;
+				sighting.ray = -1;
+			}
+		}
+	}
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Trace the rays of the current wave, on worker threads if nb_vision_threaded is set. Nothing
+ * else runs while they do, so the world they trace against doesn't change.
+ */
+void NextBotVisionBatch::TraceWave( void )
+{
+	m_rayCount += m_rays.Count();
+
+	if ( nb_vision_threaded.GetBool() && m_rays.Count() > 1 )
+	{
+		ParallelProcess( "NextBotVisionBatch::TraceWave", m_rays.Base(), m_rays.Count(), &NextBotVisionBatch::TraceRayJob );
+	}
+	else
+	{
+		FOR_EACH_VEC( m_rays, it )
+		{
+			TraceRayJob( m_rays[ it ] );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotVisionBatch::TraceRayJob( Ray &ray )
+{
+	trace_t result;
+	NextBotTraceFilterIgnoreActors filter( ray.subject, COLLISION_GROUP_NONE );
+
+	UTIL_TraceLine( ray.from, ray.to, MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, &filter, &result );
+	ray.isClear = !result.DidHit();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotVisionBatch::ResetStats( void )
+{
+	m_ticks = 0;
+	m_deferredTicks = 0;
+	m_updated = 0;
+	m_deferred = 0;
+	m_maxStaleness = 0;
+	m_candidatePairs = 0;
+	m_culledPairs = 0;
+	m_tracedRays = 0;
+	m_sharedRayHits = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotVisionBatch::Report( void ) const
+{
+	Msg( "Vision pass: %s\n", IsEnabled() ? "enabled" : "disabled (nb_vision_batch 0)" );
+
+	if ( m_ticks )
+	{
+		Msg( "  %d bot updates over %d ticks, %.1f per tick\n", m_updated, m_ticks, (float)m_updated / m_ticks );
+		Msg( "  %d ticks left bots for the next one, %d bot updates deferred, %d ticks longest between updates (nb_vision_ray_budget %d)\n", m_deferredTicks, m_deferred, m_maxStaleness, nb_vision_ray_budget.GetInt() );
+		Msg( "  rays: %.1f per tick, %d not traced because the reverse ray was\n", (float)m_tracedRays / m_ticks, m_sharedRayHits );
+	}
+
+	if ( m_candidatePairs )
+	{
+		Msg( "  %d bot/entity pairs, %d (%.0f%%) culled before tracing\n", m_candidatePairs, m_culledPairs, 100.0f * m_culledPairs / m_candidatePairs );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nb_vision_report, "Print NextBot vision pass updates, rays traced, and culling", FCVAR_CHEAT )
+{
+	TheNextBots().GetVisionBatch().Report();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nb_vision_reset_stats, "Reset NextBot vision pass statistics", FCVAR_CHEAT )
+{
+	TheNextBots().GetVisionBatch().ResetStats();
+}
@@ -0,0 +1,111 @@
+// NextBotVisionBatch.h
+// Update the vision of every NextBot in one pass per tick
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#ifndef _NEXT_BOT_VISION_BATCH_H_
+#define _NEXT_BOT_VISION_BATCH_H_
+
+#include "utlvector.h"
+#include "utlmap.h"
+
+class INextBot;
+class IVision;
+class CBaseEntity;
+
+
+//---------------------------------------------------------------------------------------------------------------
+/**
+ * The vision pass owned by the NextBotManager. Instead of each bot tracing to each entity it
+ * could see from within its own update, the manager updates the known entities of every bot
+ * whose vision is due at the start of the tick:
+ *  - the candidates of each bot are culled by range and field of view four at a time, and
+ *    then by the potential visibility of their nav areas
+ *  - the rays of the candidates of all bots are traced together on worker threads, a wave per
+ *    ray of the IVision::IsLineOfSightClearToEntity() cascade, and the eye to eye ray between
+ *    two bots that look for each other is traced once
+ *  - bots are added to the pass until the rays of the first wave reach nb_vision_ray_budget;
+ *    bots that don't fit keep what they knew and are first in line next tick
+ *  - the known entities of the bots are then updated on the main thread, one bot at a time
+ *
+ * This follows IVision::IsAbleToSee() step by step, so it relies on IVision derived classes
+ * customizing vision through the virtual predicates it calls (IsIgnored(), GetMaxVisionRange(),
+ * IsVisibleEntityNoticed(), etc.) rather than by overriding IsAbleToSee() itself.
+ */
+class NextBotVisionBatch
+{
+public:
+	NextBotVisionBatch( void );
+
+	bool IsEnabled( void ) const;						// if false, each bot updates its own vision in IVision::Update()
+
+	void Reset( void );
+	void Update( const CUtlVector< INextBot * > &bots, int updateInterval );	// update the vision of the given bots that are due, every updateInterval ticks
+
+	void ResetStats( void );
+	void Report( void ) const;
+
+private:
+	void AddViewer( IVision *vision );					// collect the sightings of the bot
+	void CollectCandidates( IVision *vision );			// fill m_candidates with the entities that pass the range and FOV tests
+	void TraceSightings( void );						// resolve the line of sight of every sighting
+	void TraceWave( void );								// trace m_rays
+	void ApplyVision( int viewer );						// update the known entities of the bot
+	static int CompareBatchTick( IVision * const *a, IVision * const *b );
+
+	CUtlVector< IVision * > m_due;						// oldest first
+	CUtlVector< CBaseEntity * > m_potentiallyVisible;
+	CUtlVector< CBaseEntity * > m_candidates;
+	CUtlVector< CBaseEntity * > m_visible;
+
+	// structure of arrays for culling four candidates at a time
+	CUtlVector< Vector > m_center;
+	CUtlVector< Vector > m_eye;
+	CUtlVector< float > m_radius;
+
+	struct Viewer
+	{
+		IVision *vision;
+		Vector eye;
+		int firstSighting;
+		int sightingCount;
+	};
+	CUtlVector< Viewer > m_viewers;						// the bots updated this tick
+
+	struct Sighting
+	{
+		int viewer;
+		CBaseEntity *subject;
+		Vector center;									// of the subject, captured on the main thread
+		Vector eye;
+		Vector origin;
+		int ray;										// the ray of the current wave this waits on, or -1
+		bool isClear;
+	};
+	CUtlVector< Sighting > m_sightings;
+
+	struct Ray
+	{
+		Vector from;
+		Vector to;
+		CBaseEntity *subject;							// ignored by the trace
+		bool isClear;
+	};
+	static void TraceRayJob( Ray &ray );
+	CUtlVector< Ray > m_rays;							// the current wave
+	CUtlMap< unsigned int, int > m_sharedRays;			// eye to eye rays of the current wave, keyed by viewer and subject entindex
+	int m_rayCount;										// rays traced this tick
+
+	// statistics
+	int m_ticks;
+	int m_deferredTicks;								// ticks that left bots for the next one
+	int m_updated;										// bot vision updates
+	int m_deferred;										// bot vision updates pushed to a later tick
+	int m_maxStaleness;									// most ticks a bot went without a vision update
+	int m_candidatePairs;								// bot/entity pairs considered
+	int m_culledPairs;									// rejected by range, fog, FOV or area visibility
+	int m_tracedRays;
+	int m_sharedRayHits;								// rays not traced because the reverse was
+};
+
+
+#endif // _NEXT_BOT_VISION_BATCH_H_
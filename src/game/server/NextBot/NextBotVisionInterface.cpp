@@ -12,6 +12,7 @@
 #include "NextBotVisionInterface.h"
 #include "NextBotBodyInterface.h"
 #include "NextBotUtil.h"
+#include "NextBotManager.h"
 
 #ifdef TERROR
 #include "querycache.h"
@@ -44,6 +45,7 @@ void IVision::Reset( void )
 
 	m_knownEntityVector.RemoveAll();
 	m_lastVisionUpdateTimestamp = 0.0f;
+	m_batchTick = -1;
 	m_primaryThreat = NULL;
 
 	m_FOV = GetDefaultFieldOfView();
@@ -346,21 +348,23 @@ public:
 		return true;
 	}
 	
-	bool Contains( CBaseEntity *entity ) const
+	IVision *m_vision;
+	CUtlVector< CBaseEntity * > m_recognized;
+};
+
+
+//------------------------------------------------------------------------------------------
+static bool ContainsEntity( const CUtlVector< CBaseEntity * > &entityVector, CBaseEntity *entity )
+{
+	for( int i=0; i < entityVector.Count(); ++i )
 	{
-		for( int i=0; i < m_recognized.Count(); ++i )
+		if ( entity->entindex() == entityVector[ i ]->entindex() )
 		{
-			if ( entity->entindex() == m_recognized[ i ]->entindex() )
-			{
-				return true;
-			}
+			return true;
 		}
-		return false;
 	}
-	
-	IVision *m_vision;
-	CUtlVector< CBaseEntity * > m_recognized;
-};
+	return false;
+}
 
 
 //------------------------------------------------------------------------------------------
@@ -381,7 +385,17 @@ void IVision::UpdateKnownEntities( void )
 		if ( visibleNow( potentiallyVisible[ pit ] ) == false )
 			break;
 	}
-	
+
+	UpdateKnownEntities( visibleNow.m_recognized );
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Update the known set given the entities we can see right now, and emit OnSight()/OnLostSight()
+ */
+void IVision::UpdateKnownEntities( const CUtlVector< CBaseEntity * > &visibleNow )
+{
 	// update known set with new data
 	{	VPROF_BUDGET( "IVision::UpdateKnownEntities( update status )", "NextBot" );
 
@@ -398,7 +412,7 @@ void IVision::UpdateKnownEntities( void )
 				continue;
 			}
 			
-			if ( visibleNow.Contains( known.GetEntity() ) )
+			if ( ContainsEntity( visibleNow, known.GetEntity() ) )
 			{
 				// this visible entity was already known (but perhaps not visible until now)
 				known.UpdatePosition();
@@ -461,11 +475,11 @@ void IVision::UpdateKnownEntities( void )
 	{	VPROF_BUDGET( "IVision::UpdateKnownEntities( new recognizes )", "NextBot" );
 
 		int i, j;
-		for( i=0; i < visibleNow.m_recognized.Count(); ++i )
+		for( i=0; i < visibleNow.Count(); ++i )
 		{	
 			for( j=0; j < m_knownEntityVector.Count(); ++j )
 			{
-				if ( visibleNow.m_recognized[i] == m_knownEntityVector[j].GetEntity() )
+				if ( visibleNow[i] == m_knownEntityVector[j].GetEntity() )
 				{
 					break;
 				}
@@ -474,7 +488,7 @@ void IVision::UpdateKnownEntities( void )
 			if ( j == m_knownEntityVector.Count() )
 			{
 				// recognized a previously unknown entity (emit OnSight() event after reaction time has passed)
-				CKnownEntity known( visibleNow.m_recognized[i] );
+				CKnownEntity known( visibleNow[i] );
 				known.UpdatePosition();
 				known.UpdateVisibilityStatus( true );
 				m_knownEntityVector.AddToTail( known );
@@ -558,6 +572,12 @@ void IVision::Update( void )
 		return;
 	}
 
+	if ( TheNextBots().GetVisionBatch().IsEnabled() )
+	{
+		// the NextBotManager updates the known entities of all bots at the start of the tick
+		return;
+	}
+
 	UpdateKnownEntities();
 
 	m_lastVisionUpdateTimestamp = gpGlobals->curtime;
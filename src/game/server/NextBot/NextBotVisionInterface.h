@@ -109,6 +109,8 @@ public:
 	virtual bool IsLookingAt( const CBaseCombatCharacter *actor, float cosTolerance = 0.95f ) const;	// are we looking at the given actor
 
 private:
+	friend class NextBotVisionBatch;
+
 	CountdownTimer m_scanTimer;			// for throttling update rate
 	
 	float m_FOV;						// current FOV in degrees
@@ -116,10 +118,12 @@ private:
 	
 	CUtlVector< CKnownEntity > m_knownEntityVector;		// the set of enemies/friends we are aware of
 	void UpdateKnownEntities( void );
+	void UpdateKnownEntities( const CUtlVector< CBaseEntity * > &visibleNow );	// update the known set given the entities we can see right now
 	bool IsAwareOf( const CKnownEntity &known ) const;	// return true if our reaction time has passed for this entity
 	mutable CHandle< CBaseEntity > m_primaryThreat;
 
 	float m_lastVisionUpdateTimestamp;
+	int m_batchTick;									// when NextBotVisionBatch last updated our known entities
 	IntervalTimer m_notVisibleTimer[ MAX_TEAMS ];		// for tracking interval since last saw a member of the given team
 };
 
@@ -9,6 +9,8 @@
 #include "fmtstr.h"
 
 #include "NextBotPath.h"
+#include "NextBotPathQueue.h"
+#include "NextBotManager.h"
 #include "NextBotInterface.h"
 #include "NextBotLocomotionInterface.h"
 #include "NextBotBodyInterface.h"
@@ -33,6 +35,14 @@ Path::Path( void )
 	m_cursorData.segmentPrior = NULL;
 	m_ageTimer.Invalidate();
 	m_subject = NULL;
+	m_isAsyncPending = false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+Path::~Path()
+{
+	CancelComputeAsync();
 }
 
 
@@ -452,6 +462,147 @@ bool Path::BuildTrivialPath( INextBot *bot, const Vector &goal )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Queue a path search from bot to goal. See NextBotPathQueue.
+ */
+bool Path::ComputeAsync( INextBot *bot, const Vector &goal, float maxPathLength, bool includeGoalIfPathFails )
+{
+	VPROF_BUDGET( "Path::ComputeAsync", "NextBot" );
+
+	CancelComputeAsync();
+
+	CNavArea *startArea = bot->GetEntity()->GetLastKnownArea();
+	if ( !startArea )
+	{
+		Invalidate();
+		OnPathChanged( bot, NO_PATH );
+		return false;
+	}
+
+	// check line-of-sight to the goal position when finding it's nav area
+	const float maxDistanceToArea = 200.0f;
+	CNavArea *goalArea = TheNavMesh->GetNearestNavArea( goal, true, maxDistanceToArea, true );
+
+	// if we are already in the goal area, build trivial path
+	if ( startArea == goalArea )
+	{
+		Invalidate();
+		BuildTrivialPath( bot, goal );
+		return true;
+	}
+
+	NextBotPathQueue &queue = TheNextBots().GetPathQueue();
+	NextBotPathRequest *request = queue.AllocateRequest();
+
+	request->bot = bot;
+	request->path = this;
+	request->startArea = startArea;
+	request->goalArea = goalArea;
+	request->goal = goal;
+	request->maxPathLength = maxPathLength;
+	request->teamID = bot->GetEntity()->GetTeamNumber();
+	request->includeGoalIfPathFails = includeGoalIfPathFails;
+
+	// make sure path end position is on the ground
+	request->pathEndPosition = goal;
+	if ( goalArea )
+	{
+		request->pathEndPosition.z = goalArea->GetZ( goal );
+	}
+	else
+	{
+		TheNavMesh->GetGroundHeight( goal, &request->pathEndPosition.z );
+	}
+
+	ILocomotion *mover = bot->GetLocomotionInterface();
+	request->stepHeight = ( mover ) ? mover->GetStepHeight() : StepHeight;
+	request->maxJumpHeight = ( mover ) ? mover->GetMaxJumpHeight() : JumpCrouchHeight;
+	request->deathDropHeight = ( mover ) ? mover->GetDeathDropHeight() : DeathDrop;
+
+	queue.Submit( request );
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void Path::CancelComputeAsync( void )
+{
+	if ( m_isAsyncPending )
+	{
+		TheNextBots().GetPathQueue().Cancel( this );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Build the path from the areas a queued search found, the same way Compute() does
+ */
+void Path::AssembleAreaPath( INextBot *bot, const NextBotPathRequest &request )
+{
+	VPROF_BUDGET( "Path::AssembleAreaPath", "NextBot" );
+
+	Invalidate();
+
+	int count = request.areas.Count();
+	if ( count == 0 )
+	{
+		OnPathChanged( bot, NO_PATH );
+		return;
+	}
+
+	if ( count == 1 )
+	{
+		BuildTrivialPath( bot, request.goal );
+		return;
+	}
+
+	// save room for endpoint, keeping the end of the path like Compute() does
+	int first = 0;
+	if ( count > MAX_PATH_SEGMENTS-1 )
+	{
+		first = count - ( MAX_PATH_SEGMENTS-1 );
+		count = MAX_PATH_SEGMENTS-1;
+	}
+
+	m_segmentCount = count;
+	for( int i=0; i<count; ++i )
+	{
+		m_path[ i ].area = request.areas[ first + i ];
+		m_path[ i ].how = request.how[ first + i ];
+		m_path[ i ].type = ON_GROUND;
+	}
+
+	if ( request.pathResult || request.includeGoalIfPathFails )
+	{
+		// append actual goal position
+		m_path[ m_segmentCount ].area = request.areas.Tail();
+		m_path[ m_segmentCount ].pos = request.pathEndPosition;
+		m_path[ m_segmentCount ].ladder = NULL;
+		m_path[ m_segmentCount ].how = NUM_TRAVERSE_TYPES;
+		m_path[ m_segmentCount ].type = ON_GROUND;
+		++m_segmentCount;
+	}
+
+	// compute path positions
+	if ( ComputePathDetails( bot, bot->GetPosition() ) == false )
+	{
+		Invalidate();
+		OnPathChanged( bot, NO_PATH );
+		return;
+	}
+
+	// remove redundant nodes and clean up path
+	Optimize( bot );
+
+	PostProcess();
+
+	OnPathChanged( bot, request.pathResult ? COMPLETE_PATH : PARTIAL_PATH );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Draw the path for debugging.
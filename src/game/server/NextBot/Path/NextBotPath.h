@@ -9,6 +9,7 @@
 #include "NextBotInterface.h"
 
 #include "tier0/vprof.h"
+#include "nav_hierarchy.h"
 
 #define PATH_NO_LENGTH_LIMIT 0.0f				// non-default argument value for Path::Compute()
 #define PATH_TRUNCATE_INCOMPLETE_PATH false		// non-default argument value for Path::Compute()
@@ -16,6 +17,8 @@
 class INextBot;
 class CNavArea;
 class CNavLadder;
+class NextBotPathQueue;
+struct NextBotPathRequest;
 
 
 //---------------------------------------------------------------------------------------------------------------
@@ -52,7 +55,7 @@ class Path
 {
 public:
 	Path( void );
-	virtual ~Path() { }
+	virtual ~Path();
 	
 	enum SegmentType
 	{
@@ -158,6 +161,7 @@ public:
 		VPROF_BUDGET( "Path::Compute(subject)", "NextBot" );
 
 		Invalidate();
+		CancelComputeAsync();
 
 		m_subject = subject;
 		
@@ -190,7 +194,7 @@ public:
 		// Compute shortest path to subject
 		//
 		CNavArea *closestArea = NULL;
-		bool pathResult = NavAreaBuildPath( startArea, subjectArea, &subjectPos, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber() );
+		bool pathResult = NavAreaBuildPathHierarchical( startArea, subjectArea, &subjectPos, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber() );
 
 		// Failed?
 		if ( closestArea == NULL )
@@ -275,6 +279,7 @@ public:
 		VPROF_BUDGET( "Path::Compute(goal)", "NextBotSpiky" );
 
 		Invalidate();
+		CancelComputeAsync();
 		
 		const Vector &start = bot->GetPosition();
 		
@@ -318,7 +323,7 @@ public:
 		// Compute shortest path to goal
 		//
 		CNavArea *closestArea = NULL;
-		bool pathResult = NavAreaBuildPath( startArea, goalArea, &goal, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber() );
+		bool pathResult = NavAreaBuildPathHierarchical( startArea, goalArea, &goal, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber() );
 
 		// Failed?
 		if ( closestArea == NULL )
@@ -390,6 +395,20 @@ public:
 	}
 
 
+	//-----------------------------------------------------------------------------------------------------------------
+	/**
+	 * Queue a path computation from bot to 'goal' on the NextBotManager's path queue.
+	 * The search runs on a worker thread using the bot's step, jump and drop limits and a
+	 * snapshot of blocked areas, instead of a cost functor. The result is delivered by the
+	 * end of the next tick through OnPathChanged(), and the current path stays as it is until
+	 * then. If bot and goal share an area the trivial path is built immediately.
+	 * Returns false if the bot has no nav area.
+	 */
+	bool ComputeAsync( INextBot *bot, const Vector &goal, float maxPathLength = 0.0f, bool includeGoalIfPathFails = true );
+	bool IsComputeAsyncPending( void ) const			{ return m_isAsyncPending; }
+	void CancelComputeAsync( void );					// forget a pending ComputeAsync() request
+
+
 	//-----------------------------------------------------------------------------------------------------------------
 	/**
 	 * Build a path from bot's current location to an undetermined goal area
@@ -599,6 +618,10 @@ private:
 	int FindNextOccludedNode( INextBot *bot, int anchor );	// used by Optimize()
 
 	void InsertSegment( Segment newSegment, int i );		// insert new segment at index i
+
+	friend class NextBotPathQueue;
+	void AssembleAreaPath( INextBot *bot, const NextBotPathRequest &request );	// build the path from a ComputeAsync() result
+	bool m_isAsyncPending;
 	
 	mutable Vector m_pathPos;								// used by GetPosition()
 	mutable Vector m_closePos;								// used by GetClosestPosition()
@@ -0,0 +1,564 @@
+// NextBotPathQueue.cpp
+// Asynchronous, batched path requests for NextBots
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#include "cbase.h"
+
+#include "nav_mesh.h"
+#include "nav_pathfind.h"
+#include "vstdlib/jobthread.h"
+#include "tier0/vprof.h"
+
+#include "NextBotManager.h"
+#include "NextBotPath.h"
+#include "NextBotPathQueue.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar nb_path_queue_budget( "nb_path_queue_budget", "32", FCVAR_CHEAT, "Maximum number of queued path requests searched per tick (0 = no limit)" );
+ConVar nb_path_queue_threaded( "nb_path_queue_threaded", "1", FCVAR_CHEAT, "Run queued path searches on worker threads" );
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Capture everything about the areas that can change while queued searches run
+ */
+void NextBotPathSnapshot::Update( const CUtlVector< int > &teams )
+{
+	VPROF_BUDGET( "NextBotPathSnapshot::Update", "NextBot" );
+
+	unsigned int areaIDCount = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		areaIDCount = MAX( areaIDCount, TheNavAreas[ it ]->GetID() + 1 );
+	}
+
+	m_blocked.SetCount( teams.Count() );
+	FOR_EACH_VEC( teams, t )
+	{
+		m_blocked[t].teamID = teams[t];
+		m_blocked[t].blocked.Resize( areaIDCount );
+		m_blocked[t].blocked.ClearAll();
+	}
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+		unsigned int id = area->GetID();
+
+		FOR_EACH_VEC( m_blocked, t )
+		{
+			if ( area->IsBlocked( m_blocked[t].teamID ) )
+			{
+				m_blocked[t].blocked.Set( id );
+			}
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+const CVarBitVec *NextBotPathSnapshot::GetBlockedAreas( int teamID ) const
+{
+	FOR_EACH_VEC( m_blocked, t )
+	{
+		if ( m_blocked[t].teamID == teamID )
+			return &m_blocked[t].blocked;
+	}
+
+	return NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Cost of queued searches. Same costs as CSimpleBotPathCost, with the bot's locomotion limits
+ * copied into the request, so a queued path matches the one Path::Compute() would find.
+ */
+class NextBotPathSnapshotCost
+{
+public:
+	NextBotPathSnapshotCost( const NextBotPathRequest &request ) : m_request( request )
+	{
+	}
+
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+	{
+		if ( fromArea == NULL )
+		{
+			// first area in path, no cost
+			return 0.0f;
+		}
+
+		// compute distance traveled along path so far
+		float dist;
+
+		if ( ladder )
+		{
+			dist = ladder->m_length;
+		}
+		else if ( length > 0.0 )
+		{
+			dist = length;
+		}
+		else
+		{
+			dist = ( area->GetCenter() - fromArea->GetCenter() ).Length();
+		}
+
+		float cost = dist + fromArea->GetCostSoFar();
+
+		// check height change
+		float deltaZ = fromArea->ComputeAdjacentConnectionHeightChange( area );
+		if ( deltaZ >= m_request.stepHeight )
+		{
+			if ( deltaZ >= m_request.maxJumpHeight )
+			{
+				// too high to reach
+				return -1.0f;
+			}
+
+			// jumping is slower than flat ground
+			const float jumpPenalty = 5.0f;
+			cost += jumpPenalty * dist;
+		}
+		else if ( deltaZ < -m_request.deathDropHeight )
+		{
+			// too far to drop
+			return -1.0f;
+		}
+
+		return cost;
+	}
+
+private:
+	const NextBotPathRequest &m_request;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------------------
+NextBotPathQueue::NextBotPathQueue( void )
+{
+	ResetStats();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+NextBotPathQueue::~NextBotPathQueue()
+{
+	Wait();
+
+	m_pending.PurgeAndDeleteElements();
+	m_inFlight.PurgeAndDeleteElements();
+	m_freeList.PurgeAndDeleteElements();
+	m_searches.PurgeAndDeleteElements();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Drop all requests, leaving their Paths as they are
+ */
+void NextBotPathQueue::Reset( void )
+{
+	Wait();
+	m_batches.RemoveAll();
+
+	FOR_EACH_VEC( m_pending, it )
+	{
+		m_pending[ it ]->path->m_isAsyncPending = false;
+		FreeRequest( m_pending[ it ] );
+	}
+	m_pending.RemoveAll();
+
+	FOR_EACH_VEC( m_inFlight, it )
+	{
+		if ( m_inFlight[ it ]->path )
+		{
+			m_inFlight[ it ]->path->m_isAsyncPending = false;
+		}
+		FreeRequest( m_inFlight[ it ] );
+	}
+	m_inFlight.RemoveAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+NextBotPathRequest *NextBotPathQueue::AllocateRequest( void )
+{
+	if ( m_freeList.Count() )
+	{
+		NextBotPathRequest *request = m_freeList.Tail();
+		m_freeList.RemoveMultipleFromTail( 1 );
+		return request;
+	}
+
+	return new NextBotPathRequest;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotPathQueue::FreeRequest( NextBotPathRequest *request )
+{
+	request->bot = NULL;
+	request->path = NULL;
+	request->areas.RemoveAll();
+	request->how.RemoveAll();
+
+	m_freeList.AddToTail( request );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Queue a request. A newer request for the same Path replaces the older one.
+ */
+void NextBotPathQueue::Submit( NextBotPathRequest *request )
+{
+	Assert( request->path && request->bot );
+
+	if ( request->path->m_isAsyncPending )
+	{
+		Cancel( request->path );
+	}
+
+	request->path->m_isAsyncPending = true;
+	request->submitTick = gpGlobals->tickcount;
+
+	m_pending.AddToTail( request );
+
+	++m_submitted;
+	m_maxPending = MAX( m_maxPending, m_pending.Count() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotPathQueue::Cancel( Path *path )
+{
+	FOR_EACH_VEC_BACK( m_pending, it )
+	{
+		if ( m_pending[ it ]->path == path )
+		{
+			FreeRequest( m_pending[ it ] );
+			m_pending.Remove( it );
+			++m_cancelled;
+		}
+	}
+
+	// in flight requests are still being searched - just forget who they were for
+	FOR_EACH_VEC( m_inFlight, it )
+	{
+		if ( m_inFlight[ it ]->path == path )
+		{
+			m_inFlight[ it ]->path = NULL;
+			++m_cancelled;
+		}
+	}
+
+	path->m_isAsyncPending = false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotPathQueue::Cancel( INextBot *bot )
+{
+	FOR_EACH_VEC_BACK( m_pending, it )
+	{
+		if ( m_pending[ it ]->bot == bot )
+		{
+			m_pending[ it ]->path->m_isAsyncPending = false;
+			FreeRequest( m_pending[ it ] );
+			m_pending.Remove( it );
+			++m_cancelled;
+		}
+	}
+
+	FOR_EACH_VEC( m_inFlight, it )
+	{
+		if ( m_inFlight[ it ]->bot == bot && m_inFlight[ it ]->path )
+		{
+			m_inFlight[ it ]->path->m_isAsyncPending = false;
+			m_inFlight[ it ]->path = NULL;
+			m_inFlight[ it ]->bot = NULL;
+			++m_cancelled;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Snapshot nav costs and start searching the oldest pending requests, up to the per-tick budget.
+ * Called by the NextBotManager at the start of the tick.
+ */
+void NextBotPathQueue::Dispatch( void )
+{
+	VPROF_BUDGET( "NextBotPathQueue::Dispatch", "NextBot" );
+
+	Assert( m_inFlight.Count() == 0 );
+
+	if ( m_pending.Count() == 0 )
+		return;
+
+	if ( !TheNavMesh->IsLoaded() )
+	{
+		Reset();
+		return;
+	}
+
+	++m_ticks;
+	m_totalPending += m_pending.Count();
+
+	int count = m_pending.Count();
+	int budget = nb_path_queue_budget.GetInt();
+	if ( budget > 0 && count > budget )
+	{
+		count = budget;
+		++m_deferredTicks;
+	}
+
+	m_inFlight.AddMultipleToTail( count, m_pending.Base() );
+	m_pending.RemoveMultipleFromHead( count );
+
+	CUtlVector< int > teams;
+	FOR_EACH_VEC( m_inFlight, it )
+	{
+		if ( teams.Find( m_inFlight[ it ]->teamID ) == teams.InvalidIndex() )
+		{
+			teams.AddToTail( m_inFlight[ it ]->teamID );
+		}
+	}
+
+	m_snapshot.Update( teams );
+
+	// one batch per worker thread
+	int threadCount = ( g_pThreadPool && nb_path_queue_threaded.GetBool() ) ? g_pThreadPool->NumThreads() : 0;
+	int batchCount = clamp( threadCount, 1, count );
+
+	while ( m_searches.Count() < batchCount )
+	{
+		m_searches.AddToTail( new CNavSearchContext );
+	}
+
+	m_batches.SetCount( batchCount );
+	for( int b=0; b<batchCount; ++b )
+	{
+		Batch &batch = m_batches[b];
+		batch.first = b * count / batchCount;
+		batch.count = ( b+1 ) * count / batchCount - batch.first;
+		batch.search = m_searches[b];
+		batch.job = NULL;
+		batch.time = 0.0;
+	}
+
+	for( int b=0; b<batchCount; ++b )
+	{
+		if ( threadCount > 0 )
+		{
+			// runs inline if no worker is idle
+			m_batches[b].job = g_pThreadPool->AddCall( this, &NextBotPathQueue::RunBatch, b );
+		}
+		else
+		{
+			RunBatch( b );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotPathQueue::RunBatch( int b )
+{
+	Batch &batch = m_batches[b];
+
+	double start = Plat_FloatTime();
+
+	for( int i=0; i<batch.count; ++i )
+	{
+		Search( *batch.search, m_inFlight[ batch.first + i ] );
+	}
+
+	batch.time = Plat_FloatTime() - start;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Search for one request. Runs on a worker thread, so it must only read the request's inputs,
+ * the snapshot, and the static parts of the mesh.
+ */
+void NextBotPathQueue::Search( CNavSearchContext &search, NextBotPathRequest *request )
+{
+	request->areas.RemoveAll();
+	request->how.RemoveAll();
+
+	search.SetBlockedAreas( m_snapshot.GetBlockedAreas( request->teamID ) );
+
+	NextBotPathSnapshotCost cost( *request );
+	CNavArea *closestArea = NULL;
+	request->pathResult = NavAreaBuildPath( search, request->startArea, request->goalArea, &request->goal, cost, &closestArea, request->maxPathLength, request->teamID );
+
+	search.SetBlockedAreas( NULL );
+
+	// follow parent links back from the closest area
+	for( CNavArea *area = closestArea; area; area = search.GetParent( area ) )
+	{
+		request->areas.AddToTail( area );
+		request->how.AddToTail( search.GetParentHow( area ) );
+
+		if ( area == request->startArea )
+		{
+			// startArea can be re-evaluated during the pathfind and given a parent...
+			break;
+		}
+	}
+
+	// put in start to goal order
+	for( int i=0, j=request->areas.Count()-1; i<j; ++i, --j )
+	{
+		V_swap( request->areas[i], request->areas[j] );
+		V_swap( request->how[i], request->how[j] );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotPathQueue::Wait( void )
+{
+	FOR_EACH_VEC( m_batches, b )
+	{
+		if ( m_batches[b].job )
+		{
+			m_batches[b].job->WaitForFinishAndRelease();
+			m_batches[b].job = NULL;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Wait for this tick's searches and build the Paths that still want them.
+ * Called after entity think.
+ */
+void NextBotPathQueue::Deliver( void )
+{
+	VPROF_BUDGET( "NextBotPathQueue::Deliver", "NextBot" );
+
+	if ( m_inFlight.Count() == 0 )
+		return;
+
+	double waitStart = Plat_FloatTime();
+	Wait();
+	m_maxWaitTime = MAX( m_maxWaitTime, Plat_FloatTime() - waitStart );
+
+	FOR_EACH_VEC( m_batches, b )
+	{
+		m_searchTime += m_batches[b].time;
+		m_maxSearchTime = MAX( m_maxSearchTime, m_batches[b].time );
+	}
+	m_batches.RemoveAll();
+
+	FOR_EACH_VEC( m_inFlight, it )
+	{
+		NextBotPathRequest *request = m_inFlight[ it ];
+		Path *path = request->path;
+
+		if ( path )
+		{
+			// clear first, so OnPathChanged() can make a new request
+			request->path = NULL;
+			path->m_isAsyncPending = false;
+
+			int latency = gpGlobals->tickcount - request->submitTick;
+			m_totalLatency += latency;
+			m_maxLatency = MAX( m_maxLatency, latency );
+			++m_delivered;
+
+			path->AssembleAreaPath( request->bot, *request );
+		}
+
+		FreeRequest( request );
+	}
+
+	m_inFlight.RemoveAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotPathQueue::ResetStats( void )
+{
+	m_maxPending = 0;
+	m_totalPending = 0;
+	m_submitted = 0;
+	m_delivered = 0;
+	m_cancelled = 0;
+	m_ticks = 0;
+	m_deferredTicks = 0;
+	m_totalLatency = 0;
+	m_maxLatency = 0;
+	m_searchTime = 0.0;
+	m_maxSearchTime = 0.0;
+	m_maxWaitTime = 0.0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void NextBotPathQueue::Report( void ) const
+{
+	Msg( "Path queue: %d pending, %d in flight\n", m_pending.Count(), m_inFlight.Count() );
+	Msg( "  %d submitted, %d delivered, %d cancelled\n", m_submitted, m_delivered, m_cancelled );
+
+	if ( m_ticks )
+	{
+		Msg( "  queue depth: %.1f average, %d max\n", (float)m_totalPending / m_ticks, m_maxPending );
+		Msg( "  %d ticks dispatched, %d left requests for the next tick (nb_path_queue_budget %d)\n", m_ticks, m_deferredTicks, nb_path_queue_budget.GetInt() );
+		Msg( "  search time: %.3f ms/tick average, %.3f ms slowest batch, %.3f ms longest wait\n", 1000.0 * m_searchTime / m_ticks, 1000.0 * m_maxSearchTime, 1000.0 * m_maxWaitTime );
+	}
+
+	if ( m_delivered )
+	{
+		Msg( "  latency: %.2f ticks average, %d max\n", (float)m_totalLatency / m_delivered, m_maxLatency );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Delivers the searches dispatched by NextBotManager::Update() once entity think is over
+ */
+class CNextBotPathQueueSystem : public CAutoGameSystemPerFrame
+{
+public:
+	CNextBotPathQueueSystem( void ) : CAutoGameSystemPerFrame( "CNextBotPathQueueSystem" )
+	{
+	}
+
+	virtual void FrameUpdatePostEntityThink( void )
+	{
+		TheNextBots().GetPathQueue().Deliver();
+	}
+
+	virtual void LevelShutdownPreEntity( void )
+	{
+		TheNextBots().GetPathQueue().Reset();
+	}
+};
+
+static CNextBotPathQueueSystem s_NextBotPathQueueSystem;
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nb_path_queue_report, "Print NextBot path queue depth, latency, and search time", FCVAR_CHEAT )
+{
+	TheNextBots().GetPathQueue().Report();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nb_path_queue_reset_stats, "Reset NextBot path queue statistics", FCVAR_CHEAT )
+{
+	TheNextBots().GetPathQueue().ResetStats();
+}
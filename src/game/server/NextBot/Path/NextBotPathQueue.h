@@ -0,0 +1,140 @@
+// NextBotPathQueue.h
+// Asynchronous, batched path requests for NextBots
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#ifndef _NEXT_BOT_PATH_QUEUE_H_
+#define _NEXT_BOT_PATH_QUEUE_H_
+
+#include "nav.h"
+#include "bitvec.h"
+#include "utlvector.h"
+
+class INextBot;
+class CNavArea;
+class CNavSearchContext;
+class CJob;
+class Path;
+
+
+//---------------------------------------------------------------------------------------------------------------
+/**
+ * A read-only copy of the blocked state the queued searches need, taken on the main thread
+ * before they are handed to worker threads. Everything else the searches read (area
+ * geometry and connections) only changes while editing or loading the mesh.
+ */
+class NextBotPathSnapshot
+{
+public:
+	void Update( const CUtlVector< int > &teams );		// capture blocked areas for each of the given teams
+
+	const CVarBitVec *GetBlockedAreas( int teamID ) const;
+
+private:
+	struct TeamBlocked
+	{
+		int teamID;
+		CVarBitVec blocked;								// indexed by area ID
+	};
+	CUtlVector< TeamBlocked > m_blocked;
+};
+
+
+//---------------------------------------------------------------------------------------------------------------
+/**
+ * A queued path search. Everything the worker thread needs is copied in when the request is made.
+ */
+struct NextBotPathRequest
+{
+	// owner - only touched on the main thread
+	INextBot *bot;
+	Path *path;											// NULL if the request was cancelled while in flight
+	int submitTick;
+
+	// input
+	CNavArea *startArea;
+	CNavArea *goalArea;
+	Vector goal;										// the goal as given, passed to the search
+	Vector pathEndPosition;								// the goal on the ground
+	float maxPathLength;
+	int teamID;
+	bool includeGoalIfPathFails;
+	float stepHeight;									// from the bot's locomotor
+	float maxJumpHeight;
+	float deathDropHeight;
+
+	// output
+	bool pathResult;									// true if the path reaches the goal
+	CUtlVector< CNavArea * > areas;						// start to closest area
+	CUtlVector< NavTraverseType > how;					// how each area is entered from the previous one
+};
+
+
+//---------------------------------------------------------------------------------------------------------------
+/**
+ * The path request queue owned by the NextBotManager. Requests made during a tick are
+ * dispatched to worker threads at the start of the next one (up to nb_path_queue_budget of
+ * them, oldest first), run during entity think, and delivered to their Paths when entity
+ * think ends.
+ */
+class NextBotPathQueue
+{
+public:
+	NextBotPathQueue( void );
+	~NextBotPathQueue();
+
+	void Reset( void );									// drop all requests
+	NextBotPathRequest *AllocateRequest( void );
+	void Submit( NextBotPathRequest *request );			// take ownership of a filled-in request from AllocateRequest()
+
+	void Cancel( Path *path );							// drop the request for the given path
+	void Cancel( INextBot *bot );						// drop every request made by the given bot
+
+	void Dispatch( void );								// start searches for pending requests
+	void Deliver( void );								// wait for dispatched searches and hand their results to the Paths
+
+	int GetPendingCount( void ) const					{ return m_pending.Count(); }
+	int GetInFlightCount( void ) const					{ return m_inFlight.Count(); }
+
+	void ResetStats( void );
+	void Report( void ) const;
+
+private:
+	void RunBatch( int batch );							// worker thread entry point
+	void Wait( void );									// block until every dispatched batch has finished
+	void Search( CNavSearchContext &search, NextBotPathRequest *request );
+	void FreeRequest( NextBotPathRequest *request );
+
+	CUtlVector< NextBotPathRequest * > m_pending;		// oldest first
+	CUtlVector< NextBotPathRequest * > m_inFlight;
+	CUtlVector< NextBotPathRequest * > m_freeList;
+
+	NextBotPathSnapshot m_snapshot;
+
+	struct Batch
+	{
+		int first;										// range of m_inFlight
+		int count;
+		CNavSearchContext *search;
+		CJob *job;
+		double time;									// seconds spent searching
+	};
+	CUtlVector< Batch > m_batches;
+	CUtlVector< CNavSearchContext * > m_searches;		// one per batch, reused
+
+	// statistics
+	int m_maxPending;
+	int m_totalPending;									// sum of queue depth over dispatching ticks
+	int m_submitted;
+	int m_delivered;
+	int m_cancelled;
+	int m_ticks;										// ticks that dispatched anything
+	int m_deferredTicks;								// ticks that left requests over for the next one
+	int m_totalLatency;									// ticks from submit to delivery
+	int m_maxLatency;
+	double m_searchTime;								// sum over batches
+	double m_maxSearchTime;								// slowest batch
+	double m_maxWaitTime;								// longest main thread wait in Deliver()
+};
+
+
+#endif // _NEXT_BOT_PATH_QUEUE_H_
@@ -149,6 +149,12 @@ public:
 	// Update is called repeatedly (usually once per server frame) while the Action is active
 	virtual ActionResult< CSimpleBot >	Update( CSimpleBot *me, float interval )
 	{
+		if ( m_path.IsComputeAsyncPending() )
+		{
+			// our path request is queued - it will be delivered by the end of the tick
+			return Continue();
+		}
+
 		if ( m_path.IsValid() && !m_timer.IsElapsed() ) 
 		{
 			// PathFollower::Update() moves the bot along the path using the bot's ILocomotion and IBody interfaces
@@ -161,8 +167,8 @@ public:
 
 			if ( pick.m_area )
 			{
-				CSimpleBotPathCost cost( me );
-				m_path.Compute( me, pick.m_area->GetCenter(), cost );
+				// CSimpleBotPathCost only depends on our locomotor limits, which the path queue uses too
+				m_path.ComputeAsync( me, pick.m_area->GetCenter() );
 			}
 
 			// follow this path for a random duration (or until we reach the end)
@@ -9,12 +9,34 @@
 #include "ServerNetworkProperty.h"
 #include "tier0/dbg.h"
 #include "gameinterface.h"
+#include "dt_send_flat.h"
+#include "igamesystem.h"
+#include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 extern CTimedEventMgr g_NetworkPropertyEventMgr;
 
+bool g_bNetworkPropDirtyTracking = false;
+
+static void NetPropDirtyTrackingChanged( IConVar *pConVar, const char *pOldValue, float flOldValue )
+{
+	ConVarRef var( pConVar );
+	if ( g_bNetworkPropDirtyTracking == var.GetBool() )
+		return;
+
+	g_bNetworkPropDirtyTracking = var.GetBool();
+
+	// Any history recorded before this point has a gap in it now
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		pEntity->NetworkProp()->ResetPropChangeHistory();
+	}
+}
+
+ConVar sv_netprop_dirty_tracking( "sv_netprop_dirty_tracking", "0", 0, "Track network var changes per property instead of only per entity, and count props that snapshots can skip.", NetPropDirtyTrackingChanged );
+
 
 //-----------------------------------------------------------------------------
 // Save/load
@@ -64,6 +86,9 @@ void CServerNetworkProperty::Init( CBaseEntity *pEntity )
 	m_pServerClass = NULL;
 //	m_pTransmitProxy = NULL;
 	m_bPendingStateChange = false;
+	m_bAllPropsDirty = false;
+	m_bAnyPropsDirty = false;
+	m_pFlatSendTable = NULL;
 	m_PVSInfo.m_nClusterCount = 0;
 	m_TimerEvent.Init( &g_NetworkPropertyEventMgr, this );
 }
@@ -305,4 +330,279 @@ void CServerNetworkProperty::FireEvent()
 }
 
 
+//-----------------------------------------------------------------------------
+// Per-property dirty bits
+//-----------------------------------------------------------------------------
+CSendTableFlat *CServerNetworkProperty::GetFlatSendTable()
+{
+	if ( !m_pFlatSendTable )
+	{
+		ServerClass *pServerClass = GetServerClass();
+		if ( pServerClass && pServerClass->m_pTable )
+		{
+			m_pFlatSendTable = SendTable_GetFlat( pServerClass->m_pTable );
+		}
+	}
+	return m_pFlatSendTable;
+}
+
+void CServerNetworkProperty::MarkAllPropsDirty()
+{
+	if ( !m_pPev )
+		return;
+
+	m_bAllPropsDirty = true;
+	m_bAnyPropsDirty = true;
+}
+
+void CServerNetworkProperty::MarkPropsDirty( unsigned short varOffset )
+{
+	if ( !m_pPev || m_bAllPropsDirty )
+		return;
 
+	CSendTableFlat *pFlat = GetFlatSendTable();
+	if ( !pFlat )
+	{
+		MarkAllPropsDirty();
+		return;
+	}
+
+	const unsigned short *pProps;
+	int nProps = pFlat->FindPropsAtOffset( varOffset, &pProps );
+	if ( !nProps )
+	{
+		// Not a directly networked var (or one we can't map), so be conservative
+		MarkAllPropsDirty();
+		return;
+	}
+
+	if ( !m_bAnyPropsDirty )
+	{
+		if ( m_DirtyProps.GetNumBits() != pFlat->GetNumProps() )
+		{
+			m_DirtyProps.Resize( pFlat->GetNumProps(), true );
+		}
+
+		// Props behind pointer-modifying proxies can't be mapped, so they go out with any change
+		for ( int i = 0; i < pFlat->GetNumUntrackedProps(); ++i )
+		{
+			m_DirtyProps.Set( pFlat->GetUntrackedProp( i ) );
+		}
+		m_bAnyPropsDirty = true;
+	}
+
+	for ( int i = 0; i < nProps; ++i )
+	{
+		m_DirtyProps.Set( pProps[i] );
+	}
+}
+
+int CServerNetworkProperty::CountDirtyProps()
+{
+	if ( !m_bAnyPropsDirty )
+		return 0;
+
+	CSendTableFlat *pFlat = GetFlatSendTable();
+	if ( !pFlat )
+		return 0;
+
+	if ( m_bAllPropsDirty )
+		return pFlat->GetNumProps();
+
+	int nCount = 0;
+	for ( int i = m_DirtyProps.FindNextSetBit( 0 ); i >= 0; i = m_DirtyProps.FindNextSetBit( i + 1 ) )
+	{
+		++nCount;
+	}
+	return nCount;
+}
+
+void CServerNetworkProperty::ClearDirtyProps()
+{
+	if ( !m_bAnyPropsDirty )
+		return;
+
+	if ( m_DirtyProps.GetNumBits() )
+	{
+		m_DirtyProps.ClearAll();
+	}
+	m_bAllPropsDirty = false;
+	m_bAnyPropsDirty = false;
+}
+
+void CServerNetworkProperty::CommitDirtyProps( int nTick )
+{
+	CSendTableFlat *pFlat = m_bAnyPropsDirty ? GetFlatSendTable() : NULL;
+	if ( pFlat )
+	{
+		if ( m_PropChangeTicks.Count() != pFlat->GetNumProps() || m_bAllPropsDirty )
+		{
+			// Without earlier history, every prop counts as changed now
+			m_PropChangeTicks.SetCount( pFlat->GetNumProps() );
+			for ( int i = 0; i < m_PropChangeTicks.Count(); ++i )
+			{
+				m_PropChangeTicks[i] = nTick;
+			}
+		}
+		else
+		{
+			for ( int i = m_DirtyProps.FindNextSetBit( 0 ); i >= 0; i = m_DirtyProps.FindNextSetBit( i + 1 ) )
+			{
+				m_PropChangeTicks[i] = nTick;
+			}
+		}
+	}
+
+	ClearDirtyProps();
+}
+
+bool CServerNetworkProperty::GetPropsChangedSince( int nFromTick, CVarBitVec *pProps ) const
+{
+	if ( !g_bNetworkPropDirtyTracking || !m_PropChangeTicks.Count() || nFromTick <= 0 )
+		return false;
+
+	pProps->Resize( m_PropChangeTicks.Count(), true );
+	for ( int i = 0; i < m_PropChangeTicks.Count(); ++i )
+	{
+		if ( m_PropChangeTicks[i] > nFromTick )
+		{
+			pProps->Set( i );
+		}
+	}
+	return true;
+}
+
+void CServerNetworkProperty::ResetPropChangeHistory()
+{
+	m_PropChangeTicks.Purge();
+	if ( m_DirtyProps.GetNumBits() )
+	{
+		m_DirtyProps.ClearAll();
+	}
+	m_bAllPropsDirty = false;
+	m_bAnyPropsDirty = false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Gathers per-class counts of props that changed (and must be encoded) versus
+// props that didn't (and snapshot building can skip), then resets the dirty
+// bits once per network update.
+//-----------------------------------------------------------------------------
+struct NetPropDirtyStats_t
+{
+	int64	m_nPropsEncoded;
+	int64	m_nPropsSkipped;
+	int		m_nEntityUpdates;
+	int		m_nFullUpdates;
+};
+
+class CNetworkPropDirtyTracker : public CAutoGameSystemPerFrame
+{
+public:
+	CNetworkPropDirtyTracker() : CAutoGameSystemPerFrame( "CNetworkPropDirtyTracker" ), m_Stats( DefLessFunc( ServerClass* ) )
+	{
+	}
+
+	virtual void LevelShutdownPostEntity()
+	{
+		m_Stats.RemoveAll();
+	}
+
+	virtual void PreClientUpdate()
+	{
+		if ( !g_bNetworkPropDirtyTracking )
+			return;
+
+		VPROF_BUDGET( "CNetworkPropDirtyTracker::PreClientUpdate", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+		for ( int i = 0; i < gpGlobals->maxEntities; ++i )
+		{
+			edict_t *pEdict = INDEXENT( i );
+			if ( !pEdict || pEdict->IsFree() )
+				continue;
+
+			CBaseEntity *pEntity = GetContainingEntity( pEdict );
+			if ( !pEntity )
+				continue;
+
+			CServerNetworkProperty *pNetProp = pEntity->NetworkProp();
+			if ( !pNetProp->HasDirtyProps() )
+				continue;
+
+			CSendTableFlat *pFlat = pNetProp->GetFlatSendTable();
+			if ( pFlat )
+			{
+				NetPropDirtyStats_t &stats = FindOrAddStats( pNetProp->GetServerClass() );
+				int nDirty = pNetProp->CountDirtyProps();
+				stats.m_nPropsEncoded += nDirty;
+				stats.m_nPropsSkipped += pFlat->GetNumProps() - nDirty;
+				stats.m_nEntityUpdates++;
+				if ( pNetProp->AreAllPropsDirty() )
+				{
+					stats.m_nFullUpdates++;
+				}
+			}
+
+			pNetProp->CommitDirtyProps( gpGlobals->tickcount );
+		}
+	}
+
+	void Report()
+	{
+		Msg( "%-40s %10s %12s %12s %8s\n", "Class", "Updates", "Encoded", "Skipped", "Full%" );
+		int64 nTotalEncoded = 0, nTotalSkipped = 0;
+		FOR_EACH_MAP_FAST( m_Stats, i )
+		{
+			const NetPropDirtyStats_t &stats = m_Stats[i];
+			float flFullPct = stats.m_nEntityUpdates ? 100.0f * stats.m_nFullUpdates / stats.m_nEntityUpdates : 0.0f;
+			Msg( "%-40s %10d %12lld %12lld %7.1f%%\n", m_Stats.Key( i )->GetName(), stats.m_nEntityUpdates,
+				stats.m_nPropsEncoded, stats.m_nPropsSkipped, flFullPct );
+			nTotalEncoded += stats.m_nPropsEncoded;
+			nTotalSkipped += stats.m_nPropsSkipped;
+		}
+		int64 nTotal = nTotalEncoded + nTotalSkipped;
+		Msg( "Total: %lld props encoded, %lld skipped (%.1f%% skipped)\n", nTotalEncoded, nTotalSkipped,
+			nTotal ? 100.0f * nTotalSkipped / nTotal : 0.0f );
+	}
+
+	void Reset()
+	{
+		m_Stats.RemoveAll();
+	}
+
+private:
+	NetPropDirtyStats_t &FindOrAddStats( ServerClass *pClass )
+	{
+		unsigned short i = m_Stats.Find( pClass );
+		if ( i == m_Stats.InvalidIndex() )
+		{
+			NetPropDirtyStats_t stats;
+			V_memset( &stats, 0, sizeof( stats ) );
+			i = m_Stats.Insert( pClass, stats );
+		}
+		return m_Stats[i];
+	}
+
+	CUtlMap<ServerClass*, NetPropDirtyStats_t> m_Stats;
+};
+
+static CNetworkPropDirtyTracker g_NetworkPropDirtyTracker;
+
+CON_COMMAND( sv_netprop_dirty_report, "Print per-class counts of network props encoded vs skipped by per-property dirty tracking." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "reset" ) )
+	{
+		g_NetworkPropDirtyTracker.Reset();
+		return;
+	}
+
+	if ( !g_bNetworkPropDirtyTracking )
+	{
+		Msg( "sv_netprop_dirty_tracking is off.\n" );
+	}
+	g_NetworkPropDirtyTracker.Report();
+}
@@ -15,6 +15,12 @@
 #include "server_class.h"
 #include "edict.h"
 #include "timedeventmgr.h"
+#include "bitvec.h"
+
+class CSendTableFlat;
+
+// When set, network var changes are also recorded per property (see sv_netprop_dirty_tracking)
+extern bool g_bNetworkPropDirtyTracking;
 
 //
 // Lightweight base class for networkable data on the server.
@@ -61,6 +67,25 @@ public:
 	void NetworkStateChanged();
 	void NetworkStateChanged( unsigned short offset );
 
+	// Per-property change tracking. Indices are into the flattened SendTable
+	// of this entity's server class (see SendTable_GetFlat).
+	CSendTableFlat *GetFlatSendTable();
+	bool HasDirtyProps() const;
+	bool AreAllPropsDirty() const;
+	bool IsPropDirty( int iFlatProp ) const;
+	int CountDirtyProps();
+	void ClearDirtyProps();
+
+	// Stamps the dirty props with nTick, then clears the dirty bits. Once an
+	// entity has history, GetPropsChangedSince() sets the props a delta from
+	// nFromTick has to carry; it returns false if every prop must be sent.
+	void CommitDirtyProps( int nTick );
+	bool GetPropsChangedSince( int nFromTick, CVarBitVec *pProps ) const;
+
+	// Forgets the per-prop history. Changes made while tracking was off were
+	// never recorded, so sv_netprop_dirty_tracking calls this when it toggles.
+	void ResetPropChangeHistory();
+
 	// Marks the PVS information dirty
 	void MarkPVSInformationDirty();
 
@@ -109,6 +134,10 @@ private:
 	// Marks the networkable that it will should transmit
 	void SetTransmit( CCheckTransmitInfo *pInfo );
 
+	// Records a change for the per-property dirty bits
+	void MarkAllPropsDirty();
+	void MarkPropsDirty( unsigned short varOffset );
+
 private:
 	CBaseEntity *m_pOuter;
 	// CBaseTransmitProxy *m_pTransmitProxy;
@@ -124,6 +153,15 @@ private:
 	CEventRegister	m_TimerEvent;
 	bool m_bPendingStateChange : 1;
 
+	// Per-property dirty bits, sized to the flattened SendTable on first change
+	bool m_bAllPropsDirty : 1;
+	bool m_bAnyPropsDirty : 1;
+	CSendTableFlat *m_pFlatSendTable;
+	CVarBitVec m_DirtyProps;
+
+	// Tick each prop last changed in, filled in by CommitDirtyProps
+	CUtlVector<int> m_PropChangeTicks;
+
 //	friend class CBaseTransmitProxy;
 };
 
@@ -178,12 +216,18 @@ inline void CServerNetworkProperty::SetNetworkParent( EHANDLE hParent )
 //-----------------------------------------------------------------------------
 inline void CServerNetworkProperty::NetworkStateForceUpdate()
 { 
+	if ( g_bNetworkPropDirtyTracking )
+		MarkAllPropsDirty();
+
 	if ( m_pPev )
 		m_pPev->StateChanged();
 }
 
 inline void CServerNetworkProperty::NetworkStateChanged()
 { 
+	if ( g_bNetworkPropDirtyTracking )
+		MarkAllPropsDirty();
+
 	// If we're using the timer, then ignore this call.
 	if ( m_TimerEvent.IsRegistered() )
 	{
@@ -200,6 +244,9 @@ inline void CServerNetworkProperty::NetworkStateChanged()
 
 inline void CServerNetworkProperty::NetworkStateChanged( unsigned short varOffset )
 { 
+	if ( g_bNetworkPropDirtyTracking )
+		MarkPropsDirty( varOffset );
+
 	// If we're using the timer, then ignore this call.
 	if ( m_TimerEvent.IsRegistered() )
 	{
@@ -248,6 +295,27 @@ inline void CServerNetworkProperty::SetEdict( edict_t *pEdict )
 }
 
 
+//-----------------------------------------------------------------------------
+// Per-property dirty bits
+//-----------------------------------------------------------------------------
+inline bool CServerNetworkProperty::HasDirtyProps() const
+{
+	return m_bAnyPropsDirty;
+}
+
+inline bool CServerNetworkProperty::AreAllPropsDirty() const
+{
+	return m_bAllPropsDirty;
+}
+
+inline bool CServerNetworkProperty::IsPropDirty( int iFlatProp ) const
+{
+	if ( m_bAllPropsDirty )
+		return true;
+	return m_bAnyPropsDirty && iFlatProp < m_DirtyProps.GetNumBits() && m_DirtyProps.IsBitSet( iFlatProp );
+}
+
+
 inline int CServerNetworkProperty::AreaNum() const
 {
 	const_cast<CServerNetworkProperty*>(this)->RecomputePVSInformation();
@@ -25,6 +25,7 @@
 #include "ndebugoverlay.h"
 #include "ai_hint.h"
 #include "tier0/icommandline.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -70,6 +71,8 @@ CON_COMMAND( ai_debug_node_connect, "Debug the attempted connection between two
 
 ConVar g_ai_norebuildgraph( "ai_norebuildgraph", "0" );
 
+ConVar ai_network_build_threaded( "ai_network_build_threaded", "1", 0, "Trace node visibility on worker threads while building the AI node graph" );
+
 
 //-----------------------------------------------------------------------------
 // CAI_NetworkManager
@@ -2112,6 +2115,8 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 	// ------------------------------------------------------------
 	//  First mark all nodes around vecPos as having to be rebuilt
 	// ------------------------------------------------------------
+	InitCandidates( pNetwork );
+
 	int i;
 	for (i = 0; i < nNodes; i++)
 	{
@@ -2124,8 +2129,9 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 			Vector vRebuildPos			= ppNodes[i]->GetOrigin();
 			ppNodes[i]->SetNeedsRebuild();
 			ppNodes[i]->SetZone( AI_NODE_ZONE_UNIVERSAL );
-			for (int node = 0; node < nNodes; node++)
+			for (int iCandidate = 0; iCandidate < m_Candidates[i].Count(); iCandidate++)
 			{
+				int node = m_Candidates[i][iCandidate];
 				if ( ppNodes[node]->GetType() == NODE_AIR )
 				{
 					if ((ppNodes[node]->GetOrigin() - vRebuildPos).LengthSqr() < MAX_AIR_NODE_LINK_DIST_SQ)
@@ -2168,6 +2174,19 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 	{
 		m_NeighborsTable[i].Resize( nNodes );
 	}
+
+	InitCandidates( pNetwork );
+	m_WillInitNeighbors.Resize( nNodes );
+	m_WillInitNeighbors.ClearAll();
+	for (i = 0; i < nNodes; i++)
+	{
+		if (ppNodes[i]->NeedsRebuild())
+		{
+			m_WillInitNeighbors.Set( i );
+		}
+	}
+	PrecomputeVisibility( pNetwork );
+
 	for (i = 0; i < nNodes; i++)
 	{
 		// If near point of change recalculate
@@ -2218,6 +2237,9 @@ void CAI_NetworkBuilder::EndBuild()
 {
 	m_NeighborsTable.SetSize(0);
 	m_DidSetNeighborsTable.Resize(0);
+	m_Candidates.SetSize(0);
+	m_CandidateVisibility.SetSize(0);
+	m_WillInitNeighbors.Resize(0);
 	CAI_TestHull::ReturnTestHull();
 }
 
@@ -2276,6 +2298,12 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		m_NeighborsTable[i].Resize( nNodes );
 		m_NeighborsTable[i].ClearAll();
 	}
+
+	InitCandidates( pNetwork );
+	m_WillInitNeighbors.Resize( nNodes );
+	m_WillInitNeighbors.SetAll();
+	PrecomputeVisibility( pNetwork );
+
 	for (i = 0; i < nNodes; i++)
 	{	
 		InitNeighbors( pNetwork, ppNodes[i] );
@@ -2386,6 +2414,60 @@ void CAI_NetworkBuilder::ForceDynamicLinkNeighbors(void)
 
 CAI_NetworkBuilder g_AINetworkBuilder;
 
+//-----------------------------------------------------------------------------
+// Purpose: Relink the nodes around the player after changing the geometry or
+//			hints near them, without rebuilding the whole node graph
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( ai_relink_nodes, "Relink the AI nodes within the given radius of the player (default 256) and the nodes that can link to them", FCVAR_CHEAT )
+{
+	CBasePlayer *pPlayer = UTIL_GetCommandClient();
+	if ( !pPlayer || !g_pAINetworkManager || !g_pAINetworkManager->GetNetwork() )
+		return;
+
+	CAI_Network *pNetwork = g_pAINetworkManager->GetNetwork();
+	float flRadius = ( args.ArgC() > 1 ) ? atof( args[1] ) : 256.0f;
+
+	int nChanged = 0;
+	for ( int i = 0; i < pNetwork->NumNodes(); i++ )
+	{
+		CAI_Node *pNode = pNetwork->GetNode( i );
+		if ( ( pNode->GetOrigin() - pPlayer->GetAbsOrigin() ).LengthSqr() < flRadius * flRadius )
+		{
+			pNode->m_eNodeInfo |= bits_NODE_WC_CHANGED;
+			nChanged++;
+		}
+	}
+
+	if ( !nChanged )
+	{
+		Msg( "ai_relink_nodes: no nodes within %.0f units\n", flRadius );
+		return;
+	}
+
+	CFastTimer timer;
+	timer.Start();
+
+	g_pAINetworkManager->StartRebuild();
+	g_AINetworkBuilder.InitZones( pNetwork );
+	CAI_DynamicLink::InitDynamicLinks();
+
+	timer.End();
+
+	int nRelinked = 0;
+	for ( int i = 0; i < pNetwork->NumNodes(); i++ )
+	{
+		CAI_Node *pNode = pNetwork->GetNode( i );
+		if ( pNode->NeedsRebuild() )
+		{
+			nRelinked++;
+		}
+		pNode->m_eNodeInfo &= ~bits_NODE_WC_CHANGED;
+		pNode->ClearNeedsRebuild();
+	}
+
+	Msg( "ai_relink_nodes: relinked %d nodes around %d changed, %f seconds\n", nRelinked, nChanged, timer.GetDuration().GetSeconds() );
+}
+
 
 //-----------------------------------------------------------------------------
 // Purpose: Initializes position of climb node in the world.  Climb nodes are
@@ -2606,6 +2688,207 @@ void CAI_NetworkBuilder::InitNodePosition(CAI_Network *pNetwork, CAI_Node *pNode
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Find the nodes close enough to each node to link to, by bucketing
+//			the nodes into columns MAX_NODE_LINK_DIST wide instead of testing
+//			every pair.  Air nodes link further, so they get their own grid.
+//-----------------------------------------------------------------------------
+static int CompareNodeIds( const int *pLeft, const int *pRight )
+{
+	return *pLeft - *pRight;
+}
+
+void CAI_NetworkBuilder::InitCandidates( CAI_Network *pNetwork )
+{
+	AI_PROFILE_SCOPE( CAI_Node_InitCandidates );
+
+	int nNodes = pNetwork->NumNodes();
+	int i;
+
+	m_Candidates.SetSize( nNodes );
+	for (i = 0; i < nNodes; i++)
+	{
+		m_Candidates[i].RemoveAll();
+	}
+
+	if ( !nNodes )
+		return;
+
+	Vector2D mins( FLT_MAX, FLT_MAX );
+	Vector2D maxs( -FLT_MAX, -FLT_MAX );
+	for (i = 0; i < nNodes; i++)
+	{
+		const Vector &origin = pNetwork->GetNode( i )->GetOrigin();
+		mins.x = MIN( mins.x, origin.x );
+		mins.y = MIN( mins.y, origin.y );
+		maxs.x = MAX( maxs.x, origin.x );
+		maxs.y = MAX( maxs.y, origin.y );
+	}
+
+	const float cellSize = MAX_NODE_LINK_DIST;
+	int sizeX = (int)( ( maxs.x - mins.x ) / cellSize ) + 1;
+	int sizeY = (int)( ( maxs.y - mins.y ) / cellSize ) + 1;
+
+	// A list of the nodes in each cell: grid 0 holds the air nodes, grid 1 the rest
+	CUtlVector<int> firstInCell[2];
+	CUtlVector<int> nextInCell;
+	for (int grid = 0; grid < 2; grid++)
+	{
+		firstInCell[grid].SetCount( sizeX * sizeY );
+		firstInCell[grid].FillWithValue( -1 );
+	}
+	nextInCell.SetCount( nNodes );
+
+	for (i = nNodes - 1; i >= 0; i--)
+	{
+		CAI_Node *pNode = pNetwork->GetNode( i );
+		int grid = ( pNode->GetType() == NODE_AIR ) ? 0 : 1;
+		int cell = (int)( ( pNode->GetOrigin().x - mins.x ) / cellSize ) + (int)( ( pNode->GetOrigin().y - mins.y ) / cellSize ) * sizeX;
+
+		nextInCell[i] = firstInCell[grid][cell];
+		firstInCell[grid][cell] = i;
+	}
+
+	// InitVisibility() only considers nodes within the link distance of the other node's type.
+	// Use the longer distance of the two types so that j is a candidate of i exactly when i is a
+	// candidate of j; InitNeighbors() copies a neighbor bit from whichever node it visited first.
+	const float linkDistSqr[2] = { MAX_AIR_NODE_LINK_DIST_SQ, MAX_NODE_LINK_DIST_SQ };
+	const int cellRadius[2] = { (int)ceil( MAX_AIR_NODE_LINK_DIST / cellSize ), 1 };
+
+	for (i = 0; i < nNodes; i++)
+	{
+		const Vector &origin = pNetwork->GetNode( i )->GetOrigin();
+		int cellX = (int)( ( origin.x - mins.x ) / cellSize );
+		int cellY = (int)( ( origin.y - mins.y ) / cellSize );
+		int nodeGrid = ( pNetwork->GetNode( i )->GetType() == NODE_AIR ) ? 0 : 1;
+
+		for (int grid = 0; grid < 2; grid++)
+		{
+			float maxDistSqr = MAX( linkDistSqr[grid], linkDistSqr[nodeGrid] );
+			int radius = MAX( cellRadius[grid], cellRadius[nodeGrid] );
+
+			for (int y = MAX( cellY - radius, 0 ); y <= MIN( cellY + radius, sizeY - 1 ); y++)
+			{
+				for (int x = MAX( cellX - radius, 0 ); x <= MIN( cellX + radius, sizeX - 1 ); x++)
+				{
+					for (int node = firstInCell[grid][x + y * sizeX]; node != -1; node = nextInCell[node])
+					{
+						if ( ( pNetwork->GetNode( node )->GetOrigin() - origin ).LengthSqr() <= maxDistSqr )
+						{
+							m_Candidates[i].AddToTail( node );
+						}
+					}
+				}
+			}
+		}
+
+		m_Candidates[i].Sort( CompareNodeIds );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Trace the line of sight InitVisibility() needs on worker threads.
+//			Each pair is traced from the node InitNeighbors() reaches first,
+//			which is the one InitVisibility() would trace it from, so the
+//			result is the same as tracing while building the neighbors.
+//-----------------------------------------------------------------------------
+void CAI_NetworkBuilder::PrecomputeVisibility( CAI_Network *pNetwork )
+{
+	int nNodes = pNetwork->NumNodes();
+
+	CUtlVector<int> nodes;
+	m_CandidateVisibility.SetSize( nNodes );
+	for (int i = 0; i < nNodes; i++)
+	{
+		m_CandidateVisibility[i].SetCount( m_Candidates[i].Count() );
+		m_CandidateVisibility[i].FillWithValue( -1 );
+
+		if ( m_WillInitNeighbors.IsBitSet( i ) )
+		{
+			nodes.AddToTail( i );
+		}
+	}
+
+	if ( !ai_network_build_threaded.GetBool() )
+		return;
+
+	m_pBuildNetwork = pNetwork;
+	ParallelProcess( "CAI_NetworkBuilder::PrecomputeVisibility", nodes.Base(), nodes.Count(), &CAI_NetworkBuilder::PrecomputeVisibilityJob );
+	m_pBuildNetwork = NULL;
+}
+
+//-------------------------------------
+
+void CAI_NetworkBuilder::PrecomputeVisibilityJob( int &iNode )
+{
+	CAI_NetworkBuilder *pBuilder = &g_AINetworkBuilder;
+	CAI_Network *pNetwork = pBuilder->m_pBuildNetwork;
+	CAI_Node *pNode = pNetwork->GetNode( iNode );
+
+	if ( pNode->GetType() == NODE_DELETED )
+		return;
+
+	Vector srcPos = pNode->GetPosition( HULL_SMALL_CENTERED );
+
+	const CUtlVector<int> &candidates = pBuilder->m_Candidates[iNode];
+	CUtlVector<signed char> &visibility = pBuilder->m_CandidateVisibility[iNode];
+
+	for (int iCandidate = 0; iCandidate < candidates.Count(); iCandidate++)
+	{
+		int testnode = candidates[iCandidate];
+
+		// The other node gets there first and traces this pair
+		if ( testnode <= iNode && ( testnode == iNode || pBuilder->m_WillInitNeighbors.IsBitSet( testnode ) ) )
+			continue;
+
+		// Skipped by InitVisibility() without tracing, or a duplicate it may delete
+		CAI_Node *pTestNode = pNetwork->GetNode( testnode );
+		if ( pTestNode->GetType() == NODE_DELETED || pTestNode->GetOrigin() == pNode->GetOrigin() )
+			continue;
+
+		visibility[iCandidate] = TestVisibility( srcPos, pTestNode->GetPosition( HULL_SMALL_CENTERED ) ) ? 1 : 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Return true if there is a line of sight between two nodes, trying
+//			several heights.  Safe to call from worker threads.
+//-----------------------------------------------------------------------------
+bool CAI_NetworkBuilder::TestVisibility( const Vector &srcPos, const Vector &destPos )
+{
+	trace_t	tr;
+
+	// ------------------
+	//  Bottom to bottom
+	// ------------------
+	AI_TraceLine ( srcPos, destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+		return true;
+
+	// ------------------
+	//  Top to top
+	// ------------------
+	AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+		return true;
+
+	// ------------------
+	//  Top to Bottom
+	// ------------------
+	AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+		return true;
+
+	// ------------------
+	//  Bottom to Top
+	// ------------------
+	AI_TraceLine ( srcPos,destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+		return true;
+
+	return false;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Set the visibility for this node.  (What nodes it can see with a
 //			line trace)
@@ -2626,9 +2909,11 @@ void CAI_NetworkBuilder::InitVisibility(CAI_Network *pNetwork, CAI_Node *pNode)
 	// position using the smallest hull to make sure were not in geometry
 	Vector srcPos = pNode->GetPosition(HULL_SMALL_CENTERED);
 
-	// Check the visibility on every other node in the network
-	for (int testnode = 0; testnode < pNetwork->NumNodes(); testnode++ )
+	// Check the visibility on every other node close enough to link to
+	const CUtlVector<int> &candidates = m_Candidates[pNode->m_iID];
+	for (int iCandidate = 0; iCandidate < candidates.Count(); iCandidate++ )
   	{
+		int testnode = candidates[iCandidate];
 		CAI_Node *testNode = pNetwork->GetNode( testnode );
 
 		if ( DebuggingConnect( pNode->m_iID, testnode ) )
@@ -2683,56 +2968,16 @@ void CAI_NetworkBuilder::InitVisibility(CAI_Network *pNetwork, CAI_Node *pNode)
 		// position using the smallest hull to make sure were not in geometry
 		Vector destPos = pNetwork->GetNode( testnode )->GetPosition(HULL_SMALL_CENTERED);
 
-		trace_t	tr;
-		tr.m_pEnt = NULL;
-
-		// Try several line of sight checks
-
-		bool isVisible = false;
-
-		// ------------------
-		//  Bottom to bottom
-		// ------------------
-		AI_TraceLine ( srcPos, destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-		if (!tr.startsolid && tr.fraction == 1.0)
+		// Use the result traced by PrecomputeVisibility() if there is one
+		bool isVisible;
+		signed char precomputed = m_CandidateVisibility[pNode->m_iID][iCandidate];
+		if ( precomputed >= 0 )
 		{
-			isVisible = true;
+			isVisible = ( precomputed != 0 );
 		}
-
-		// ------------------
-		//  Top to top
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Top to Bottom
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Bottom to Top
-		// ------------------
-		if (!isVisible)
+		else
 		{
-			AI_TraceLine ( srcPos,destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
+			isVisible = TestVisibility( srcPos, destPos );
 		}
 
 		// ------------------
@@ -2809,9 +3054,13 @@ void CAI_NetworkBuilder::InitNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
 	AI_PROFILE_SCOPE_BEGIN( CAI_Node_InitNeighbors );
 
 	// Now check each neighbor against all other neighbors to see if one of
-	// them is a redundant connection
-	for (int checknode = 0; checknode < pNetwork->NumNodes(); checknode++ )
+	// them is a redundant connection. Only nodes close enough to link to can
+	// be neighbors.
+	const CUtlVector<int> &candidates = m_Candidates[pNode->m_iID];
+	for (int iCheck = 0; iCheck < candidates.Count(); iCheck++ )
 	{
+		int checknode = candidates[iCheck];
+
 		if ( DebuggingConnect( pNode->m_iID, checknode ) )
 		{
 			DevMsg( " " ); // break here..
@@ -2832,8 +3081,10 @@ void CAI_NetworkBuilder::InitNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
 
 		CAI_Node *pCheckNode = pNetwork->GetNode(checknode);
 
-		for (int testnode = 0; testnode < pNetwork->NumNodes(); testnode++ )
+		for (int iTest = 0; iTest < candidates.Count(); iTest++ )
 		{
+			int testnode = candidates[iTest];
+
 			// don't check against itself
 			if (( testnode == checknode ) || (testnode == pNode->m_iID))
 			{
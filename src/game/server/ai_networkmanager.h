@@ -113,6 +113,11 @@ private:
 	void			FloodFillZone( CAI_Node **ppNodes, CAI_Node *pNode, int zone );
 
 	int				ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull );
+
+	void			InitCandidates( CAI_Network *pNetwork );
+	void			PrecomputeVisibility( CAI_Network *pNetwork );
+	static void		PrecomputeVisibilityJob( int &iNode );
+	static bool		TestVisibility( const Vector &srcPos, const Vector &destPos );
 	
 	void 			BeginBuild();
 	void			EndBuild();
@@ -120,6 +125,11 @@ private:
 	CUtlVector<CVarBitVec>	m_NeighborsTable;
 	CVarBitVec				m_DidSetNeighborsTable;
 	CAI_TestHull *			m_pTestHull;
+
+	CUtlVector< CUtlVector<int> >			m_Candidates;				// For each node, the nodes close enough to link to, by increasing ID
+	CUtlVector< CUtlVector<signed char> >	m_CandidateVisibility;		// For each candidate, 1 if visible, 0 if not, -1 if InitVisibility() must trace
+	CVarBitVec								m_WillInitNeighbors;		// Nodes InitNeighbors() will be called on, for PrecomputeVisibilityJob()
+	CAI_Network *							m_pBuildNetwork;
 };
 
 extern CAI_NetworkBuilder g_AINetworkBuilder;
@@ -272,6 +272,161 @@ int CAI_Pathfinder::NearestNodeToPoint( const Vector &vecOrigin )
 	return GetNetwork()->NearestNodeToPoint( GetOuter(), vecOrigin );
 }
 
+//-----------------------------------------------------------------------------
+// Per-node search state for FindBestPath, shared by all pathfinders. Each
+// node is stamped with the search that last touched it, so a query only pays
+// for the nodes it reaches instead of resetting arrays the size of the graph.
+// The open list is a binary heap indexed by node so decreasing a node's cost
+// doesn't need a search.
+//-----------------------------------------------------------------------------
+class CAI_PathfindScratch
+{
+public:
+	CAI_PathfindScratch()
+	 :	m_iSearch( 0 ),
+		m_bInUse( false )
+	{
+	}
+
+	void BeginSearch( int nNodes )
+	{
+		Assert( !m_bInUse );
+		m_bInUse = true;
+		m_Heap.RemoveAll();
+
+		if ( m_Searches.Count() != nNodes )
+		{
+			m_G.SetCount( nNodes );
+			m_F.SetCount( nNodes );
+			m_Parents.SetCount( nNodes );
+			m_HeapIndex.SetCount( nNodes );
+			m_Searches.SetCount( nNodes );
+			ResetStamps();
+		}
+
+		if ( ++m_iSearch == 0 )
+		{
+			ResetStamps();
+			m_iSearch = 1;
+		}
+	}
+
+	void EndSearch()
+	{
+		m_bInUse = false;
+	}
+
+	bool IsVisited( int iNode ) const
+	{
+		return m_Searches[iNode] == m_iSearch;
+	}
+
+	void Visit( int iNode )
+	{
+		m_Searches[iNode] = m_iSearch;
+		m_HeapIndex[iNode] = -1;
+	}
+
+	bool IsOpenEmpty() const
+	{
+		return m_Heap.Count() == 0;
+	}
+
+	// Adds a node to the open list, or moves it up if its cost dropped
+	void Open( int iNode )
+	{
+		int i = m_HeapIndex[iNode];
+		if ( i < 0 )
+		{
+			i = m_Heap.AddToTail( iNode );
+			m_HeapIndex[iNode] = i;
+		}
+		SiftUp( i );
+	}
+
+	int PopSmallest()
+	{
+		int iNode = m_Heap[0];
+		m_HeapIndex[iNode] = -1;
+
+		int iLast = m_Heap.Tail();
+		m_Heap.FastRemove( m_Heap.Count() - 1 );
+		if ( m_Heap.Count() )
+		{
+			m_Heap[0] = iLast;
+			m_HeapIndex[iLast] = 0;
+			SiftDown( 0 );
+		}
+		return iNode;
+	}
+
+	CUtlVector<float>	m_G;
+	CUtlVector<float>	m_F;
+	CUtlVector<int>		m_Parents;
+
+private:
+	void ResetStamps()
+	{
+		for ( int i = 0; i < m_Searches.Count(); i++ )
+		{
+			m_Searches[i] = 0;
+		}
+	}
+
+	// Ties go to the lower node ID, which is the order the old linear scan picked them in
+	bool IsLess( int iNodeA, int iNodeB ) const
+	{
+		return ( m_F[iNodeA] < m_F[iNodeB] ) || ( m_F[iNodeA] == m_F[iNodeB] && iNodeA < iNodeB );
+	}
+
+	void Place( int i, int iNode )
+	{
+		m_Heap[i] = iNode;
+		m_HeapIndex[iNode] = i;
+	}
+
+	void SiftUp( int i )
+	{
+		int iNode = m_Heap[i];
+		while ( i > 0 )
+		{
+			int iParent = ( i - 1 ) >> 1;
+			if ( !IsLess( iNode, m_Heap[iParent] ) )
+				break;
+			Place( i, m_Heap[iParent] );
+			i = iParent;
+		}
+		Place( i, iNode );
+	}
+
+	void SiftDown( int i )
+	{
+		int iNode = m_Heap[i];
+		int nCount = m_Heap.Count();
+		for ( ;; )
+		{
+			int iChild = 2 * i + 1;
+			if ( iChild >= nCount )
+				break;
+			if ( iChild + 1 < nCount && IsLess( m_Heap[iChild + 1], m_Heap[iChild] ) )
+				iChild++;
+			if ( !IsLess( m_Heap[iChild], iNode ) )
+				break;
+			Place( i, m_Heap[iChild] );
+			i = iChild;
+		}
+		Place( i, iNode );
+	}
+
+	CUtlVector<int>			m_Heap;
+	CUtlVector<int>			m_HeapIndex;
+	CUtlVector<unsigned>	m_Searches;
+	unsigned				m_iSearch;
+	bool					m_bInUse;
+};
+
+static CAI_PathfindScratch g_AIPathfindScratch;
+
 //-----------------------------------------------------------------------------
 // Purpose: Build a path between two nodes
 //-----------------------------------------------------------------------------
@@ -290,35 +445,24 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	int nNodes = GetNetwork()->NumNodes();
 	CAI_Node **pAInode = GetNetwork()->AccessNodes();
 
-	CVarBitVec	openBS(nNodes);
-	CVarBitVec	closeBS(nNodes);
-
 	// ------------- INITIALIZE ------------------------
-	float* nodeG = (float *)stackalloc( nNodes * sizeof(float) );
-	float* nodeH = (float *)stackalloc( nNodes * sizeof(float) );
-	float* nodeF = (float *)stackalloc( nNodes * sizeof(float) );
-	int*   nodeP = (int *)stackalloc( nNodes * sizeof(int) );		// Node parent 
+	CAI_PathfindScratch &scratch = g_AIPathfindScratch;
+	scratch.BeginSearch( nNodes );
 
-	for (int node=0;node<nNodes;node++)
-	{
-		nodeG[node] = FLT_MAX;
-		nodeP[node] = -1;
-	}
+	float *nodeG = scratch.m_G.Base();
+	float *nodeF = scratch.m_F.Base();
+	int   *nodeP = scratch.m_Parents.Base();		// Node parent 
 
+	scratch.Visit( startID );
 	nodeG[startID] = 0;
-
-	nodeH[startID] = 0.1*(pAInode[startID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length(); // Don't want to over estimate
-	nodeF[startID] = nodeG[startID] + nodeH[startID];
-
-	openBS.Set(startID);
-	closeBS.Set( startID );
+	nodeP[startID] = NO_NODE;
+	nodeF[startID] = nodeG[startID] + 0.1*(pAInode[startID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length(); // Don't want to over estimate
+	scratch.Open( startID );
 
 	// --------------- FIND BEST PATH ------------------
-	while (!openBS.IsAllClear()) 
+	while ( !scratch.IsOpenEmpty() ) 
 	{
-		int smallestID = CAI_Network::FindBSSmallest(&openBS,nodeF,nNodes);
-	
-		openBS.Clear(smallestID);
+		int smallestID = scratch.PopSmallest();
 
 		CAI_Node *pSmallestNode = pAInode[smallestID];
 		
@@ -327,7 +471,8 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 
 		if (smallestID == endID) 
 		{
-			AI_Waypoint_t* route = MakeRouteFromParents(&nodeP[0], endID);
+			AI_Waypoint_t* route = MakeRouteFromParents(nodeP, endID);
+			scratch.EndSearch();
 			return route;
 		}
 
@@ -353,19 +498,23 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 
 			float new_g  = nodeG[smallestID] + dist;
 
-			if ( !closeBS.IsBitSet(testID) || (new_g < nodeG[testID]) ) 
+			if ( !scratch.IsVisited(testID) || (new_g < nodeG[testID]) ) 
 			{
+				if ( !scratch.IsVisited(testID) )
+				{
+					scratch.Visit( testID );
+				}
+
 				nodeP[testID] = smallestID;
 				nodeG[testID] = new_g;
-				nodeH[testID] = (pAInode[testID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length();
-				nodeF[testID] = nodeG[testID] + nodeH[testID];
+				nodeF[testID] = nodeG[testID] + (pAInode[testID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length();
 
-				closeBS.Set( testID );
-				openBS.Set( testID );
+				scratch.Open( testID );
 			}
 		}
 	}
 
+	scratch.EndSearch();
 	return NULL;   
 }
 
@@ -2135,3 +2284,80 @@ void CAI_Pathfinder::CTriDebugOverlay::AddTriOverlayLine(const Vector &origin, c
 }
 
 //-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Runs FindBestPath between random node pairs of the loaded graph using an
+// NPC's pathfinder and reports how long the queries took.
+//-----------------------------------------------------------------------------
+CON_COMMAND( ai_pathfind_benchmark, "Time FindBestPath between random nodes. Usage: ai_pathfind_benchmark [queries] [npc name] [seed]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nQueries = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 1000;
+	int nSeed = ( args.ArgC() > 3 ) ? atoi( args[3] ) : 0;
+
+	CAI_BaseNPC *pNPC = NULL;
+	if ( args.ArgC() > 2 )
+	{
+		CBaseEntity *pEntity = gEntList.FindEntityByName( NULL, args[2] );
+		if ( !pEntity )
+		{
+			pEntity = gEntList.FindEntityByClassname( NULL, args[2] );
+		}
+		pNPC = pEntity ? pEntity->MyNPCPointer() : NULL;
+	}
+	else if ( g_AI_Manager.NumAIs() )
+	{
+		pNPC = g_AI_Manager.AccessAIs()[0];
+	}
+
+	if ( !pNPC || !pNPC->GetPathfinder() || !pNPC->GetNavigator() )
+	{
+		Msg( "ai_pathfind_benchmark: no NPC to path with\n" );
+		return;
+	}
+
+	CAI_Network *pNetwork = g_pBigAINet;
+	int nNodes = pNetwork ? pNetwork->NumNodes() : 0;
+	if ( nNodes < 2 )
+	{
+		Msg( "ai_pathfind_benchmark: node graph isn't loaded\n" );
+		return;
+	}
+
+	CUniformRandomStream random;
+	random.SetSeed( nSeed );
+
+	int nFound = 0;
+	int nWaypoints = 0;
+	double flMaxMS = 0;
+	CCycleCount total;
+	for ( int i = 0; i < nQueries; i++ )
+	{
+		int startID = random.RandomInt( 0, nNodes - 1 );
+		int endID = random.RandomInt( 0, nNodes - 1 );
+
+		CFastTimer timer;
+		timer.Start();
+		AI_Waypoint_t *pRoute = pNPC->GetPathfinder()->FindBestPath( startID, endID );
+		timer.End();
+
+		total += timer.GetDuration();
+		flMaxMS = MAX( flMaxMS, timer.GetDuration().GetMillisecondsF() );
+
+		if ( pRoute )
+		{
+			nFound++;
+			for ( AI_Waypoint_t *pWaypoint = pRoute; pWaypoint; pWaypoint = pWaypoint->GetNext() )
+			{
+				nWaypoints++;
+			}
+			DeleteAll( pRoute );
+		}
+	}
+
+	Msg( "ai_pathfind_benchmark: %d queries on %d nodes with %s (%s hull)\n", nQueries, nNodes, pNPC->GetDebugName(), NAI_Hull::Name( pNPC->GetHullType() ) );
+	Msg( "  %d paths found, %.1f waypoints avg\n", nFound, nFound ? (float)nWaypoints / nFound : 0.0f );
+	Msg( "  %.3f ms total, %.4f ms avg, %.4f ms max\n", total.GetMillisecondsF(), total.GetMillisecondsF() / nQueries, flMaxMS );
+}
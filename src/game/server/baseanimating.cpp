@@ -1400,18 +1400,178 @@ int CBaseAnimating::LookupPoseParameter( CStudioHdr *pStudioHdr, const char *szN
 		return 0;
 	}
 
-	for (int i = 0; i < pStudioHdr->GetNumPoseParameters(); i++)
+	int iParameter = pStudioHdr->FindPoseParameter( szName );
+	if ( iParameter >= 0 )
 	{
-		if (Q_stricmp( pStudioHdr->pPoseParameter( i ).pszName(), szName ) == 0)
-		{
-			return i;
-		}
+		return iParameter;
 	}
 
 	// AssertMsg( 0, UTIL_VarArgs( "poseparameter %s couldn't be mapped!!!\n", szName ) );
 	return -1; // Error
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Time the name lookups against the linear searches they replaced
+//-----------------------------------------------------------------------------
+static int LookupNameLinear( CStudioHdr *pStudioHdr, int nTable, const char *pszName )
+{
+	switch ( nTable )
+	{
+	case CStudioHdr::CNameToIndexMapping::NAME_TABLE_SEQUENCE:
+		for ( int i = 0; i < pStudioHdr->GetNumSeq(); i++ )
+		{
+			if ( !Q_stricmp( pStudioHdr->pSeqdesc( i ).pszLabel(), pszName ) )
+				return i;
+		}
+		break;
+	case CStudioHdr::CNameToIndexMapping::NAME_TABLE_ACTIVITY:
+		for ( int i = 0; i < pStudioHdr->GetNumSeq(); i++ )
+		{
+			if ( !Q_stricmp( pStudioHdr->pSeqdesc( i ).pszActivityName(), pszName ) )
+				return i;
+		}
+		break;
+	case CStudioHdr::CNameToIndexMapping::NAME_TABLE_ATTACHMENT:
+		for ( int i = 0; i < pStudioHdr->GetNumAttachments(); i++ )
+		{
+			if ( !Q_stricmp( pStudioHdr->pAttachment( i ).pszName(), pszName ) )
+				return i;
+		}
+		break;
+	case CStudioHdr::CNameToIndexMapping::NAME_TABLE_POSEPARAM:
+		for ( int i = 0; i < pStudioHdr->GetNumPoseParameters(); i++ )
+		{
+			if ( !Q_stricmp( pStudioHdr->pPoseParameter( i ).pszName(), pszName ) )
+				return i;
+		}
+		break;
+	}
+	return -1;
+}
+
+static int LookupNameIndexed( CStudioHdr *pStudioHdr, int nTable, const char *pszName )
+{
+	switch ( nTable )
+	{
+	case CStudioHdr::CNameToIndexMapping::NAME_TABLE_SEQUENCE:		return pStudioHdr->FindSequenceByName( pszName );
+	case CStudioHdr::CNameToIndexMapping::NAME_TABLE_ACTIVITY:		return pStudioHdr->FindSequenceByActivityName( pszName );
+	case CStudioHdr::CNameToIndexMapping::NAME_TABLE_ATTACHMENT:	return pStudioHdr->FindAttachment( pszName );
+	case CStudioHdr::CNameToIndexMapping::NAME_TABLE_POSEPARAM:		return pStudioHdr->FindPoseParameter( pszName );
+	}
+	return -1;
+}
+
+CON_COMMAND_F( anim_bench_lookups, "Time looking up every sequence, activity, attachment and pose parameter name of the models in the map, by linear search and through the model's name index. Arguments: [passes]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nPasses = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 16;
+
+	static const char *s_pTableNames[] = { "sequences", "activities", "attachments", "pose parameters" };
+	COMPILE_TIME_ASSERT( ARRAYSIZE( s_pTableNames ) == CStudioHdr::CNameToIndexMapping::NAME_TABLE_COUNT );
+
+	// one entity per model, with every name it can be asked for plus one it can't
+	struct lookupbenchmodel_t
+	{
+		CStudioHdr *pStudioHdr;
+		CUtlVector< const char * > names[CStudioHdr::CNameToIndexMapping::NAME_TABLE_COUNT];
+	};
+	CUtlVector< lookupbenchmodel_t > models;
+	CUtlVector< const studiohdr_t * > seen;
+	int nMostSequences = 0;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		CStudioHdr *pStudioHdr = pAnimating ? pAnimating->GetModelPtr() : NULL;
+		if ( !pStudioHdr || !pStudioHdr->SequencesAvailable() )
+			continue;
+
+		if ( seen.Find( pStudioHdr->GetRenderHdr() ) != seen.InvalidIndex() )
+			continue;
+		seen.AddToTail( pStudioHdr->GetRenderHdr() );
+
+		lookupbenchmodel_t &model = models[ models.AddToTail() ];
+		model.pStudioHdr = pStudioHdr;
+		for ( int i = 0; i < pStudioHdr->GetNumSeq(); i++ )
+		{
+			model.names[CStudioHdr::CNameToIndexMapping::NAME_TABLE_SEQUENCE].AddToTail( pStudioHdr->pSeqdesc( i ).pszLabel() );
+			model.names[CStudioHdr::CNameToIndexMapping::NAME_TABLE_ACTIVITY].AddToTail( pStudioHdr->pSeqdesc( i ).pszActivityName() );
+		}
+		for ( int i = 0; i < pStudioHdr->GetNumAttachments(); i++ )
+		{
+			model.names[CStudioHdr::CNameToIndexMapping::NAME_TABLE_ATTACHMENT].AddToTail( pStudioHdr->pAttachment( i ).pszName() );
+		}
+		for ( int i = 0; i < pStudioHdr->GetNumPoseParameters(); i++ )
+		{
+			model.names[CStudioHdr::CNameToIndexMapping::NAME_TABLE_POSEPARAM].AddToTail( pStudioHdr->pPoseParameter( i ).pszName() );
+		}
+		for ( int t = 0; t < CStudioHdr::CNameToIndexMapping::NAME_TABLE_COUNT; t++ )
+		{
+			model.names[t].AddToTail( "__not_in_this_model__" );
+		}
+
+		nMostSequences = MAX( nMostSequences, pStudioHdr->GetNumSeq() );
+	}
+
+	if ( models.Count() == 0 )
+	{
+		Msg( "No animating entities with a model in the map.\n" );
+		return;
+	}
+
+	for ( int t = 0; t < CStudioHdr::CNameToIndexMapping::NAME_TABLE_COUNT; t++ )
+	{
+		// the index has to find what the linear search found, including for repeated names
+		int nMismatches = 0;
+		FOR_EACH_VEC( models, m )
+		{
+			FOR_EACH_VEC( models[m].names[t], n )
+			{
+				const char *pszName = models[m].names[t][n];
+				if ( LookupNameLinear( models[m].pStudioHdr, t, pszName ) != LookupNameIndexed( models[m].pStudioHdr, t, pszName ) )
+				{
+					++nMismatches;
+				}
+			}
+		}
+
+		float flMs[2];
+		int64 nLookups = 0;
+		for ( int mode = 0; mode < 2; mode++ )
+		{
+			int nChecksum = 0;
+			nLookups = 0;
+			CFastTimer timer;
+			timer.Start();
+			for ( int pass = 0; pass < nPasses; pass++ )
+			{
+				FOR_EACH_VEC( models, m )
+				{
+					FOR_EACH_VEC( models[m].names[t], n )
+					{
+						const char *pszName = models[m].names[t][n];
+						nChecksum += mode ? LookupNameIndexed( models[m].pStudioHdr, t, pszName ) : LookupNameLinear( models[m].pStudioHdr, t, pszName );
+						++nLookups;
+					}
+				}
+			}
+			timer.End();
+
+			flMs[mode] = timer.GetDuration().GetMillisecondsF();
+			if ( nChecksum == 0x7fffffff )
+			{
+				Msg( "\n" ); // keep the lookups from being optimized away
+			}
+		}
+
+		Msg( "%-16s %lld lookups: linear %.2f ms, indexed %.2f ms, %.1fx, %d mismatches\n", s_pTableNames[t], nLookups, flMs[0], flMs[1],
+			( flMs[1] > 0.0f ) ? flMs[0] / flMs[1] : 0.0f, nMismatches );
+	}
+
+	Msg( "%d models (most sequences %d), %d passes\n", models.Count(), nMostSequences, nPasses );
+}
+
 //=========================================================
 //=========================================================
 bool CBaseAnimating::HasPoseParameter( int iSequence, const char *szName )
@@ -1860,6 +2020,13 @@ void CBaseAnimating::BuildMatricesWithBoneMerge(
 
 ConVar sv_pvsskipanimation( "sv_pvsskipanimation", "1", FCVAR_ARCHIVE, "Skips SetupBones when npc's are outside the PVS" );
 ConVar ai_setupbones_debug( "ai_setupbones_debug", "0", 0, "Shows that bones that are setup every think" );
+ConVar sv_bonecache_shared( "sv_bonecache_shared", "1", 0, "Reuse the bones set up for an entity earlier in the tick when its animation state is the same" );
+ConVar sv_bonecache_hitboxmask( "sv_bonecache_hitboxmask", "1", 0, "Only set up the bones used by hitboxes for hitbox traces and bounds" );
+
+static CInterlockedInt s_nBoneCacheHits;		// the entity's bone cache was still valid
+static CInterlockedInt s_nSharedBoneCacheHits;	// reused the bones of the same state earlier in the tick
+static CInterlockedInt s_nBoneSetups;
+static CInterlockedInt s_nBonesEvaluated;
 
 
 
@@ -1905,6 +2072,17 @@ void CBaseAnimating::SetupBones( matrix3x4_t *pBoneToWorld, int boneMask )
 
 	AddEFlags( EFL_SETTING_UP_BONES );
 
+	++s_nBoneSetups;
+	int nBonesEvaluated = 0;
+	for ( int i = 0; i < pStudioHdr->numbones(); i++ )
+	{
+		if ( pStudioHdr->boneFlags( i ) & boneMask )
+		{
+			nBonesEvaluated++;
+		}
+	}
+	s_nBonesEvaluated += nBonesEvaluated;
+
 	Vector pos[MAXSTUDIOBONES];
 	Quaternion q[MAXSTUDIOBONES];
 
@@ -1983,6 +2161,302 @@ void CBaseAnimating::SetupBones( matrix3x4_t *pBoneToWorld, int boneMask )
 	RemoveEFlags( EFL_SETTING_UP_BONES );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: hash everything SetupBones() reads, so that bones set up for the 
+//			same state earlier in the tick can be reused.  That includes the
+//			time: autoplay sequences are evaluated at curtime, not the cycle.
+// Output : false if the bones can't be reused
+//-----------------------------------------------------------------------------
+bool CBaseAnimating::HashBoneSetup( CRC32_t *pCRC )
+{
+	// IK traces against the world, and bone merging reads the bones of the parent
+	if ( m_pIk || dynamic_cast< CBaseAnimating* >( GetMoveParent() ) )
+		return false;
+
+	const model_t *pModel = GetModel();
+	int state[2] = { GetSequence(), CanSkipAnimation() };
+	float flState[4] = { GetCycle(), GetModelScale(), m_flEstIkOffset, gpGlobals->curtime };
+	Vector vecOrigin = GetAbsOrigin();
+	QAngle angAngles = GetAbsAngles();
+
+	CRC32_ProcessBuffer( pCRC, &pModel, sizeof( pModel ) );
+	CRC32_ProcessBuffer( pCRC, state, sizeof( state ) );
+	CRC32_ProcessBuffer( pCRC, flState, sizeof( flState ) );
+	CRC32_ProcessBuffer( pCRC, &vecOrigin, sizeof( vecOrigin ) );
+	CRC32_ProcessBuffer( pCRC, &angAngles, sizeof( angAngles ) );
+	CRC32_ProcessBuffer( pCRC, GetPoseParameterArray(), NUM_POSEPAREMETERS * sizeof( float ) );
+	CRC32_ProcessBuffer( pCRC, GetEncodedControllerArray(), NUM_BONECTRLS * sizeof( float ) );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: time CBoneSetup::AccumulatePose() over every sequence of the models
+//			of the animating entities in the map, with anim_simdbones off and on
+//-----------------------------------------------------------------------------
+static void AccumulateAllPoses( CUtlVector< CBaseAnimating * > &models, Vector *pos, Quaternion *q, int64 *pBones, CUtlVector< float > *pResults )
+{
+	static const float s_cycles[] = { 0.0f, 0.37f, 0.71f };
+
+	FOR_EACH_VEC( models, m )
+	{
+		CStudioHdr *pStudioHdr = models[m]->GetModelPtr();
+		IBoneSetup boneSetup( pStudioHdr, BONE_USED_BY_ANYTHING, models[m]->GetPoseParameterArray() );
+
+		for ( int iSequence = 0; iSequence < pStudioHdr->GetNumSeq(); iSequence++ )
+		{
+			for ( int c = 0; c < ARRAYSIZE( s_cycles ); c++ )
+			{
+				boneSetup.InitPose( pos, q );
+				boneSetup.AccumulatePose( pos, q, iSequence, s_cycles[c], 1.0f, gpGlobals->curtime, NULL );
+				*pBones += pStudioHdr->numbones();
+
+				if ( pResults )
+				{
+					for ( int i = 0; i < pStudioHdr->numbones(); i++ )
+					{
+						pResults->AddToTail( q[i].x );	pResults->AddToTail( q[i].y );	pResults->AddToTail( q[i].z );	pResults->AddToTail( q[i].w );
+						pResults->AddToTail( pos[i].x );	pResults->AddToTail( pos[i].y );	pResults->AddToTail( pos[i].z );
+					}
+				}
+			}
+		}
+	}
+}
+
+CON_COMMAND_F( anim_bench_accumulatepose, "Time AccumulatePose() over every sequence of the models in the map with anim_simdbones 0 and 1, and report bones per microsecond. Arguments: [passes]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nPasses = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 4;
+
+	// one entity per model
+	CUtlVector< CBaseAnimating * > models;
+	int nSequences = 0;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		CStudioHdr *pStudioHdr = pAnimating ? pAnimating->GetModelPtr() : NULL;
+		if ( !pStudioHdr || pStudioHdr->numbones() == 0 )
+			continue;
+
+		bool bSeen = false;
+		FOR_EACH_VEC( models, m )
+		{
+			if ( models[m]->GetModelPtr()->GetRenderHdr() == pStudioHdr->GetRenderHdr() )
+			{
+				bSeen = true;
+				break;
+			}
+		}
+
+		if ( !bSeen )
+		{
+			models.AddToTail( pAnimating );
+			nSequences += pStudioHdr->GetNumSeq();
+		}
+	}
+
+	if ( models.Count() == 0 )
+	{
+		Msg( "No animating entities with a model in the map.\n" );
+		return;
+	}
+
+	ConVarRef anim_simdbones( "anim_simdbones" );
+	bool bWasEnabled = anim_simdbones.GetBool();
+
+	Vector pos[MAXSTUDIOBONES];
+	Quaternion q[MAXSTUDIOBONES];
+
+	// compare the poses first
+	CUtlVector< float > results[2];
+	int64 nBones = 0;
+	for ( int mode = 0; mode < 2; mode++ )
+	{
+		anim_simdbones.SetValue( mode );
+		AccumulateAllPoses( models, pos, q, &nBones, &results[mode] );
+	}
+
+	float flMaxError = 0.0f;
+	for ( int i = 0; i < results[0].Count() && i < results[1].Count(); i++ )
+	{
+		flMaxError = MAX( flMaxError, fabs( results[0][i] - results[1][i] ) );
+	}
+
+	float flBonesPerUs[2];
+	for ( int mode = 0; mode < 2; mode++ )
+	{
+		anim_simdbones.SetValue( mode );
+
+		nBones = 0;
+		CFastTimer timer;
+		timer.Start();
+		for ( int pass = 0; pass < nPasses; pass++ )
+		{
+			AccumulateAllPoses( models, pos, q, &nBones, NULL );
+		}
+		timer.End();
+
+		float flUs = timer.GetDuration().GetMicrosecondsF();
+		flBonesPerUs[mode] = ( flUs > 0.0f ) ? nBones / flUs : 0.0f;
+		Msg( "anim_simdbones %d: %lld bones in %.2f ms, %.2f bones/us\n", mode, nBones, flUs / 1000.0f, flBonesPerUs[mode] );
+	}
+
+	anim_simdbones.SetValue( bWasEnabled );
+
+	Msg( "%d models, %d sequences, %d passes: %.2fx, largest difference %g\n", models.Count(), nSequences, nPasses, 
+		( flBonesPerUs[0] > 0.0f ) ? flBonesPerUs[1] / flBonesPerUs[0] : 0.0f, flMaxError );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Solve the IK chains of each model to targets around its feet
+//-----------------------------------------------------------------------------
+struct ikbenchmodel_t
+{
+	CUtlVector< mstudioikchain_t * > chains;
+	CUtlVector< matrix3x4_t > bones;
+};
+
+static void SolveAllIKChains( CUtlVector< ikbenchmodel_t > &models, int nTargets, int64 *pChains, CUtlVector< float > *pResults )
+{
+	matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+	Vector targets[32];
+	bool solved[32];
+
+	FOR_EACH_VEC( models, m )
+	{
+		ikbenchmodel_t &model = models[m];
+		int nChains = model.chains.Count();
+
+		for ( int t = 0; t < nTargets; t++ )
+		{
+			memcpy( boneToWorld, model.bones.Base(), model.bones.Count() * sizeof(matrix3x4_t) );
+
+			// raise and pull in the feet a little further for every target
+			float flFraction = (float)t / nTargets;
+			for ( int c = 0; c < nChains; c++ )
+			{
+				Vector vecThigh, vecFoot;
+				MatrixPosition( boneToWorld[ model.chains[c]->pLink( 0 )->bone ], vecThigh );
+				MatrixPosition( boneToWorld[ model.chains[c]->pLink( 2 )->bone ], vecFoot );
+				targets[c] = vecFoot + ( vecThigh - vecFoot ) * ( 0.6f * flFraction ) + Vector( 0, 0, 4.0f * flFraction );
+			}
+
+			Studio_SolveIKChains( nChains, model.chains.Base(), targets, boneToWorld, solved );
+			*pChains += nChains;
+
+			if ( pResults )
+			{
+				for ( int c = 0; c < nChains; c++ )
+				{
+					pResults->AddToTail( solved[c] ? 1.0f : 0.0f );
+					for ( int k = 0; k < 3; k++ )
+					{
+						const float *pMatrix = boneToWorld[ model.chains[c]->pLink( k )->bone ].Base();
+						pResults->AddMultipleToTail( 12, pMatrix );
+					}
+				}
+			}
+		}
+	}
+}
+
+CON_COMMAND_F( ik_bench_solve, "Time solving the IK chains of the models in the map with anim_simdik 0 and 1, and report chains per millisecond. Arguments: [passes]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nPasses = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 16;
+	const int nTargets = 64;
+
+	// one entity per model with IK chains, posed as it is now
+	CUtlVector< ikbenchmodel_t > models;
+	CUtlVector< const studiohdr_t * > seen;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		CStudioHdr *pStudioHdr = pAnimating ? pAnimating->GetModelPtr() : NULL;
+		if ( !pStudioHdr || pStudioHdr->numikchains() == 0 || pStudioHdr->numikchains() > 32 )
+			continue;
+
+		if ( seen.Find( pStudioHdr->GetRenderHdr() ) != seen.InvalidIndex() )
+			continue;
+		seen.AddToTail( pStudioHdr->GetRenderHdr() );
+
+		// Studio_SolveIKChains() needs chains that don't share bones
+		CBoneBitList chainBones;
+		bool bSharedBones = false;
+		for ( int i = 0; i < pStudioHdr->numikchains(); i++ )
+		{
+			for ( int k = 0; k < 3; k++ )
+			{
+				int bone = pStudioHdr->pIKChain( i )->pLink( k )->bone;
+				bSharedBones = bSharedBones || chainBones.IsBoneMarked( bone );
+				chainBones.MarkBone( bone );
+			}
+		}
+		if ( bSharedBones )
+			continue;
+
+		ikbenchmodel_t &model = models[ models.AddToTail() ];
+		model.bones.SetCount( pStudioHdr->numbones() );
+		pAnimating->SetupBones( model.bones.Base(), BONE_USED_BY_ANYTHING );
+		for ( int i = 0; i < pStudioHdr->numikchains(); i++ )
+		{
+			model.chains.AddToTail( pStudioHdr->pIKChain( i ) );
+		}
+	}
+
+	if ( models.Count() == 0 )
+	{
+		Msg( "No animating entities with IK chains in the map.\n" );
+		return;
+	}
+
+	ConVarRef anim_simdik( "anim_simdik" );
+	bool bWasEnabled = anim_simdik.GetBool();
+
+	// compare the solutions first
+	CUtlVector< float > results[2];
+	int64 nChains = 0;
+	for ( int mode = 0; mode < 2; mode++ )
+	{
+		anim_simdik.SetValue( mode );
+		SolveAllIKChains( models, nTargets, &nChains, &results[mode] );
+	}
+
+	float flMaxError = 0.0f;
+	for ( int i = 0; i < results[0].Count() && i < results[1].Count(); i++ )
+	{
+		flMaxError = MAX( flMaxError, fabs( results[0][i] - results[1][i] ) );
+	}
+
+	float flChainsPerMs[2];
+	for ( int mode = 0; mode < 2; mode++ )
+	{
+		anim_simdik.SetValue( mode );
+
+		nChains = 0;
+		CFastTimer timer;
+		timer.Start();
+		for ( int pass = 0; pass < nPasses; pass++ )
+		{
+			SolveAllIKChains( models, nTargets, &nChains, NULL );
+		}
+		timer.End();
+
+		float flMs = timer.GetDuration().GetMillisecondsF();
+		flChainsPerMs[mode] = ( flMs > 0.0f ) ? nChains / flMs : 0.0f;
+		Msg( "anim_simdik %d: %lld chains in %.2f ms, %.0f chains/ms\n", mode, nChains, flMs, flChainsPerMs[mode] );
+	}
+
+	anim_simdik.SetValue( bWasEnabled );
+
+	Msg( "%d models, %d passes: %.2fx, largest difference %g\n", models.Count(), nPasses, 
+		( flChainsPerMs[0] > 0.0f ) ? flChainsPerMs[1] / flChainsPerMs[0] : 0.0f, flMaxError );
+}
+
 //=========================================================
 //=========================================================
 int CBaseAnimating::GetNumBones ( void )
@@ -2743,32 +3217,132 @@ void CBaseAnimating::UnlockStudioHdr()
 	}
 }
 
+//-----------------------------------------------------------------------------
+// The bones set up this tick, by entity and animation state, so an entity that
+// is moved back to a state it was in earlier in the tick (lag compensation 
+// restoring a player, say) doesn't set up the same bones again.
+//-----------------------------------------------------------------------------
+struct sharedbonesetup_t
+{
+	int		hEntity;
+	int		boneMask;
+	int		iFirstBone;		// into s_SharedBones
+	int		nBones;
+};
+
+static CUtlMap< CRC32_t, sharedbonesetup_t > s_SharedBoneSetups( DefLessFunc( CRC32_t ) );
+static CUtlVector< matrix3x4_t > s_SharedBones;
+static int s_nSharedBoneSetupTick = -1;
+static CThreadFastMutex s_SharedBoneSetupMutex;
+
+static void StartSharedBoneSetupTick()
+{
+	if ( s_nSharedBoneSetupTick != gpGlobals->tickcount )
+	{
+		s_nSharedBoneSetupTick = gpGlobals->tickcount;
+		s_SharedBoneSetups.RemoveAll();
+		s_SharedBones.RemoveAll();
+	}
+}
+
+static bool GetSharedBones( CRC32_t crc, int hEntity, int boneMask, matrix3x4_t *pBoneToWorld, int nBones )
+{
+	AUTO_LOCK( s_SharedBoneSetupMutex );
+	StartSharedBoneSetupTick();
+
+	unsigned short i = s_SharedBoneSetups.Find( crc );
+	if ( i == s_SharedBoneSetups.InvalidIndex() )
+		return false;
+
+	const sharedbonesetup_t &setup = s_SharedBoneSetups[i];
+	if ( setup.hEntity != hEntity || ( setup.boneMask & boneMask ) != boneMask || setup.nBones != nBones )
+		return false;
+
+	memcpy( pBoneToWorld, s_SharedBones.Base() + setup.iFirstBone, nBones * sizeof( matrix3x4_t ) );
+	return true;
+}
+
+static void AddSharedBones( CRC32_t crc, int hEntity, int boneMask, const matrix3x4_t *pBoneToWorld, int nBones )
+{
+	AUTO_LOCK( s_SharedBoneSetupMutex );
+	StartSharedBoneSetupTick();
+
+	sharedbonesetup_t setup;
+	setup.hEntity = hEntity;
+	setup.boneMask = boneMask;
+	setup.iFirstBone = s_SharedBones.AddMultipleToTail( nBones, pBoneToWorld );
+	setup.nBones = nBones;
+	s_SharedBoneSetups.InsertOrReplace( crc, setup );
+}
+
+CON_COMMAND( sv_bonecache_report, "Report the server bone cache hits and the bones set up. Arguments: [reset]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nHits = s_nBoneCacheHits;
+	int nSharedHits = s_nSharedBoneCacheHits;
+	int nSetups = s_nBoneSetups;
+	int nRequests = nHits + nSharedHits + nSetups;
+
+	Msg( "%d bone requests: %d cached (%.1f%%), %d shared within the tick (%.1f%%), %d set up\n", 
+		nRequests, nHits, nRequests ? 100.0f * nHits / nRequests : 0.0f, nSharedHits, nRequests ? 100.0f * nSharedHits / nRequests : 0.0f, nSetups );
+	Msg( "%d bones evaluated, %.1f per set up\n", (int)s_nBonesEvaluated, nSetups ? (float)s_nBonesEvaluated / nSetups : 0.0f );
+
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "reset" ) )
+	{
+		s_nBoneCacheHits = 0;
+		s_nSharedBoneCacheHits = 0;
+		s_nBoneSetups = 0;
+		s_nBonesEvaluated = 0;
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: return the index to the shared bone cache
 // Output :
 //-----------------------------------------------------------------------------
 CBoneCache *CBaseAnimating::GetBoneCache( void )
 {
-	CStudioHdr *pStudioHdr = GetModelPtr( );
-	Assert(pStudioHdr);
-
-	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
 	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
 
 	// TF queries these bones to position weapons when players are killed
 #if defined( TF_DLL )
 	boneMask |= BONE_USED_BY_BONE_MERGE;
 #endif
+	return GetBoneCache( boneMask );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: the bone cache for hitbox traces and bounds, which only need the 
+//			bones that hitboxes use (and their parents)
+//-----------------------------------------------------------------------------
+CBoneCache *CBaseAnimating::GetHitboxBoneCache( void )
+{
+	if ( !sv_bonecache_hitboxmask.GetBool() )
+		return GetBoneCache();
+
+	return GetBoneCache( BONE_USED_BY_HITBOX );
+}
+
+CBoneCache *CBaseAnimating::GetBoneCache( int boneMask )
+{
+	CStudioHdr *pStudioHdr = GetModelPtr( );
+	Assert(pStudioHdr);
+
+	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
+
 	if ( pcache )
 	{
 		if ( pcache->IsValid( gpGlobals->curtime ) && (pcache->m_boneMask & boneMask) == boneMask && pcache->m_timeValid <= gpGlobals->curtime)
 		{
 			// Msg("%s:%s:%s (%x:%x:%8.4f) cache\n", GetClassname(), GetDebugName(), STRING(GetModelName()), boneMask, pcache->m_boneMask, pcache->m_timeValid );
 			// in memory and still valid, use it!
+			++s_nBoneCacheHits;
 			return pcache;
 		}
-		// in memory, but missing some of the bone masks
-		if ( (pcache->m_boneMask & boneMask) != boneMask )
+		// in memory, but cached for a different set of bones
+		if ( pcache->m_boneMask != boneMask )
 		{
 			Studio_DestroyBoneCache( m_boneCacheHandle );
 			m_boneCacheHandle = 0;
@@ -2777,7 +3351,27 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 	}
 
 	matrix3x4_t bonetoworld[MAXSTUDIOBONES];
-	SetupBones( bonetoworld, boneMask );
+
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	int hEntity = GetRefEHandle().ToInt();
+	CRC32_ProcessBuffer( &crc, &hEntity, sizeof( hEntity ) );
+	bool bShared = sv_bonecache_shared.GetBool() && HashBoneSetup( &crc );
+	CRC32_Final( &crc );
+
+	if ( bShared && GetSharedBones( crc, hEntity, boneMask, bonetoworld, pStudioHdr->numbones() ) )
+	{
+		++s_nSharedBoneCacheHits;
+	}
+	else
+	{
+		SetupBones( bonetoworld, boneMask );
+
+		if ( bShared )
+		{
+			AddSharedBones( crc, hEntity, boneMask, bonetoworld, pStudioHdr->numbones() );
+		}
+	}
 
 	if ( pcache )
 	{
@@ -2846,7 +3440,7 @@ bool CBaseAnimating::TestHitboxes( const Ray_t &ray, unsigned int fContentsMask,
 	if ( !set || !set->numhitboxes )
 		return false;
 
-	CBoneCache *pcache = GetBoneCache( );
+	CBoneCache *pcache = GetHitboxBoneCache();
 
 	matrix3x4_t *hitboxbones[MAXSTUDIOBONES];
 	pcache->ReadCachedBonePointers( hitboxbones, pStudioHdr->numbones() );
@@ -3257,7 +3851,7 @@ bool CBaseAnimating::ComputeHitboxSurroundingBox( Vector *pVecWorldMins, Vector
 	if ( !set || !set->numhitboxes )
 		return false;
 
-	CBoneCache *pCache = GetBoneCache();
+	CBoneCache *pCache = GetHitboxBoneCache();
 
 	// Compute a box in world space that surrounds this entity
 	pVecWorldMins->Init( FLT_MAX, FLT_MAX, FLT_MAX );
@@ -3297,7 +3891,7 @@ bool CBaseAnimating::ComputeEntitySpaceHitboxSurroundingBox( Vector *pVecWorldMi
 	if ( !set || !set->numhitboxes )
 		return false;
 
-	CBoneCache *pCache = GetBoneCache();
+	CBoneCache *pCache = GetHitboxBoneCache();
 	matrix3x4_t *hitboxbones[MAXSTUDIOBONES];
 	pCache->ReadCachedBonePointers( hitboxbones, pStudioHdr->numbones() );
 
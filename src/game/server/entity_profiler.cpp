@@ -0,0 +1,590 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Attributes server frame time to entity classes and map regions.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cbase.h"
+#include "entity_profiler.h"
+#include "igamesystem.h"
+#include "filesystem.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlsymbol.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/generichash.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+// The rolling window is this many one-second buckets
+#define ENTITY_PROFILE_BUCKETS			16
+#define ENTITY_PROFILE_MAX_DEPTH		32
+
+// Past this many (map, classname, region) entries new keys are charged to one
+// "<other>" entry per map until entries age out of the window
+#define ENTITY_PROFILE_MAX_STATS		4096
+
+bool g_bEntityProfile = true;
+
+static void EntityProfileChanged( IConVar *pConVar, const char *pOldValue, float flOldValue )
+{
+	ConVarRef var( pConVar );
+	g_bEntityProfile = var.GetBool();
+}
+
+ConVar sv_entity_profile( "sv_entity_profile", "1", 0, "Attribute think, touch, physics and transmit time to entity classes and map regions (see sv_entity_profile_report).", EntityProfileChanged );
+ConVar sv_entity_profile_region_size( "sv_entity_profile_region_size", "1024", 0, "Size in world units of the map regions used by sv_entity_profile.", true, 64.0f, false, 0.0f );
+
+static const char *s_pCategoryNames[ENTITY_PROFILE_NUM_CATEGORIES] =
+{
+	"think",
+	"touch",
+	"physics",
+	"network",
+};
+
+
+//-----------------------------------------------------------------------------
+// Timing data
+//-----------------------------------------------------------------------------
+struct EntityProfileKey_t
+{
+	UtlSymId_t	m_MapName;
+	UtlSymId_t	m_Classname;
+	int			m_nRegion;
+};
+
+struct EntityProfileKeyHashFunctor
+{
+	unsigned int operator()( const EntityProfileKey_t &key ) const { return Hash8( &key ); }
+};
+
+struct EntityProfileKeyEqualFunctor
+{
+	bool operator()( const EntityProfileKey_t &lhs, const EntityProfileKey_t &rhs ) const
+	{
+		return lhs.m_MapName == rhs.m_MapName && lhs.m_Classname == rhs.m_Classname && lhs.m_nRegion == rhs.m_nRegion;
+	}
+};
+
+COMPILE_TIME_ASSERT( sizeof( EntityProfileKey_t ) == 8 );
+
+struct EntityProfileStats_t
+{
+	EntityProfileKey_t	m_Key;
+	uint64				m_Cycles[ENTITY_PROFILE_BUCKETS][ENTITY_PROFILE_NUM_CATEGORIES];
+	uint32				m_nCalls[ENTITY_PROFILE_BUCKETS][ENTITY_PROFILE_NUM_CATEGORIES];
+};
+
+struct EntityProfileFrames_t
+{
+	UtlSymId_t	m_MapName;
+	uint64		m_Cycles[ENTITY_PROFILE_BUCKETS];
+	uint64		m_MaxCycles[ENTITY_PROFILE_BUCKETS];
+	int			m_nFrames[ENTITY_PROFILE_BUCKETS];
+	int			m_nOverBudget[ENTITY_PROFILE_BUCKETS];
+};
+
+// Resolved key for an edict, refreshed once per bucket so the region follows the entity
+struct EntityProfileEdictCache_t
+{
+	CBaseEntity		*m_pEntity;
+	const char		*m_pClassname;
+	int				m_nBucketSerial;
+	int				m_iStats;
+};
+
+struct EntityProfileScopeFrame_t
+{
+	uint64	m_nStart;
+	uint64	m_nChildCycles;
+};
+
+
+class CEntityProfiler : public CAutoGameSystemPerFrame
+{
+public:
+	CEntityProfiler() : CAutoGameSystemPerFrame( "CEntityProfiler" ), m_Names( 0, 256, true )
+	{
+		m_nScopeDepth = 0;
+		m_iBucket = 0;
+		m_nBucketSerial = -1;
+		m_iFrames = -1;
+		m_nFrameStart = 0;
+		m_MapName = m_Names.AddString( "<none>" );
+		m_OtherName = m_Names.AddString( "<other>" );
+		ClearEdictCache();
+	}
+
+	virtual void LevelInitPreEntity()
+	{
+		ClearEdictCache();
+		m_MapName = m_Names.AddString( STRING( gpGlobals->mapname ) );
+		m_iFrames = FindOrAddFrames( m_MapName );
+	}
+
+	virtual void LevelShutdownPostEntity()
+	{
+		// Classnames come from the game string pool, which is about to be freed
+		ClearEdictCache();
+	}
+
+	virtual void FrameUpdatePreEntityThink()
+	{
+		AdvanceBucket();
+		m_nFrameStart = g_bEntityProfile ? Plat_Rdtsc() : 0;
+	}
+
+	virtual void FrameUpdatePostEntityThink()
+	{
+		if ( !m_nFrameStart || m_iFrames < 0 )
+			return;
+
+		uint64 nCycles = Plat_Rdtsc() - m_nFrameStart;
+		EntityProfileFrames_t &frames = m_Frames[m_iFrames];
+		frames.m_Cycles[m_iBucket] += nCycles;
+		frames.m_MaxCycles[m_iBucket] = MAX( frames.m_MaxCycles[m_iBucket], nCycles );
+		frames.m_nFrames[m_iBucket]++;
+		if ( CyclesToMS( nCycles ) > gpGlobals->interval_per_tick * 1000.0 )
+		{
+			frames.m_nOverBudget[m_iBucket]++;
+		}
+	}
+
+	void EnterScope()
+	{
+		Assert( ThreadInMainThread() );
+		if ( m_nScopeDepth < ENTITY_PROFILE_MAX_DEPTH )
+		{
+			EntityProfileScopeFrame_t &frame = m_ScopeStack[m_nScopeDepth];
+			frame.m_nChildCycles = 0;
+			frame.m_nStart = Plat_Rdtsc();
+		}
+		++m_nScopeDepth;
+	}
+
+	void ExitScope( CBaseEntity *pEntity, EntityProfileCategory_t category )
+	{
+		--m_nScopeDepth;
+		if ( m_nScopeDepth >= ENTITY_PROFILE_MAX_DEPTH )
+			return;
+
+		const EntityProfileScopeFrame_t &frame = m_ScopeStack[m_nScopeDepth];
+		uint64 nTotal = Plat_Rdtsc() - frame.m_nStart;
+		uint64 nSelf = ( nTotal > frame.m_nChildCycles ) ? nTotal - frame.m_nChildCycles : 0;
+		if ( m_nScopeDepth > 0 )
+		{
+			m_ScopeStack[m_nScopeDepth - 1].m_nChildCycles += nTotal;
+		}
+
+		int iStats = FindStats( pEntity );
+		m_Stats[iStats].m_Cycles[m_iBucket][category] += nSelf;
+		m_Stats[iStats].m_nCalls[m_iBucket][category]++;
+	}
+
+	void Report( int nCount );
+	void Dump( const char *pFilename );
+	void Reset();
+
+private:
+	static double CyclesToMS( uint64 nCycles )
+	{
+		CCycleCount count( nCycles );
+		return count.GetMillisecondsF();
+	}
+
+	void ClearEdictCache()
+	{
+		V_memset( m_EdictCache, 0, sizeof( m_EdictCache ) );
+	}
+
+	int RegionForEntity( CBaseEntity *pEntity )
+	{
+		float flSize = sv_entity_profile_region_size.GetFloat();
+		const Vector &vecOrigin = pEntity->GetAbsOrigin();
+		int x = (int)floor( vecOrigin.x / flSize );
+		int y = (int)floor( vecOrigin.y / flSize );
+		return ( ( x & 0xFFFF ) << 16 ) | ( y & 0xFFFF );
+	}
+
+	int FindOrAddStats( const char *pClassname, int nRegion )
+	{
+		EntityProfileKey_t key;
+		key.m_MapName = m_MapName;
+		key.m_Classname = m_Names.AddString( pClassname );
+		key.m_nRegion = nRegion;
+
+		UtlHashHandle_t h = m_StatsIndex.Find( key );
+		if ( h != m_StatsIndex.InvalidHandle() )
+			return m_StatsIndex[h];
+
+		if ( m_Stats.Count() >= ENTITY_PROFILE_MAX_STATS && key.m_Classname != m_OtherName )
+			return FindOrAddStats( "<other>", 0 );
+
+		int iStats = m_Stats.AddToTail();
+		V_memset( &m_Stats[iStats], 0, sizeof( EntityProfileStats_t ) );
+		m_Stats[iStats].m_Key = key;
+		m_StatsIndex.Insert( key, iStats );
+		return iStats;
+	}
+
+	int FindStats( CBaseEntity *pEntity )
+	{
+		const char *pClassname = pEntity->GetClassname();
+		int iEdict = pEntity->edict() ? pEntity->entindex() : -1;
+		if ( iEdict < 0 )
+			return FindOrAddStats( pClassname, RegionForEntity( pEntity ) );
+
+		EntityProfileEdictCache_t &cache = m_EdictCache[iEdict];
+		if ( cache.m_pEntity != pEntity || cache.m_pClassname != pClassname || cache.m_nBucketSerial != m_nBucketSerial )
+		{
+			cache.m_pEntity = pEntity;
+			cache.m_pClassname = pClassname;
+			cache.m_nBucketSerial = m_nBucketSerial;
+			cache.m_iStats = FindOrAddStats( pClassname, RegionForEntity( pEntity ) );
+		}
+		return cache.m_iStats;
+	}
+
+	int FindOrAddFrames( UtlSymId_t mapName )
+	{
+		for ( int i = 0; i < m_Frames.Count(); ++i )
+		{
+			if ( m_Frames[i].m_MapName == mapName )
+				return i;
+		}
+
+		int i = m_Frames.AddToTail();
+		V_memset( &m_Frames[i], 0, sizeof( EntityProfileFrames_t ) );
+		m_Frames[i].m_MapName = mapName;
+		return i;
+	}
+
+	void ClearBucket( int iBucket )
+	{
+		for ( int i = 0; i < m_Stats.Count(); ++i )
+		{
+			V_memset( m_Stats[i].m_Cycles[iBucket], 0, sizeof( m_Stats[i].m_Cycles[iBucket] ) );
+			V_memset( m_Stats[i].m_nCalls[iBucket], 0, sizeof( m_Stats[i].m_nCalls[iBucket] ) );
+		}
+		for ( int i = 0; i < m_Frames.Count(); ++i )
+		{
+			m_Frames[i].m_Cycles[iBucket] = 0;
+			m_Frames[i].m_MaxCycles[iBucket] = 0;
+			m_Frames[i].m_nFrames[iBucket] = 0;
+			m_Frames[i].m_nOverBudget[iBucket] = 0;
+		}
+	}
+
+	void AdvanceBucket()
+	{
+		int nSerial = gpGlobals->tickcount / MAX( TIME_TO_TICKS( 1.0f ), 1 );
+		if ( nSerial == m_nBucketSerial )
+			return;
+
+		// Clear every bucket we skipped over, at most the whole window
+		int nAdvance = ( m_nBucketSerial < 0 ) ? ENTITY_PROFILE_BUCKETS : MIN( abs( nSerial - m_nBucketSerial ), ENTITY_PROFILE_BUCKETS );
+		for ( int i = 1; i <= nAdvance; ++i )
+		{
+			ClearBucket( ( m_iBucket + i ) % ENTITY_PROFILE_BUCKETS );
+		}
+		m_iBucket = ( m_iBucket + nAdvance ) % ENTITY_PROFILE_BUCKETS;
+		m_nBucketSerial = nSerial;
+
+		PruneStats();
+	}
+
+	static bool HasCalls( const EntityProfileStats_t &stats )
+	{
+		for ( int iBucket = 0; iBucket < ENTITY_PROFILE_BUCKETS; ++iBucket )
+		{
+			for ( int c = 0; c < ENTITY_PROFILE_NUM_CATEGORIES; ++c )
+			{
+				if ( stats.m_nCalls[iBucket][c] )
+					return true;
+			}
+		}
+		return false;
+	}
+
+	static bool HasFrames( const EntityProfileFrames_t &frames )
+	{
+		for ( int iBucket = 0; iBucket < ENTITY_PROFILE_BUCKETS; ++iBucket )
+		{
+			if ( frames.m_nFrames[iBucket] )
+				return true;
+		}
+		return false;
+	}
+
+	// Drops entries that haven't been hit in the whole window, so entities
+	// wandering through new regions or maps changing don't grow the tables forever
+	void PruneStats()
+	{
+		int nKept = 0;
+		for ( int i = 0; i < m_Stats.Count(); ++i )
+		{
+			if ( !HasCalls( m_Stats[i] ) )
+				continue;
+			if ( nKept != i )
+			{
+				m_Stats[nKept] = m_Stats[i];
+			}
+			++nKept;
+		}
+
+		if ( nKept != m_Stats.Count() )
+		{
+			m_Stats.RemoveMultipleFromTail( m_Stats.Count() - nKept );
+			m_StatsIndex.RemoveAll();
+			for ( int i = 0; i < m_Stats.Count(); ++i )
+			{
+				m_StatsIndex.Insert( m_Stats[i].m_Key, i );
+			}
+			ClearEdictCache();
+		}
+
+		for ( int i = m_Frames.Count(); --i >= 0; )
+		{
+			if ( m_Frames[i].m_MapName != m_MapName && !HasFrames( m_Frames[i] ) )
+			{
+				m_Frames.Remove( i );
+			}
+		}
+		if ( m_iFrames >= 0 )
+		{
+			m_iFrames = FindOrAddFrames( m_MapName );
+		}
+	}
+
+	CUtlSymbolTable		m_Names;
+	UtlSymId_t			m_MapName;
+	UtlSymId_t			m_OtherName;
+
+	CUtlVector<EntityProfileStats_t>	m_Stats;
+	CUtlHashtable<EntityProfileKey_t, int, EntityProfileKeyHashFunctor, EntityProfileKeyEqualFunctor> m_StatsIndex;
+	CUtlVector<EntityProfileFrames_t>	m_Frames;
+	int					m_iFrames;
+	uint64				m_nFrameStart;
+
+	int					m_iBucket;
+	int					m_nBucketSerial;
+
+	EntityProfileScopeFrame_t	m_ScopeStack[ENTITY_PROFILE_MAX_DEPTH];
+	int					m_nScopeDepth;
+
+	EntityProfileEdictCache_t	m_EdictCache[MAX_EDICTS];
+};
+
+static CEntityProfiler g_EntityProfiler;
+
+
+void EntityProfile_EnterScope()
+{
+	g_EntityProfiler.EnterScope();
+}
+
+void EntityProfile_ExitScope( CBaseEntity *pEntity, EntityProfileCategory_t category )
+{
+	g_EntityProfiler.ExitScope( pEntity, category );
+}
+
+
+//-----------------------------------------------------------------------------
+// Output
+//-----------------------------------------------------------------------------
+struct EntityProfileTotal_t
+{
+	int		m_iStats;
+	uint64	m_Cycles[ENTITY_PROFILE_NUM_CATEGORIES];
+	uint64	m_nTotalCycles;
+	uint32	m_nCalls;
+};
+
+static int __cdecl SortProfileTotals( const EntityProfileTotal_t *pLeft, const EntityProfileTotal_t *pRight )
+{
+	if ( pLeft->m_nTotalCycles == pRight->m_nTotalCycles )
+		return 0;
+	return ( pLeft->m_nTotalCycles > pRight->m_nTotalCycles ) ? -1 : 1;
+}
+
+static void FormatRegion( int nRegion, char *pBuf, int nBufLen )
+{
+	V_snprintf( pBuf, nBufLen, "region(%d,%d)", (int)(short)( nRegion >> 16 ), (int)(short)( nRegion & 0xFFFF ) );
+}
+
+
+void CEntityProfiler::Report( int nCount )
+{
+	CUtlVector<EntityProfileTotal_t> totals;
+	for ( int i = 0; i < m_Stats.Count(); ++i )
+	{
+		EntityProfileTotal_t total;
+		V_memset( &total, 0, sizeof( total ) );
+		total.m_iStats = i;
+		for ( int iBucket = 0; iBucket < ENTITY_PROFILE_BUCKETS; ++iBucket )
+		{
+			for ( int c = 0; c < ENTITY_PROFILE_NUM_CATEGORIES; ++c )
+			{
+				total.m_Cycles[c] += m_Stats[i].m_Cycles[iBucket][c];
+				total.m_nCalls += m_Stats[i].m_nCalls[iBucket][c];
+			}
+		}
+		for ( int c = 0; c < ENTITY_PROFILE_NUM_CATEGORIES; ++c )
+		{
+			total.m_nTotalCycles += total.m_Cycles[c];
+		}
+		if ( total.m_nTotalCycles )
+		{
+			totals.AddToTail( total );
+		}
+	}
+	totals.Sort( SortProfileTotals );
+
+	for ( int i = 0; i < m_Frames.Count(); ++i )
+	{
+		const EntityProfileFrames_t &frames = m_Frames[i];
+		uint64 nCycles = 0, nMaxCycles = 0;
+		int nFrames = 0, nOverBudget = 0;
+		for ( int iBucket = 0; iBucket < ENTITY_PROFILE_BUCKETS; ++iBucket )
+		{
+			nCycles += frames.m_Cycles[iBucket];
+			nMaxCycles = MAX( nMaxCycles, frames.m_MaxCycles[iBucket] );
+			nFrames += frames.m_nFrames[iBucket];
+			nOverBudget += frames.m_nOverBudget[iBucket];
+		}
+		if ( !nFrames )
+			continue;
+
+		Msg( "%s: %d ticks in the last %d seconds, %.2f ms avg, %.2f ms max, %d over the %.2f ms budget\n",
+			m_Names.String( frames.m_MapName ), nFrames, ENTITY_PROFILE_BUCKETS, CyclesToMS( nCycles ) / nFrames,
+			CyclesToMS( nMaxCycles ), nOverBudget, gpGlobals->interval_per_tick * 1000.0f );
+	}
+
+	Msg( "%-32s %-20s %-20s %9s %9s %9s %9s %9s\n", "Class", "Map", "Region", "think", "touch", "physics", "network", "total" );
+	for ( int i = 0; i < totals.Count() && i < nCount; ++i )
+	{
+		const EntityProfileTotal_t &total = totals[i];
+		const EntityProfileKey_t &key = m_Stats[total.m_iStats].m_Key;
+
+		char region[64];
+		FormatRegion( key.m_nRegion, region, sizeof( region ) );
+		Msg( "%-32s %-20s %-20s %9.2f %9.2f %9.2f %9.2f %9.2f\n", m_Names.String( key.m_Classname ), m_Names.String( key.m_MapName ), region,
+			CyclesToMS( total.m_Cycles[ENTITY_PROFILE_THINK] ), CyclesToMS( total.m_Cycles[ENTITY_PROFILE_TOUCH] ),
+			CyclesToMS( total.m_Cycles[ENTITY_PROFILE_PHYSICS] ), CyclesToMS( total.m_Cycles[ENTITY_PROFILE_NETWORK] ),
+			CyclesToMS( total.m_nTotalCycles ) );
+	}
+	Msg( "(ms summed over the window)\n" );
+}
+
+
+void CEntityProfiler::Dump( const char *pFilename )
+{
+	FileHandle_t hFile = g_pFullFileSystem->Open( pFilename, "w", "MOD" );
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Warning( "sv_entity_profile_dump: couldn't open %s\n", pFilename );
+		return;
+	}
+
+	CUtlVector<uint64> attributed;
+	attributed.SetCount( m_Frames.Count() );
+	for ( int i = 0; i < attributed.Count(); ++i )
+	{
+		attributed[i] = 0;
+	}
+
+	// Folded stacks: map;category;classname;region <microseconds>
+	int nLines = 0;
+	for ( int i = 0; i < m_Stats.Count(); ++i )
+	{
+		const EntityProfileStats_t &stats = m_Stats[i];
+		int iFrames = FindOrAddFrames( stats.m_Key.m_MapName );
+		if ( iFrames >= attributed.Count() )
+		{
+			attributed.AddToTail( 0 );
+		}
+
+		char region[64];
+		FormatRegion( stats.m_Key.m_nRegion, region, sizeof( region ) );
+
+		for ( int c = 0; c < ENTITY_PROFILE_NUM_CATEGORIES; ++c )
+		{
+			uint64 nCycles = 0;
+			for ( int iBucket = 0; iBucket < ENTITY_PROFILE_BUCKETS; ++iBucket )
+			{
+				nCycles += stats.m_Cycles[iBucket][c];
+			}
+			attributed[iFrames] += nCycles;
+
+			int64 nMicroseconds = (int64)( CyclesToMS( nCycles ) * 1000.0 );
+			if ( nMicroseconds <= 0 )
+				continue;
+
+			g_pFullFileSystem->FPrintf( hFile, "%s;%s;%s;%s %lld\n", m_Names.String( stats.m_Key.m_MapName ), s_pCategoryNames[c],
+				m_Names.String( stats.m_Key.m_Classname ), region, nMicroseconds );
+			++nLines;
+		}
+	}
+
+	// Whatever the frame spent outside entity code
+	for ( int i = 0; i < m_Frames.Count(); ++i )
+	{
+		uint64 nCycles = 0;
+		for ( int iBucket = 0; iBucket < ENTITY_PROFILE_BUCKETS; ++iBucket )
+		{
+			nCycles += m_Frames[i].m_Cycles[iBucket];
+		}
+		if ( nCycles <= attributed[i] )
+			continue;
+
+		int64 nMicroseconds = (int64)( CyclesToMS( nCycles - attributed[i] ) * 1000.0 );
+		if ( nMicroseconds > 0 )
+		{
+			g_pFullFileSystem->FPrintf( hFile, "%s;other %lld\n", m_Names.String( m_Frames[i].m_MapName ), nMicroseconds );
+			++nLines;
+		}
+	}
+
+	g_pFullFileSystem->Close( hFile );
+	Msg( "Wrote %d stacks to %s\n", nLines, pFilename );
+}
+
+
+void CEntityProfiler::Reset()
+{
+	m_Stats.RemoveAll();
+	m_StatsIndex.RemoveAll();
+	for ( int i = 0; i < ENTITY_PROFILE_BUCKETS; ++i )
+	{
+		ClearBucket( i );
+	}
+	ClearEdictCache();
+}
+
+
+CON_COMMAND( sv_entity_profile_report, "Print the entity classes that used the most server time over the last few seconds. Usage: sv_entity_profile_report [count]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_EntityProfiler.Report( ( args.ArgC() > 1 ) ? atoi( args[1] ) : 20 );
+}
+
+CON_COMMAND( sv_entity_profile_dump, "Write entity profile data as folded stacks for flamegraph.pl. Usage: sv_entity_profile_dump [filename]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_EntityProfiler.Dump( ( args.ArgC() > 1 ) ? args[1] : "entity_profile.txt" );
+}
+
+CON_COMMAND( sv_entity_profile_reset, "Clear entity profile data." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_EntityProfiler.Reset();
+}
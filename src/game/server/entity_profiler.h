@@ -0,0 +1,74 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Attributes server frame time to entity classes and map regions.
+//
+//			VPROF groups time by budget group; this answers which entity
+//			classes (and where on the map) that time went to. Think, touch,
+//			physics and transmit checks are timed with rdtsc, self time is
+//			summed per (map, category, classname, region) over a rolling
+//			window, and sv_entity_profile_dump writes it out as folded
+//			stacks that flamegraph.pl can render.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef ENTITY_PROFILER_H
+#define ENTITY_PROFILER_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+class CBaseEntity;
+
+enum EntityProfileCategory_t
+{
+	ENTITY_PROFILE_THINK = 0,
+	ENTITY_PROFILE_TOUCH,
+	ENTITY_PROFILE_PHYSICS,
+	ENTITY_PROFILE_NETWORK,
+
+	ENTITY_PROFILE_NUM_CATEGORIES
+};
+
+// Set by sv_entity_profile
+extern bool g_bEntityProfile;
+
+void EntityProfile_EnterScope();
+void EntityProfile_ExitScope( CBaseEntity *pEntity, EntityProfileCategory_t category );
+
+
+//-----------------------------------------------------------------------------
+// Times the enclosing block. Time spent in nested scopes is charged to the
+// nested entity, not this one.
+//-----------------------------------------------------------------------------
+class CEntityProfileScope
+{
+public:
+	CEntityProfileScope( CBaseEntity *pEntity, EntityProfileCategory_t category )
+	{
+		m_pEntity = g_bEntityProfile ? pEntity : NULL;
+		m_Category = category;
+		if ( m_pEntity )
+		{
+			EntityProfile_EnterScope();
+		}
+	}
+
+	~CEntityProfileScope()
+	{
+		if ( m_pEntity )
+		{
+			EntityProfile_ExitScope( m_pEntity, m_Category );
+		}
+	}
+
+private:
+	CBaseEntity				*m_pEntity;
+	EntityProfileCategory_t	m_Category;
+};
+
+#define ENTITY_PROFILE_SCOPE( pEntity, category )	CEntityProfileScope _entityProfileScope( pEntity, category )
+
+
+#endif // ENTITY_PROFILER_H
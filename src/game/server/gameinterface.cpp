@@ -90,6 +90,8 @@
 #include "serverbenchmark_base.h"
 #include "querycache.h"
 #include "player_voice_listener.h"
+#include "entity_profiler.h"
+#include "bone_setup.h"
 
 #ifdef TF_DLL
 #include "gc_clientsystem.h"
@@ -1407,6 +1409,9 @@ void CServerGameDLL::LevelShutdown( void )
 	g_pParticleSystemMgr->UncacheAllParticleSystems();
 	g_pParticleSystemMgr->RecreateDictionary();
 
+	Studio_FlushDecodedAnimations();
+	CStudioHdr::CNameToIndexMapping::ResetMappings();
+
 	g_nCurrentChapterIndex = -1;
 
 #ifndef _XBOX
@@ -2557,7 +2562,10 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 		if ( nFlags == FL_EDICT_FULLCHECK )
 		{
 			// do a full ShouldTransmit() check, may return FL_EDICT_CHECKPVS
-			nFlags = pEnt->ShouldTransmit( pInfo );
+			{
+				ENTITY_PROFILE_SCOPE( pEnt, ENTITY_PROFILE_NETWORK );
+				nFlags = pEnt->ShouldTransmit( pInfo );
+			}
 
 			Assert( !(nFlags & FL_EDICT_FULLCHECK) );
 
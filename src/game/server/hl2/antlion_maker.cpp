@@ -1252,6 +1252,8 @@ void CAntlionTemplateMaker::BlockedCheckFunc( void )
 
 	if ( CAI_HintManager::FindAllHints( vec3_origin, hintCriteria, &hintList ) > 0 )
 	{
+		// Test every burrow point in one partition walk
+		CEntityBatchQuery batch;
 		for ( int i = 0; i < hintList.Count(); i++ )
 		{
 			CAI_Hint *pNode = hintList[i];
@@ -1260,21 +1262,26 @@ void CAntlionTemplateMaker::BlockedCheckFunc( void )
 			{
 				Vector vHintPos;
 				pNode->GetPosition( AI_GetSinglePlayer(), &vHintPos );
+				batch.AddBox( vHintPos + NAI_Hull::Mins( HULL_MEDIUM ), vHintPos + NAI_Hull::Maxs( HULL_MEDIUM ) );
+			}
+		}
+		batch.Execute();
 
-				CBaseEntity*	pList[20];
-				int count = UTIL_EntitiesInBox( pList, 20, vHintPos + NAI_Hull::Mins( HULL_MEDIUM ), vHintPos + NAI_Hull::Maxs( HULL_MEDIUM ), 0 );
+		for ( int iQuery = 0; iQuery < batch.QueryCount(); iQuery++ )
+		{
+			CBaseEntity * const *pList = batch.GetResults( iQuery );
+			int count = batch.GetResultCount( iQuery );
 
-				//Iterate over all the possible targets
-				for ( int i = 0; i < count; i++ )
-				{
-					if ( pList[i]->GetMoveType() != MOVETYPE_VPHYSICS )
-						continue;
+			//Iterate over all the possible targets
+			for ( int i = 0; i < count; i++ )
+			{
+				if ( pList[i]->GetMoveType() != MOVETYPE_VPHYSICS )
+					continue;
 
-					if ( PhysGetEntityMass( pList[i] ) > ANTLION_MAKER_BLOCKED_MASS )
-					{
-						iBlocked++;
-						break;
-					}
+				if ( PhysGetEntityMass( pList[i] ) > ANTLION_MAKER_BLOCKED_MASS )
+				{
+					iBlocked++;
+					break;
 				}
 			}
 		}
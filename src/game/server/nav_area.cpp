@@ -14,11 +14,14 @@
 #include "tier0/vprof.h"
 #include "tier0/tslist.h"
 #include "tier1/utlhash.h"
+#include "bitvec.h"
 #include "vstdlib/jobthread.h"
 
 #include "nav_mesh.h"
 #include "nav_node.h"
 #include "nav_pathfind.h"
+#include "nav_hierarchy.h"
+#include "nav_visibility.h"
 #include "nav_colors.h"
 #include "fmtstr.h"
 #include "props_shared.h"
@@ -47,6 +50,8 @@ unsigned int CNavArea::m_masterMarker = 1;
 CNavArea *CNavArea::m_openList = NULL;
 CNavArea *CNavArea::m_openListTail = NULL;
 
+CTHREADLOCALPTR( CNavSearchContext ) CNavSearchContext::s_active;
+
 bool CNavArea::m_isReset = false;
 uint32 CNavArea::s_nCurrVisTestCounter = 0;
 
@@ -766,10 +771,15 @@ void CNavArea::OnDestroyNotify( CNavArea *dead )
 		m_incomingConnect[ d ].FindAndRemove( con );
 	}
 
-	// remove all visibility info, since we're editing the mesh anyways
-	m_inheritVisibilityFrom.area = NULL;
-	m_potentiallyVisibleAreas.RemoveAll();
-	m_isInheritedFrom = false;
+	// visibility between the remaining areas doesn't change, we just need to forget the dead one
+	if ( m_inheritVisibilityFrom.area == dead )
+	{
+		FlattenVisibility();
+	}
+
+	AreaBindInfo info;
+	info.area = dead;
+	m_potentiallyVisibleAreas.FindAndRemove( info );
 }
 
 
@@ -807,6 +817,8 @@ void CNavArea::ConnectTo( CNavArea *area, NavDirType dir )
 	m_connect[ dir ].AddToTail( con );
 	m_incomingConnect[ dir ].FindAndRemove( con );
 
+	TheNavClusters.Invalidate();
+
 	NavDirType dirOpposite = OppositeDirection( dir );
 	con.area = this;
 	if ( area->m_connect[ dirOpposite ].Find( con ) == area->m_connect[ dirOpposite ].InvalidIndex() )
@@ -829,6 +841,8 @@ void CNavArea::ConnectTo( CNavLadder *ladder )
 
 	Disconnect( ladder ); // just in case
 
+	TheNavClusters.Invalidate();
+
 	if ( GetCenter().z > center )
 	{
 		AddLadderDown( ladder );
@@ -856,6 +870,7 @@ void CNavArea::Disconnect( CNavArea *area )
 		if ( index != m_connect[ dir ].InvalidIndex() )
 		{
 			m_connect[ dir ].Remove( index );
+			TheNavClusters.Invalidate();
 			if ( area->IsConnected( this, dirOpposite ) )
 			{
 				AddIncomingConnection( area, dir );
@@ -3552,6 +3567,390 @@ void CNavArea::ClearSearchLists( void )
 	m_openListTail = NULL;
 }
 
+
+//--------------------------------------------------------------------------------------------------------------
+CNavSearchContext::CNavSearchContext( void )
+{
+	m_search = 0;
+	m_blocked = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavSearchContext::IsBlocked( const CNavArea *area, int teamID, bool ignoreNavBlockers ) const
+{
+	if ( m_blocked )
+	{
+		unsigned int id = area->GetID();
+		return id < (unsigned int)m_blocked->GetNumBits() && m_blocked->IsBitSet( id );
+	}
+
+	return area->IsBlocked( teamID, ignoreNavBlockers );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+CNavSearchContext &CNavSearchContext::GetMainThreadContext( void )
+{
+	Assert( ThreadInMainThread() );
+
+	static CNavSearchContext mainThreadContext;
+	return mainThreadContext;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Start a new search. Areas reached by the previous search become unreached.
+ */
+void CNavSearchContext::Begin( void )
+{
+	AssertMsg( GetActive() == NULL, "Nav searches can't nest on one thread" );
+	s_active = this;
+
+	++m_search;
+	if ( m_search == 0 )
+	{
+		// wrapped - forget every stamp so none of them can match again
+		for( int i=0; i<m_state.Count(); ++i )
+		{
+			m_state[i].search = 0;
+		}
+		m_search = 1;
+	}
+
+	m_heap.RemoveAll();
+	m_reached.RemoveAll();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::End( void )
+{
+	Assert( GetActive() == this );
+	s_active = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+CNavSearchContext::AreaState &CNavSearchContext::Reach( CNavArea *area )
+{
+	unsigned int id = area->GetID();
+	if ( id >= (unsigned int)m_state.Count() )
+	{
+		int oldCount = m_state.Count();
+		m_state.AddMultipleToTail( id + 1 - oldCount );
+		for( int i=oldCount; i<m_state.Count(); ++i )
+		{
+			m_state[i].search = 0;
+		}
+	}
+
+	AreaState &state = m_state[ id ];
+	if ( state.search != m_search )
+	{
+		state.search = m_search;
+		state.heapIndex = -1;
+		state.totalCost = 0.0f;
+		state.costSoFar = 0.0f;
+		state.pathLengthSoFar = 0.0f;
+		state.parent = NULL;
+		state.parentHow = NUM_TRAVERSE_TYPES;
+
+		m_reached.AddToTail( area );
+	}
+
+	return state;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::AddToOpenList( CNavArea *area )
+{
+	AreaState &state = Reach( area );
+
+	if ( state.heapIndex < 0 )
+	{
+		HeapEntry &entry = m_heap[ m_heap.AddToTail() ];
+		entry.totalCost = state.totalCost;
+		entry.id = area->GetID();
+		entry.area = area;
+
+		SiftUp( m_heap.Count() - 1 );
+		return;
+	}
+
+	// already open - costs only drop during a search, but don't rely on the functor for that
+	HeapEntry &entry = m_heap[ state.heapIndex ];
+	bool isCheaper = ( state.totalCost <= entry.totalCost );
+	entry.totalCost = state.totalCost;
+
+	if ( isCheaper )
+	{
+		SiftUp( state.heapIndex );
+	}
+	else
+	{
+		SiftDown( state.heapIndex );
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+CNavArea *CNavSearchContext::PopOpenList( void )
+{
+	if ( m_heap.Count() == 0 )
+		return NULL;
+
+	CNavArea *area = m_heap[0].area;
+	m_state[ m_heap[0].id ].heapIndex = -1;
+
+	int last = m_heap.Count() - 1;
+	if ( last > 0 )
+	{
+		m_heap[0] = m_heap[ last ];
+		m_state[ m_heap[0].id ].heapIndex = 0;
+	}
+	m_heap.RemoveMultipleFromTail( 1 );
+
+	if ( m_heap.Count() > 1 )
+	{
+		SiftDown( 0 );
+	}
+
+	return area;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::SiftUp( int index )
+{
+	HeapEntry entry = m_heap[ index ];
+
+	while( index > 0 )
+	{
+		int parent = ( index - 1 ) / 2;
+		if ( !IsBefore( entry, m_heap[ parent ] ) )
+			break;
+
+		m_heap[ index ] = m_heap[ parent ];
+		m_state[ m_heap[ index ].id ].heapIndex = index;
+		index = parent;
+	}
+
+	m_heap[ index ] = entry;
+	m_state[ entry.id ].heapIndex = index;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::SiftDown( int index )
+{
+	HeapEntry entry = m_heap[ index ];
+	int count = m_heap.Count();
+
+	while( true )
+	{
+		int child = 2 * index + 1;
+		if ( child >= count )
+			break;
+
+		if ( child + 1 < count && IsBefore( m_heap[ child + 1 ], m_heap[ child ] ) )
+			++child;
+
+		if ( !IsBefore( m_heap[ child ], entry ) )
+			break;
+
+		m_heap[ index ] = m_heap[ child ];
+		m_state[ m_heap[ index ].id ].heapIndex = index;
+		index = child;
+	}
+
+	m_heap[ index ] = entry;
+	m_state[ entry.id ].heapIndex = index;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Write the results of the last search into the areas, for callers that follow GetParent() after
+ * NavAreaBuildPath() returns. Closed areas are left marked, as ClearSearchLists() + AddToClosedList() did.
+ */
+void CNavSearchContext::CopyToAreas( void ) const
+{
+	Assert( GetActive() == NULL );
+
+	CNavArea::ClearSearchLists();
+
+	for( int i=0; i<m_reached.Count(); ++i )
+	{
+		CNavArea *area = m_reached[i];
+		const AreaState &state = m_state[ area->GetID() ];
+
+		area->SetParent( state.parent, state.parentHow );
+		area->SetTotalCost( state.totalCost );
+		area->SetCostSoFar( state.costSoFar );
+		area->SetPathLengthSoFar( state.pathLengthSoFar );
+
+		if ( state.heapIndex < 0 )
+		{
+			area->AddToClosedList();
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A batch of start/goal pairs searched by one job of nav_pathfind_benchmark, with its own search context
+ */
+struct NavPathfindBenchmarkBatch
+{
+	int first;
+	int count;
+	CCycleCount time;
+};
+
+static CUtlVector< CNavArea * > s_benchmarkStart;
+static CUtlVector< CNavArea * > s_benchmarkGoal;
+static CUtlVector< float > s_benchmarkCost;		// cost of the path found, or -1
+
+static void RunNavPathfindBenchmarkBatch( NavPathfindBenchmarkBatch &batch )
+{
+	CNavSearchContext search;
+	ShortestPathCost costFunc;
+
+	CFastTimer timer;
+	timer.Start();
+
+	for( int i=batch.first; i<batch.first + batch.count; ++i )
+	{
+		bool found = NavAreaBuildPath( search, s_benchmarkStart[i], s_benchmarkGoal[i], NULL, costFunc );
+		s_benchmarkCost[i] = found ? search.GetCostSoFar( s_benchmarkGoal[i] ) : -1.0f;
+	}
+
+	timer.End();
+	batch.time = timer.GetDuration();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Time NavAreaBuildPath() over every pair of areas (or a random sample of them), first on the main thread
+ * the way bots path today, then spread over the job threads with one search context per job.
+ */
+CON_COMMAND_F( nav_pathfind_benchmark, "Time shortest paths between random pairs of nav areas. Usage: nav_pathfind_benchmark [pair count (default 10000) | all] [seed]", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int areaCount = TheNavAreas.Count();
+	if ( areaCount < 2 )
+	{
+		Msg( "nav_pathfind_benchmark: no navigation mesh loaded\n" );
+		return;
+	}
+
+	int64 allPairs = (int64)areaCount * ( areaCount - 1 );
+
+	// every ordered pair is quadratic in the area count, so only do it when asked
+	int64 maxPairs = 10000;
+	if ( args.ArgC() > 1 )
+	{
+		maxPairs = !V_stricmp( args[1], "all" ) ? (int64)INT_MAX / 2 : MAX( atoi( args[1] ), 1 );
+	}
+	int pairCount = (int)MIN( maxPairs, allPairs );
+
+	s_benchmarkStart.SetCount( pairCount );
+	s_benchmarkGoal.SetCount( pairCount );
+	s_benchmarkCost.SetCount( pairCount );
+
+	if ( pairCount == allPairs )
+	{
+		int n = 0;
+		for( int i=0; i<areaCount; ++i )
+		{
+			for( int j=0; j<areaCount; ++j )
+			{
+				if ( i != j )
+				{
+					s_benchmarkStart[n] = TheNavAreas[i];
+					s_benchmarkGoal[n] = TheNavAreas[j];
+					++n;
+				}
+			}
+		}
+	}
+	else
+	{
+		CUniformRandomStream random;
+		random.SetSeed( ( args.ArgC() > 2 ) ? atoi( args[2] ) : 0 );
+
+		for( int n=0; n<pairCount; ++n )
+		{
+			int i = random.RandomInt( 0, areaCount - 1 );
+			int j = random.RandomInt( 0, areaCount - 2 );
+			s_benchmarkStart[n] = TheNavAreas[i];
+			s_benchmarkGoal[n] = TheNavAreas[ ( j >= i ) ? j + 1 : j ];
+		}
+	}
+
+	// main thread, results written back to the areas
+	CUtlVector< float > serialCost;
+	serialCost.SetCount( pairCount );
+
+	ShortestPathCost costFunc;
+	int found = 0;
+	CFastTimer timer;
+	timer.Start();
+	for( int n=0; n<pairCount; ++n )
+	{
+		if ( NavAreaBuildPath( s_benchmarkStart[n], s_benchmarkGoal[n], NULL, costFunc ) )
+		{
+			serialCost[n] = s_benchmarkGoal[n]->GetCostSoFar();
+			++found;
+		}
+		else
+		{
+			serialCost[n] = -1.0f;
+		}
+	}
+	timer.End();
+	double serialMS = timer.GetDuration().GetMillisecondsF();
+
+	// job threads, one context per batch
+	const int batchSize = 256;
+	CUtlVector< NavPathfindBenchmarkBatch > batches;
+	for( int n=0; n<pairCount; n += batchSize )
+	{
+		NavPathfindBenchmarkBatch &batch = batches[ batches.AddToTail() ];
+		batch.first = n;
+		batch.count = MIN( batchSize, pairCount - n );
+	}
+
+	timer.Start();
+	ParallelProcess( "nav_pathfind_benchmark", batches.Base(), batches.Count(), &RunNavPathfindBenchmarkBatch );
+	timer.End();
+	double parallelMS = timer.GetDuration().GetMillisecondsF();
+
+	CCycleCount jobTime;
+	for( int i=0; i<batches.Count(); ++i )
+	{
+		jobTime += batches[i].time;
+	}
+
+	int mismatches = 0;
+	for( int n=0; n<pairCount; ++n )
+	{
+		if ( serialCost[n] != s_benchmarkCost[n] )
+		{
+			++mismatches;
+		}
+	}
+
+	Msg( "nav_pathfind_benchmark: %d of %lld area pairs on %d areas, %d paths found\n", pairCount, allPairs, areaCount, found );
+	Msg( "  main thread: %.3f ms total, %.4f ms per path\n", serialMS, serialMS / pairCount );
+	Msg( "  job threads: %.3f ms wall, %.3f ms in jobs, %.4f ms per path\n", parallelMS, jobTime.GetMillisecondsF(), jobTime.GetMillisecondsF() / pairCount );
+	if ( mismatches )
+	{
+		Warning( "  %d paths differ between the main thread and job threads!\n", mismatches );
+	}
+
+	s_benchmarkStart.Purge();
+	s_benchmarkGoal.Purge();
+	s_benchmarkCost.Purge();
+}
+
 //--------------------------------------------------------------------------------------------------------------
 void CNavArea::SetCorner( NavCornerType corner, const Vector& newPosition )
 {
@@ -3603,6 +4002,9 @@ void CNavArea::SetCorner( NavCornerType corner, const Vector& newPosition )
 	}
 
 	CalcDebugID();
+
+	// the area index holds our extent
+	TheNavMesh->InvalidateAreaIndex();
 }
 
 
@@ -4562,6 +4964,9 @@ void CNavArea::Shift( const Vector &shift )
 	m_seCorner += shift;
 	
 	m_center += shift;
+
+	// the area index holds our extent
+	TheNavMesh->InvalidateAreaIndex();
 }
 
 
@@ -5518,6 +5923,65 @@ void CNavArea::ResetPotentiallyVisibleAreas()
 }
 
 
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Merge the list we inherit from into our own, so our list alone holds our visibility
+ */
+void CNavArea::FlattenVisibility( void )
+{
+	CNavArea *anchor = m_inheritVisibilityFrom.area;
+	if ( !anchor )
+		return;
+
+	m_inheritVisibilityFrom.area = NULL;
+
+	const CAreaBindInfoArray &inherited = anchor->m_potentiallyVisibleAreas;
+	for( int i=0; i<inherited.Count(); ++i )
+	{
+		// our own entries override the inherited ones
+		if ( m_potentiallyVisibleAreas.Find( inherited[i] ) == m_potentiallyVisibleAreas.InvalidIndex() )
+		{
+			m_potentiallyVisibleAreas.AddToTail( inherited[i] );
+		}
+	}
+
+	// with nothing left to override, explicit NOT_VISIBLE entries are no longer needed
+	for( int i=m_potentiallyVisibleAreas.Count()-1; i>=0; --i )
+	{
+		if ( m_potentiallyVisibleAreas[i].attributes == NOT_VISIBLE )
+		{
+			m_potentiallyVisibleAreas.FastRemove( i );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CNavArea::SetVisibilityEntry( CNavArea *area, unsigned char attributes )
+{
+	AreaBindInfo info;
+	info.area = area;
+	info.attributes = attributes;
+
+	int i = m_potentiallyVisibleAreas.Find( info );
+	if ( i == m_potentiallyVisibleAreas.InvalidIndex() )
+	{
+		if ( attributes != NOT_VISIBLE || m_inheritVisibilityFrom.area )
+		{
+			m_potentiallyVisibleAreas.AddToTail( info );
+		}
+	}
+	else if ( attributes != NOT_VISIBLE || m_inheritVisibilityFrom.area )
+	{
+		m_potentiallyVisibleAreas[i].attributes = attributes;
+	}
+	else
+	{
+		m_potentiallyVisibleAreas.Remove( i );
+	}
+}
+
+
 //--------------------------------------------------------------------------------------------------------
 /**
  * Determine visibility between areas.
@@ -5528,11 +5992,15 @@ void CNavArea::ResetPotentiallyVisibleAreas()
 CNavArea *g_pCurVisArea;
 CTSListWithFreeList< CNavArea::AreaBindInfo > g_ComputedVis;
 
-void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
+/**
+ * Trace visibility between g_pCurVisArea and the given area. visThisToOther is the entry for 'area' in
+ * g_pCurVisArea's list, and visOtherToThis the entry for g_pCurVisArea in the list of 'area'.
+ * SetupPVS() must have been called for g_pCurVisArea.
+ */
+static void ComputeVisPair( CNavArea *area, CNavArea::VisibilityType *pVisThisToOther, CNavArea::VisibilityType *pVisOtherToThis )
 {
-	CNavArea *area = assert_cast< CNavArea * >( pOtherArea );
-	VisibilityType visThisToOther = ( area == g_pCurVisArea ) ? COMPLETELY_VISIBLE : NOT_VISIBLE;
-	VisibilityType visOtherToThis = NOT_VISIBLE;
+	CNavArea::VisibilityType visThisToOther = ( area == g_pCurVisArea ) ? CNavArea::COMPLETELY_VISIBLE : CNavArea::NOT_VISIBLE;
+	CNavArea::VisibilityType visOtherToThis = CNavArea::NOT_VISIBLE;
 
 	if ( area != g_pCurVisArea )
 	{
@@ -5547,15 +6015,25 @@ void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
 
 		if ( !visOtherToThis && visThisToOther )
 		{
-			visOtherToThis = POTENTIALLY_VISIBLE;
+			visOtherToThis = CNavArea::POTENTIALLY_VISIBLE;
 		}
 
 		if ( !visThisToOther && visOtherToThis )
 		{
-			visThisToOther = POTENTIALLY_VISIBLE;
+			visThisToOther = CNavArea::POTENTIALLY_VISIBLE;
 		}
 	}
 
+	*pVisThisToOther = visThisToOther;
+	*pVisOtherToThis = visOtherToThis;
+}
+
+void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
+{
+	CNavArea *area = assert_cast< CNavArea * >( pOtherArea );
+	VisibilityType visThisToOther, visOtherToThis;
+	ComputeVisPair( area, &visThisToOther, &visOtherToThis );
+
 	CNavArea::AreaBindInfo info;
 	if ( visThisToOther != NOT_VISIBLE )
 	{
@@ -5627,6 +6105,108 @@ void CNavArea::ComputeVisibilityToMesh( void )
 }
 
 
+//--------------------------------------------------------------------------------------------------------
+struct NavVisPairResult
+{
+	CNavArea *area;
+	CNavArea::VisibilityType visThisToOther;
+	CNavArea::VisibilityType visOtherToThis;
+};
+
+static void ComputeVisPairJob( NavVisPairResult &result )
+{
+	ComputeVisPair( result.area, &result.visThisToOther, &result.visOtherToThis );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Recompute visibility between this area and the rest of the mesh after it was added or changed by
+ * editing, keeping the visibility of every other pair of areas. Produces the same visibility as
+ * ComputeVisibilityToMesh() would for these pairs, but the lists are not re-compressed into deltas.
+ */
+void CNavArea::UpdateVisibilityToMesh( void )
+{
+	NavAreaCollector collector;
+	float radius = nav_max_view_distance.GetFloat();
+	if ( radius == 0.0f )
+	{
+		radius = DEF_NAV_VIEW_DISTANCE;
+	}
+	TheNavMesh->ForAllAreasInRadius( collector, GetCenter(), radius );
+
+	CUtlVector< NavVisPairResult > results;
+	results.SetCount( collector.m_area.Count() );
+	FOR_EACH_VEC( collector.m_area, it )
+	{
+		results[ it ].area = collector.m_area[ it ];
+	}
+
+	SetupPVS();
+
+	g_pCurVisArea = this;
+	ParallelProcess( "CNavArea::UpdateVisibilityToMesh", results.Base(), results.Count(), &ComputeVisPairJob );
+
+	// areas inheriting from us are about to lose what they inherit
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		if ( TheNavAreas[ it ]->m_inheritVisibilityFrom.area == this )
+		{
+			TheNavAreas[ it ]->FlattenVisibility();
+		}
+	}
+
+	// our new list, and how each area sees us - areas out of range can't
+	CUtlVector< unsigned char > visOtherToThis;
+	visOtherToThis.SetCount( m_nextID );
+	V_memset( visOtherToThis.Base(), NOT_VISIBLE, visOtherToThis.Count() );
+
+	m_inheritVisibilityFrom.area = NULL;
+	m_potentiallyVisibleAreas.RemoveAll();
+
+	FOR_EACH_VEC( results, it )
+	{
+		const NavVisPairResult &result = results[ it ];
+
+		if ( result.visThisToOther != NOT_VISIBLE )
+		{
+			AreaBindInfo info;
+			info.area = result.area;
+			info.attributes = result.visThisToOther;
+			m_potentiallyVisibleAreas.AddToTail( info );
+		}
+
+		if ( result.area->GetID() < (unsigned int)visOtherToThis.Count() )
+		{
+			visOtherToThis[ result.area->GetID() ] = result.visOtherToThis;
+		}
+	}
+
+	// An inheriting area needs an entry of its own whenever its visibility of us differs from
+	// its anchor's. Anchors never inherit, so their entries are final.
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		CNavArea *area = TheNavAreas[ it ];
+		if ( area == this )
+			continue;
+
+		unsigned char vis = visOtherToThis[ area->GetID() ];
+
+		CNavArea *anchor = area->m_inheritVisibilityFrom.area;
+		if ( anchor && anchor != this && vis == visOtherToThis[ anchor->GetID() ] )
+		{
+			// same as what we inherit, drop any entry of our own
+			AreaBindInfo info;
+			info.area = this;
+			area->m_potentiallyVisibleAreas.FindAndRemove( info );
+			continue;
+		}
+
+		area->SetVisibilityEntry( this, vis );
+	}
+}
+
+
 //--------------------------------------------------------------------------------------------------------
 /**
  * The center and all four corners must ALL be visible
@@ -5722,6 +6302,13 @@ bool CNavArea::IsPotentiallyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+	// the visibility matrix knows every area that was in the mesh when it was built
+	int visibility = TheNavVisibility.GetVisibility( this, viewedArea );
+	if ( visibility >= 0 )
+	{
+		return ( visibility != NOT_VISIBLE );
+	}
+
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
@@ -5767,6 +6354,12 @@ bool CNavArea::IsCompletelyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+	int visibility = TheNavVisibility.GetVisibility( this, viewedArea );
+	if ( visibility >= 0 )
+	{
+		return ( visibility & COMPLETELY_VISIBLE ) ? true : false;
+	}
+
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
@@ -14,6 +14,7 @@
 
 #include "nav_ladder.h"
 #include "tier1/memstack.h"
+#include "tier0/threadtools.h"
 
 // BOTPORT: Clean up relationship between team index and danger storage in nav areas
 enum { MAX_NAV_TEAMS = 2 };
@@ -23,6 +24,8 @@ enum { MAX_NAV_TEAMS = 2 };
 class CFuncElevator;
 class CFuncNavPrerequisite;
 class CFuncNavCost;
+class CNavSearchContext;
+class CVarBitVec;
 
 class CNavVectorNoEditAllocator
 {
@@ -429,8 +432,8 @@ public:
 	BOOL IsMarked( void ) const			{ return (m_marker == m_masterMarker) ? true : false; }
 	
 	void SetParent( CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES )	{ m_parent = parent; m_parentHow = how; }
-	CNavArea *GetParent( void ) const	{ return m_parent; }
-	NavTraverseType GetParentHow( void ) const	{ return m_parentHow; }
+	CNavArea *GetParent( void ) const;							// reads the active CNavSearchContext, if there is one
+	NavTraverseType GetParentHow( void ) const;
 
 	bool IsOpen( void ) const;									// true if on "open list"
 	void AddToOpenList( void );									// add to open list in decreasing value order
@@ -447,13 +450,13 @@ public:
 	static void ClearSearchLists( void );						// clears the open and closed lists for a new search
 
 	void SetTotalCost( float value )	{ DebuggerBreakOnNaN_StagingOnly( value ); Assert( value >= 0.0 && !IS_NAN(value) ); m_totalCost = value; }
-	float GetTotalCost( void ) const	{ DebuggerBreakOnNaN_StagingOnly( m_totalCost ); return m_totalCost; }
+	float GetTotalCost( void ) const;
 
 	void SetCostSoFar( float value )	{ DebuggerBreakOnNaN_StagingOnly( value ); Assert( value >= 0.0 && !IS_NAN(value) ); m_costSoFar = value; }
-	float GetCostSoFar( void ) const	{ DebuggerBreakOnNaN_StagingOnly( m_costSoFar ); return m_costSoFar; }
+	float GetCostSoFar( void ) const;
 
 	void SetPathLengthSoFar( float value )	{ DebuggerBreakOnNaN_StagingOnly( value ); Assert( value >= 0.0 && !IS_NAN(value) ); m_pathLengthSoFar = value; }
-	float GetPathLengthSoFar( void ) const	{ DebuggerBreakOnNaN_StagingOnly( m_pathLengthSoFar ); return m_pathLengthSoFar; }
+	float GetPathLengthSoFar( void ) const;
 
 	//- editing -----------------------------------------------------------------------------------------
 	virtual void Draw( void ) const;							// draw area for debugging & editing
@@ -643,6 +646,7 @@ public:
 private:
 	friend class CNavMesh;
 	friend class CNavLadder;
+	friend class CNavVisibilityMatrix;
 	friend class CCSNavArea;									// allow CS load code to complete replace our default load behavior
 
 	static bool m_isReset;										// if true, don't bother cleaning up in destructor since everything is going away
@@ -738,7 +742,10 @@ private:
 
 	//- visibility --------------------------------------------------------------------------------------
 	void ComputeVisibilityToMesh( void );						// compute visibility to surrounding mesh
+	void UpdateVisibilityToMesh( void );						// recompute visibility between this area and the rest of an analyzed mesh
 	void ResetPotentiallyVisibleAreas();
+	void FlattenVisibility( void );								// copy in the list we inherit from, so we no longer depend on it
+	void SetVisibilityEntry( CNavArea *area, unsigned char attributes );	// set, or with NOT_VISIBLE remove, the entry for 'area' in our own list
 	static void ComputeVisToArea( CNavArea *&pOtherArea );
 
 #ifndef _X360
@@ -1058,4 +1065,235 @@ inline Vector CNavArea::GetCorner( NavCornerType corner ) const
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The state of one A* search over the mesh: each area's costs and parent, and an open list kept as an
+ * indexed binary heap. Areas keep their own copy of this state for the single-threaded searches, but a
+ * search that owns a context touches nothing in the areas themselves, so searches with different
+ * contexts can run on different threads at once.
+ *
+ * While a search is running, its context is "active" on that thread, and the area accessors that cost
+ * functors use (GetCostSoFar(), GetParent(), etc) read from it instead of the area.
+ */
+class CNavSearchContext
+{
+public:
+	CNavSearchContext( void );
+
+	void Begin( void );											// start a new search and make this the active context on this thread
+	void End( void );											// stop being the active context on this thread
+	static CNavSearchContext *GetActive( void )					{ return s_active; }
+
+	static CNavSearchContext &GetMainThreadContext( void );		// used by the NavAreaBuildPath() variant that writes results to the areas
+	void CopyToAreas( void ) const;								// write parents and costs of every area this search reached back into the areas
+
+	bool IsOpen( const CNavArea *area ) const;
+	bool IsClosed( const CNavArea *area ) const;
+	void AddToOpenList( CNavArea *area );						// add area at its total cost, or move it up if it is already open
+	bool IsOpenListEmpty( void ) const							{ return m_heap.Count() == 0; }
+	CNavArea *PopOpenList( void );								// remove and return the open area with the lowest total cost, which becomes closed
+
+	void SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES );
+	CNavArea *GetParent( const CNavArea *area ) const;
+	NavTraverseType GetParentHow( const CNavArea *area ) const;
+
+	void SetTotalCost( CNavArea *area, float value );
+	float GetTotalCost( const CNavArea *area ) const;
+
+	void SetCostSoFar( CNavArea *area, float value );
+	float GetCostSoFar( const CNavArea *area ) const;
+
+	void SetPathLengthSoFar( CNavArea *area, float value );
+	float GetPathLengthSoFar( const CNavArea *area ) const;
+
+	int GetReachedAreaCount( void ) const						{ return m_reached.Count(); }
+
+	/**
+	 * Use a snapshot of which areas are blocked, indexed by area ID, instead of asking the areas.
+	 * Searches running off the main thread need this, since blocked state can change under them.
+	 */
+	void SetBlockedAreas( const CVarBitVec *blocked )			{ m_blocked = blocked; }
+	bool IsBlocked( const CNavArea *area, int teamID, bool ignoreNavBlockers = false ) const;
+
+private:
+	struct AreaState
+	{
+		unsigned int search;									// state is only valid if this equals m_search
+		int heapIndex;											// index in m_heap, or -1 if not open
+		float totalCost;
+		float costSoFar;
+		float pathLengthSoFar;
+		CNavArea *parent;
+		NavTraverseType parentHow;
+	};
+
+	struct HeapEntry
+	{
+		float totalCost;
+		unsigned int id;										// breaks ties, so results don't depend on insertion order
+		CNavArea *area;
+	};
+
+	AreaState &Reach( CNavArea *area );							// state of area, reset if this search hasn't reached it yet
+	const AreaState *Find( const CNavArea *area ) const;		// state of area, or NULL if this search hasn't reached it
+
+	bool IsBefore( const HeapEntry &a, const HeapEntry &b ) const	{ return a.totalCost < b.totalCost || ( a.totalCost == b.totalCost && a.id < b.id ); }
+	void SiftUp( int index );
+	void SiftDown( int index );
+
+	CUtlVector< AreaState > m_state;							// indexed by area ID
+	CUtlVector< HeapEntry > m_heap;
+	CUtlVector< CNavArea * > m_reached;							// every area with valid state, for CopyToAreas()
+	unsigned int m_search;
+	const CVarBitVec *m_blocked;
+
+	static CTHREADLOCALPTR( CNavSearchContext ) s_active;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+inline const CNavSearchContext::AreaState *CNavSearchContext::Find( const CNavArea *area ) const
+{
+	unsigned int id = area->GetID();
+	if ( id < (unsigned int)m_state.Count() && m_state[ id ].search == m_search )
+		return &m_state[ id ];
+
+	return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavSearchContext::IsOpen( const CNavArea *area ) const
+{
+	const AreaState *state = Find( area );
+	return state && state->heapIndex >= 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavSearchContext::IsClosed( const CNavArea *area ) const
+{
+	const AreaState *state = Find( area );
+	return state && state->heapIndex < 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavSearchContext::SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how )
+{
+	AreaState &state = Reach( area );
+	state.parent = parent;
+	state.parentHow = how;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline CNavArea *CNavSearchContext::GetParent( const CNavArea *area ) const
+{
+	const AreaState *state = Find( area );
+	return state ? state->parent : NULL;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline NavTraverseType CNavSearchContext::GetParentHow( const CNavArea *area ) const
+{
+	const AreaState *state = Find( area );
+	return state ? state->parentHow : NUM_TRAVERSE_TYPES;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavSearchContext::SetTotalCost( CNavArea *area, float value )
+{
+	DebuggerBreakOnNaN_StagingOnly( value );
+	Assert( value >= 0.0 && !IS_NAN(value) );
+	Reach( area ).totalCost = value;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavSearchContext::GetTotalCost( const CNavArea *area ) const
+{
+	const AreaState *state = Find( area );
+	return state ? state->totalCost : 0.0f;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavSearchContext::SetCostSoFar( CNavArea *area, float value )
+{
+	DebuggerBreakOnNaN_StagingOnly( value );
+	Assert( value >= 0.0 && !IS_NAN(value) );
+	Reach( area ).costSoFar = value;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavSearchContext::GetCostSoFar( const CNavArea *area ) const
+{
+	const AreaState *state = Find( area );
+	return state ? state->costSoFar : 0.0f;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavSearchContext::SetPathLengthSoFar( CNavArea *area, float value )
+{
+	DebuggerBreakOnNaN_StagingOnly( value );
+	Assert( value >= 0.0 && !IS_NAN(value) );
+	Reach( area ).pathLengthSoFar = value;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavSearchContext::GetPathLengthSoFar( const CNavArea *area ) const
+{
+	const AreaState *state = Find( area );
+	return state ? state->pathLengthSoFar : 0.0f;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline CNavArea *CNavArea::GetParent( void ) const
+{
+	const CNavSearchContext *search = CNavSearchContext::GetActive();
+	if ( search )
+		return search->GetParent( this );
+
+	return m_parent;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline NavTraverseType CNavArea::GetParentHow( void ) const
+{
+	const CNavSearchContext *search = CNavSearchContext::GetActive();
+	if ( search )
+		return search->GetParentHow( this );
+
+	return m_parentHow;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetTotalCost( void ) const
+{
+	const CNavSearchContext *search = CNavSearchContext::GetActive();
+	if ( search )
+		return search->GetTotalCost( this );
+
+	DebuggerBreakOnNaN_StagingOnly( m_totalCost );
+	return m_totalCost;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetCostSoFar( void ) const
+{
+	const CNavSearchContext *search = CNavSearchContext::GetActive();
+	if ( search )
+		return search->GetCostSoFar( this );
+
+	DebuggerBreakOnNaN_StagingOnly( m_costSoFar );
+	return m_costSoFar;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetPathLengthSoFar( void ) const
+{
+	const CNavSearchContext *search = CNavSearchContext::GetActive();
+	if ( search )
+		return search->GetPathLengthSoFar( this );
+
+	DebuggerBreakOnNaN_StagingOnly( m_pathLengthSoFar );
+	return m_pathLengthSoFar;
+}
+
+
 #endif // _NAV_AREA_H_
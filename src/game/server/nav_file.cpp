@@ -11,6 +11,8 @@
 
 #include "cbase.h"
 #include "nav_mesh.h"
+#include "nav_hierarchy.h"
+#include "nav_visibility.h"
 #include "gamerules.h"
 #include "datacache/imdlcache.h"
 
@@ -1194,6 +1196,17 @@ bool CNavMesh::Save( void ) const
 	//
 	SaveCustomData( fileBuffer );
 
+	//
+	// Store visibility between areas in run-length form, rebuilt to pick up any edits
+	//
+	TheNavVisibility.Build();
+	TheNavVisibility.Save( fileBuffer );
+
+	//
+	// Store the cluster hierarchy, if editing hasn't invalidated it
+	//
+	TheNavClusters.Save( fileBuffer );
+
 	if ( p4 )
 	{
 		char szCorrectPath[MAX_PATH];
@@ -1598,11 +1611,37 @@ NavErrorType CNavMesh::Load( void )
 	//
 	LoadCustomData( fileBuffer, subVersion );
 
+	//
+	// Load the visibility matrix and the cluster hierarchy, if this file has them
+	//
+	TheNavVisibility.Load( fileBuffer );
+	TheNavClusters.Load( fileBuffer );
+
 	//
 	// Bind pointers, etc
 	//
 	NavErrorType loadResult = PostLoad( version );
 
+	if ( loadResult == NAV_OK )
+	{
+		TheNavClusters.PostLoad();
+		if ( !TheNavClusters.IsBuilt() )
+		{
+			TheNavClusters.Build();
+		}
+	}
+
+	if ( loadResult == NAV_OK && !TheNavVisibility.IsBuilt() )
+	{
+		TheNavVisibility.Build();
+	}
+
+	if ( loadResult == NAV_OK )
+	{
+		// so lookups by position can use the index before the first Update()
+		BuildAreaIndex();
+	}
+
 	WarnIfMeshNeedsAnalysis( version );
 
 	return loadResult;
@@ -15,6 +15,9 @@
 #include "nav_node.h"
 #include "nav_pathfind.h"
 #include "viewport_panel_names.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/generichash.h"
+#include "vstdlib/jobthread.h"
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
 
@@ -43,6 +46,8 @@ ConVar nav_generate_jump_connections( "nav_generate_jump_connections", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+ConVar nav_generate_threaded( "nav_generate_threaded", "1", FCVAR_CHEAT, "Trace sampling steps, node crouch checks, and candidate areas on worker threads. The generated mesh is the same either way." );
+ConVar nav_generate_sample_batch( "nav_generate_sample_batch", "4096", FCVAR_CHEAT, "Number of sampling steps traced ahead of the flood fill at a time when nav_generate_threaded is set" );
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -52,6 +57,84 @@ bool FindGroundForNode( Vector *pos, Vector *normal );	// find a ground Z for po
 const float MaxTraversableHeight = StepHeight;		// max internal obstacle height that can occur between nav nodes and safely disregarded
 const float MinObstacleAreaWidth = 10.0f;			// min width of a nav area we will generate on top of an obstacle
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The outcome of one sampling step, as computed by CNavMesh::TraceSampleStep()
+ */
+struct NavSampleStep
+{
+	bool isValid;									// false if we can't move in this direction
+	Vector to;
+	Vector toNormal;
+	bool isOnDisplacement;
+	float obstacleHeight;
+	float obstacleStartDist;
+	float obstacleEndDist;
+};
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A node that might be the NW corner of an area, for CNavMesh::TestAreaJob()
+ */
+struct NavAreaCandidate
+{
+	CNavNode *node;
+	bool isValid;									// TestArea() passed
+};
+
+static int s_testAreaWidth;							// size being tried by the current batch of TestAreaJob()s
+static int s_testAreaHeight;
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Sampling steps traced ahead of the flood fill in SampleStep().
+ *
+ * A step's traces only depend on where it starts (see TraceSampleStep()), so when the flood fill
+ * reaches a step that hasn't been traced, we trace a batch of the steps around it - the unexplored
+ * directions of the current node and its parents, then breadth first outwards from every position
+ * those steps reach - one wave at a time across the worker threads. The flood fill itself still
+ * runs serially in its usual order, so it creates exactly the nodes the serial version would.
+ */
+class CNavSampleCache
+{
+public:
+	void Reset( void );
+	bool GetStep( CNavNode *node, NavDirType dir, NavSampleStep *step );	// false if the step can't be predicted, and must be traced directly
+
+private:
+	struct Key
+	{
+		float x, y, z;
+		int dir;
+	};
+
+	struct KeyFuncs
+	{
+		unsigned int operator()( const Key &key ) const				{ return HashBlock( &key, sizeof( Key ) ); }
+		bool operator()( const Key &a, const Key &b ) const			{ return V_memcmp( &a, &b, sizeof( Key ) ) == 0; }
+	};
+
+	struct Work
+	{
+		Key key;
+		NavSampleStep step;
+	};
+
+	static Key MakeKey( const Vector &from, NavDirType dir );
+	static void TraceJob( Work &work );
+
+	void Predict( CNavNode *node, NavDirType dir );
+	void Queue( const Vector &from, NavDirType dir, CUtlVector< Work > *wave );
+
+	CUtlHashtable< Key, int, KeyFuncs, KeyFuncs > m_index;				// index into m_steps, or -1 if queued but not traced yet
+	CUtlVector< NavSampleStep > m_steps;
+	CUtlVector< Work > m_wave;
+	CUtlVector< Work > m_nextWave;
+};
+
+static CNavSampleCache s_sampleCache;
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Shortest path cost, paying attention to "blocked" areas
@@ -3192,6 +3275,39 @@ bool CNavMesh::CheckObstacles( CNavNode *node, int width, int height, int x, int
 	return true;
 }
 
+//--------------------------------------------------------------------------------------------------------------
+void CNavMesh::TestAreaJob( NavAreaCandidate &candidate )
+{
+	candidate.isValid = TheNavMesh->TestArea( candidate.node, s_testAreaWidth, s_testAreaHeight );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return true if any node an area of size (width, height) at 'node' would cover is already covered.
+ * The area must have passed TestArea(), so all of its nodes exist.
+ */
+bool CNavMesh::IsAreaCovered( CNavNode *node, int width, int height ) const
+{
+	CNavNode *vertNode = node;
+	for( int y=0; y<height; y++ )
+	{
+		CNavNode *horizNode = vertNode;
+		for( int x=0; x<width; x++ )
+		{
+			if ( horizNode->IsCovered() )
+				return true;
+
+			horizNode = horizNode->GetConnectedNode( EAST );
+		}
+
+		vertNode = vertNode->GetConnectedNode( SOUTH );
+	}
+
+	return false;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /** 
  * Create a nav area, and mark all nodes it overlaps as "covered"
@@ -3298,15 +3414,38 @@ void CNavMesh::CreateNavAreasFromNodes( void )
 	int tryHeight = tryWidth;
 	int uncoveredNodes = CNavNode::GetListLength();
 
+	bool isThreaded = nav_generate_threaded.GetBool();
+	CUtlVector< NavAreaCandidate > candidates;
+
 	while( uncoveredNodes > 0 )
 	{
-		for( CNavNode *node = CNavNode::GetFirst(); node; node = node->GetNext() )
+		if ( isThreaded )
 		{
-			if (node->IsCovered())
-				continue;
+			// Test every uncovered node in parallel, then build areas in node order as the serial
+			// loop would. Building an area only covers nodes, and covering can only make TestArea()
+			// fail, so a node that failed here would have failed in the serial loop too, and one that
+			// passed still fits if none of its nodes were covered by an area built before it.
+			candidates.RemoveAll();
+			for( CNavNode *node = CNavNode::GetFirst(); node; node = node->GetNext() )
+			{
+				if ( !node->IsCovered() )
+				{
+					NavAreaCandidate &candidate = candidates[ candidates.AddToTail() ];
+					candidate.node = node;
+					candidate.isValid = false;
+				}
+			}
+
+			s_testAreaWidth = tryWidth;
+			s_testAreaHeight = tryHeight;
+			ParallelProcess( "CNavMesh::CreateNavAreasFromNodes", candidates.Base(), candidates.Count(), &TestAreaJob );
 
-			if (TestArea( node, tryWidth, tryHeight ))
+			FOR_EACH_VEC( candidates, it )
 			{
+				CNavNode *node = candidates[ it ].node;
+				if ( !candidates[ it ].isValid || IsAreaCovered( node, tryWidth, tryHeight ) )
+					continue;
+
 				int covered = BuildArea( node, tryWidth, tryHeight );
 				if (covered < 0)
 				{
@@ -3317,6 +3456,26 @@ void CNavMesh::CreateNavAreasFromNodes( void )
 				uncoveredNodes -= covered;
 			}
 		}
+		else
+		{
+			for( CNavNode *node = CNavNode::GetFirst(); node; node = node->GetNext() )
+			{
+				if (node->IsCovered())
+					continue;
+
+				if (TestArea( node, tryWidth, tryHeight ))
+				{
+					int covered = BuildArea( node, tryWidth, tryHeight );
+					if (covered < 0)
+					{
+						Error( "Generate: Error - Data corrupt.\n" );
+						return;
+					}
+
+					uncoveredNodes -= covered;
+				}
+			}
+		}
 
 		if (tryWidth >= tryHeight)
 			--tryWidth;
@@ -3468,6 +3627,7 @@ void CNavMesh::BeginGeneration( bool incremental )
 
 	// the system will see this NULL and select the next walkable seed
 	m_currentNode = NULL;
+	s_sampleCache.Reset();
 
 	// if there are no seed points, we can't generate
 	if (m_walkableSeeds.Count() == 0)
@@ -3658,6 +3818,9 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
+			s_sampleCache.Reset();
+			CheckDeferredNodeCrouch();
+
 			// sampling is complete, now build nav areas
 			m_generationState = CREATE_AREAS_FROM_SAMPLES;
 
@@ -4127,7 +4290,16 @@ CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDir
 		m_currentNode = node;
 	}
 
-	node->CheckCrouch();
+	if ( nav_generate_threaded.GetBool() )
+	{
+		// the crouch traces only depend on the node's position, and nothing reads their results
+		// until areas are built, so CheckDeferredNodeCrouch() runs them all in parallel after sampling
+		node->m_isCrouchCheckDeferred = true;
+	}
+	else
+	{
+		node->CheckCrouch();
+	}
 
 	// determine if there's a cliff nearby and set an attribute on this node
 	for ( int i = 0; i < NUM_DIRECTIONS; i++ )
@@ -4143,6 +4315,36 @@ CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDir
 	return node;
 }
 
+//--------------------------------------------------------------------------------------------------------------
+void CNavMesh::CheckNodeCrouchJob( CNavNode *&node )
+{
+	// CheckCrouch() replaces the attributes, and AddNode() adds the cliff flag after it
+	int cliff = node->GetAttributes() & NAV_MESH_CLIFF;
+	node->CheckCrouch();
+	node->SetAttributes( node->GetAttributes() | cliff );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Run the crouch checks AddNode() deferred while sampling
+ */
+void CNavMesh::CheckDeferredNodeCrouch( void )
+{
+	CUtlVector< CNavNode * > nodes;
+	for( CNavNode *node = CNavNode::GetFirst(); node; node = node->GetNext() )
+	{
+		if ( node->m_isCrouchCheckDeferred )
+		{
+			node->m_isCrouchCheckDeferred = false;
+			nodes.AddToTail( node );
+		}
+	}
+
+	ParallelProcess( "CNavMesh::CheckDeferredNodeCrouch", nodes.Base(), nodes.Count(), &CheckNodeCrouchJob );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 inline CNavNode *LadderEndSearch( const Vector *pos, NavDirType mountDir )
 {
@@ -4350,6 +4552,375 @@ static bool IsNodeOverlapped( const Vector& pos, const Vector& offset )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+void CNavSampleCache::Reset( void )
+{
+	m_index.Purge();
+	m_steps.Purge();
+	m_wave.Purge();
+	m_nextWave.Purge();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavSampleCache::Key CNavSampleCache::MakeKey( const Vector &from, NavDirType dir )
+{
+	Key key;
+	key.x = from.x;
+	key.y = from.y;
+	key.z = from.z;
+	key.dir = dir;
+	return key;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSampleCache::TraceJob( Work &work )
+{
+	Vector from( work.key.x, work.key.y, work.key.z );
+	TheNavMesh->TraceSampleStep( from, (NavDirType)work.key.dir, &work.step );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavSampleCache::GetStep( CNavNode *node, NavDirType dir, NavSampleStep *step )
+{
+	Key key = MakeKey( *node->GetPosition(), dir );
+
+	UtlHashHandle_t h = m_index.Find( key );
+	if ( h == m_index.InvalidHandle() )
+	{
+		Predict( node, dir );
+		h = m_index.Find( key );
+	}
+
+	if ( h == m_index.InvalidHandle() || m_index[ h ] < 0 )
+		return false;
+
+	*step = m_steps[ m_index[ h ] ];
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSampleCache::Queue( const Vector &from, NavDirType dir, CUtlVector< Work > *wave )
+{
+	bool didInsert;
+	Key key = MakeKey( from, dir );
+	m_index.Insert( key, -1, &didInsert );
+
+	if ( didInsert )
+	{
+		Work &work = wave->Element( wave->AddToTail() );
+		work.key = key;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Trace the step from 'node' in 'dir', and a batch of the steps the flood fill is likely to take after it
+ */
+void CNavSampleCache::Predict( CNavNode *node, NavDirType dir )
+{
+	VPROF_BUDGET( "CNavSampleCache::Predict", "NextBot" );
+
+	m_wave.RemoveAll();
+	Queue( *node->GetPosition(), dir, &m_wave );
+
+	// once this node is done, the flood fill pops back through its parents' unexplored directions
+	const int maxParents = 64;
+	int parentCount = 0;
+	for( CNavNode *parent = node; parent && parentCount < maxParents; parent = parent->GetParent(), ++parentCount )
+	{
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			if ( !parent->HasVisited( (NavDirType)d ) )
+			{
+				Queue( *parent->GetPosition(), (NavDirType)d, &m_wave );
+			}
+		}
+	}
+
+	int budget = MAX( nav_generate_sample_batch.GetInt(), 1 );
+	int traced = 0;
+
+	while( m_wave.Count() && traced < budget )
+	{
+		ParallelProcess( "CNavSampleCache::Predict", m_wave.Base(), m_wave.Count(), &TraceJob );
+		traced += m_wave.Count();
+
+		m_nextWave.RemoveAll();
+
+		FOR_EACH_VEC( m_wave, it )
+		{
+			const Work &work = m_wave[ it ];
+			m_index[ m_index.Find( work.key ) ] = m_steps.AddToTail( work.step );
+
+			if ( !work.step.isValid )
+				continue;
+
+			// a new node steps in every direction, except back the way it came when AddNode() links both ways
+			NavDirType back = OppositeDirection( (NavDirType)work.key.dir );
+			const float zTolerance = 50.0f;
+			bool isLinkedBack = fabs( work.key.z - work.step.to.z ) < zTolerance;
+
+			for( int d=0; d<NUM_DIRECTIONS; ++d )
+			{
+				if ( d == back && isLinkedBack )
+					continue;
+
+				Queue( work.step.to, (NavDirType)d, &m_nextWave );
+			}
+		}
+
+		m_wave.Swap( m_nextWave );
+	}
+
+	// forget what was queued but not traced, so it can be queued again
+	FOR_EACH_VEC( m_wave, it )
+	{
+		m_index.Remove( m_wave[ it ].key );
+	}
+	m_wave.RemoveAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavMesh::ResetSampleCache( void )
+{
+	s_sampleCache.Reset();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The traces of one SampleStep(): try to move one generation step from 'from' in direction 'dir'.
+ * Returns false (and clears step->isValid) if there is no walkable position there.
+ * This only depends on where the step starts, never on the nodes sampled so far, which
+ * is what lets CNavSampleCache trace steps ahead of the flood fill.
+ */
+bool CNavMesh::TraceSampleStep( const Vector &from, NavDirType dir, NavSampleStep *step )
+{
+	step->isValid = false;
+
+	// snap to grid
+	int cx = SnapToGrid( from.x );
+	int cy = SnapToGrid( from.y );
+
+	// attempt to move to adjacent node
+	switch( dir )
+	{
+		case NORTH:		cy -= GenerationStepSize; break;
+		case SOUTH:		cy += GenerationStepSize; break;
+		case EAST:		cx += GenerationStepSize; break;
+		case WEST:		cx -= GenerationStepSize; break;
+	}
+
+	Vector pos( cx, cy, from.z );
+
+	// sanity check to not generate across the world for incremental generation
+	const float incrementalRange = nav_generate_incremental_range.GetFloat();
+	if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
+	{
+		bool inRange = false;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
+			{
+				inRange = true;
+				break;
+			}
+		}
+
+		if ( !inRange )
+		{
+			return false;
+		}
+	}
+
+	if ( m_generationMode == GENERATE_SIMPLIFY )
+	{
+		if ( !m_simplifyGenerationExtent.Contains( pos ) )
+		{
+			return false;
+		}
+	}
+
+	// test if we can move to new position
+	trace_t result;
+	CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
+	Vector to = vec3_origin, toNormal = vec3_origin;
+	float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
+	if ( TraceAdjacentNode( 0, from, pos, &result ) )
+	{
+		to = result.endpos;
+		toNormal = result.plane.normal;
+	}
+	else
+	{
+		// test going up ClimbUpHeight
+		bool success = false;
+		for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
+		{						
+			trace_t tr;
+			Vector start( from );
+			Vector end( pos );
+			start.z += height;
+			end.z += height;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+			if ( !tr.startsolid && tr.fraction == 1.0f )
+			{
+				if ( !StayOnFloor( &tr ) )
+				{
+					break;
+				}
+
+				to = tr.endpos;
+				toNormal = tr.plane.normal;
+
+				start = end = from;
+				end.z += height;
+				UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+				if ( tr.fraction < 1.0f )
+				{
+					break;
+				}
+
+				// keep track of far up we had to go to find a path to the next node
+				obstacleHeight = height;
+				success = true;
+				break;
+			}
+			else
+			{
+				// Could not trace from node to node at this height, something is in the way.
+				// Trace in the other direction to see if we hit something
+				Vector vecToObstacleStart = tr.endpos - start;
+				Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
+				if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
+				{
+					UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+					if ( !tr.startsolid && tr.fraction < 1.0 )
+					{
+						// We hit something going the other direction.  There is some obstacle between the two nodes.
+						Vector vecToObstacleEnd = tr.endpos - start;
+						Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
+						if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
+						{
+							// Remember the distances to start and end of the obstacle (with respect to the "from" node).
+							// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
+							// If we do eventually clear the obstacle, these values will be the start and end distance to the
+							// very tip of the obstacle.
+							obstacleStartDist = vecToObstacleStart.Length();
+							obstacleEndDist = vecToObstacleEnd.Length();
+							if ( obstacleEndDist == 0 )
+							{
+								obstacleEndDist = GenerationStepSize;
+							}
+						}								
+					}
+				}
+			}
+		}
+
+		if ( !success )
+		{
+			return false;
+		}
+	}
+
+	// Don't generate nodes if we spill off the end of the world onto skybox
+	if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
+	{
+		return false;
+	}
+
+	// If we're incrementally generating, don't overlap existing nav areas.
+	Vector testPos( to );
+	bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
+	bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
+	bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
+	bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
+	if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+	{
+		return false;
+	}
+
+	int nTolerance = nav_generate_incremental_tolerance.GetInt();
+	if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
+	{
+		bool bValid = false;
+		int zPos = to.z;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			int zMin = seedPos.z - nTolerance;
+			int zMax = seedPos.z + nTolerance;
+
+			if ( zPos >= zMin && zPos <= zMax )
+			{
+				bValid = true;
+				break;
+			}
+		}
+
+		if ( !bValid )
+			return false;
+	}
+
+
+	bool isOnDisplacement = result.IsDispSurface();
+
+	if ( nav_displacement_test.GetInt() > 0 )
+	{
+		// Test for nodes under displacement surfaces.
+		// This happens during development, and is a pain because the space underneath a displacement
+		// is not 'solid'.
+		Vector start = to + Vector( 0, 0, 0 );
+		Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
+		UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+
+		if ( result.fraction > 0 )
+		{
+			end = start;
+			start = result.endpos;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+			if ( result.fraction < 1 )
+			{
+				// if we made it down to within StepHeight, maybe we're on a static prop
+				if ( result.endpos.z > to.z + StepHeight )
+				{
+					return false;
+				}
+			}
+		}
+	}
+
+	float deltaZ = to.z - from.z;
+	// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
+	// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
+	// and distances
+	if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+	{
+		obstacleHeight = 0;
+		obstacleStartDist = 0;
+		obstacleEndDist = GenerationStepSize;
+	}
+
+	step->to = to;
+	step->toNormal = toNormal;
+	step->isOnDisplacement = isOnDisplacement;
+	step->obstacleHeight = obstacleHeight;
+	step->obstacleStartDist = obstacleStartDist;
+	step->obstacleEndDist = obstacleEndDist;
+	step->isValid = true;
+
+	return true;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Search the world and build a map of possible movements.
@@ -4409,223 +4980,28 @@ bool CNavMesh::SampleStep( void )
 				// have not searched in this direction yet
 
 				// start at current node position
-				Vector pos = *m_currentNode->GetPosition();
-
-				// snap to grid
-				int cx = SnapToGrid( pos.x );
-				int cy = SnapToGrid( pos.y );
-
-				// attempt to move to adjacent node
-				switch( dir )
-				{
-					case NORTH:		cy -= GenerationStepSize; break;
-					case SOUTH:		cy += GenerationStepSize; break;
-					case EAST:		cx += GenerationStepSize; break;
-					case WEST:		cx -= GenerationStepSize; break;
-				}
-
-				pos.x = cx;
-				pos.y = cy;
+				Vector from( *m_currentNode->GetPosition() );
 
 				m_generationDir = (NavDirType)dir;
 
 				// mark direction as visited
 				m_currentNode->MarkAsVisited( m_generationDir );
 
-				// sanity check to not generate across the world for incremental generation
-				const float incrementalRange = nav_generate_incremental_range.GetFloat();
-				if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
-				{
-					bool inRange = false;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
-						{
-							inRange = true;
-							break;
-						}
-					}
-
-					if ( !inRange )
-					{
-						return true;
-					}
-				}
-
-				if ( m_generationMode == GENERATE_SIMPLIFY )
-				{
-					if ( !m_simplifyGenerationExtent.Contains( pos ) )
-					{
-						return true;
-					}
-				}
-
 				// test if we can move to new position
-				trace_t result;
-				Vector from( *m_currentNode->GetPosition() );
-				CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
-				Vector to = vec3_origin, toNormal = vec3_origin;
-				float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
-				if ( TraceAdjacentNode( 0, from, pos, &result ) )
-				{
-					to = result.endpos;
-					toNormal = result.plane.normal;
-				}
-				else
-				{
-					// test going up ClimbUpHeight
-					bool success = false;
-					for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
-					{						
-						trace_t tr;
-						Vector start( from );
-						Vector end( pos );
-						start.z += height;
-						end.z += height;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-						if ( !tr.startsolid && tr.fraction == 1.0f )
-						{
-							if ( !StayOnFloor( &tr ) )
-							{
-								break;
-							}
-
-							to = tr.endpos;
-							toNormal = tr.plane.normal;
-
-							start = end = from;
-							end.z += height;
-							UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-							if ( tr.fraction < 1.0f )
-							{
-								break;
-							}
-
-							// keep track of far up we had to go to find a path to the next node
-							obstacleHeight = height;
-							success = true;
-							break;
-						}
-						else
-						{
-							// Could not trace from node to node at this height, something is in the way.
-							// Trace in the other direction to see if we hit something
-							Vector vecToObstacleStart = tr.endpos - start;
-							Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
-							if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
-							{
-								UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-								if ( !tr.startsolid && tr.fraction < 1.0 )
-								{
-									// We hit something going the other direction.  There is some obstacle between the two nodes.
-									Vector vecToObstacleEnd = tr.endpos - start;
-									Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
-									if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
-									{
-										// Remember the distances to start and end of the obstacle (with respect to the "from" node).
-										// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
-										// If we do eventually clear the obstacle, these values will be the start and end distance to the
-										// very tip of the obstacle.
-										obstacleStartDist = vecToObstacleStart.Length();
-										obstacleEndDist = vecToObstacleEnd.Length();
-										if ( obstacleEndDist == 0 )
-										{
-											obstacleEndDist = GenerationStepSize;
-										}
-									}								
-								}
-							}
-						}
-					}
-
-					if ( !success )
-					{
-						return true;
-					}
-				}
-
-				// Don't generate nodes if we spill off the end of the world onto skybox
-				if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
+				NavSampleStep step;
+				if ( !nav_generate_threaded.GetBool() || !s_sampleCache.GetStep( m_currentNode, m_generationDir, &step ) )
 				{
-					return true;
+					TraceSampleStep( from, m_generationDir, &step );
 				}
 
-				// If we're incrementally generating, don't overlap existing nav areas.
-				Vector testPos( to );
-				bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
-				bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
-				bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
-				bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
-				if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+				if ( !step.isValid )
 				{
 					return true;
 				}
 
-				int nTolerance = nav_generate_incremental_tolerance.GetInt();
-				if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
-				{
-					bool bValid = false;
-					int zPos = to.z;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						int zMin = seedPos.z - nTolerance;
-						int zMax = seedPos.z + nTolerance;
-
-						if ( zPos >= zMin && zPos <= zMax )
-						{
-							bValid = true;
-							break;
-						}
-					}
-
-					if ( !bValid )
-						return true;
-				}
-
-
-				bool isOnDisplacement = result.IsDispSurface();
-
-				if ( nav_displacement_test.GetInt() > 0 )
-				{
-					// Test for nodes under displacement surfaces.
-					// This happens during development, and is a pain because the space underneath a displacement
-					// is not 'solid'.
-					Vector start = to + Vector( 0, 0, 0 );
-					Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
-					UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-
-					if ( result.fraction > 0 )
-					{
-						end = start;
-						start = result.endpos;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-						if ( result.fraction < 1 )
-						{
-							// if we made it down to within StepHeight, maybe we're on a static prop
-							if ( result.endpos.z > to.z + StepHeight )
-							{
-								return true;
-							}
-						}
-					}
-				}
-
-				float deltaZ = to.z - m_currentNode->GetPosition()->z;
-				// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
-				// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
-				// and distances
-				if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
-				{
-					obstacleHeight = 0;
-					obstacleStartDist = 0;
-					obstacleEndDist = GenerationStepSize;
-				}
-
 				// we can move here
 				// create a new navigation node, and update current node pointer
-				AddNode( to, toNormal, m_generationDir, m_currentNode, isOnDisplacement, obstacleHeight, obstacleStartDist, obstacleEndDist );
+				AddNode( step.to, step.toNormal, m_generationDir, m_currentNode, step.isOnDisplacement, step.obstacleHeight, step.obstacleStartDist, step.obstacleEndDist );
 
 				return true;
 			}
@@ -0,0 +1,916 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_hierarchy.cpp
+// Hierarchical path planning over the Navigation Mesh
+
+#include "cbase.h"
+#include "nav_mesh.h"
+#include "nav_hierarchy.h"
+#include "utlbuffer.h"
+#include "utlpriorityqueue.h"
+#include "checksum_crc.h"
+#include "tier0/fasttimer.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+ConVar nav_hierarchical_path( "nav_hierarchical_path", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "If nonzero, long bot paths are routed through nav area clusters first, and only refined inside the clusters along the route." );
+ConVar nav_hierarchical_path_min_distance( "nav_hierarchical_path_min_distance", "2000", FCVAR_GAMEDLL | FCVAR_CHEAT, "Paths shorter than this (straight line) are always computed with a full search." );
+ConVar nav_cluster_size( "nav_cluster_size", "1024", FCVAR_GAMEDLL | FCVAR_CHEAT, "Size of the grid cells nav areas are grouped into for hierarchical pathing. Takes effect when clusters are rebuilt." );
+
+CNavClusterGraph TheNavClusters;
+
+/// Identifies the cluster block at the end of a .nav file. It is written after the derived class
+/// mesh data, and older games stop reading before it, so the file version doesn't change.
+const unsigned int NavClusterMagicNumber = 0x534C434E;		// "NCLS"
+const unsigned int NavClusterVersion = 2;
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A move from one area to an adjacent one, with the same cost ShortestPathCost charges for it
+ */
+struct NavClusterStep
+{
+	CNavArea *area;
+	float cost;
+};
+
+typedef CUtlVectorFixedGrowable< NavClusterStep, 32 > NavClusterStepVector;
+
+static void AddStep( NavClusterStepVector *steps, CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, float length )
+{
+	if ( area == NULL || area == fromArea )
+		return;
+
+	float dist;
+	if ( ladder )
+	{
+		dist = ladder->m_length;
+	}
+	else if ( length > 0.0f )
+	{
+		dist = length;
+	}
+	else
+	{
+		dist = ( area->GetCenter() - fromArea->GetCenter() ).Length();
+	}
+
+	float cost = dist;
+
+	if ( area->GetAttributes() & NAV_MESH_CROUCH )
+	{
+		const float crouchPenalty = 20.0f;
+		cost += crouchPenalty * dist;
+	}
+
+	if ( area->GetAttributes() & NAV_MESH_JUMP )
+	{
+		const float jumpPenalty = 5.0f;
+		cost += jumpPenalty * dist;
+	}
+
+	NavClusterStep &step = steps->Element( steps->AddToTail() );
+	step.area = area;
+	step.cost = cost;
+}
+
+/**
+ * Collect every area NavAreaBuildPath() could move to from 'area' - floor connections, ladders, and elevators
+ */
+static void CollectSteps( CNavArea *area, NavClusterStepVector *steps )
+{
+	steps->RemoveAll();
+
+	for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+	{
+		const NavConnectVector *floorList = area->GetAdjacentAreas( (NavDirType)dir );
+		for( int i=0; i<floorList->Count(); ++i )
+		{
+			const NavConnect &connect = floorList->Element( i );
+			AddStep( steps, connect.area, area, NULL, connect.length );
+		}
+	}
+
+	// do not use BEHIND connection, as its very hard to get to when going up a ladder
+	const NavLadderConnectVector *ladderList = area->GetLadders( CNavLadder::LADDER_UP );
+	for( int i=0; i<ladderList->Count(); ++i )
+	{
+		const CNavLadder *ladder = ladderList->Element( i ).ladder;
+		AddStep( steps, ladder->m_topForwardArea, area, ladder, -1.0f );
+		AddStep( steps, ladder->m_topLeftArea, area, ladder, -1.0f );
+		AddStep( steps, ladder->m_topRightArea, area, ladder, -1.0f );
+	}
+
+	ladderList = area->GetLadders( CNavLadder::LADDER_DOWN );
+	for( int i=0; i<ladderList->Count(); ++i )
+	{
+		const CNavLadder *ladder = ladderList->Element( i ).ladder;
+		AddStep( steps, ladder->m_bottomArea, area, ladder, -1.0f );
+	}
+
+	if ( area->GetElevator() )
+	{
+		const NavConnectVector &elevatorAreas = area->GetElevatorAreas();
+		for( int i=0; i<elevatorAreas.Count(); ++i )
+		{
+			AddStep( steps, elevatorAreas[i].area, area, NULL, -1.0f );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+struct NavClusterQueueEntry
+{
+	float cost;
+	int index;				// area ID or portal index
+	CNavArea *area;
+};
+
+static bool NavClusterQueueLess( const NavClusterQueueEntry &lhs, const NavClusterQueueEntry &rhs )
+{
+	// CUtlPriorityQueue keeps the "largest" element at the head, and we want the cheapest
+	return lhs.cost > rhs.cost;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavClusterCorridor::Clear( void )
+{
+	m_clusters.ClearAll();
+	m_route.RemoveAll();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavClusterCorridor::AddCluster( int cluster )
+{
+	if ( cluster < 0 )
+		return;
+
+	if ( cluster >= m_clusters.GetNumBits() )
+	{
+		m_clusters.Resize( MAX( cluster + 1, TheNavClusters.GetClusterCount() ) );
+	}
+
+	m_clusters.Set( cluster );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavClusterGraph::CNavClusterGraph( void )
+{
+	m_isBuilt = false;
+	m_clusterSize = 0.0f;
+	m_meshChecksum = 0;
+	m_localSearch = 0;
+	m_portalSearch = 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavClusterGraph::Reset( void )
+{
+	m_isBuilt = false;
+	m_meshChecksum = 0;
+	m_clusters.Purge();
+	m_portals.Purge();
+	m_areaCluster.Purge();
+	m_areaPortal.Purge();
+	m_localDist.Purge();
+	m_localMarker.Purge();
+	m_portalCost.Purge();
+	m_portalParent.Purge();
+	m_portalMarker.Purge();
+	m_localSearch = 0;
+	m_portalSearch = 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavClusterGraph::Invalidate( void )
+{
+	m_isBuilt = false;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Size the per-area tables for the current mesh
+ */
+static int GetNavAreaIDLimit( void )
+{
+	unsigned int maxID = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		maxID = MAX( maxID, TheNavAreas[ it ]->GetID() );
+	}
+	return maxID + 1;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Everything Build() reads from the mesh - area IDs, centers, and the steps between areas and their costs.
+ * Each area is hashed on its own and the results summed, so the order of TheNavAreas doesn't matter.
+ */
+unsigned int CNavClusterGraph::ComputeMeshChecksum( void )
+{
+	NavClusterStepVector steps;
+	unsigned int checksum = 0;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		CNavArea *area = TheNavAreas[ it ];
+
+		CRC32_t crc;
+		CRC32_Init( &crc );
+
+		unsigned int id = area->GetID();
+		CRC32_ProcessBuffer( &crc, &id, sizeof( id ) );
+		CRC32_ProcessBuffer( &crc, &area->GetCenter(), sizeof( Vector ) );
+
+		CollectSteps( area, &steps );
+		for( int i=0; i<steps.Count(); ++i )
+		{
+			unsigned int adjID = steps[i].area->GetID();
+			CRC32_ProcessBuffer( &crc, &adjID, sizeof( adjID ) );
+			CRC32_ProcessBuffer( &crc, &steps[i].cost, sizeof( steps[i].cost ) );
+		}
+
+		CRC32_Final( &crc );
+		checksum += crc;
+	}
+
+	return checksum;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Group the areas of the mesh into clusters, find the portals, and compute the cost of crossing each cluster.
+ * Costs are computed as if nothing were blocked, so they only change when the mesh does.
+ */
+void CNavClusterGraph::Build( void )
+{
+	CFastTimer timer;
+	timer.Start();
+
+	Reset();
+
+	m_clusterSize = MAX( nav_cluster_size.GetFloat(), 1.0f );
+
+	int idLimit = GetNavAreaIDLimit();
+	m_areaCluster.SetCount( idLimit );
+	m_areaPortal.SetCount( idLimit );
+	for( int i=0; i<idLimit; ++i )
+	{
+		m_areaCluster[i] = -1;
+		m_areaPortal[i] = -1;
+	}
+
+	AssignClusters();
+	FindPortals();
+
+	for( int c=0; c<m_clusters.Count(); ++c )
+	{
+		ComputeClusterCosts( c );
+	}
+
+	m_meshChecksum = ComputeMeshChecksum();
+	m_isBuilt = true;
+
+	timer.End();
+	DevMsg( "Built %d nav clusters with %d portals in %.2f ms\n", m_clusters.Count(), m_portals.Count(), timer.GetDuration().GetMillisecondsF() );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A cluster is the set of areas reachable from a seed area without leaving the seed's grid cell
+ */
+void CNavClusterGraph::AssignClusters( void )
+{
+	NavClusterStepVector steps;
+	CUtlVector< CNavArea * > stack;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		CNavArea *seed = TheNavAreas[ it ];
+		if ( m_areaCluster[ seed->GetID() ] >= 0 )
+			continue;
+
+		int cellX = (int)floor( seed->GetCenter().x / m_clusterSize );
+		int cellY = (int)floor( seed->GetCenter().y / m_clusterSize );
+
+		int c = m_clusters.AddToTail();
+		m_clusters[c].isDirty = true;
+		m_clusters[c].hasBlockedAreas = false;
+
+		m_areaCluster[ seed->GetID() ] = c;
+		stack.AddToTail( seed );
+
+		while( stack.Count() )
+		{
+			CNavArea *area = stack.Tail();
+			stack.RemoveMultipleFromTail( 1 );
+
+			m_clusters[c].areas.AddToTail( area );
+
+			CollectSteps( area, &steps );
+			for( int i=0; i<steps.Count(); ++i )
+			{
+				CNavArea *adjArea = steps[i].area;
+				if ( m_areaCluster[ adjArea->GetID() ] >= 0 )
+					continue;
+
+				if ( (int)floor( adjArea->GetCenter().x / m_clusterSize ) != cellX ||
+					 (int)floor( adjArea->GetCenter().y / m_clusterSize ) != cellY )
+					continue;
+
+				m_areaCluster[ adjArea->GetID() ] = c;
+				stack.AddToTail( adjArea );
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+int CNavClusterGraph::AddPortal( CNavArea *area )
+{
+	int &portal = m_areaPortal[ area->GetID() ];
+	if ( portal < 0 )
+	{
+		portal = m_portals.AddToTail();
+		m_portals[ portal ].area = area;
+		m_portals[ portal ].cluster = GetCluster( area );
+		m_clusters[ m_portals[ portal ].cluster ].portals.AddToTail( portal );
+	}
+
+	return portal;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Any area with a step into another cluster is a portal, as is the area it steps to
+ */
+void CNavClusterGraph::FindPortals( void )
+{
+	NavClusterStepVector steps;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		CNavArea *area = TheNavAreas[ it ];
+		int cluster = GetCluster( area );
+
+		CollectSteps( area, &steps );
+		for( int i=0; i<steps.Count(); ++i )
+		{
+			int adjCluster = GetCluster( steps[i].area );
+			if ( adjCluster < 0 || adjCluster == cluster )
+				continue;
+
+			int from = AddPortal( area );
+			int to = AddPortal( steps[i].area );
+
+			Edge &edge = m_portals[ from ].crossEdges[ m_portals[ from ].crossEdges.AddToTail() ];
+			edge.portal = to;
+			edge.cost = steps[i].cost;
+		}
+	}
+
+	m_portalCost.SetCount( m_portals.Count() );
+	m_portalParent.SetCount( m_portals.Count() );
+	m_portalMarker.SetCount( m_portals.Count() );
+	for( int i=0; i<m_portals.Count(); ++i )
+	{
+		m_portalMarker[i] = 0;
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavClusterGraph::SearchCluster( CNavArea *source, bool ignoreBlocked, int teamID )
+{
+	if ( m_localDist.Count() != m_areaCluster.Count() )
+	{
+		m_localDist.SetCount( m_areaCluster.Count() );
+		m_localMarker.SetCount( m_areaCluster.Count() );
+		for( int i=0; i<m_localMarker.Count(); ++i )
+		{
+			m_localMarker[i] = 0;
+		}
+		m_localSearch = 0;
+	}
+
+	++m_localSearch;
+	if ( m_localSearch == 0 )
+	{
+		for( int i=0; i<m_localMarker.Count(); ++i )
+		{
+			m_localMarker[i] = 0;
+		}
+		m_localSearch = 1;
+	}
+
+	if ( !ignoreBlocked && source->IsBlocked( teamID ) )
+		return;
+
+	int cluster = GetCluster( source );
+
+	CUtlPriorityQueue< NavClusterQueueEntry > open( 0, 32, NavClusterQueueLess );
+	NavClusterStepVector steps;
+
+	NavClusterQueueEntry entry;
+	entry.cost = 0.0f;
+	entry.index = source->GetID();
+	entry.area = source;
+	m_localDist[ entry.index ] = 0.0f;
+	m_localMarker[ entry.index ] = m_localSearch;
+	open.Insert( entry );
+
+	while( open.Count() )
+	{
+		entry = open.ElementAtHead();
+		open.RemoveAtHead();
+
+		// stale entry - a cheaper one was already expanded
+		if ( entry.cost > m_localDist[ entry.index ] )
+			continue;
+
+		CollectSteps( entry.area, &steps );
+		for( int i=0; i<steps.Count(); ++i )
+		{
+			CNavArea *adjArea = steps[i].area;
+			if ( GetCluster( adjArea ) != cluster )
+				continue;
+
+			if ( !ignoreBlocked && adjArea->IsBlocked( teamID ) )
+				continue;
+
+			unsigned int id = adjArea->GetID();
+			float cost = entry.cost + steps[i].cost;
+			if ( m_localMarker[ id ] == m_localSearch && m_localDist[ id ] <= cost )
+				continue;
+
+			m_localDist[ id ] = cost;
+			m_localMarker[ id ] = m_localSearch;
+
+			NavClusterQueueEntry adjEntry;
+			adjEntry.cost = cost;
+			adjEntry.index = id;
+			adjEntry.area = adjArea;
+			open.Insert( adjEntry );
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavClusterGraph::IsLocallyReached( const CNavArea *area ) const
+{
+	unsigned int id = area->GetID();
+	return id < (unsigned int)m_localMarker.Count() && m_localMarker[ id ] == m_localSearch;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find the cost of crossing the cluster between each pair of its portals, ignoring blocked areas
+ */
+void CNavClusterGraph::ComputeClusterCosts( int cluster )
+{
+	Cluster &c = m_clusters[ cluster ];
+
+	for( int i=0; i<c.portals.Count(); ++i )
+	{
+		Portal &from = m_portals[ c.portals[i] ];
+		from.innerEdges.RemoveAll();
+
+		SearchCluster( from.area, true );
+
+		for( int j=0; j<c.portals.Count(); ++j )
+		{
+			CNavArea *toArea = m_portals[ c.portals[j] ].area;
+			if ( i == j || !IsLocallyReached( toArea ) )
+				continue;
+
+			Edge &edge = from.innerEdges[ from.innerEdges.AddToTail() ];
+			edge.portal = c.portals[j];
+			edge.cost = m_localDist[ toArea->GetID() ];
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavClusterGraph::UpdateDirtyClusters( void )
+{
+	for( int c=0; c<m_clusters.Count(); ++c )
+	{
+		Cluster &cluster = m_clusters[c];
+		if ( !cluster.isDirty )
+			continue;
+
+		cluster.hasBlockedAreas = false;
+		for( int i=0; i<cluster.areas.Count(); ++i )
+		{
+			if ( cluster.areas[i]->IsBlocked( TEAM_ANY ) )
+			{
+				cluster.hasBlockedAreas = true;
+				break;
+			}
+		}
+		cluster.isDirty = false;
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavClusterGraph::OnAreaBlockedChanged( CNavArea *area )
+{
+	int cluster = GetCluster( area );
+	if ( cluster >= 0 && cluster < m_clusters.Count() )
+	{
+		m_clusters[ cluster ].isDirty = true;
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavClusterGraph::BuildCorridor( CNavArea *startArea, CNavArea *goalArea, int teamID, CNavClusterCorridor *corridor )
+{
+	VPROF_BUDGET( "CNavClusterGraph::BuildCorridor", "NextBotSpiky" );
+	Assert( ThreadInMainThread() );
+
+	if ( !m_isBuilt )
+		return false;
+
+	int startCluster = GetCluster( startArea );
+	int goalCluster = GetCluster( goalArea );
+	if ( startCluster < 0 || goalCluster < 0 || startCluster == goalCluster )
+		return false;
+
+	UpdateDirtyClusters();
+
+	++m_portalSearch;
+	if ( m_portalSearch == 0 )
+	{
+		for( int i=0; i<m_portalMarker.Count(); ++i )
+		{
+			m_portalMarker[i] = 0;
+		}
+		m_portalSearch = 1;
+	}
+
+	const Vector &goalPos = goalArea->GetCenter();
+	CUtlPriorityQueue< NavClusterQueueEntry > open( 0, 64, NavClusterQueueLess );
+
+	// enter the portal graph through the portals reachable inside the start cluster
+	SearchCluster( startArea, false, teamID );
+
+	const CUtlVector< int > &startPortals = m_clusters[ startCluster ].portals;
+	for( int i=0; i<startPortals.Count(); ++i )
+	{
+		int p = startPortals[i];
+		CNavArea *area = m_portals[p].area;
+		if ( !IsLocallyReached( area ) )
+			continue;
+
+		m_portalCost[p] = m_localDist[ area->GetID() ];
+		m_portalParent[p] = -1;
+		m_portalMarker[p] = m_portalSearch;
+
+		NavClusterQueueEntry entry;
+		entry.cost = m_portalCost[p] + ( area->GetCenter() - goalPos ).Length();
+		entry.index = p;
+		entry.area = area;
+		open.Insert( entry );
+	}
+
+	// A* over the portals until one in the goal cluster comes off the open list
+	int goalPortal = -1;
+	while( open.Count() )
+	{
+		NavClusterQueueEntry entry = open.ElementAtHead();
+		open.RemoveAtHead();
+
+		int p = entry.index;
+		float costSoFar = m_portalCost[p];
+
+		// stale entry - a cheaper one was already expanded
+		if ( entry.cost > costSoFar + ( entry.area->GetCenter() - goalPos ).Length() )
+			continue;
+
+		if ( m_portals[p].cluster == goalCluster )
+		{
+			goalPortal = p;
+			break;
+		}
+
+		// the precomputed crossing costs ignore blocked areas, so search clusters that have some for this team
+		CUtlVector< Edge > blockedEdges;
+		const Cluster &cluster = m_clusters[ m_portals[p].cluster ];
+		if ( cluster.hasBlockedAreas )
+		{
+			SearchCluster( entry.area, false, teamID );
+			for( int i=0; i<cluster.portals.Count(); ++i )
+			{
+				int q = cluster.portals[i];
+				if ( q == p || !IsLocallyReached( m_portals[q].area ) )
+					continue;
+
+				Edge &edge = blockedEdges[ blockedEdges.AddToTail() ];
+				edge.portal = q;
+				edge.cost = m_localDist[ m_portals[q].area->GetID() ];
+			}
+		}
+
+		for( int pass=0; pass<2; ++pass )
+		{
+			const CUtlVector< Edge > &edges = ( pass == 1 ) ? m_portals[p].crossEdges : ( cluster.hasBlockedAreas ? blockedEdges : m_portals[p].innerEdges );
+			for( int i=0; i<edges.Count(); ++i )
+			{
+				int q = edges[i].portal;
+				CNavArea *area = m_portals[q].area;
+				if ( area->IsBlocked( teamID ) )
+					continue;
+
+				float cost = costSoFar + edges[i].cost;
+				if ( m_portalMarker[q] == m_portalSearch && m_portalCost[q] <= cost )
+					continue;
+
+				m_portalCost[q] = cost;
+				m_portalParent[q] = p;
+				m_portalMarker[q] = m_portalSearch;
+
+				NavClusterQueueEntry adjEntry;
+				adjEntry.cost = cost + ( area->GetCenter() - goalPos ).Length();
+				adjEntry.index = q;
+				adjEntry.area = area;
+				open.Insert( adjEntry );
+			}
+		}
+	}
+
+	if ( goalPortal < 0 )
+		return false;
+
+	corridor->Clear();
+	corridor->AddCluster( startCluster );
+	corridor->AddCluster( goalCluster );
+
+	for( int p = goalPortal; p >= 0; p = m_portalParent[p] )
+	{
+		corridor->AddCluster( m_portals[p].cluster );
+		corridor->m_route.AddToHead( m_portals[p].area );
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Append the hierarchy to a .nav file. Crossing costs never include blocked areas, so what is written
+ * doesn't depend on the state of the map. If editing invalidated the hierarchy nothing is written, and
+ * it is rebuilt when the mesh is next loaded.
+ */
+void CNavClusterGraph::Save( CUtlBuffer &fileBuffer ) const
+{
+	if ( !m_isBuilt )
+		return;
+
+	fileBuffer.PutUnsignedInt( NavClusterMagicNumber );
+	fileBuffer.PutUnsignedInt( NavClusterVersion );
+	fileBuffer.PutFloat( m_clusterSize );
+	fileBuffer.PutUnsignedInt( TheNavAreas.Count() );
+	fileBuffer.PutUnsignedInt( m_meshChecksum );
+
+	fileBuffer.PutUnsignedInt( m_clusters.Count() );
+	for( int c=0; c<m_clusters.Count(); ++c )
+	{
+		const CUtlVector< CNavArea * > &areas = m_clusters[c].areas;
+		fileBuffer.PutUnsignedInt( areas.Count() );
+		for( int i=0; i<areas.Count(); ++i )
+		{
+			fileBuffer.PutUnsignedInt( areas[i]->GetID() );
+		}
+	}
+
+	fileBuffer.PutUnsignedInt( m_portals.Count() );
+	for( int p=0; p<m_portals.Count(); ++p )
+	{
+		const Portal &portal = m_portals[p];
+		fileBuffer.PutUnsignedInt( portal.area->GetID() );
+
+		fileBuffer.PutUnsignedInt( portal.crossEdges.Count() );
+		for( int i=0; i<portal.crossEdges.Count(); ++i )
+		{
+			fileBuffer.PutUnsignedInt( portal.crossEdges[i].portal );
+			fileBuffer.PutFloat( portal.crossEdges[i].cost );
+		}
+
+		fileBuffer.PutUnsignedInt( portal.innerEdges.Count() );
+		for( int i=0; i<portal.innerEdges.Count(); ++i )
+		{
+			fileBuffer.PutUnsignedInt( portal.innerEdges[i].portal );
+			fileBuffer.PutFloat( portal.innerEdges[i].cost );
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Read the hierarchy cached at the end of a .nav file. Must be called after the areas have been
+ * added to the mesh, since areas are stored by ID. The mesh checksum can only be checked once
+ * connections are bound, in PostLoad().
+ */
+bool CNavClusterGraph::Load( CUtlBuffer &fileBuffer )
+{
+	Reset();
+
+	if ( fileBuffer.GetBytesRemaining() < (int)( 4 * sizeof(unsigned int) ) )
+		return false;
+
+	if ( fileBuffer.GetUnsignedInt() != NavClusterMagicNumber )
+		return false;
+
+	if ( fileBuffer.GetUnsignedInt() != NavClusterVersion )
+		return false;
+
+	m_clusterSize = fileBuffer.GetFloat();
+	if ( m_clusterSize != MAX( nav_cluster_size.GetFloat(), 1.0f ) )
+	{
+		DevMsg( "Nav clusters in file use a cluster size of %g, rebuilding\n", m_clusterSize );
+		return false;
+	}
+
+	unsigned int areaCount = fileBuffer.GetUnsignedInt();
+	if ( areaCount != (unsigned int)TheNavAreas.Count() )
+		return false;
+
+	unsigned int meshChecksum = fileBuffer.GetUnsignedInt();
+
+	int idLimit = GetNavAreaIDLimit();
+	m_areaCluster.SetCount( idLimit );
+	m_areaPortal.SetCount( idLimit );
+	for( int i=0; i<idLimit; ++i )
+	{
+		m_areaCluster[i] = -1;
+		m_areaPortal[i] = -1;
+	}
+
+	bool isValid = true;
+	unsigned int assigned = 0;
+
+	unsigned int clusterCount = fileBuffer.GetUnsignedInt();
+	if ( clusterCount > areaCount )
+	{
+		Reset();
+		return false;
+	}
+
+	m_clusters.SetCount( clusterCount );
+	for( unsigned int c=0; c<clusterCount && isValid; ++c )
+	{
+		m_clusters[c].isDirty = true;
+		m_clusters[c].hasBlockedAreas = false;
+
+		unsigned int count = fileBuffer.GetUnsignedInt();
+		for( unsigned int i=0; i<count && isValid; ++i )
+		{
+			CNavArea *area = TheNavMesh->GetNavAreaByID( fileBuffer.GetUnsignedInt() );
+			if ( area == NULL || m_areaCluster[ area->GetID() ] >= 0 || !fileBuffer.IsValid() )
+			{
+				isValid = false;
+				break;
+			}
+
+			m_areaCluster[ area->GetID() ] = c;
+			m_clusters[c].areas.AddToTail( area );
+			++assigned;
+		}
+	}
+
+	unsigned int portalCount = isValid ? fileBuffer.GetUnsignedInt() : 0;
+	if ( portalCount > areaCount )
+	{
+		isValid = false;
+	}
+
+	for( unsigned int p=0; p<portalCount && isValid; ++p )
+	{
+		CNavArea *area = TheNavMesh->GetNavAreaByID( fileBuffer.GetUnsignedInt() );
+		if ( area == NULL || GetCluster( area ) < 0 || m_areaPortal[ area->GetID() ] >= 0 || !fileBuffer.IsValid() )
+		{
+			isValid = false;
+			break;
+		}
+
+		AddPortal( area );
+
+		for( int pass=0; pass<2 && isValid; ++pass )
+		{
+			CUtlVector< Edge > &edges = ( pass == 0 ) ? m_portals[p].crossEdges : m_portals[p].innerEdges;
+
+			unsigned int edgeCount = fileBuffer.GetUnsignedInt();
+			if ( edgeCount > portalCount || !fileBuffer.IsValid() )
+			{
+				isValid = false;
+				break;
+			}
+
+			edges.SetCount( edgeCount );
+			for( unsigned int i=0; i<edgeCount; ++i )
+			{
+				edges[i].portal = fileBuffer.GetUnsignedInt();
+				edges[i].cost = fileBuffer.GetFloat();
+
+				if ( (unsigned int)edges[i].portal >= portalCount )
+				{
+					isValid = false;
+				}
+			}
+		}
+	}
+
+	if ( !isValid || assigned != areaCount || !fileBuffer.IsValid() )
+	{
+		DevMsg( "Nav clusters in file don't match the mesh, rebuilding\n" );
+		Reset();
+		return false;
+	}
+
+	m_portalCost.SetCount( m_portals.Count() );
+	m_portalParent.SetCount( m_portals.Count() );
+	m_portalMarker.SetCount( m_portals.Count() );
+	for( int i=0; i<m_portals.Count(); ++i )
+	{
+		m_portalMarker[i] = 0;
+	}
+
+	m_meshChecksum = meshChecksum;
+	m_isBuilt = true;
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavClusterGraph::PostLoad( void )
+{
+	if ( m_isBuilt && m_meshChecksum != ComputeMeshChecksum() )
+	{
+		DevMsg( "Nav clusters in file were built from a different mesh, rebuilding\n" );
+		Reset();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavClusterGraph::Report( void ) const
+{
+	if ( !m_isBuilt )
+	{
+		Msg( "Nav clusters are not built\n" );
+		return;
+	}
+
+	int innerEdges = 0;
+	int crossEdges = 0;
+	for( int p=0; p<m_portals.Count(); ++p )
+	{
+		innerEdges += m_portals[p].innerEdges.Count();
+		crossEdges += m_portals[p].crossEdges.Count();
+	}
+
+	int largest = 0;
+	int blocked = 0;
+	for( int c=0; c<m_clusters.Count(); ++c )
+	{
+		largest = MAX( largest, m_clusters[c].areas.Count() );
+		if ( m_clusters[c].hasBlockedAreas )
+		{
+			++blocked;
+		}
+	}
+
+	Msg( "%d nav areas in %d clusters of size %g (%.1f areas avg, %d largest, %d with blocked areas)\n",
+		TheNavAreas.Count(), m_clusters.Count(), m_clusterSize, m_clusters.Count() ? (float)TheNavAreas.Count() / m_clusters.Count() : 0.0f, largest, blocked );
+	Msg( "%d portals, %d edges inside clusters, %d between clusters\n", m_portals.Count(), innerEdges, crossEdges );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_build_clusters, "Rebuild the nav area clusters used by hierarchical pathing (they are rebuilt when a mesh without them is loaded).", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavClusters.Build();
+	TheNavClusters.Report();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_cluster_report, "Print statistics about the nav area clusters used by hierarchical pathing.", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavClusters.Report();
+}
@@ -0,0 +1,212 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_hierarchy.h
+// Hierarchical path planning over the Navigation Mesh.
+//
+// Areas are grouped into clusters - connected pieces of a coarse grid - and the areas on
+// the borders between clusters ("portals") form a much smaller graph, with the cost of
+// crossing each cluster between its portals precomputed. A long path is first routed
+// through the portal graph, and NavAreaBuildPath() then only refines it through the
+// clusters along that route.
+
+#ifndef _NAV_HIERARCHY_H_
+#define _NAV_HIERARCHY_H_
+
+#include "nav_pathfind.h"
+#include "bitvec.h"
+
+class CUtlBuffer;
+
+extern ConVar nav_hierarchical_path;
+extern ConVar nav_hierarchical_path_min_distance;
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The clusters a coarse route passes through, and the portal areas along it
+ */
+class CNavClusterCorridor
+{
+public:
+	void Clear( void );
+	void AddCluster( int cluster );
+	bool ContainsCluster( int cluster ) const	{ return cluster >= 0 && cluster < m_clusters.GetNumBits() && m_clusters.IsBitSet( cluster ); }
+	bool Contains( const CNavArea *area ) const;
+
+	CUtlVector< CNavArea * > m_route;			// portal areas from start to goal
+
+private:
+	CVarBitVec m_clusters;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The cluster/portal abstraction of the mesh. Built when the mesh is loaded (or read from the .nav).
+ * Crossing costs are computed as if nothing were blocked; clusters that contain blocked areas are
+ * searched directly, for the querying team, when a route passes through them.
+ */
+class CNavClusterGraph
+{
+public:
+	CNavClusterGraph( void );
+
+	void Reset( void );
+	void Build( void );										// group the areas of TheNavMesh into clusters and compute portal costs
+	bool IsBuilt( void ) const			{ return m_isBuilt; }
+	void Invalidate( void );								// areas were added, removed, or reconnected - hierarchy is unusable until rebuilt
+
+	void Save( CUtlBuffer &fileBuffer ) const;				// writes nothing if the hierarchy isn't built
+	bool Load( CUtlBuffer &fileBuffer );					// returns false if there is no cached hierarchy, or it doesn't match the mesh
+	void PostLoad( void );									// after the mesh binds its connections - drop a loaded hierarchy built from a different mesh
+
+	int GetClusterCount( void ) const	{ return m_clusters.Count(); }
+	int GetPortalCount( void ) const	{ return m_portals.Count(); }
+	int GetCluster( const CNavArea *area ) const;			// -1 if area isn't in a cluster
+
+	void OnAreaBlockedChanged( CNavArea *area );			// the area's cluster may have gained or lost blocked areas
+
+	/**
+	 * Route from startArea to goalArea through the portal graph, avoiding areas blocked for teamID,
+	 * and collect the clusters along it. Returns false if the areas share a cluster or no route exists.
+	 * Main thread only, since it shares search scratch space between calls.
+	 */
+	bool BuildCorridor( CNavArea *startArea, CNavArea *goalArea, int teamID, CNavClusterCorridor *corridor );
+
+	void Report( void ) const;								// print cluster and portal statistics
+
+private:
+	struct Edge
+	{
+		int portal;
+		float cost;
+	};
+
+	struct Portal
+	{
+		CNavArea *area;
+		int cluster;
+		CUtlVector< Edge > crossEdges;						// to portals in other clusters
+		CUtlVector< Edge > innerEdges;						// to portals in the same cluster
+	};
+
+	struct Cluster
+	{
+		CUtlVector< CNavArea * > areas;
+		CUtlVector< int > portals;
+		bool isDirty;										// hasBlockedAreas needs recomputing
+		bool hasBlockedAreas;								// innerEdges of the portals can't be used as is
+	};
+
+	void AssignClusters( void );
+	void FindPortals( void );
+	void ComputeClusterCosts( int cluster );
+	void UpdateDirtyClusters( void );
+	int AddPortal( CNavArea *area );
+	static unsigned int ComputeMeshChecksum( void );
+
+	// Dijkstra from 'source' through the areas of its cluster, skipping areas blocked for teamID unless
+	// ignoreBlocked is set. Distances are left in m_localDist.
+	void SearchCluster( CNavArea *source, bool ignoreBlocked, int teamID = TEAM_ANY );
+	bool IsLocallyReached( const CNavArea *area ) const;
+
+	bool m_isBuilt;
+	float m_clusterSize;									// nav_cluster_size when built
+	unsigned int m_meshChecksum;							// ComputeMeshChecksum() of the mesh the hierarchy was built from
+
+	CUtlVector< Cluster > m_clusters;
+	CUtlVector< Portal > m_portals;
+	CUtlVector< int > m_areaCluster;						// indexed by area ID
+	CUtlVector< int > m_areaPortal;							// indexed by area ID, -1 if not a portal
+
+	// scratch for SearchCluster()
+	CUtlVector< float > m_localDist;						// indexed by area ID
+	CUtlVector< unsigned int > m_localMarker;
+	unsigned int m_localSearch;
+
+	// scratch for BuildCorridor()
+	CUtlVector< float > m_portalCost;
+	CUtlVector< int > m_portalParent;
+	CUtlVector< unsigned int > m_portalMarker;
+	unsigned int m_portalSearch;
+};
+
+extern CNavClusterGraph TheNavClusters;
+
+
+//--------------------------------------------------------------------------------------------------------------
+inline int CNavClusterGraph::GetCluster( const CNavArea *area ) const
+{
+	unsigned int id = area->GetID();
+	return ( id < (unsigned int)m_areaCluster.Count() ) ? m_areaCluster[ id ] : -1;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavClusterCorridor::Contains( const CNavArea *area ) const
+{
+	return ContainsCluster( TheNavClusters.GetCluster( area ) );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Wraps a NavAreaBuildPath() cost functor, making every area outside the corridor a dead end
+ */
+template< typename CostFunctor >
+class NavCorridorCost
+{
+public:
+	NavCorridorCost( CostFunctor &costFunc, const CNavClusterCorridor &corridor ) : m_costFunc( costFunc ), m_corridor( corridor )
+	{
+	}
+
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+	{
+		if ( fromArea && !m_corridor.Contains( area ) )
+			return -1.0f;
+
+		return m_costFunc( area, fromArea, ladder, elevator, length );
+	}
+
+private:
+	CostFunctor &m_costFunc;
+	const CNavClusterCorridor &m_corridor;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Same contract as NavAreaBuildPath(). When the goal is far enough away, the path is first routed
+ * through the cluster graph and the A* search is confined to the clusters along that route. If the
+ * confined search fails (the cost functor may refuse areas the coarse route used), the full search
+ * is run instead, so a path is found whenever NavAreaBuildPath() alone would find one, although it
+ * can be slightly longer than the optimal path.
+ */
+template< typename CostFunctor >
+bool NavAreaBuildPathHierarchical( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	if ( nav_hierarchical_path.GetBool() && startArea && goalArea && !ignoreNavBlockers && TheNavClusters.IsBuilt() )
+	{
+		float minRange = nav_hierarchical_path_min_distance.GetFloat();
+		if ( ( startArea->GetCenter() - goalArea->GetCenter() ).IsLengthGreaterThan( minRange ) )
+		{
+			CNavClusterCorridor corridor;
+			if ( TheNavClusters.BuildCorridor( startArea, goalArea, teamID, &corridor ) )
+			{
+				NavCorridorCost< CostFunctor > corridorCost( costFunc, corridor );
+				if ( NavAreaBuildPath( startArea, goalArea, goalPos, corridorCost, closestArea, maxPathLength, teamID, ignoreNavBlockers ) )
+					return true;
+			}
+		}
+	}
+
+	return NavAreaBuildPath( startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+}
+
+
+#endif // _NAV_HIERARCHY_H_
@@ -21,6 +21,8 @@
 #endif
 #include "functorutils.h"
 #include "nav_pathfind.h"
+#include "nav_hierarchy.h"
+#include "nav_visibility.h"
 
 #ifdef TF_DLL
 #include "tf/nav_mesh/tf_nav_area.h"
@@ -53,6 +55,8 @@ ConVar nav_show_func_nav_avoid( "nav_show_func_nav_avoid", "0", FCVAR_GAMEDLL |
 ConVar nav_show_func_nav_prefer( "nav_show_func_nav_prefer", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "Show areas of designer-placed bot preference due to func_nav_prefer entities" );
 ConVar nav_show_func_nav_prerequisite( "nav_show_func_nav_prerequisite", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "Show areas of designer-placed bot preference due to func_nav_prerequisite entities" );
 ConVar nav_max_vis_delta_list_length( "nav_max_vis_delta_list_length", "64", FCVAR_CHEAT );
+ConVar nav_area_index( "nav_area_index", "1", FCVAR_GAMEDLL | FCVAR_CHEAT, "Look up nav areas by position with the fine grained area index instead of the area grid." );
+ConVar nav_area_index_cell_size( "nav_area_index_cell_size", "64", FCVAR_GAMEDLL | FCVAR_CHEAT, "Size of the cells of the nav area index. Takes effect when the index is rebuilt." );
 
 extern ConVar nav_show_potentially_visible;
 
@@ -66,6 +70,10 @@ CNavMesh::CNavMesh( void )
 {
 	m_spawnName = NULL;
 	m_gridCellSize = 300.0f;
+	m_areaIndexCellSize = 64.0f;
+	m_areaIndexSizeX = 0;
+	m_areaIndexSizeY = 0;
+	m_isAreaIndexValid = false;
 	m_editMode = NORMAL;
 	m_bQuitWhenFinished = false;
 	m_hostThreadModeRestoreValue = 0;
@@ -186,6 +194,9 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 
 		TheNavAreas.RemoveAll();
 
+		TheNavClusters.Reset();
+		TheNavVisibility.Reset();
+
 		CNavArea::m_isReset = false;
 
 
@@ -212,6 +223,10 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 		m_grid.RemoveAll();
 		m_gridSizeX = 0;
 		m_gridSizeY = 0;
+
+		m_areaIndex.Purge();
+		m_areaIndexCellStart.Purge();
+		m_isAreaIndexValid = false;
 	}
 
 	// clear the hash table
@@ -262,6 +277,11 @@ void CNavMesh::Update( void )
 		return; // don't bother trying to draw stuff while we're generating
 	}
 
+	if ( !m_isAreaIndexValid )
+	{
+		BuildAreaIndex();
+	}
+
 	// Test all of the areas for blocked status
 	if ( m_updateBlockedAreasTimer.HasStarted() && m_updateBlockedAreasTimer.IsElapsed() )
 	{
@@ -514,6 +534,10 @@ void CNavMesh::AddNavArea( CNavArea *area )
 		m_transientAreas.AddToTail( area );
 	}
 
+	TheNavClusters.Invalidate();
+	TheNavVisibility.OnAreaAdded( area );
+	InvalidateAreaIndex();
+
 	++m_areaCount;
 }
 
@@ -568,6 +592,10 @@ void CNavMesh::RemoveNavArea( CNavArea *area )
 	m_avoidanceObstacleAreas.FindAndRemove( area );
 	m_blockedAreas.FindAndRemove( area );
 
+	TheNavClusters.Invalidate();
+	TheNavVisibility.OnAreaRemoved( area );
+	InvalidateAreaIndex();
+
 	--m_areaCount;
 }
 
@@ -689,49 +717,162 @@ inline void CNavMesh::GridToWorld( int gridX, int gridY, Vector *pos ) const
 
 //--------------------------------------------------------------------------------------------------------------
 /**
- * Given a position, return the nav area that IsOverlapping and is *immediately* beneath it
+ * Build the fine grained index of area extents over the same world region as the grid
  */
-CNavArea *CNavMesh::GetNavArea( const Vector &pos, float beneathLimit ) const
+void CNavMesh::BuildAreaIndex( void )
 {
-	VPROF_BUDGET( "CNavMesh::GetNavArea", "NextBot"  );
+	VPROF_BUDGET( "CNavMesh::BuildAreaIndex", "NextBot" );
+
+	m_areaIndex.RemoveAll();
+	m_areaIndexCellStart.RemoveAll();
+	m_isAreaIndexValid = false;
 
 	if ( !m_grid.Count() )
-		return NULL;
+		return;
+
+	m_areaIndexCellSize = MAX( nav_area_index_cell_size.GetFloat(), 16.0f );
+	m_areaIndexSizeX = (int)ceil( m_gridSizeX * m_gridCellSize / m_areaIndexCellSize );
+	m_areaIndexSizeY = (int)ceil( m_gridSizeY * m_gridCellSize / m_areaIndexCellSize );
+
+	// count the areas overlapping each cell, then fill the cells in area order
+	int cellCount = m_areaIndexSizeX * m_areaIndexSizeY;
+	m_areaIndexCellStart.SetCount( cellCount + 1 );
+	V_memset( m_areaIndexCellStart.Base(), 0, m_areaIndexCellStart.Count() * sizeof( int ) );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+		int loX = WorldToAreaIndexX( area->GetCorner( NORTH_WEST ).x );
+		int loY = WorldToAreaIndexY( area->GetCorner( NORTH_WEST ).y );
+		int hiX = WorldToAreaIndexX( area->GetCorner( SOUTH_EAST ).x );
+		int hiY = WorldToAreaIndexY( area->GetCorner( SOUTH_EAST ).y );
+
+		for( int y = loY; y <= hiY; ++y )
+		{
+			for( int x = loX; x <= hiX; ++x )
+			{
+				++m_areaIndexCellStart[ x + y*m_areaIndexSizeX + 1 ];
+			}
+		}
+	}
+
+	for( int i=0; i<cellCount; ++i )
+	{
+		m_areaIndexCellStart[ i+1 ] += m_areaIndexCellStart[ i ];
+	}
+
+	m_areaIndex.SetCount( m_areaIndexCellStart[ cellCount ] );
+
+	CUtlVector< int > fill;
+	fill.CopyArray( m_areaIndexCellStart.Base(), cellCount );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		CNavArea *area = TheNavAreas[ it ];
+		const Vector &nw = area->GetCorner( NORTH_WEST );
+		const Vector &se = area->GetCorner( SOUTH_EAST );
+
+		NavAreaIndexEntry entry;
+		entry.loX = nw.x;
+		entry.loY = nw.y;
+		entry.hiX = se.x;
+		entry.hiY = se.y;
+		entry.area = area;
+
+		int loX = WorldToAreaIndexX( nw.x );
+		int loY = WorldToAreaIndexY( nw.y );
+		int hiX = WorldToAreaIndexX( se.x );
+		int hiY = WorldToAreaIndexY( se.y );
+
+		for( int y = loY; y <= hiY; ++y )
+		{
+			for( int x = loX; x <= hiX; ++x )
+			{
+				m_areaIndex[ fill[ x + y*m_areaIndexSizeX ]++ ] = entry;
+			}
+		}
+	}
+
+	m_isAreaIndexValid = true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Collect the areas whose 2D extents contain the given position, as CNavArea::IsOverlapping( pos ) tests them
+ */
+void CNavMesh::CollectAreasOverlapping( const Vector &pos, NavAreaOverlapVector *areas ) const
+{
+	if ( m_isAreaIndexValid && nav_area_index.GetBool() )
+	{
+		int cell = WorldToAreaIndexX( pos.x ) + WorldToAreaIndexY( pos.y ) * m_areaIndexSizeX;
+		int end = m_areaIndexCellStart[ cell+1 ];
+		for( int i = m_areaIndexCellStart[ cell ]; i < end; ++i )
+		{
+			const NavAreaIndexEntry &entry = m_areaIndex[i];
+			if ( pos.x >= entry.loX && pos.x <= entry.hiX && pos.y >= entry.loY && pos.y <= entry.hiY )
+			{
+				areas->AddToTail( entry.area );
+			}
+		}
+		return;
+	}
 
 	// get list in cell that contains position
 	int x = WorldToGridX( pos.x );
 	int y = WorldToGridY( pos.y );
 	NavAreaVector *areaVector = &m_grid[ x + y*m_gridSizeX ];
 
-	// search cell list to find correct area
+	FOR_EACH_VEC( (*areaVector), it )
+	{
+		CNavArea *area = (*areaVector)[ it ];
+		if ( area->IsOverlapping( pos ) )
+		{
+			areas->AddToTail( area );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Given a position, return the nav area that IsOverlapping and is *immediately* beneath it
+ */
+CNavArea *CNavMesh::GetNavArea( const Vector &pos, float beneathLimit ) const
+{
+	VPROF_BUDGET( "CNavMesh::GetNavArea", "NextBot"  );
+
+	if ( !m_grid.Count() )
+		return NULL;
+
+	// search the areas containing the position to find the correct one
 	CNavArea *use = NULL;
 	float useZ = -99999999.9f;
 	Vector testPos = pos + Vector( 0, 0, 5 );
 
-	FOR_EACH_VEC( (*areaVector), it )
+	NavAreaOverlapVector overlapping;
+	CollectAreasOverlapping( testPos, &overlapping );
+
+	FOR_EACH_VEC( overlapping, it )
 	{
-		CNavArea *area = (*areaVector)[ it ];
+		CNavArea *area = overlapping[ it ];
 
-		// check if position is within 2D boundaries of this area
-		if (area->IsOverlapping( testPos ))
-		{
-			// project position onto area to get Z
-			float z = area->GetZ( testPos );
+		// project position onto area to get Z
+		float z = area->GetZ( testPos );
 
-			// if area is above us, skip it
-			if (z > testPos.z)
-				continue;
+		// if area is above us, skip it
+		if (z > testPos.z)
+			continue;
 
-			// if area is too far below us, skip it
-			if (z < pos.z - beneathLimit)
-				continue;
+		// if area is too far below us, skip it
+		if (z < pos.z - beneathLimit)
+			continue;
 
-			// if area is higher than the one we have, use this instead
-			if (z > useZ)
-			{
-				use = area;
-				useZ = z;
-			}
+		// if area is higher than the one we have, use this instead
+		if (z > useZ)
+		{
+			use = area;
+			useZ = z;
 		}
 	}
 
@@ -757,32 +898,49 @@ CNavArea *CNavMesh::GetNavArea( CBaseEntity *pEntity, int nFlags, float flBeneat
 	{
 		// Check if we're still in the last area
 		CNavArea *pLastNavArea = pBCC->GetLastKnownArea();
-		if ( pLastNavArea && pLastNavArea->IsOverlapping( testPos ) )
+		if ( pLastNavArea )
 		{
-			float flZ = pLastNavArea->GetZ( testPos );
-			if ( ( flZ <= testPos.z + StepHeight ) && ( flZ >= testPos.z - StepHeight ) )
-				return pLastNavArea;
+			if ( pLastNavArea->IsOverlapping( testPos ) )
+			{
+				float flZ = pLastNavArea->GetZ( testPos );
+				if ( ( flZ <= testPos.z + StepHeight ) && ( flZ >= testPos.z - StepHeight ) )
+					return pLastNavArea;
+			}
+
+			// most of the time we have just stepped into an area adjacent to the last one
+			bool bSkipBlocked = ( ( nFlags & GETNAVAREA_ALLOW_BLOCKED_AREAS ) == 0 );
+			for ( int dir = 0; dir < NUM_DIRECTIONS; ++dir )
+			{
+				const NavConnectVector *pAdjacent = pLastNavArea->GetAdjacentAreas( (NavDirType)dir );
+				FOR_EACH_VEC( (*pAdjacent), it )
+				{
+					CNavArea *pAdjArea = (*pAdjacent)[ it ].area;
+					if ( !pAdjArea->IsOverlapping( testPos ) )
+						continue;
+
+					if ( bSkipBlocked && pAdjArea->IsBlocked( pEntity->GetTeamNumber() ) )
+						continue;
+
+					float flZ = pAdjArea->GetZ( testPos );
+					if ( ( flZ <= testPos.z + StepHeight ) && ( flZ >= testPos.z - StepHeight ) )
+						return pAdjArea;
+				}
+			}
 		}
 		flStepHeight = StepHeight;
 	}
 
-	// get list in cell that contains position
-	int x = WorldToGridX( testPos.x );
-	int y = WorldToGridY( testPos.y );
-	NavAreaVector *areaVector = &m_grid[ x + y*m_gridSizeX ];
-
-	// search cell list to find correct area
+	// search the areas containing the position to find the correct one
 	CNavArea *use = NULL;
 	float useZ = -99999999.9f;
 
+	NavAreaOverlapVector overlapping;
+	CollectAreasOverlapping( testPos, &overlapping );
+
 	bool bSkipBlockedAreas = ( ( nFlags & GETNAVAREA_ALLOW_BLOCKED_AREAS ) == 0 );
-	FOR_EACH_VEC( (*areaVector), it )
+	FOR_EACH_VEC( overlapping, it )
 	{
-		CNavArea *pArea = (*areaVector)[ it ];
-
-		// check if position is within 2D boundaries of this area
-		if ( !pArea->IsOverlapping( testPos ) )
-			continue;
+		CNavArea *pArea = overlapping[ it ];
 
 		// don't consider blocked areas
 		if ( bSkipBlockedAreas && pArea->IsBlocked( pEntity->GetTeamNumber() ) )
@@ -878,11 +1036,18 @@ CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDi
 	}
 
 
+	// search the area index if it's up to date, since its cells are smaller and store area extents
+	bool useIndex = m_isAreaIndexValid && nav_area_index.GetBool();
+	float cellSize = useIndex ? m_areaIndexCellSize : m_gridCellSize;
+	int sizeX = useIndex ? m_areaIndexSizeX : m_gridSizeX;
+	int sizeY = useIndex ? m_areaIndexSizeY : m_gridSizeY;
+
 	// get list in cell that contains position
-	int originX = WorldToGridX( pos.x );
-	int originY = WorldToGridY( pos.y );
+	int originX = useIndex ? WorldToAreaIndexX( pos.x ) : WorldToGridX( pos.x );
+	int originY = useIndex ? WorldToAreaIndexY( pos.y ) : WorldToGridY( pos.y );
 
-	int shiftLimit = ceil(maxDist / m_gridCellSize);
+	int maxShift = ceil(maxDist / cellSize);
+	int shiftLimit = maxShift;
 
 	//
 	// Search in increasing rings out from origin, starting with cell
@@ -895,12 +1060,12 @@ CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDi
 	{
 		for( int x = originX - shift; x <= originX + shift; ++x )
 		{
-			if ( x < 0 || x >= m_gridSizeX )
+			if ( x < 0 || x >= sizeX )
 				continue;
 
 			for( int y = originY - shift; y <= originY + shift; ++y )
 			{
-				if ( y < 0 || y >= m_gridSizeY )
+				if ( y < 0 || y >= sizeY )
 					continue;
 
 				// only check these areas if we're on the outer edge of our spiral
@@ -910,12 +1075,28 @@ CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDi
 					 y < originY + shift )
 					continue;
 
-				NavAreaVector *areaVector = &m_grid[ x + y*m_gridSizeX ];
+				int cell = x + y*sizeX;
+				int cellCount = useIndex ? m_areaIndexCellStart[ cell+1 ] - m_areaIndexCellStart[ cell ] : m_grid[ cell ].Count();
 
 				// find closest area in this cell
-				FOR_EACH_VEC( (*areaVector), it )
+				for( int it=0; it<cellCount; ++it )
 				{
-					CNavArea *area = (*areaVector)[ it ];
+					CNavArea *area;
+					if ( useIndex )
+					{
+						// the closest point on the area can't be nearer than its 2D extent
+						const NavAreaIndexEntry &entry = m_areaIndex[ m_areaIndexCellStart[ cell ] + it ];
+						float dx = MAX( MAX( entry.loX - pos.x, pos.x - entry.hiX ), 0.0f );
+						float dy = MAX( MAX( entry.loY - pos.y, pos.y - entry.hiY ), 0.0f );
+						if ( dx*dx + dy*dy >= closeDistSq )
+							continue;
+
+						area = entry.area;
+					}
+					else
+					{
+						area = m_grid[ cell ][ it ];
+					}
 
 					// skip if we've already visited this area
 					if ( area->m_nearNavSearchMarker == searchMarker )
@@ -986,8 +1167,16 @@ CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDi
 					closeDistSq = distSq;
 					close = area;
 
-					// look one more step outwards
-					shiftLimit = shift+1;
+					if ( useIndex )
+					{
+						// a ring of cells is at least (shift-1) cells away, so stop at the first one that is too far
+						shiftLimit = MIN( maxShift, (int)( FastSqrt( closeDistSq ) / cellSize ) + 1 );
+					}
+					else
+					{
+						// look one more step outwards
+						shiftLimit = shift+1;
+					}
 				}
 			}
 		}
@@ -1021,6 +1210,121 @@ CNavArea *CNavMesh::GetNearestNavArea( CBaseEntity *pEntity, int nFlags, float m
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Time GetNavArea() and GetNearestNavArea() at random positions, with the area index and with the area grid.
+ * Most positions are a little above a random area, the rest are anywhere within the extent of the mesh.
+ */
+CON_COMMAND_F( nav_bench_area_lookup, "Time nav area lookups by position with and without the area index. Usage: nav_bench_area_lookup [lookups] [seed]", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int areaCount = TheNavAreas.Count();
+	if ( areaCount == 0 )
+	{
+		Msg( "nav_bench_area_lookup: no navigation mesh loaded\n" );
+		return;
+	}
+
+	int count = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 100000;
+
+	CUniformRandomStream random;
+	random.SetSeed( ( args.ArgC() > 2 ) ? atoi( args[2] ) : 0 );
+
+	Extent meshExtent;
+	meshExtent.Init();
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		Extent areaExtent;
+		TheNavAreas[ it ]->GetExtent( &areaExtent );
+		meshExtent.Encompass( areaExtent );
+	}
+
+	CUtlVector< Vector > positions;
+	positions.SetCount( count );
+	for( int i=0; i<count; ++i )
+	{
+		if ( random.RandomInt( 0, 3 ) )
+		{
+			positions[i] = TheNavAreas[ random.RandomInt( 0, areaCount - 1 ) ]->GetRandomPoint();
+			positions[i].z += random.RandomFloat( 0.0f, HalfHumanHeight );
+		}
+		else
+		{
+			positions[i].x = random.RandomFloat( meshExtent.lo.x, meshExtent.hi.x );
+			positions[i].y = random.RandomFloat( meshExtent.lo.y, meshExtent.hi.y );
+			positions[i].z = random.RandomFloat( meshExtent.lo.z, meshExtent.hi.z );
+		}
+	}
+
+	// nearest area lookups trace to the ground, so time fewer of them
+	int nearestCount = MAX( count / 10, 1 );
+
+	if ( !TheNavMesh->IsAreaIndexValid() )
+	{
+		TheNavMesh->BuildAreaIndex();
+	}
+
+	bool wasIndexed = nav_area_index.GetBool();
+
+	CUtlVector< CNavArea * > found[2];
+	double lookupMS[2];
+	double nearestMS[2];
+	for( int pass=0; pass<2; ++pass )
+	{
+		// pass 0 uses the grid, pass 1 the index
+		nav_area_index.SetValue( pass );
+		found[ pass ].SetCount( count );
+
+		CFastTimer timer;
+		timer.Start();
+		for( int i=0; i<count; ++i )
+		{
+			found[ pass ][i] = TheNavMesh->GetNavArea( positions[i] );
+		}
+		timer.End();
+		lookupMS[ pass ] = timer.GetDuration().GetMillisecondsF();
+
+		timer.Start();
+		for( int i=0; i<nearestCount; ++i )
+		{
+			TheNavMesh->GetNearestNavArea( positions[i], false, 500.0f, false, false );
+		}
+		timer.End();
+		nearestMS[ pass ] = timer.GetDuration().GetMillisecondsF();
+	}
+
+	nav_area_index.SetValue( wasIndexed );
+
+	int onMesh = 0;
+	int mismatches = 0;
+	for( int i=0; i<count; ++i )
+	{
+		if ( found[1][i] )
+		{
+			++onMesh;
+		}
+
+		if ( found[0][i] != found[1][i] )
+		{
+			++mismatches;
+		}
+	}
+
+	Msg( "nav_bench_area_lookup: %d positions on %d areas, %d on the mesh\n", count, areaCount, onMesh );
+	Msg( "  GetNavArea:        grid %.3f ms (%.3f us each), index %.3f ms (%.3f us each)\n",
+		 lookupMS[0], 1000.0 * lookupMS[0] / count, lookupMS[1], 1000.0 * lookupMS[1] / count );
+	Msg( "  GetNearestNavArea: grid %.3f ms (%.3f us each), index %.3f ms (%.3f us each) over %d positions\n",
+		 nearestMS[0], 1000.0 * nearestMS[0] / nearestCount, nearestMS[1], 1000.0 * nearestMS[1] / nearestCount, nearestCount );
+	if ( mismatches )
+	{
+		// overlapping areas within the same height range may be returned in a different order
+		Warning( "  %d lookups found a different area with the index\n", mismatches );
+	}
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Given an ID, return the associated area
@@ -3361,6 +3665,8 @@ void CNavMesh::OnAreaBlocked( CNavArea *area )
 	{
 		m_blockedAreas.AddToTail( area );
 	}
+
+	TheNavClusters.OnAreaBlockedChanged( area );
 }
 
 
@@ -3369,6 +3675,8 @@ void CNavMesh::OnAreaBlocked( CNavArea *area )
 void CNavMesh::OnAreaUnblocked( CNavArea *area )
 {
 	m_blockedAreas.FindAndRemove( area );
+
+	TheNavClusters.OnAreaBlockedChanged( area );
 }
 
 
@@ -3450,6 +3758,8 @@ void CNavMesh::BeginVisibilityComputations( void )
 		CNavArea *area = TheNavAreas[ it ];
 		area->ResetPotentiallyVisibleAreas();
 	}
+
+	TheNavVisibility.Reset();
 }
 
 
@@ -3543,4 +3853,6 @@ void CNavMesh::EndVisibilityComputations( void )
 	}
 
 	Msg( "NavMesh Visibility List Lengths:  min = %d, avg = %d, max = %d\n", minVisLength, avgVisLength, maxVisLength );
+
+	TheNavVisibility.Build();
 }
@@ -31,6 +31,8 @@
 class CNavArea;
 class CBaseEntity; 
 class CBreakable;
+struct NavSampleStep;
+struct NavAreaCandidate;
 
 extern ConVar nav_edit;
 extern ConVar nav_quicksave;
@@ -329,6 +331,9 @@ public:
 	CNavArea *GetNavAreaByID( unsigned int id ) const;
 	CNavArea *GetNearestNavArea( const Vector &pos, bool anyZ = false, float maxDist = 10000.0f, bool checkLOS = false, bool checkGround = true, int team = TEAM_ANY ) const;
 	CNavArea *GetNearestNavArea( CBaseEntity *pEntity, int nGetNavAreaFlags = GETNAVAREA_CHECK_GROUND, float maxDist = 10000.0f ) const;
+	void BuildAreaIndex( void );										// rebuild the index of area extents used by the lookups above
+	void InvalidateAreaIndex( void )			{ m_isAreaIndexValid = false; }	// area extents changed, rebuild the index on the next Update()
+	bool IsAreaIndexValid( void ) const			{ return m_isAreaIndexValid; }
 
 	Place GetPlace( const Vector &pos ) const;							// return Place at given coordinate
 	const char *PlaceToName( Place place ) const;						// given a place, return its name
@@ -1098,6 +1103,30 @@ private:
 	float m_minY;
 	unsigned int m_areaCount;									// total number of nav areas
 
+	/**
+	 * A finer grained index of the 2D extents of the areas for lookups by position. Each cell holds
+	 * the extents of the areas overlapping it, so areas that don't contain the position are rejected
+	 * without touching them. Rebuilt by Update() after the mesh changes - the grid is used until then.
+	 */
+	struct NavAreaIndexEntry
+	{
+		float loX, loY;
+		float hiX, hiY;
+		CNavArea *area;
+	};
+	CUtlVector< NavAreaIndexEntry > m_areaIndex;
+	CUtlVector< int > m_areaIndexCellStart;						// first entry of each cell, plus one past the last entry of the last cell
+	float m_areaIndexCellSize;
+	int m_areaIndexSizeX;
+	int m_areaIndexSizeY;
+	bool m_isAreaIndexValid;
+
+	int WorldToAreaIndexX( float wx ) const;
+	int WorldToAreaIndexY( float wy ) const;
+
+	typedef CUtlVectorFixedGrowable< CNavArea *, 16 > NavAreaOverlapVector;
+	void CollectAreasOverlapping( const Vector &pos, NavAreaOverlapVector *areas ) const;	// areas whose 2D extents contain pos
+
 	bool m_isLoaded;											// true if a Navigation Mesh has been loaded
 	bool m_isOutOfDate;											// true if the Navigation Mesh is older than the actual BSP
 	bool m_isAnalyzed;											// true if the Navigation Mesh needs analysis
@@ -1189,10 +1218,17 @@ private:
 	void DestroyLadders( void );
 
 	bool SampleStep( void );									// sample the walkable areas of the map
+	friend class CNavSampleCache;
+	bool TraceSampleStep( const Vector &from, NavDirType dir, NavSampleStep *step );	// the traces of one SampleStep(), safe to run on worker threads
+	void ResetSampleCache( void );								// forget the sample steps predicted for the current generation pass
+	void CheckDeferredNodeCrouch( void );						// run the node crouch checks AddNode() deferred, in parallel
+	static void CheckNodeCrouchJob( CNavNode *&node );
 	void CreateNavAreasFromNodes( void );						// cover all of the sampled nodes with nav areas
 
 	bool TestArea( CNavNode *node, int width, int height );		// check if an area of size (width, height) can fit, starting from node as upper left corner
 	int BuildArea( CNavNode *node, int width, int height );		// create a CNavArea of size (width, height) starting fom node at upper left corner
+	static void TestAreaJob( NavAreaCandidate &candidate );
+	bool IsAreaCovered( CNavNode *node, int width, int height ) const;	// true if any node of an area that passed TestArea() is already covered
 	bool CheckObstacles( CNavNode *node, int width, int height, int x, int y );
 
 	void MarkPlayerClipAreas( void );
@@ -1324,6 +1360,20 @@ inline int CNavMesh::ComputeHashKey( unsigned int id ) const
 	return id & 0xFF;
 }
 
+//--------------------------------------------------------------------------------------------------------------
+inline int CNavMesh::WorldToAreaIndexX( float wx ) const
+{
+	int x = (int)( (wx - m_minX) / m_areaIndexCellSize );
+	return clamp( x, 0, m_areaIndexSizeX-1 );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline int CNavMesh::WorldToAreaIndexY( float wy ) const
+{
+	int y = (int)( (wy - m_minY) / m_areaIndexCellSize );
+	return clamp( y, 0, m_areaIndexSizeY-1 );
+}
+
 //--------------------------------------------------------------------------------------------------------------
 inline int CNavMesh::WorldToGridX( float wx ) const
 { 
@@ -85,6 +85,7 @@ CNavNode::CNavNode( const Vector &pos, const Vector &normal, CNavNode *parent, b
 	m_listLength++;
 
 	m_isCovered = false;
+	m_isCrouchCheckDeferred = false;
 	m_area = NULL;
 
 	m_attributeFlags = 0;
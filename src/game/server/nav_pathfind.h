@@ -86,22 +86,11 @@ public:
 
 //--------------------------------------------------------------------------------------------------------------
 /**
- * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
- * If cost functor returns -1 for an area, that area is considered a dead end.
- * This doesn't actually build a path, but the path is defined by following parent
- * pointers back from goalArea to startArea.
- * If 'closestArea' is non-NULL, the closest area to the goal is returned (useful if the path fails).
- * If 'goalArea' is NULL, will compute a path as close as possible to 'goalPos'.
- * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
- * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
- * Returns true if a path exists.
+ * The A* search behind NavAreaBuildPath(). The search state is kept in 'search', which must be active.
  */
-#define IGNORE_NAV_BLOCKERS true
 template< typename CostFunctor >
-bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+bool NavAreaSearch( CNavSearchContext &search, CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea, float maxPathLength, int teamID, bool ignoreNavBlockers )
 {
-	VPROF_BUDGET( "NavAreaBuildPath", "NextBotSpiky" );
-
 	if ( closestArea )
 	{
 		*closestArea = startArea;
@@ -111,9 +100,9 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	if (startArea == NULL)
 		return false;
 
-	startArea->SetParent( NULL );
+	search.SetParent( startArea, NULL );
 
-	if (goalArea != NULL && goalArea->IsBlocked( teamID, ignoreNavBlockers ))
+	if (goalArea != NULL && search.IsBlocked( goalArea, teamID, ignoreNavBlockers ))
 		goalArea = NULL;
 
 	if (goalArea == NULL && goalPos == NULL)
@@ -128,33 +117,30 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	// determine actual goal position
 	Vector actualGoalPos = (goalPos) ? *goalPos : goalArea->GetCenter();
 
-	// start search
-	CNavArea::ClearSearchLists();
-
 	// compute estimate of path length
 	/// @todo Cost might work as "manhattan distance"
-	startArea->SetTotalCost( (startArea->GetCenter() - actualGoalPos).Length() );
+	search.SetTotalCost( startArea, (startArea->GetCenter() - actualGoalPos).Length() );
 
 	float initCost = costFunc( startArea, NULL, NULL, NULL, -1.0f );	
 	if (initCost < 0.0f)
 		return false;
-	startArea->SetCostSoFar( initCost );
-	startArea->SetPathLengthSoFar( 0.0 );
+	search.SetCostSoFar( startArea, initCost );
+	search.SetPathLengthSoFar( startArea, 0.0 );
 
-	startArea->AddToOpenList();
+	search.AddToOpenList( startArea );
 
 	// keep track of the area we visit that is closest to the goal
-	float closestAreaDist = startArea->GetTotalCost();
+	float closestAreaDist = search.GetTotalCost( startArea );
 
 	// do A* search
-	while( !CNavArea::IsOpenListEmpty() )
+	while( !search.IsOpenListEmpty() )
 	{
-		// get next area to check
-		CNavArea *area = CNavArea::PopOpenList();
+		// get next area to check (this closes it)
+		CNavArea *area = search.PopOpenList();
 
 
 		// don't consider blocked areas
-		if ( area->IsBlocked( teamID, ignoreNavBlockers ) )
+		if ( search.IsBlocked( area, teamID, ignoreNavBlockers ) )
 			continue;
 
 		// check if we have found the goal area or position
@@ -323,13 +309,13 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// don't backtrack
 			Assert( newArea );
-			if ( newArea == area->GetParent() )
+			if ( newArea == search.GetParent( area ) )
 				continue;
 			if ( newArea == area ) // self neighbor?
 				continue;
 
 			// don't consider blocked areas
-			if ( newArea->IsBlocked( teamID, ignoreNavBlockers ) )
+			if ( search.IsBlocked( newArea, teamID, ignoreNavBlockers ) )
 				continue;
 
 			float newCostSoFar = costFunc( newArea, area, ladder, elevator, length );
@@ -346,28 +332,28 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// Safety check against a bogus functor.  The cost of the path
 			// A...B, C should always be at least as big as the path A...B.
-			Assert( newCostSoFar >= area->GetCostSoFar() );
+			float costSoFar = search.GetCostSoFar( area );
+			Assert( newCostSoFar >= costSoFar );
 
 			// And now that we've asserted, let's be a bit more defensive.
 			// Make sure that any jump to a new area incurs some pathfinsing
 			// cost, to avoid us spinning our wheels over insignificant cost
 			// benefit, floating point precision bug, or busted cost functor.
-			float minNewCostSoFar = area->GetCostSoFar() * 1.00001f + 0.00001f;
+			float minNewCostSoFar = costSoFar * 1.00001f + 0.00001f;
 			newCostSoFar = Max( newCostSoFar, minNewCostSoFar );
 				
 			// stop if path length limit reached
+			float newLengthSoFar = 0.0f;
 			if ( bHaveMaxPathLength )
 			{
 				// keep track of path length so far
 				float deltaLength = ( newArea->GetCenter() - area->GetCenter() ).Length();
-				float newLengthSoFar = area->GetPathLengthSoFar() + deltaLength;
+				newLengthSoFar = search.GetPathLengthSoFar( area ) + deltaLength;
 				if ( newLengthSoFar > maxPathLength )
 					continue;
-				
-				newArea->SetPathLengthSoFar( newLengthSoFar );
 			}
 
-			if ( ( newArea->IsOpen() || newArea->IsClosed() ) && newArea->GetCostSoFar() <= newCostSoFar )
+			if ( ( search.IsOpen( newArea ) || search.IsClosed( newArea ) ) && search.GetCostSoFar( newArea ) <= newCostSoFar )
 			{
 				// this is a worse path - skip it
 				continue;
@@ -385,36 +371,70 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 					closestAreaDist = newCostRemaining;
 				}
 				
-				newArea->SetCostSoFar( newCostSoFar );
-				newArea->SetTotalCost( newCostSoFar + newCostRemaining );
-
-				if ( newArea->IsClosed() )
+				search.SetCostSoFar( newArea, newCostSoFar );
+				search.SetTotalCost( newArea, newCostSoFar + newCostRemaining );
+				if ( bHaveMaxPathLength )
 				{
-					newArea->RemoveFromClosedList();
+					search.SetPathLengthSoFar( newArea, newLengthSoFar );
 				}
 
-				if ( newArea->IsOpen() )
-				{
-					// area already on open list, update the list order to keep costs sorted
-					newArea->UpdateOnOpenList();
-				}
-				else
-				{
-					newArea->AddToOpenList();
-				}
+				// (re)opens a closed area, or moves an open one up the heap
+				search.AddToOpenList( newArea );
 
-				newArea->SetParent( area, how );
+				search.SetParent( newArea, area, how );
 			}
 		}
-
-		// we have searched this area
-		area->AddToClosedList();
 	}
 
 	return false;
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
+ * If cost functor returns -1 for an area, that area is considered a dead end.
+ * This doesn't actually build a path, but the path is defined by following search.GetParent()
+ * back from goalArea to startArea. Nothing in the mesh is written, so searches with their own
+ * contexts can run on job threads, as long as the cost functor only reads shared state.
+ * If 'closestArea' is non-NULL, the closest area to the goal is returned (useful if the path fails).
+ * If 'goalArea' is NULL, will compute a path as close as possible to 'goalPos'.
+ * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
+ * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
+ * Returns true if a path exists.
+ */
+#define IGNORE_NAV_BLOCKERS true
+template< typename CostFunctor >
+bool NavAreaBuildPath( CNavSearchContext &search, CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	search.Begin();
+	bool result = NavAreaSearch( search, startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+	search.End();
+
+	return result;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * As above, using the main thread's search context. The results are copied into the areas
+ * afterwards, so the path is defined by following parent pointers back from goalArea to startArea.
+ */
+template< typename CostFunctor >
+bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	VPROF_BUDGET( "NavAreaBuildPath", "NextBotSpiky" );
+
+	CNavSearchContext &search = CNavSearchContext::GetMainThreadContext();
+	bool result = NavAreaBuildPath( search, startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+	search.CopyToAreas();
+
+	return result;
+}
+
+
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Compute distance between two areas. Return -1 if can't reach 'endArea' from 'startArea'.
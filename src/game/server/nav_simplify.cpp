@@ -129,10 +129,16 @@ void CNavMesh::GenerateNodes( const Extent &bounds )
 	m_seedIdx = 0;
 
 	Assert( m_generationMode == GENERATE_SIMPLIFY );
+
+	// steps predicted by an earlier pass were traced against a different mesh and bounds
+	ResetSampleCache();
 	while ( SampleStep() )
 	{
 		// do nothing
 	}
+
+	ResetSampleCache();
+	CheckDeferredNodeCrouch();
 }
 
 
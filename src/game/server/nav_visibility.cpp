@@ -0,0 +1,578 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_visibility.cpp
+// Area-to-area visibility of the Navigation Mesh in a form that can be queried in constant time
+
+#include "cbase.h"
+#include "nav_mesh.h"
+#include "nav_visibility.h"
+#include "utlbuffer.h"
+#include "tier0/fasttimer.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+ConVar nav_visibility_matrix_max_memory( "nav_visibility_matrix_max_memory", "32", FCVAR_GAMEDLL | FCVAR_CHEAT, "Megabytes the nav area visibility matrix may use to answer queries without a search. Larger meshes search each area's visibility runs instead." );
+
+CNavVisibilityMatrix TheNavVisibility;
+
+/// Identifies the visibility block at the end of a .nav file. Like the cluster block it is written
+/// after the derived class mesh data, so the file version doesn't change.
+const unsigned int NavVisibilityMagicNumber = 0x5349564E;		// "NVIS"
+const unsigned int NavVisibilityVersion = 1;
+
+const unsigned char NavVisibilityUnset = 0xFF;
+
+static int CompareSlots( const int *a, const int *b )
+{
+	return *a - *b;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavVisibilityMatrix::CNavVisibilityMatrix( void )
+{
+	m_isBuilt = false;
+	m_rowWords = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavVisibilityMatrix::Reset( void )
+{
+	m_isBuilt = false;
+	m_areas.Purge();
+	m_slot.Purge();
+	m_runs.Purge();
+	m_rowStart.Purge();
+	m_bits.Purge();
+	m_rowWords = 0;
+	m_dirty.Purge();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Encode the visibility lists of every area as runs. Each area's own list overrides the
+ * list it inherits from, just as CNavArea::IsPotentiallyVisible() searches them.
+ */
+void CNavVisibilityMatrix::Build( void )
+{
+	CFastTimer timer;
+	timer.Start();
+
+	NavAreaVector dirty;
+	dirty.CopyArray( m_dirty.Base(), m_dirty.Count() );
+
+	Reset();
+
+	// a mesh that was never analyzed has no visibility to capture
+	bool hasVisibility = false;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		if ( TheNavAreas[ it ]->m_potentiallyVisibleAreas.Count() )
+		{
+			hasVisibility = true;
+			break;
+		}
+	}
+
+	if ( !hasVisibility )
+		return;
+
+	unsigned int maxID = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		maxID = MAX( maxID, TheNavAreas[ it ]->GetID() );
+	}
+
+	m_slot.SetCount( maxID + 1 );
+	for( int i=0; i<m_slot.Count(); ++i )
+	{
+		m_slot[i] = -1;
+	}
+
+	m_areas.CopyArray( TheNavAreas.Base(), TheNavAreas.Count() );
+	FOR_EACH_VEC( m_areas, it )
+	{
+		m_slot[ m_areas[ it ]->GetID() ] = it;
+	}
+
+	CUtlVector< unsigned char > rowVis;
+	rowVis.SetCount( m_areas.Count() );
+	V_memset( rowVis.Base(), NavVisibilityUnset, rowVis.Count() );
+
+	CUtlVector< int > cols;
+
+	m_rowStart.SetCount( m_areas.Count() + 1 );
+	FOR_EACH_VEC( m_areas, row )
+	{
+		m_rowStart[ row ] = m_runs.Count();
+
+		const CNavArea *area = m_areas[ row ];
+		cols.RemoveAll();
+
+		for( int pass=0; pass<2; ++pass )
+		{
+			const CNavArea *listArea = ( pass == 0 ) ? area : area->m_inheritVisibilityFrom.area;
+			if ( !listArea )
+				break;
+
+			const CNavArea::CAreaBindInfoArray &list = listArea->m_potentiallyVisibleAreas;
+			for( int i=0; i<list.Count(); ++i )
+			{
+				int col = GetSlot( list[i].area );
+				if ( col < 0 || rowVis[ col ] != NavVisibilityUnset )
+					continue;
+
+				rowVis[ col ] = list[i].attributes;
+				cols.AddToTail( col );
+			}
+		}
+
+		cols.Sort( CompareSlots );
+
+		FOR_EACH_VEC( cols, it )
+		{
+			int col = cols[ it ];
+			unsigned char vis = rowVis[ col ];
+			rowVis[ col ] = NavVisibilityUnset;
+
+			if ( vis == CNavArea::NOT_VISIBLE )
+				continue;
+
+			// extend the last run if this area follows it with the same visibility
+			if ( m_runs.Count() > m_rowStart[ row ] )
+			{
+				Run &last = m_runs.Tail();
+				if ( last.visibility == vis && last.first + last.count == col && last.count < 0xFFFF )
+				{
+					++last.count;
+					continue;
+				}
+			}
+
+			Run &run = m_runs[ m_runs.AddToTail() ];
+			run.first = col;
+			run.count = 1;
+			run.visibility = vis;
+		}
+	}
+	m_rowStart[ m_areas.Count() ] = m_runs.Count();
+
+	BuildDenseMatrix();
+
+	// areas added by editing are still waiting for UpdateAreas()
+	m_dirty.CopyArray( dirty.Base(), dirty.Count() );
+	m_isBuilt = true;
+
+	timer.End();
+	DevMsg( "Nav visibility matrix built for %d areas (%d runs) in %.2f ms\n", m_areas.Count(), m_runs.Count(), timer.GetDuration().GetMillisecondsF() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Expand the runs into 2 bits per area pair, if that fits in nav_visibility_matrix_max_memory
+ */
+void CNavVisibilityMatrix::BuildDenseMatrix( void )
+{
+	m_bits.Purge();
+	m_rowWords = ( m_areas.Count() + 15 ) / 16;
+
+	double bytes = (double)m_rowWords * m_areas.Count() * sizeof( uint32 );
+	if ( bytes > nav_visibility_matrix_max_memory.GetFloat() * 1024.0 * 1024.0 )
+		return;
+
+	m_bits.SetCount( m_rowWords * m_areas.Count() );
+	V_memset( m_bits.Base(), 0, m_bits.Count() * sizeof( uint32 ) );
+
+	for( int row=0; row<m_areas.Count(); ++row )
+	{
+		uint32 *bits = &m_bits[ row * m_rowWords ];
+		for( int r=m_rowStart[ row ]; r<m_rowStart[ row+1 ]; ++r )
+		{
+			const Run &run = m_runs[r];
+			for( int col=run.first; col<run.first+run.count; ++col )
+			{
+				bits[ col >> 4 ] |= (uint32)run.visibility << ( ( col & 15 ) << 1 );
+			}
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int CNavVisibilityMatrix::FindRun( int row, int col ) const
+{
+	int lo = m_rowStart[ row ];
+	int hi = m_rowStart[ row+1 ] - 1;
+
+	while( lo <= hi )
+	{
+		int mid = ( lo + hi ) / 2;
+		const Run &run = m_runs[ mid ];
+
+		if ( col < run.first )
+		{
+			hi = mid - 1;
+		}
+		else if ( col >= run.first + run.count )
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			return run.visibility;
+		}
+	}
+
+	return CNavArea::NOT_VISIBLE;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavVisibilityMatrix::OnAreaAdded( CNavArea *area )
+{
+	if ( m_isBuilt && m_dirty.Find( area ) == m_dirty.InvalidIndex() )
+	{
+		m_dirty.AddToTail( area );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavVisibilityMatrix::OnAreaRemoved( CNavArea *area )
+{
+	m_dirty.FindAndRemove( area );
+
+	int slot = GetSlot( area );
+	if ( slot >= 0 )
+	{
+		// the rest of the matrix is still valid, nothing will ask about this area again
+		m_slot[ area->GetID() ] = -1;
+		m_areas[ slot ] = NULL;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavVisibilityMatrix::UpdateAreas( const NavAreaVector &areas )
+{
+	NavAreaVector update;
+	update.CopyArray( m_dirty.Base(), m_dirty.Count() );
+	FOR_EACH_VEC( areas, it )
+	{
+		if ( update.Find( areas[ it ] ) == update.InvalidIndex() )
+		{
+			update.AddToTail( areas[ it ] );
+		}
+	}
+
+	CFastTimer timer;
+	timer.Start();
+
+	FOR_EACH_VEC( update, it )
+	{
+		update[ it ]->UpdateVisibilityToMesh();
+	}
+
+	m_dirty.RemoveAll();
+	Build();
+
+	timer.End();
+	Msg( "Updated visibility of %d nav areas in %.2f seconds\n", update.Count(), timer.GetDuration().GetSeconds() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Append the matrix to a .nav file, as runs over the areas in the order they are listed here
+ */
+void CNavVisibilityMatrix::Save( CUtlBuffer &fileBuffer ) const
+{
+	if ( !m_isBuilt )
+		return;
+
+	fileBuffer.PutUnsignedInt( NavVisibilityMagicNumber );
+	fileBuffer.PutUnsignedInt( NavVisibilityVersion );
+
+	// size of the rest of the block, so a reader can skip it
+	int sizePos = fileBuffer.TellPut();
+	fileBuffer.PutUnsignedInt( 0 );
+
+	fileBuffer.PutUnsignedInt( m_areas.Count() );
+	FOR_EACH_VEC( m_areas, it )
+	{
+		fileBuffer.PutUnsignedInt( m_areas[ it ] ? m_areas[ it ]->GetID() : 0 );
+	}
+
+	for( int row=0; row<m_areas.Count(); ++row )
+	{
+		fileBuffer.PutUnsignedInt( m_rowStart[ row+1 ] - m_rowStart[ row ] );
+		for( int r=m_rowStart[ row ]; r<m_rowStart[ row+1 ]; ++r )
+		{
+			fileBuffer.PutUnsignedInt( m_runs[r].first );
+			fileBuffer.PutUnsignedShort( m_runs[r].count );
+			fileBuffer.PutUnsignedChar( m_runs[r].visibility );
+		}
+	}
+
+	int endPos = fileBuffer.TellPut();
+	fileBuffer.SeekPut( CUtlBuffer::SEEK_HEAD, sizePos );
+	fileBuffer.PutUnsignedInt( endPos - sizePos - sizeof( unsigned int ) );
+	fileBuffer.SeekPut( CUtlBuffer::SEEK_HEAD, endPos );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Read the matrix stored in a .nav file. Must be called after the areas have been added to the mesh,
+ * since they are stored by ID. If the file has no visibility block the read position is left alone,
+ * and if the block can't be used it is skipped.
+ */
+bool CNavVisibilityMatrix::Load( CUtlBuffer &fileBuffer )
+{
+	Reset();
+
+	if ( fileBuffer.GetBytesRemaining() < (int)( 3 * sizeof(unsigned int) ) )
+		return false;
+
+	int startPos = fileBuffer.TellGet();
+	if ( fileBuffer.GetUnsignedInt() != NavVisibilityMagicNumber )
+	{
+		fileBuffer.SeekGet( CUtlBuffer::SEEK_HEAD, startPos );
+		return false;
+	}
+
+	unsigned int version = fileBuffer.GetUnsignedInt();
+	unsigned int size = fileBuffer.GetUnsignedInt();
+	if ( size > (unsigned int)fileBuffer.GetBytesRemaining() )
+	{
+		fileBuffer.SeekGet( CUtlBuffer::SEEK_HEAD, startPos );
+		return false;
+	}
+	int endPos = fileBuffer.TellGet() + size;
+
+	unsigned int areaCount = fileBuffer.GetUnsignedInt();
+	bool isValid = ( version == NavVisibilityVersion && areaCount == (unsigned int)TheNavAreas.Count() );
+
+	if ( isValid )
+	{
+		m_areas.SetCount( areaCount );
+
+		unsigned int maxID = 0;
+		for( unsigned int i=0; i<areaCount; ++i )
+		{
+			m_areas[i] = TheNavMesh->GetNavAreaByID( fileBuffer.GetUnsignedInt() );
+			if ( m_areas[i] == NULL )
+			{
+				isValid = false;
+				break;
+			}
+			maxID = MAX( maxID, m_areas[i]->GetID() );
+		}
+
+		if ( isValid )
+		{
+			m_slot.SetCount( maxID + 1 );
+			for( int i=0; i<m_slot.Count(); ++i )
+			{
+				m_slot[i] = -1;
+			}
+
+			FOR_EACH_VEC( m_areas, it )
+			{
+				if ( m_slot[ m_areas[ it ]->GetID() ] >= 0 )
+				{
+					isValid = false;
+					break;
+				}
+				m_slot[ m_areas[ it ]->GetID() ] = it;
+			}
+		}
+	}
+
+	if ( isValid )
+	{
+		m_rowStart.SetCount( areaCount + 1 );
+	}
+
+	for( unsigned int row=0; row<areaCount && isValid; ++row )
+	{
+		m_rowStart[ row ] = m_runs.Count();
+
+		unsigned int runCount = fileBuffer.GetUnsignedInt();
+		if ( runCount > areaCount || !fileBuffer.IsValid() )
+		{
+			isValid = false;
+			break;
+		}
+
+		int nextCol = 0;
+		for( unsigned int r=0; r<runCount; ++r )
+		{
+			Run &run = m_runs[ m_runs.AddToTail() ];
+			run.first = fileBuffer.GetUnsignedInt();
+			run.count = fileBuffer.GetUnsignedShort();
+			run.visibility = fileBuffer.GetUnsignedChar();
+
+			// runs must be in order, and within the matrix
+			if ( run.first < nextCol || run.count == 0 || (unsigned int)( run.first + run.count ) > areaCount ||
+				 run.visibility == CNavArea::NOT_VISIBLE || run.visibility > ( CNavArea::POTENTIALLY_VISIBLE | CNavArea::COMPLETELY_VISIBLE ) )
+			{
+				isValid = false;
+				break;
+			}
+			nextCol = run.first + run.count;
+		}
+	}
+
+	if ( !isValid || !fileBuffer.IsValid() || fileBuffer.TellGet() != endPos )
+	{
+		DevMsg( "Nav visibility in file doesn't match the mesh, rebuilding\n" );
+		Reset();
+		fileBuffer.SeekGet( CUtlBuffer::SEEK_HEAD, endPos );
+		return false;
+	}
+
+	m_rowStart[ areaCount ] = m_runs.Count();
+
+	BuildDenseMatrix();
+
+	m_isBuilt = true;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int CNavVisibilityMatrix::CountMismatches( void ) const
+{
+	if ( !m_isBuilt )
+		return 0;
+
+	int mismatches = 0;
+	FOR_EACH_VEC( m_areas, row )
+	{
+		const CNavArea *area = m_areas[ row ];
+		if ( !area )
+			continue;
+
+		FOR_EACH_VEC( m_areas, col )
+		{
+			const CNavArea *other = m_areas[ col ];
+			if ( !other || other == area )
+				continue;
+
+			// search the lists the way CNavArea::IsPotentiallyVisible() does without a matrix
+			int listVis = CNavArea::NOT_VISIBLE;
+			CNavArea::AreaBindInfo info;
+			info.area = const_cast< CNavArea * >( other );
+
+			int i = area->m_potentiallyVisibleAreas.Find( info );
+			if ( i != area->m_potentiallyVisibleAreas.InvalidIndex() )
+			{
+				listVis = area->m_potentiallyVisibleAreas[i].attributes;
+			}
+			else if ( area->m_inheritVisibilityFrom.area )
+			{
+				const CNavArea::CAreaBindInfoArray &inherited = area->m_inheritVisibilityFrom.area->m_potentiallyVisibleAreas;
+				i = inherited.Find( info );
+				if ( i != inherited.InvalidIndex() )
+				{
+					listVis = inherited[i].attributes;
+				}
+			}
+
+			if ( GetVisibility( area, other ) != listVis )
+			{
+				if ( mismatches < 10 )
+				{
+					Warning( "Nav visibility of area #%d from area #%d is %d in the matrix, %d in the lists\n", other->GetID(), area->GetID(), GetVisibility( area, other ), listVis );
+				}
+				++mismatches;
+			}
+		}
+	}
+
+	return mismatches;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavVisibilityMatrix::Report( void ) const
+{
+	if ( !m_isBuilt )
+	{
+		Msg( "Nav visibility matrix is not built (has the mesh been analyzed?)\n" );
+		return;
+	}
+
+	int listEntries = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		listEntries += TheNavAreas[ it ]->m_potentiallyVisibleAreas.Count();
+	}
+
+	int pairs = 0;
+	FOR_EACH_VEC( m_runs, it )
+	{
+		pairs += m_runs[ it ].count;
+	}
+
+	Msg( "%d nav areas, %d visible pairs in %d runs (%.1f pairs per run)\n",
+		m_areas.Count(), pairs, m_runs.Count(), m_runs.Count() ? (float)pairs / m_runs.Count() : 0.0f );
+	Msg( "Runs use %d KB, the dense matrix %d KB%s, the visibility lists %d KB\n",
+		( m_runs.Count() * (int)sizeof( Run ) + m_rowStart.Count() * (int)sizeof( int ) ) / 1024,
+		m_bits.Count() * (int)sizeof( uint32 ) / 1024,
+		m_bits.Count() ? "" : " (too large, see nav_visibility_matrix_max_memory)",
+		listEntries * (int)sizeof( CNavArea::AreaBindInfo ) / 1024 );
+
+	if ( m_dirty.Count() )
+	{
+		Msg( "%d areas added since the mesh was analyzed have no visibility - use nav_update_visibility\n", m_dirty.Count() );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_update_visibility, "Compute visibility for nav areas created since the mesh was analyzed, and for the selected set.", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !TheNavVisibility.IsBuilt() )
+	{
+		Msg( "The nav mesh has no visibility data - use nav_analyze\n" );
+		return;
+	}
+
+	TheNavVisibility.UpdateAreas( TheNavMesh->GetSelectedSet() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_visibility_report, "Print statistics about the nav area visibility matrix.", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavVisibility.Report();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_visibility_verify, "Check every pair of areas in the nav area visibility matrix against the visibility lists.", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int mismatches = TheNavVisibility.CountMismatches();
+	Msg( "%d mismatched area pairs\n", mismatches );
+}
@@ -0,0 +1,111 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_visibility.h
+// Area-to-area visibility of the Navigation Mesh in a form that can be queried in constant time.
+//
+// The per-area visibility lists computed by nav_analyze (delta encoded against an adjacent
+// "anchor" area) stay the source of truth - they are what the ForAll*VisibleAreas() iterators
+// and the editor use. This matrix is derived from them: each area's row is stored as runs of
+// consecutive area indices with the same visibility, which is what is written to the .nav file,
+// and when the mesh is small enough the rows are also expanded into a 2 bit per pair matrix.
+
+#ifndef _NAV_VISIBILITY_H_
+#define _NAV_VISIBILITY_H_
+
+#include "nav_area.h"
+
+class CUtlBuffer;
+
+
+//--------------------------------------------------------------------------------------------------------------
+class CNavVisibilityMatrix
+{
+public:
+	CNavVisibilityMatrix( void );
+
+	void Reset( void );
+	void Build( void );										// capture the visibility lists of every area in TheNavAreas
+	bool IsBuilt( void ) const			{ return m_isBuilt; }
+
+	void Save( CUtlBuffer &fileBuffer ) const;
+	bool Load( CUtlBuffer &fileBuffer );					// returns false if the file has no visibility block, or it doesn't match the mesh
+
+	/**
+	 * Return the CNavArea::VisibilityType of 'to' from somewhere in 'from', or -1 if either area
+	 * isn't in the matrix, in which case the visibility lists of the areas must be searched.
+	 * Safe to call from worker threads.
+	 */
+	int GetVisibility( const CNavArea *from, const CNavArea *to ) const;
+
+	void OnAreaAdded( CNavArea *area );						// area has no visibility until UpdateAreas()
+	void OnAreaRemoved( CNavArea *area );
+
+	/**
+	 * Recompute the visibility between the given areas and the rest of the mesh, and everything
+	 * added to the mesh since the last update. Main thread only - this traces.
+	 */
+	void UpdateAreas( const NavAreaVector &areas );
+	int GetDirtyCount( void ) const		{ return m_dirty.Count(); }
+
+	int CountMismatches( void ) const;						// return the number of area pairs where the matrix and the lists disagree
+	void Report( void ) const;
+
+private:
+	struct Run
+	{
+		int first;											// index of the first area of the run
+		unsigned short count;
+		unsigned char visibility;
+	};
+
+	int GetSlot( const CNavArea *area ) const;
+	int FindRun( int row, int col ) const;					// binary search the runs of a row
+	void BuildDenseMatrix( void );
+
+	bool m_isBuilt;
+
+	CUtlVector< CNavArea * > m_areas;						// the area of each row and column
+	CUtlVector< int > m_slot;								// indexed by area ID, -1 if not in the matrix
+
+	CUtlVector< Run > m_runs;								// the non-zero visibility of each row, by increasing area index
+	CUtlVector< int > m_rowStart;							// first run of each row, plus one past the last run of the last row
+
+	CUtlVector< uint32 > m_bits;							// 2 bits per area pair, or empty if the mesh is too large
+	int m_rowWords;
+
+	NavAreaVector m_dirty;									// areas added since the last update, with no visibility yet
+};
+
+extern CNavVisibilityMatrix TheNavVisibility;
+
+
+//--------------------------------------------------------------------------------------------------------------
+inline int CNavVisibilityMatrix::GetSlot( const CNavArea *area ) const
+{
+	unsigned int id = area->GetID();
+	return ( id < (unsigned int)m_slot.Count() ) ? m_slot[ id ] : -1;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline int CNavVisibilityMatrix::GetVisibility( const CNavArea *from, const CNavArea *to ) const
+{
+	int row = GetSlot( from );
+	int col = GetSlot( to );
+	if ( row < 0 || col < 0 )
+		return -1;
+
+	if ( m_bits.Count() )
+	{
+		return ( m_bits[ row * m_rowWords + ( col >> 4 ) ] >> ( ( col & 15 ) << 1 ) ) & 0x3;
+	}
+
+	return FindRun( row, col );
+}
+
+
+#endif // _NAV_VISIBILITY_H_
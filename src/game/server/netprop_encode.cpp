@@ -0,0 +1,665 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Game-side network prop encoding using precompiled SendTable plans.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cbase.h"
+#include "netprop_encode.h"
+#include "server_class.h"
+#include "coordsize.h"
+#include "tier1/bitbuf.h"
+#include "tier1/generichash.h"
+#include "tier0/fasttimer.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+//-----------------------------------------------------------------------------
+// Reference encoder for sv_sendplan_benchmark. The engine's SendTable_Encode
+// isn't part of this tree, so this follows its per-type encoders one SendProp
+// at a time. It walks the SendTable and calls the datatable proxies itself.
+// Nothing here is shared with CSendTableFlat or CSendTablePlan, so a bug in
+// either shows up as a mismatch instead of hiding in both paths.
+//-----------------------------------------------------------------------------
+class CSendTableReferenceEncoder
+{
+public:
+	CSendTableReferenceEncoder( SendTable *pTable, int objectID, bf_write *pOut );
+
+	// Writes every prop of pStruct that isn't under a datatable whose proxy
+	// returned NULL. Returns the number of props written.
+	int		Encode( const void *pStruct );
+
+private:
+	void	GatherExcludes( const SendTable *pTable );
+	bool	IsExcluded( const SendTable *pTable, const SendProp *pProp ) const;
+	void	EncodeTable( const SendTable *pTable, const unsigned char *pStructBase );
+	void	EncodeProp( const SendProp *pProp, const void *pStructBase, const void *pData, int iElement );
+	void	EncodeFloat( const SendProp *pProp, float flValue );
+
+	SendTable			*m_pTable;
+	int					m_ObjectID;
+	bf_write			*m_pOut;
+	CUtlVector<const SendProp*> m_Excludes;
+	int					m_iProp;
+	int					m_iLastProp;
+	int					m_nWritten;
+};
+
+CSendTableReferenceEncoder::CSendTableReferenceEncoder( SendTable *pTable, int objectID, bf_write *pOut )
+{
+	m_pTable = pTable;
+	m_ObjectID = objectID;
+	m_pOut = pOut;
+	GatherExcludes( pTable );
+}
+
+void CSendTableReferenceEncoder::GatherExcludes( const SendTable *pTable )
+{
+	for ( int i = 0; i < pTable->m_nProps; ++i )
+	{
+		const SendProp *pProp = &pTable->m_pProps[i];
+		if ( pProp->GetFlags() & SPROP_EXCLUDE )
+		{
+			m_Excludes.AddToTail( pProp );
+		}
+		else if ( pProp->GetType() == DPT_DataTable && pProp->GetDataTable() )
+		{
+			GatherExcludes( pProp->GetDataTable() );
+		}
+	}
+}
+
+bool CSendTableReferenceEncoder::IsExcluded( const SendTable *pTable, const SendProp *pProp ) const
+{
+	FOR_EACH_VEC( m_Excludes, i )
+	{
+		if ( !V_stricmp( m_Excludes[i]->GetExcludeDTName(), pTable->m_pNetTableName ) &&
+			 !V_stricmp( m_Excludes[i]->GetName(), pProp->GetName() ) )
+			return true;
+	}
+	return false;
+}
+
+int CSendTableReferenceEncoder::Encode( const void *pStruct )
+{
+	m_iProp = 0;
+	m_iLastProp = -1;
+	m_nWritten = 0;
+	EncodeTable( m_pTable, (const unsigned char*)pStruct );
+	m_pOut->WriteOneBit( 0 );
+	return m_nWritten;
+}
+
+// pStructBase is NULL under a datatable that isn't sent; its props are only counted
+void CSendTableReferenceEncoder::EncodeTable( const SendTable *pTable, const unsigned char *pStructBase )
+{
+	for ( int i = 0; i < pTable->m_nProps; ++i )
+	{
+		const SendProp *pProp = &pTable->m_pProps[i];
+		if ( ( pProp->GetFlags() & ( SPROP_EXCLUDE | SPROP_INSIDEARRAY ) ) || IsExcluded( pTable, pProp ) )
+			continue;
+
+		// array element templates are written by the array that follows them
+		const SendProp *pNext = ( i + 1 < pTable->m_nProps ) ? &pTable->m_pProps[i + 1] : NULL;
+		if ( pNext && pNext->GetType() == DPT_Array && pProp->GetType() != DPT_Array )
+			continue;
+
+		if ( pProp->GetType() == DPT_DataTable )
+		{
+			if ( !pProp->GetDataTable() )
+				continue;
+
+			const unsigned char *pChild = NULL;
+			if ( pStructBase )
+			{
+				CSendProxyRecipients recipients;
+				pChild = (const unsigned char*)pProp->GetDataTableProxyFn()( pProp, pStructBase, pStructBase + abs( pProp->GetOffset() ), &recipients, m_ObjectID );
+			}
+			EncodeTable( pProp->GetDataTable(), pChild );
+			continue;
+		}
+
+		int iProp = m_iProp++;
+		if ( !pStructBase )
+			continue;
+
+		m_pOut->WriteOneBit( 1 );
+		m_pOut->WriteUBitVar( iProp - m_iLastProp - 1 );
+		m_iLastProp = iProp;
+		++m_nWritten;
+
+		if ( pProp->GetType() == DPT_Array )
+		{
+			const SendProp *pElementProp = pProp->GetArrayProp() ? pProp->GetArrayProp() : ( i > 0 ? &pTable->m_pProps[i - 1] : NULL );
+
+			int nElements = pProp->GetNumElements();
+			if ( pProp->GetArrayLengthProxy() )
+			{
+				nElements = MIN( pProp->GetArrayLengthProxy()( pStructBase, m_ObjectID ), pProp->GetNumElements() );
+			}
+			m_pOut->WriteUBitLong( nElements, pProp->GetNumArrayLengthBits() );
+
+			if ( pElementProp )
+			{
+				const unsigned char *pElement = pStructBase + abs( pElementProp->GetOffset() );
+				for ( int iElement = 0; iElement < nElements; ++iElement, pElement += pProp->GetElementStride() )
+				{
+					EncodeProp( pElementProp, pStructBase, pElement, iElement );
+				}
+			}
+		}
+		else
+		{
+			EncodeProp( pProp, pStructBase, pStructBase + abs( pProp->GetOffset() ), 0 );
+		}
+	}
+}
+
+void CSendTableReferenceEncoder::EncodeProp( const SendProp *pProp, const void *pStructBase, const void *pData, int iElement )
+{
+	DVariant var;
+	pProp->GetProxyFn()( pProp, pStructBase, pData, &var, iElement, m_ObjectID );
+
+	switch ( pProp->GetType() )
+	{
+	case DPT_Int:
+		if ( pProp->GetFlags() & SPROP_VARINT )
+		{
+			if ( pProp->GetFlags() & SPROP_UNSIGNED )
+				m_pOut->WriteVarInt32( var.m_Int );
+			else
+				m_pOut->WriteSignedVarInt32( var.m_Int );
+		}
+		else if ( pProp->GetFlags() & SPROP_UNSIGNED )
+		{
+			m_pOut->WriteUBitLong( var.m_Int, pProp->m_nBits );
+		}
+		else
+		{
+			m_pOut->WriteSBitLong( var.m_Int, pProp->m_nBits );
+		}
+		break;
+
+	case DPT_Float:
+		EncodeFloat( pProp, var.m_Float );
+		break;
+
+	case DPT_Vector:
+		EncodeFloat( pProp, var.m_Vector[0] );
+		EncodeFloat( pProp, var.m_Vector[1] );
+		if ( pProp->GetFlags() & SPROP_NORMAL )
+		{
+			m_pOut->WriteOneBit( var.m_Vector[2] <= -NORMAL_RESOLUTION );
+		}
+		else
+		{
+			EncodeFloat( pProp, var.m_Vector[2] );
+		}
+		break;
+
+	case DPT_VectorXY:
+		EncodeFloat( pProp, var.m_Vector[0] );
+		EncodeFloat( pProp, var.m_Vector[1] );
+		break;
+
+	case DPT_String:
+		{
+			const char *pString = var.m_pString ? var.m_pString : "";
+			int len = V_strlen( pString );
+			if ( len >= DT_MAX_STRING_BUFFERSIZE )
+			{
+				len = DT_MAX_STRING_BUFFERSIZE - 1;
+			}
+			m_pOut->WriteUBitLong( len, DT_MAX_STRING_BITS );
+			m_pOut->WriteBits( pString, len * 8 );
+		}
+		break;
+
+	default:
+		Assert( !"CSendTableReferenceEncoder: unsupported prop type" );
+		break;
+	}
+}
+
+void CSendTableReferenceEncoder::EncodeFloat( const SendProp *pProp, float flValue )
+{
+	int flags = pProp->GetFlags();
+	if ( flags & SPROP_COORD )
+	{
+		m_pOut->WriteBitCoord( flValue );
+	}
+	else if ( flags & ( SPROP_COORD_MP | SPROP_COORD_MP_LOWPRECISION | SPROP_COORD_MP_INTEGRAL ) )
+	{
+		m_pOut->WriteBitCoordMP( flValue, ( flags & SPROP_COORD_MP_INTEGRAL ) != 0, ( flags & SPROP_COORD_MP_LOWPRECISION ) != 0 );
+	}
+	else if ( flags & SPROP_NOSCALE )
+	{
+		m_pOut->WriteBitFloat( flValue );
+	}
+	else if ( flags & SPROP_NORMAL )
+	{
+		m_pOut->WriteBitNormal( flValue );
+	}
+	else
+	{
+		unsigned long ulValue;
+		if ( flValue < pProp->m_fLowValue )
+		{
+			ulValue = 0;
+		}
+		else if ( flValue > pProp->m_fHighValue )
+		{
+			ulValue = ( 1 << pProp->m_nBits ) - 1;
+		}
+		else
+		{
+			float flRange = ( flValue - pProp->m_fLowValue ) * pProp->m_fHighLowMul;
+			ulValue = ( pProp->m_nBits <= 22 ) ? FastFloatToSmallInt( flRange ) : RoundFloatToUnsignedLong( flRange );
+		}
+		m_pOut->WriteUBitLong( ulValue, pProp->m_nBits );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Encodes every networked entity on the map through the reference encoder and
+// through the compiled plans, checks they agree and reports the time each
+// takes.
+//-----------------------------------------------------------------------------
+CON_COMMAND( sv_sendplan_benchmark, "Time encoding all networked entities with and without precompiled SendTable plans. Usage: sv_sendplan_benchmark [passes]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nPasses = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 100;
+
+	CUtlVector<CBaseEntity*> entities;
+	CUtlVector<CSendTablePlan*> plans;
+	int nProps = 0;
+	int nCustomProxies = 0;
+	int nUnsupported = 0;
+
+	CFastTimer compileTimer;
+	compileTimer.Start();
+	for ( int i = 0; i < gpGlobals->maxEntities; ++i )
+	{
+		edict_t *pEdict = INDEXENT( i );
+		if ( !pEdict || pEdict->IsFree() )
+			continue;
+
+		CBaseEntity *pEntity = GetContainingEntity( pEdict );
+		ServerClass *pServerClass = pEntity ? pEntity->GetServerClass() : NULL;
+		if ( !pServerClass || !pServerClass->m_pTable )
+			continue;
+
+		CSendTablePlan *pPlan = SendTable_GetPlan( pServerClass->m_pTable );
+		if ( !pPlan->CanEncode() )
+		{
+			++nUnsupported;
+			continue;
+		}
+
+		entities.AddToTail( pEntity );
+		plans.AddToTail( pPlan );
+		nProps += pPlan->GetNumProps();
+		nCustomProxies += pPlan->GetNumCustomProxies();
+	}
+	compileTimer.End();
+
+	if ( !entities.Count() )
+	{
+		Msg( "sv_sendplan_benchmark: no networked entities.\n" );
+		return;
+	}
+
+	CUtlMemory<unsigned char> referenceData( 0, MAX_PACKEDENTITY_DATA );
+	CUtlMemory<unsigned char> planData( 0, MAX_PACKEDENTITY_DATA );
+	SendPlanDataTables_t *pTables = new SendPlanDataTables_t;
+
+	// Both paths must produce the same bits
+	int nMismatches = 0;
+	int nTotalBits = 0;
+	for ( int i = 0; i < entities.Count(); ++i )
+	{
+		int iEntity = entities[i]->entindex();
+		plans[i]->SetupDataTables( entities[i], iEntity, pTables );
+
+		bf_write referenceBuf( "sv_sendplan_benchmark", referenceData.Base(), referenceData.Count() );
+		bf_write planBuf( "sv_sendplan_benchmark", planData.Base(), planData.Count() );
+		CSendTableReferenceEncoder reference( entities[i]->GetServerClass()->m_pTable, iEntity, &referenceBuf );
+		reference.Encode( entities[i] );
+		plans[i]->Encode( entities[i], iEntity, *pTables, pTables->m_nValidMask, NULL, &planBuf );
+
+		nTotalBits += planBuf.GetNumBitsWritten();
+		if ( referenceBuf.IsOverflowed() || planBuf.IsOverflowed() ||
+			 referenceBuf.GetNumBitsWritten() != planBuf.GetNumBitsWritten() ||
+			 V_memcmp( referenceData.Base(), planData.Base(), planBuf.GetNumBytesWritten() ) )
+		{
+			if ( nMismatches++ < 8 )
+			{
+				Warning( "sv_sendplan_benchmark: %s (%d) encodes differently (%d bits reference, %d bits plan)\n",
+					entities[i]->GetClassname(), iEntity, referenceBuf.GetNumBitsWritten(), planBuf.GetNumBitsWritten() );
+			}
+		}
+	}
+
+	CFastTimer referenceTimer;
+	referenceTimer.Start();
+	for ( int iPass = 0; iPass < nPasses; ++iPass )
+	{
+		for ( int i = 0; i < entities.Count(); ++i )
+		{
+			bf_write buf( "sv_sendplan_benchmark", referenceData.Base(), referenceData.Count() );
+			CSendTableReferenceEncoder reference( entities[i]->GetServerClass()->m_pTable, entities[i]->entindex(), &buf );
+			reference.Encode( entities[i] );
+		}
+	}
+	referenceTimer.End();
+
+	CFastTimer planTimer;
+	planTimer.Start();
+	for ( int iPass = 0; iPass < nPasses; ++iPass )
+	{
+		for ( int i = 0; i < entities.Count(); ++i )
+		{
+			int iEntity = entities[i]->entindex();
+			plans[i]->SetupDataTables( entities[i], iEntity, pTables );
+			bf_write buf( "sv_sendplan_benchmark", planData.Base(), planData.Count() );
+			plans[i]->Encode( entities[i], iEntity, *pTables, pTables->m_nValidMask, NULL, &buf );
+		}
+	}
+	planTimer.End();
+
+	delete pTables;
+
+	double flReferenceMS = referenceTimer.GetDuration().GetMillisecondsF() / nPasses;
+	double flPlanMS = planTimer.GetDuration().GetMillisecondsF() / nPasses;
+
+	Msg( "sv_sendplan_benchmark: %d entities, %d props (%d through custom proxies), %d bytes per pass\n",
+		entities.Count(), nProps, nCustomProxies, ( nTotalBits + 7 ) >> 3 );
+	Msg( "  plan lookup/compile: %.3f ms\n", compileTimer.GetDuration().GetMillisecondsF() );
+	Msg( "  reference: %.4f ms/pass\n", flReferenceMS );
+	Msg( "  plan:      %.4f ms/pass (%.2fx)\n", flPlanMS, flPlanMS > 0.0 ? flReferenceMS / flPlanMS : 0.0 );
+	if ( nUnsupported )
+	{
+		Msg( "  %d entities skipped (SPROP_XYZE props aren't compiled into plans)\n", nUnsupported );
+	}
+	if ( nMismatches )
+	{
+		Warning( "  %d entities encoded differently!\n", nMismatches );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Entity delta memo
+//-----------------------------------------------------------------------------
+ConVar sv_netprop_delta_memo( "sv_netprop_delta_memo", "0", 0, "Have CEntityDeltaCache::WriteDelta() encode identical entity deltas once per tick and copy them after that. The snapshot code doesn't write through it yet; sv_netprop_delta_memo_benchmark does." );
+
+CEntityDeltaCache g_EntityDeltaCache;
+
+COMPILE_TIME_ASSERT( sizeof( EntityDeltaKey_t ) == 16 );
+
+unsigned int CEntityDeltaCache::KeyHashFunctor::operator()( const EntityDeltaKey_t &key ) const
+{
+	return Hash16( &key );
+}
+
+bool CEntityDeltaCache::KeyEqualFunctor::operator()( const EntityDeltaKey_t &lhs, const EntityDeltaKey_t &rhs ) const
+{
+	return lhs.m_hEntity == rhs.m_hEntity && lhs.m_nFromTick == rhs.m_nFromTick &&
+		lhs.m_nToTick == rhs.m_nToTick && lhs.m_nRecipientMask == rhs.m_nRecipientMask;
+}
+
+
+CEntityDeltaCache::CEntityDeltaCache() : m_Scratch( 0, MAX_PACKEDENTITY_DATA )
+{
+	m_nTick = -1;
+	V_memset( m_EntityTick, 0xFF, sizeof( m_EntityTick ) );
+	ResetStats();
+}
+
+
+void CEntityDeltaCache::Flush()
+{
+	m_Deltas.RemoveAll();
+	m_Data.RemoveAll();
+	m_DataTables.RemoveAll();
+	V_memset( m_EntityTick, 0xFF, sizeof( m_EntityTick ) );
+	m_nTick = gpGlobals->tickcount;
+}
+
+
+void CEntityDeltaCache::ResetStats()
+{
+	m_nHits = 0;
+	m_nMisses = 0;
+	m_nBitsEncoded = 0;
+	m_nBitsCopied = 0;
+}
+
+
+void CEntityDeltaCache::GetStats( Stats_t &stats ) const
+{
+	stats.m_nHits = m_nHits;
+	stats.m_nMisses = m_nMisses;
+	stats.m_nBitsEncoded = m_nBitsEncoded;
+	stats.m_nBitsCopied = m_nBitsCopied;
+}
+
+
+void CEntityDeltaCache::SetStats( const Stats_t &stats )
+{
+	m_nHits = stats.m_nHits;
+	m_nMisses = stats.m_nMisses;
+	m_nBitsEncoded = stats.m_nBitsEncoded;
+	m_nBitsCopied = stats.m_nBitsCopied;
+}
+
+
+void CEntityDeltaCache::ReportStats() const
+{
+	int64 nTotal = m_nHits + m_nMisses;
+	Msg( "Entity delta memo: %lld requests, %lld encoded, %lld copied (%.1f%% hit rate)\n",
+		nTotal, m_nMisses, m_nHits, nTotal ? 100.0f * m_nHits / nTotal : 0.0f );
+	Msg( "  %lld bytes encoded, %lld bytes copied from memoized deltas\n", m_nBitsEncoded >> 3, m_nBitsCopied >> 3 );
+}
+
+
+const SendPlanDataTables_t &CEntityDeltaCache::GetDataTables( CBaseEntity *pEntity, CSendTablePlan *pPlan )
+{
+	int iEntity = pEntity->entindex();
+	if ( m_EntityTick[iEntity] != m_nTick )
+	{
+		m_EntityTick[iEntity] = m_nTick;
+		m_EntityDataTables[iEntity] = (unsigned short)m_DataTables.AddToTail();
+		pPlan->SetupDataTables( pEntity, iEntity, &m_DataTables[m_EntityDataTables[iEntity]] );
+	}
+	return m_DataTables[m_EntityDataTables[iEntity]];
+}
+
+
+int CEntityDeltaCache::Encode( CBaseEntity *pEntity, CSendTablePlan *pPlan, const SendPlanDataTables_t &tables, uint32 nRecipientMask,
+	int nFromTick, bf_write *pOut )
+{
+	const CVarBitVec *pProps = NULL;
+	if ( pEntity->NetworkProp()->GetPropsChangedSince( nFromTick, &m_ChangedProps ) )
+	{
+		pProps = &m_ChangedProps;
+	}
+	return pPlan->Encode( pEntity, pEntity->entindex(), tables, nRecipientMask, pProps, pOut );
+}
+
+
+int CEntityDeltaCache::WriteDelta( CBaseEntity *pEntity, int nFromTick, int iClient, bf_write *pOut )
+{
+	ServerClass *pServerClass = pEntity->GetServerClass();
+	if ( !pServerClass || !pServerClass->m_pTable )
+		return 0;
+
+	VPROF_BUDGET( "CEntityDeltaCache::WriteDelta", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	if ( m_nTick != gpGlobals->tickcount )
+	{
+		Flush();
+	}
+
+	CSendTablePlan *pPlan = SendTable_GetPlan( pServerClass->m_pTable );
+	if ( !pPlan->CanEncode() )
+		return -1;
+
+	const SendPlanDataTables_t &tables = GetDataTables( pEntity, pPlan );
+	uint32 nRecipientMask = pPlan->GetRecipientMask( tables, iClient );
+
+	if ( !sv_netprop_delta_memo.GetBool() )
+	{
+		int nStartBit = pOut->GetNumBitsWritten();
+		int nProps = Encode( pEntity, pPlan, tables, nRecipientMask, nFromTick, pOut );
+		m_nBitsEncoded += pOut->GetNumBitsWritten() - nStartBit;
+		++m_nMisses;
+		return nProps;
+	}
+
+	EntityDeltaKey_t key;
+	key.m_hEntity = pEntity->GetRefEHandle().ToInt();
+	key.m_nFromTick = MAX( nFromTick, 0 );
+	key.m_nToTick = m_nTick;
+	key.m_nRecipientMask = nRecipientMask;
+
+	UtlHashHandle_t h = m_Deltas.Find( key );
+	if ( h != m_Deltas.InvalidHandle() )
+	{
+		const EntityDelta_t &delta = m_Deltas[h];
+		pOut->WriteBits( m_Data.Base() + delta.m_nDataOffset, delta.m_nBits );
+		m_nBitsCopied += delta.m_nBits;
+		++m_nHits;
+		return delta.m_nProps;
+	}
+
+	bf_write scratch( "CEntityDeltaCache", m_Scratch.Base(), m_Scratch.Count() );
+	EntityDelta_t delta;
+	delta.m_nProps = Encode( pEntity, pPlan, tables, nRecipientMask, nFromTick, &scratch );
+	if ( scratch.IsOverflowed() )
+	{
+		Warning( "CEntityDeltaCache: delta for %s (%d) overflowed\n", pEntity->GetClassname(), pEntity->entindex() );
+		return 0;
+	}
+
+	delta.m_nBits = scratch.GetNumBitsWritten();
+	delta.m_nDataOffset = m_Data.AddMultipleToTail( scratch.GetNumBytesWritten(), m_Scratch.Base() );
+	m_Deltas.Insert( key, delta );
+	pOut->WriteBits( m_Scratch.Base(), delta.m_nBits );
+	m_nBitsEncoded += delta.m_nBits;
+	++m_nMisses;
+	return delta.m_nProps;
+}
+
+
+CON_COMMAND( sv_netprop_delta_memo_report, "Print entity delta memo hit rates. Usage: sv_netprop_delta_memo_report [reset]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "reset" ) )
+	{
+		g_EntityDeltaCache.ResetStats();
+		return;
+	}
+
+	g_EntityDeltaCache.ReportStats();
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds this tick's entity deltas for every connected client, using each
+// client's PVS, once through the memo and once without it.
+//-----------------------------------------------------------------------------
+static void WriteClientDeltas( int nFromTick, bf_write *pOut, int *pEntityCount )
+{
+	unsigned char pvs[MAX_MAP_CLUSTERS / 8];
+
+	for ( int iPlayer = 1; iPlayer <= gpGlobals->maxClients; ++iPlayer )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( iPlayer );
+		if ( !pPlayer || !pPlayer->IsConnected() )
+			continue;
+
+		int cluster = engine->GetClusterForOrigin( pPlayer->EyePosition() );
+		engine->GetPVSForCluster( cluster, sizeof( pvs ), pvs );
+
+		for ( int i = 0; i < gpGlobals->maxEntities; ++i )
+		{
+			edict_t *pEdict = INDEXENT( i );
+			if ( !pEdict || pEdict->IsFree() )
+				continue;
+
+			CBaseEntity *pEntity = GetContainingEntity( pEdict );
+			if ( !pEntity )
+				continue;
+
+			int nTransmitState = pEntity->GetTransmitState();
+			if ( nTransmitState & FL_EDICT_DONTSEND )
+				continue;
+			if ( !( nTransmitState & FL_EDICT_ALWAYS ) && !pEntity->NetworkProp()->IsInPVS( pPlayer->edict(), pvs, sizeof( pvs ) ) )
+				continue;
+
+			pOut->Reset();
+			g_EntityDeltaCache.WriteDelta( pEntity, nFromTick, iPlayer - 1, pOut );
+			++( *pEntityCount );
+		}
+	}
+}
+
+CON_COMMAND( sv_netprop_delta_memo_benchmark, "Time building this tick's entity deltas for all clients with and without the delta memo. Usage: sv_netprop_delta_memo_benchmark [ticks_ago]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	// 0 means a full update from the baseline
+	int nTicksAgo = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 0 ) : 0;
+	int nFromTick = nTicksAgo ? MAX( gpGlobals->tickcount - nTicksAgo, 1 ) : 0;
+
+	CUtlMemory<unsigned char> data( 0, MAX_PACKEDENTITY_DATA );
+	bf_write buf( "sv_netprop_delta_memo_benchmark", data.Base(), data.Count() );
+
+	bool bMemo = sv_netprop_delta_memo.GetBool();
+	CEntityDeltaCache::Stats_t stats;
+	g_EntityDeltaCache.GetStats( stats );
+
+	int nEntities = 0;
+	sv_netprop_delta_memo.SetValue( 0 );
+	g_EntityDeltaCache.Flush();
+	CFastTimer directTimer;
+	directTimer.Start();
+	WriteClientDeltas( nFromTick, &buf, &nEntities );
+	directTimer.End();
+
+	int64 nMemoHits = g_EntityDeltaCache.GetHits();
+	int64 nMemoMisses = g_EntityDeltaCache.GetMisses();
+
+	nEntities = 0;
+	sv_netprop_delta_memo.SetValue( 1 );
+	g_EntityDeltaCache.Flush();
+	CFastTimer memoTimer;
+	memoTimer.Start();
+	WriteClientDeltas( nFromTick, &buf, &nEntities );
+	memoTimer.End();
+
+	nMemoHits = g_EntityDeltaCache.GetHits() - nMemoHits;
+	nMemoMisses = g_EntityDeltaCache.GetMisses() - nMemoMisses;
+
+	sv_netprop_delta_memo.SetValue( bMemo );
+
+	Msg( "sv_netprop_delta_memo_benchmark: %d client entity deltas from tick %d\n", nEntities, nFromTick );
+	Msg( "  without memo: %.3f ms\n", directTimer.GetDuration().GetMillisecondsF() );
+	Msg( "  with memo:    %.3f ms (%lld encoded, %lld copied, %.1f%% hit rate)\n", memoTimer.GetDuration().GetMillisecondsF(),
+		nMemoMisses, nMemoHits, nEntities ? 100.0f * nMemoHits / nEntities : 0.0f );
+
+	// Keep the benchmark out of the running totals
+	g_EntityDeltaCache.SetStats( stats );
+}
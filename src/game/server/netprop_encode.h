@@ -0,0 +1,113 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Game-side network prop encoding using precompiled SendTable plans.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef NETPROP_ENCODE_H
+#define NETPROP_ENCODE_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "dt_send_plan.h"
+#include "tier1/utlhashtable.h"
+
+class CBaseEntity;
+class bf_write;
+
+
+//-----------------------------------------------------------------------------
+// Memoizes encoded entity deltas within one tick. Clients that share a view
+// of an entity (same from-tick and same datatable proxy recipients, as with
+// spectators and SourceTV) get a copy of the bits the first of them encoded.
+//-----------------------------------------------------------------------------
+struct EntityDeltaKey_t
+{
+	int		m_hEntity;			// CBaseHandle::ToInt(), so reused slots don't collide
+	int		m_nFromTick;		// 0 for a full update
+	int		m_nToTick;
+	uint32	m_nRecipientMask;	// Datatable proxies the client receives
+};
+
+class CEntityDeltaCache
+{
+public:
+	CEntityDeltaCache();
+
+	// Writes pEntity's delta from nFromTick to the current tick as seen by
+	// iClient (a client index, like CSendProxyRecipients uses). Returns the
+	// number of props written, or -1 without writing anything if the entity's
+	// table has props the plans can't encode (see CSendTablePlan::CanEncode).
+	int				WriteDelta( CBaseEntity *pEntity, int nFromTick, int iClient, bf_write *pOut );
+
+	// Drops all memoized deltas. Happens automatically when the tick changes.
+	void			Flush();
+
+	struct Stats_t
+	{
+		int64	m_nHits;
+		int64	m_nMisses;
+		int64	m_nBitsEncoded;
+		int64	m_nBitsCopied;
+	};
+
+	void			ResetStats();
+	void			ReportStats() const;
+
+	// For callers that drive the cache themselves and shouldn't show up in the report
+	void			GetStats( Stats_t &stats ) const;
+	void			SetStats( const Stats_t &stats );
+
+	int64			GetHits() const			{ return m_nHits; }
+	int64			GetMisses() const		{ return m_nMisses; }
+
+private:
+	struct EntityDelta_t
+	{
+		int		m_nDataOffset;
+		int		m_nBits;
+		int		m_nProps;
+	};
+
+	struct KeyHashFunctor
+	{
+		unsigned int operator()( const EntityDeltaKey_t &key ) const;
+	};
+
+	struct KeyEqualFunctor
+	{
+		bool operator()( const EntityDeltaKey_t &lhs, const EntityDeltaKey_t &rhs ) const;
+	};
+
+	const SendPlanDataTables_t &GetDataTables( CBaseEntity *pEntity, CSendTablePlan *pPlan );
+	int				Encode( CBaseEntity *pEntity, CSendTablePlan *pPlan, const SendPlanDataTables_t &tables, uint32 nRecipientMask,
+						int nFromTick, bf_write *pOut );
+
+	int				m_nTick;
+	CUtlHashtable<EntityDeltaKey_t, EntityDelta_t, KeyHashFunctor, KeyEqualFunctor> m_Deltas;
+	CUtlVector<unsigned char>	m_Data;
+
+	// Datatable proxy results, evaluated once per entity per tick
+	CUtlVector<SendPlanDataTables_t>	m_DataTables;
+	int				m_EntityTick[MAX_EDICTS];
+	unsigned short	m_EntityDataTables[MAX_EDICTS];
+
+	CVarBitVec		m_ChangedProps;
+	CUtlMemory<unsigned char>	m_Scratch;
+
+	int64			m_nHits;
+	int64			m_nMisses;
+	int64			m_nBitsEncoded;
+	int64			m_nBitsCopied;
+};
+
+extern CEntityDeltaCache g_EntityDeltaCache;
+
+// When off, WriteDelta encodes every request (see sv_netprop_delta_memo)
+extern ConVar sv_netprop_delta_memo;
+
+
+#endif // NETPROP_ENCODE_H
@@ -37,6 +37,7 @@
 #include "vphysicsupdateai.h"
 #include "tier0/vcrmode.h"
 #include "pushentity.h"
+#include "entity_profiler.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -943,6 +944,7 @@ void CBaseEntity::PhysicsDispatchThink( BASEPTR thinkFunc )
 	if ( thinkFunc )
 	{
 		MDLCACHE_CRITICAL_SECTION();
+		ENTITY_PROFILE_SCOPE( this, ENTITY_PROFILE_THINK );
 		(this->*thinkFunc)();
 	}
 
@@ -1955,6 +1957,7 @@ void Physics_SimulateEntity( CBaseEntity *pEntity )
 	VPROF( ( !vprof_scope_entity_gamephys.GetBool() ) ? 
 			"Physics_SimulateEntity" : 
 			EntityFactoryDictionary()->GetCannonicalName( pEntity->GetClassname() ) );
+	ENTITY_PROFILE_SCOPE( pEntity, ENTITY_PROFILE_PHYSICS );
 
 	if ( pEntity->edict() )
 	{
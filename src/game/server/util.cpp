@@ -16,6 +16,8 @@
 #include "entitylist.h"
 #include "bspfile.h"
 #include "mathlib/mathlib.h"
+#include "mathlib/ssemath.h"
+#include "bitvec.h"
 #include "IEffects.h"
 #include "vstdlib/random.h"
 #include "soundflags.h"
@@ -310,6 +312,293 @@ CBaseEntity *CEntitySphereQuery::GetCurrentEntity()
 }
 
 
+//-----------------------------------------------------------------------------
+// class CEntityBatchQuery
+//-----------------------------------------------------------------------------
+
+// If the union of all queries is this much larger than the queries themselves
+// (e.g. a handful of tiny boxes scattered across the map) walk the partition
+// per query instead, still collecting into the shared candidate list.
+#define BATCH_QUERY_UNION_VOLUME_RATIO	8.0f
+
+class CEntityBatchQuery::CCandidateEnum : public IPartitionEnumerator
+{
+public:
+	CCandidateEnum( CEntityBatchQuery *pQuery ) : m_pQuery( pQuery ) {}
+
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		const CBaseHandle &hEntity = pHandleEntity->GetRefEHandle();
+		int iEntry = hEntity.GetEntryIndex();
+		if ( m_Seen.IsBitSet( iEntry ) )
+			return ITERATION_CONTINUE;
+		m_Seen.Set( iEntry );
+
+		CBaseEntity *pEntity = gEntList.GetBaseEntity( hEntity );
+		if ( !pEntity )
+			return ITERATION_CONTINUE;
+
+		if ( m_pQuery->m_flagMask && !(pEntity->GetFlags() & m_pQuery->m_flagMask) )
+			return ITERATION_CONTINUE;
+
+		// Use the same bounds the collision property inserts into the partition
+		Vector vecMins, vecMaxs;
+		CCollisionProperty *pCollision = pEntity->CollisionProp();
+		if ( pCollision->BoundingRadius() != 0.0f )
+		{
+			pCollision->WorldSpaceSurroundingBounds( &vecMins, &vecMaxs );
+			vecMins -= Vector( 1, 1, 1 );
+			vecMaxs += Vector( 1, 1, 1 );
+		}
+		else
+		{
+			vecMins = vecMaxs = pCollision->GetCollisionOrigin();
+		}
+
+		m_pQuery->m_Candidates.AddToTail( pEntity );
+		for ( int i = 0; i < 3; ++i )
+		{
+			m_pQuery->m_CandidateMins[i].AddToTail( vecMins[i] );
+			m_pQuery->m_CandidateMaxs[i].AddToTail( vecMaxs[i] );
+		}
+		return ITERATION_CONTINUE;
+	}
+
+private:
+	CEntityBatchQuery		*m_pQuery;
+	CBitVec<NUM_ENT_ENTRIES> m_Seen;
+};
+
+CEntityBatchQuery::CEntityBatchQuery( int flagMask, SpatialPartitionListMask_t listMask )
+{
+	m_flagMask = flagMask;
+	m_listMask = listMask;
+}
+
+void CEntityBatchQuery::Reset()
+{
+	m_Queries.RemoveAll();
+	m_Candidates.RemoveAll();
+	m_Results.RemoveAll();
+	for ( int i = 0; i < 3; ++i )
+	{
+		m_CandidateMins[i].RemoveAll();
+		m_CandidateMaxs[i].RemoveAll();
+	}
+}
+
+int CEntityBatchQuery::AddQuery( BatchQueryType_t nType, const Vector &mins, const Vector &maxs )
+{
+	int i = m_Queries.AddToTail();
+	BatchQuery_t &query = m_Queries[i];
+	query.m_nType = nType;
+	query.m_vecMins = mins;
+	query.m_vecMaxs = maxs;
+	query.m_vecStart.Init();
+	query.m_vecDelta.Init();
+	query.m_vecExtents.Init();
+	query.m_flRadius = 0.0f;
+	query.m_nFirstResult = 0;
+	query.m_nResultCount = 0;
+	return i;
+}
+
+int CEntityBatchQuery::AddBox( const Vector &mins, const Vector &maxs )
+{
+	return AddQuery( BATCH_QUERY_BOX, mins, maxs );
+}
+
+int CEntityBatchQuery::AddSphere( const Vector &center, float radius )
+{
+	Vector vecRadius( radius, radius, radius );
+	int i = AddQuery( BATCH_QUERY_SPHERE, center - vecRadius, center + vecRadius );
+	m_Queries[i].m_vecStart = center;
+	m_Queries[i].m_flRadius = radius;
+	return i;
+}
+
+int CEntityBatchQuery::AddRay( const Ray_t &ray )
+{
+	Vector vecStart = ray.m_Start;
+	Vector vecEnd = ray.m_Start + ray.m_Delta;
+	Vector vecMins, vecMaxs;
+	VectorMin( vecStart, vecEnd, vecMins );
+	VectorMax( vecStart, vecEnd, vecMaxs );
+	vecMins -= ray.m_Extents;
+	vecMaxs += ray.m_Extents;
+
+	int i = AddQuery( BATCH_QUERY_RAY, vecMins, vecMaxs );
+	m_Queries[i].m_vecStart = vecStart;
+	m_Queries[i].m_vecDelta = ray.m_Delta;
+	m_Queries[i].m_vecExtents = ray.m_Extents;
+	return i;
+}
+
+void CEntityBatchQuery::GatherCandidates()
+{
+	Vector vecUnionMins( MAX_COORD_FLOAT, MAX_COORD_FLOAT, MAX_COORD_FLOAT );
+	Vector vecUnionMaxs( -MAX_COORD_FLOAT, -MAX_COORD_FLOAT, -MAX_COORD_FLOAT );
+	float flQueryVolume = 0.0f;
+	for ( int i = 0; i < m_Queries.Count(); ++i )
+	{
+		const BatchQuery_t &query = m_Queries[i];
+		VectorMin( vecUnionMins, query.m_vecMins, vecUnionMins );
+		VectorMax( vecUnionMaxs, query.m_vecMaxs, vecUnionMaxs );
+
+		Vector vecSize = query.m_vecMaxs - query.m_vecMins;
+		flQueryVolume += ( vecSize.x + 1.0f ) * ( vecSize.y + 1.0f ) * ( vecSize.z + 1.0f );
+	}
+
+	Vector vecUnionSize = vecUnionMaxs - vecUnionMins;
+	float flUnionVolume = ( vecUnionSize.x + 1.0f ) * ( vecUnionSize.y + 1.0f ) * ( vecUnionSize.z + 1.0f );
+
+	CCandidateEnum candidateEnum( this );
+	if ( flUnionVolume <= flQueryVolume * BATCH_QUERY_UNION_VOLUME_RATIO )
+	{
+		::partition->EnumerateElementsInBox( m_listMask, vecUnionMins, vecUnionMaxs, false, &candidateEnum );
+	}
+	else
+	{
+		for ( int i = 0; i < m_Queries.Count(); ++i )
+		{
+			::partition->EnumerateElementsInBox( m_listMask, m_Queries[i].m_vecMins, m_Queries[i].m_vecMaxs, false, &candidateEnum );
+		}
+	}
+
+	// Pad the SoA arrays with empty (inverted) boxes so the SIMD loop needs no tail
+	while ( m_CandidateMins[0].Count() & 3 )
+	{
+		for ( int i = 0; i < 3; ++i )
+		{
+			m_CandidateMins[i].AddToTail( MAX_COORD_FLOAT );
+			m_CandidateMaxs[i].AddToTail( -MAX_COORD_FLOAT );
+		}
+	}
+}
+
+void CEntityBatchQuery::TestQuery( BatchQuery_t &query )
+{
+	query.m_nFirstResult = m_Results.Count();
+	query.m_nResultCount = 0;
+
+	const float *pMinX = m_CandidateMins[0].Base();
+	const float *pMinY = m_CandidateMins[1].Base();
+	const float *pMinZ = m_CandidateMins[2].Base();
+	const float *pMaxX = m_CandidateMaxs[0].Base();
+	const float *pMaxY = m_CandidateMaxs[1].Base();
+	const float *pMaxZ = m_CandidateMaxs[2].Base();
+
+	// Every query is first rejected against its enclosing box
+	fltx4 qMinX = ReplicateX4( query.m_vecMins.x );
+	fltx4 qMinY = ReplicateX4( query.m_vecMins.y );
+	fltx4 qMinZ = ReplicateX4( query.m_vecMins.z );
+	fltx4 qMaxX = ReplicateX4( query.m_vecMaxs.x );
+	fltx4 qMaxY = ReplicateX4( query.m_vecMaxs.y );
+	fltx4 qMaxZ = ReplicateX4( query.m_vecMaxs.z );
+
+	fltx4 startX = ReplicateX4( query.m_vecStart.x );
+	fltx4 startY = ReplicateX4( query.m_vecStart.y );
+	fltx4 startZ = ReplicateX4( query.m_vecStart.z );
+	fltx4 radiusSqr = ReplicateX4( query.m_flRadius * query.m_flRadius );
+
+	// Ray slab test setup; axes with no movement get a huge reciprocal so the
+	// slab degenerates into a containment test
+	fltx4 invDeltaX, invDeltaY, invDeltaZ, extX, extY, extZ;
+	if ( query.m_nType == BATCH_QUERY_RAY )
+	{
+		float flInvDelta[3];
+		for ( int i = 0; i < 3; ++i )
+		{
+			float flDelta = query.m_vecDelta[i];
+			flInvDelta[i] = ( fabsf( flDelta ) > 1e-6f ) ? 1.0f / flDelta : 1e30f;
+		}
+		invDeltaX = ReplicateX4( flInvDelta[0] );
+		invDeltaY = ReplicateX4( flInvDelta[1] );
+		invDeltaZ = ReplicateX4( flInvDelta[2] );
+		extX = ReplicateX4( query.m_vecExtents.x );
+		extY = ReplicateX4( query.m_vecExtents.y );
+		extZ = ReplicateX4( query.m_vecExtents.z );
+	}
+
+	int nCandidates = m_Candidates.Count();
+	int nPadded = m_CandidateMins[0].Count();
+	for ( int i = 0; i < nPadded; i += 4 )
+	{
+		fltx4 minX = LoadUnalignedSIMD( pMinX + i );
+		fltx4 minY = LoadUnalignedSIMD( pMinY + i );
+		fltx4 minZ = LoadUnalignedSIMD( pMinZ + i );
+		fltx4 maxX = LoadUnalignedSIMD( pMaxX + i );
+		fltx4 maxY = LoadUnalignedSIMD( pMaxY + i );
+		fltx4 maxZ = LoadUnalignedSIMD( pMaxZ + i );
+
+		fltx4 hit = AndSIMD( CmpLeSIMD( minX, qMaxX ), CmpGeSIMD( maxX, qMinX ) );
+		hit = AndSIMD( hit, AndSIMD( CmpLeSIMD( minY, qMaxY ), CmpGeSIMD( maxY, qMinY ) ) );
+		hit = AndSIMD( hit, AndSIMD( CmpLeSIMD( minZ, qMaxZ ), CmpGeSIMD( maxZ, qMinZ ) ) );
+		if ( IsAllZeros( hit ) )
+			continue;
+
+		if ( query.m_nType == BATCH_QUERY_SPHERE )
+		{
+			// Squared distance from the center to the closest point on each box
+			fltx4 dx = AddSIMD( MaxSIMD( SubSIMD( minX, startX ), Four_Zeros ), MaxSIMD( SubSIMD( startX, maxX ), Four_Zeros ) );
+			fltx4 dy = AddSIMD( MaxSIMD( SubSIMD( minY, startY ), Four_Zeros ), MaxSIMD( SubSIMD( startY, maxY ), Four_Zeros ) );
+			fltx4 dz = AddSIMD( MaxSIMD( SubSIMD( minZ, startZ ), Four_Zeros ), MaxSIMD( SubSIMD( startZ, maxZ ), Four_Zeros ) );
+			fltx4 distSqr = MaddSIMD( dx, dx, MaddSIMD( dy, dy, MulSIMD( dz, dz ) ) );
+			hit = AndSIMD( hit, CmpLeSIMD( distSqr, radiusSqr ) );
+		}
+		else if ( query.m_nType == BATCH_QUERY_RAY )
+		{
+			// Slab test of the ray segment against the boxes grown by the ray extents
+			fltx4 t0x = MulSIMD( SubSIMD( SubSIMD( minX, extX ), startX ), invDeltaX );
+			fltx4 t1x = MulSIMD( SubSIMD( AddSIMD( maxX, extX ), startX ), invDeltaX );
+			fltx4 t0y = MulSIMD( SubSIMD( SubSIMD( minY, extY ), startY ), invDeltaY );
+			fltx4 t1y = MulSIMD( SubSIMD( AddSIMD( maxY, extY ), startY ), invDeltaY );
+			fltx4 t0z = MulSIMD( SubSIMD( SubSIMD( minZ, extZ ), startZ ), invDeltaZ );
+			fltx4 t1z = MulSIMD( SubSIMD( AddSIMD( maxZ, extZ ), startZ ), invDeltaZ );
+
+			fltx4 tNear = MaxSIMD( MinSIMD( t0x, t1x ), MaxSIMD( MinSIMD( t0y, t1y ), MinSIMD( t0z, t1z ) ) );
+			fltx4 tFar = MinSIMD( MaxSIMD( t0x, t1x ), MinSIMD( MaxSIMD( t0y, t1y ), MaxSIMD( t0z, t1z ) ) );
+			hit = AndSIMD( hit, CmpLeSIMD( tNear, tFar ) );
+			hit = AndSIMD( hit, CmpGeSIMD( tFar, Four_Zeros ) );
+			hit = AndSIMD( hit, CmpLeSIMD( tNear, Four_Ones ) );
+		}
+
+		int nMask = TestSignSIMD( hit );
+		for ( int j = 0; nMask; ++j, nMask >>= 1 )
+		{
+			if ( ( nMask & 1 ) && ( i + j < nCandidates ) )
+			{
+				m_Results.AddToTail( m_Candidates[i + j] );
+				++query.m_nResultCount;
+			}
+		}
+	}
+}
+
+void CEntityBatchQuery::Execute()
+{
+	VPROF( "CEntityBatchQuery::Execute" );
+
+	m_Candidates.RemoveAll();
+	m_Results.RemoveAll();
+	for ( int i = 0; i < 3; ++i )
+	{
+		m_CandidateMins[i].RemoveAll();
+		m_CandidateMaxs[i].RemoveAll();
+	}
+
+	if ( !m_Queries.Count() )
+		return;
+
+	GatherCandidates();
+
+	for ( int i = 0; i < m_Queries.Count(); ++i )
+	{
+		TestQuery( m_Queries[i] );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Simple trace filter
 //-----------------------------------------------------------------------------
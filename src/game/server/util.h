@@ -338,6 +338,70 @@ private:
 	CBaseEntity *m_pList[MAX_SPHERE_QUERY];
 };
 
+//-----------------------------------------------------------------------------
+// class CEntityBatchQuery
+//-----------------------------------------------------------------------------
+// Resolves many box/sphere/ray entity queries with a single spatial partition
+// walk. Candidates are gathered once (one EnumElement per candidate rather than
+// per candidate per query) into SoA bounds arrays, then every query is tested
+// against four candidates at a time with SIMD. Results land in one flat array.
+class CEntityBatchQuery
+{
+public:
+	CEntityBatchQuery( int flagMask = 0, SpatialPartitionListMask_t listMask = PARTITION_ENGINE_NON_STATIC_EDICTS );
+
+	// Queue queries; each returns the query index used to fetch its results
+	int AddBox( const Vector &mins, const Vector &maxs );
+	int AddSphere( const Vector &center, float radius );
+	int AddRay( const Ray_t &ray );
+
+	// Runs all queued queries. Results stay valid until Reset()
+	void Execute();
+	void Reset();
+
+	int QueryCount() const			{ return m_Queries.Count(); }
+	int CandidateCount() const		{ return m_Candidates.Count(); }
+	int GetResultCount( int iQuery ) const	{ return m_Queries[iQuery].m_nResultCount; }
+	CBaseEntity * const *GetResults( int iQuery ) const { return m_Results.Base() + m_Queries[iQuery].m_nFirstResult; }
+
+private:
+	enum BatchQueryType_t
+	{
+		BATCH_QUERY_BOX = 0,
+		BATCH_QUERY_SPHERE,
+		BATCH_QUERY_RAY,
+	};
+
+	struct BatchQuery_t
+	{
+		BatchQueryType_t	m_nType;
+		Vector				m_vecMins;		// bounds enclosing the whole query
+		Vector				m_vecMaxs;
+		Vector				m_vecStart;		// sphere center or ray start
+		Vector				m_vecDelta;		// ray delta
+		Vector				m_vecExtents;	// ray extents
+		float				m_flRadius;
+		int					m_nFirstResult;
+		int					m_nResultCount;
+	};
+
+	class CCandidateEnum;
+
+	int AddQuery( BatchQueryType_t nType, const Vector &mins, const Vector &maxs );
+	void GatherCandidates();
+	void TestQuery( BatchQuery_t &query );
+
+	int							m_flagMask;
+	SpatialPartitionListMask_t	m_listMask;
+	CUtlVector<BatchQuery_t>	m_Queries;
+	CUtlVector<CBaseEntity *>	m_Candidates;
+	CUtlVector<CBaseEntity *>	m_Results;
+
+	// Candidate bounds, SoA, padded to a multiple of four
+	CUtlVector<float>			m_CandidateMins[3];
+	CUtlVector<float>			m_CandidateMaxs[3];
+};
+
 enum soundlevel_t;
 
 // Drops an entity onto the floor
@@ -462,13 +462,10 @@ int LookupActivity( CStudioHdr *pstudiohdr, const char *label )
 		return 0;
 	}
 
-	for ( int i = 0; i < pstudiohdr->GetNumSeq(); i++ )
+	int iSequence = pstudiohdr->FindSequenceByActivityName( label );
+	if ( iSequence >= 0 )
 	{
-		mstudioseqdesc_t &seqdesc = pstudiohdr->pSeqdesc( i );
-		if ( stricmp( seqdesc.pszActivityName(), label ) == 0 )
-		{
-			return seqdesc.activity;
-		}
+		return pstudiohdr->pSeqdesc( iSequence ).activity;
 	}
 
 	return ACT_INVALID;
@@ -493,12 +490,9 @@ int LookupSequence( CStudioHdr *pstudiohdr, const char *label )
 	//
 	// Look up by sequence name.
 	//
-	for (int i = 0; i < pstudiohdr->GetNumSeq(); i++)
-	{
-		mstudioseqdesc_t	&seqdesc = pstudiohdr->pSeqdesc( i );
-		if (stricmp( seqdesc.pszLabel(), label ) == 0)
-			return i;
-	}
+	int iSequence = pstudiohdr->FindSequenceByName( label );
+	if ( iSequence >= 0 )
+		return iSequence;
 
 	//
 	// Not found, look up by activity name.
@@ -18,6 +18,9 @@
 #include "igamesystem.h"
 #include "utlmultilist.h"
 #include "tier1/callqueue.h"
+#ifdef GAME_DLL
+#include "entity_profiler.h"
+#endif
 
 #ifdef PORTAL
 	#include "portal_util_shared.h"
@@ -911,6 +914,9 @@ void CBaseEntity::PhysicsTouch( CBaseEntity *pentOther )
 	{
 		if ( !(IsMarkedForDeletion() || pentOther->IsMarkedForDeletion()) )
 		{
+#ifdef GAME_DLL
+			ENTITY_PROFILE_SCOPE( this, ENTITY_PROFILE_TOUCH );
+#endif
 			Touch( pentOther );
 		}
 	}
@@ -926,6 +932,9 @@ void CBaseEntity::PhysicsStartTouch( CBaseEntity *pentOther )
 	{
 		if ( !(IsMarkedForDeletion() || pentOther->IsMarkedForDeletion()) )
 		{
+#ifdef GAME_DLL
+			ENTITY_PROFILE_SCOPE( this, ENTITY_PROFILE_TOUCH );
+#endif
 			StartTouch( pentOther );
 			Touch( pentOther );
 		}
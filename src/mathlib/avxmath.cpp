@@ -0,0 +1,459 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 8-wide AVX2 kernels behind the FourVectors array functions, and
+//			a benchmark of the scalar, SSE and AVX2 versions of the mathlib
+//			kernels.
+//
+//===========================================================================//
+
+#include "basetypes.h"
+#include "mathlib/mathlib.h"
+#include "mathlib/ssemath.h"
+#include "mathlib/avxmath.h"
+#include "tier0/dbg.h"
+#include "tier0/fasttimer.h"
+#include "tier0/memalloc.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+#ifdef MATHLIB_AVX2
+
+// the rows of a matrix3x4_t, each entry splatted across a register
+struct MatrixSplat8_t
+{
+	fltx8 m00, m01, m02, m03;
+	fltx8 m10, m11, m12, m13;
+	fltx8 m20, m21, m22, m23;
+};
+
+static FORCEINLINE_AVX2 void SplatMatrix8( const matrix3x4_t &mat, MatrixSplat8_t &splat )
+{
+	splat.m00 = ReplicateX8( mat[0][0] );	splat.m01 = ReplicateX8( mat[0][1] );	splat.m02 = ReplicateX8( mat[0][2] );	splat.m03 = ReplicateX8( mat[0][3] );
+	splat.m10 = ReplicateX8( mat[1][0] );	splat.m11 = ReplicateX8( mat[1][1] );	splat.m12 = ReplicateX8( mat[1][2] );	splat.m13 = ReplicateX8( mat[1][3] );
+	splat.m20 = ReplicateX8( mat[2][0] );	splat.m21 = ReplicateX8( mat[2][1] );	splat.m22 = ReplicateX8( mat[2][2] );	splat.m23 = ReplicateX8( mat[2][3] );
+}
+
+static FORCEINLINE_AVX2 void RotateBy8( EightVectors &v, const MatrixSplat8_t &m )
+{
+	fltx8 x = MaddSIMD( v.z, m.m02, MaddSIMD( v.y, m.m01, MulSIMD( v.x, m.m00 ) ) );
+	fltx8 y = MaddSIMD( v.z, m.m12, MaddSIMD( v.y, m.m11, MulSIMD( v.x, m.m10 ) ) );
+	fltx8 z = MaddSIMD( v.z, m.m22, MaddSIMD( v.y, m.m21, MulSIMD( v.x, m.m20 ) ) );
+	v.x = x;
+	v.y = y;
+	v.z = z;
+}
+
+static FORCEINLINE_AVX2 void TransformBy8( EightVectors &v, const MatrixSplat8_t &m )
+{
+	fltx8 x = MaddSIMD( v.z, m.m02, MaddSIMD( v.y, m.m01, MaddSIMD( v.x, m.m00, m.m03 ) ) );
+	fltx8 y = MaddSIMD( v.z, m.m12, MaddSIMD( v.y, m.m11, MaddSIMD( v.x, m.m10, m.m13 ) ) );
+	fltx8 z = MaddSIMD( v.z, m.m22, MaddSIMD( v.y, m.m21, MaddSIMD( v.x, m.m20, m.m23 ) ) );
+	v.x = x;
+	v.y = y;
+	v.z = z;
+}
+
+//-----------------------------------------------------------------------------
+// Rotate the vectors in place, two FourVectors per iteration. Leaves the odd
+// one at the end for the caller.
+//-----------------------------------------------------------------------------
+AVX2_TARGET int FourVectors_RotateManyBy_AVX2( FourVectors * RESTRICT pVectors, unsigned int numVectors, const matrix3x4_t &rotationMatrix )
+{
+	MatrixSplat8_t m;
+	SplatMatrix8( rotationMatrix, m );
+
+	unsigned int nPairs = numVectors >> 1;
+	for ( unsigned int i = 0; i < nPairs; ++i, pVectors += 2 )
+	{
+		EightVectors v;
+		v.LoadFourVectors( pVectors[0], pVectors[1] );
+		RotateBy8( v, m );
+		v.StoreFourVectors( pVectors[0], pVectors[1] );
+	}
+	return nPairs * 2;
+}
+
+//-----------------------------------------------------------------------------
+// Transform the vectors into pOut, which may be pVectors but must not
+// otherwise overlap it.
+//-----------------------------------------------------------------------------
+AVX2_TARGET int FourVectors_TransformManyBy_AVX2( const FourVectors *pVectors, unsigned int numVectors, const matrix3x4_t &rotationMatrix, FourVectors *pOut )
+{
+	MatrixSplat8_t m;
+	SplatMatrix8( rotationMatrix, m );
+
+	unsigned int nPairs = numVectors >> 1;
+	for ( unsigned int i = 0; i < nPairs; ++i, pVectors += 2, pOut += 2 )
+	{
+		EightVectors v;
+		v.LoadFourVectors( pVectors[0], pVectors[1] );
+		TransformBy8( v, m );
+		v.StoreFourVectors( pOut[0], pOut[1] );
+	}
+	return nPairs * 2;
+}
+
+//-----------------------------------------------------------------------------
+// A FourVectors is 12 floats, so an array of them is a flat array of floats
+// for anything done component by component.
+//-----------------------------------------------------------------------------
+AVX2_TARGET void FourVectors_AddArrays_AVX2( FourVectors * RESTRICT pDest, const FourVectors * RESTRICT pSrc, int numVectors )
+{
+	float *pD = reinterpret_cast< float * >( pDest );
+	const float *pS = reinterpret_cast< const float * >( pSrc );
+	int nFloats = numVectors * 12;
+
+	int i = 0;
+	for ( ; i + 8 <= nFloats; i += 8 )
+	{
+		StoreUnalignedSIMD( pD + i, AddSIMD( LoadUnalignedSIMD8( pD + i ), LoadUnalignedSIMD8( pS + i ) ) );
+	}
+	if ( i < nFloats )
+	{
+		// the last FourVectors component
+		StoreAlignedSIMD( pD + i, AddSIMD( LoadAlignedSIMD( pD + i ), LoadAlignedSIMD( pS + i ) ) );
+	}
+}
+
+AVX2_TARGET void FourVectors_ScaleArray_AVX2( FourVectors * RESTRICT pDest, const Vector &scale, int numVectors )
+{
+	// x, y and z of one FourVectors, then the next starting at y
+	fltx8 scaleXY = CombineSIMD8( ReplicateX4( scale.x ), ReplicateX4( scale.y ) );
+	fltx8 scaleZX = CombineSIMD8( ReplicateX4( scale.z ), ReplicateX4( scale.x ) );
+	fltx8 scaleYZ = CombineSIMD8( ReplicateX4( scale.y ), ReplicateX4( scale.z ) );
+
+	int nPairs = numVectors >> 1;
+	for ( int i = 0; i < nPairs; ++i, pDest += 2 )
+	{
+		float *pD = reinterpret_cast< float * >( pDest );
+		StoreUnalignedSIMD( pD, MulSIMD( LoadUnalignedSIMD8( pD ), scaleXY ) );
+		StoreUnalignedSIMD( pD + 8, MulSIMD( LoadUnalignedSIMD8( pD + 8 ), scaleZX ) );
+		StoreUnalignedSIMD( pD + 16, MulSIMD( LoadUnalignedSIMD8( pD + 16 ), scaleYZ ) );
+	}
+	if ( numVectors & 1 )
+	{
+		FourVectors scaleValue;
+		scaleValue.DuplicateVector( scale );
+		pDest->VProduct( scaleValue );
+	}
+}
+
+#endif // MATHLIB_AVX2
+
+
+//-----------------------------------------------------------------------------
+// Benchmark
+//-----------------------------------------------------------------------------
+static float BenchMilliseconds( const CFastTimer &timer )
+{
+	return timer.GetDuration().GetMillisecondsF();
+}
+
+static void ReportBench( const char *pName, float flScalar, float flSSE, float flAVX2 )
+{
+	if ( flAVX2 > 0.0f )
+	{
+		Msg( "  %-18s scalar %8.3f ms   sse %8.3f ms (%4.1fx)   avx2 %8.3f ms (%4.1fx)\n", pName,
+			flScalar, flSSE, flScalar / MAX( flSSE, 1e-6f ), flAVX2, flScalar / MAX( flAVX2, 1e-6f ) );
+	}
+	else
+	{
+		Msg( "  %-18s scalar %8.3f ms   sse %8.3f ms (%4.1fx)\n", pName,
+			flScalar, flSSE, flScalar / MAX( flSSE, 1e-6f ) );
+	}
+}
+
+static void ReportTierBench( const char *pName, float flScalar, float flAccurate, float flEst )
+{
+	Msg( "  %-18s scalar %8.3f ms   sse %8.3f ms (%4.1fx)   sse est %8.3f ms (%4.1fx)\n", pName,
+		flScalar, flAccurate, flScalar / MAX( flAccurate, 1e-6f ), flEst, flScalar / MAX( flEst, 1e-6f ) );
+}
+
+// time nIterations passes of expr over the inputs, step floats at a time
+#define TIME_BENCH_LOOP( step, expr )						\
+	timer.Start();											\
+	for ( int it = 0; it < nIterations; ++it )				\
+	{														\
+		for ( int i = 0; i < nFloats; i += step )			\
+		{													\
+			expr;											\
+		}													\
+	}														\
+	timer.End();
+
+#ifdef MATHLIB_AVX2
+AVX2_TARGET static float BenchSinCosAVX2( const float *pAngles, float *pSin, float *pCos, int nCount, int nIterations )
+{
+	CFastTimer timer;
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i < nCount; i += 8 )
+		{
+			fltx8 s, c;
+			SinCosSIMD( s, c, LoadAlignedSIMD8( pAngles + i ) );
+			StoreAlignedSIMD( pSin + i, s );
+			StoreAlignedSIMD( pCos + i, c );
+		}
+	}
+	timer.End();
+	return BenchMilliseconds( timer );
+}
+
+AVX2_TARGET static float BenchNormalizeAVX2( FourVectors *pVectors, int nCount, int nIterations )
+{
+	CFastTimer timer;
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i + 1 < nCount; i += 2 )
+		{
+			EightVectors v;
+			v.LoadFourVectors( pVectors[i], pVectors[i+1] );
+			v.VectorNormalize();
+			v.StoreFourVectors( pVectors[i], pVectors[i+1] );
+		}
+	}
+	timer.End();
+	return BenchMilliseconds( timer );
+}
+#endif
+
+void MathLib_RunSIMDBenchmarks( int nIterations )
+{
+	const int nVectors = 1024;									// FourVectors, so 4096 vectors
+	const int nFloats = nVectors * 4;
+	nIterations = MAX( nIterations, 1 );
+
+	bool bAVX2 = MathLib_AVX2Enabled();
+	Msg( "SIMD benchmark: %d vectors, %d iterations, avx2 %s\n", nFloats, nIterations, bAVX2 ? "on" : "off" );
+
+	FourVectors *pSrc = (FourVectors *)MemAlloc_AllocAligned( nVectors * sizeof( FourVectors ), 32 );
+	FourVectors *pDest = (FourVectors *)MemAlloc_AllocAligned( nVectors * sizeof( FourVectors ), 32 );
+	Vector *pScalar = new Vector[ nFloats ];
+	Vector *pScalarOut = new Vector[ nFloats ];
+	float *pAngles = (float *)MemAlloc_AllocAligned( nFloats * sizeof( float ), 32 );
+	float *pSin = (float *)MemAlloc_AllocAligned( nFloats * sizeof( float ), 32 );
+	float *pCos = (float *)MemAlloc_AllocAligned( nFloats * sizeof( float ), 32 );
+
+	for ( int i = 0; i < nFloats; ++i )
+	{
+		Vector v( ( i % 97 ) - 48.0f, ( i % 31 ) * 0.5f, ( i % 13 ) - 6.5f );
+		pScalar[i] = v;
+		pSrc[ i >> 2 ].X( i & 3 ) = v.x;
+		pSrc[ i >> 2 ].Y( i & 3 ) = v.y;
+		pSrc[ i >> 2 ].Z( i & 3 ) = v.z;
+		pAngles[i] = ( i - nFloats / 2 ) * 0.01f;
+	}
+
+	matrix3x4_t mat;
+	AngleMatrix( QAngle( 30.0f, 45.0f, 60.0f ), Vector( 10.0f, -20.0f, 30.0f ), mat );
+
+	CFastTimer timer;
+	float flScalar, flSSE, flAVX2;
+
+	// transform
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i < nFloats; ++i )
+		{
+			VectorTransform( pScalar[i], mat, pScalarOut[i] );
+		}
+	}
+	timer.End();
+	flScalar = BenchMilliseconds( timer );
+
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i < nVectors; ++i )
+		{
+			pDest[i] = pSrc[i];
+			pDest[i].TransformBy( mat );
+		}
+	}
+	timer.End();
+	flSSE = BenchMilliseconds( timer );
+
+	flAVX2 = 0.0f;
+#ifdef MATHLIB_AVX2
+	if ( bAVX2 )
+	{
+		timer.Start();
+		for ( int it = 0; it < nIterations; ++it )
+		{
+			FourVectors_TransformManyBy_AVX2( pSrc, nVectors, mat, pDest );
+		}
+		timer.End();
+		flAVX2 = BenchMilliseconds( timer );
+	}
+#endif
+	ReportBench( "TransformManyBy", flScalar, flSSE, flAVX2 );
+
+	// sincos
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i < nFloats; ++i )
+		{
+			SinCos( pAngles[i], &pSin[i], &pCos[i] );
+		}
+	}
+	timer.End();
+	flScalar = BenchMilliseconds( timer );
+
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i < nFloats; i += 4 )
+		{
+			fltx4 s, c;
+			SinCosSIMD( s, c, LoadAlignedSIMD( pAngles + i ) );
+			StoreAlignedSIMD( pSin + i, s );
+			StoreAlignedSIMD( pCos + i, c );
+		}
+	}
+	timer.End();
+	flSSE = BenchMilliseconds( timer );
+
+	flAVX2 = 0.0f;
+#ifdef MATHLIB_AVX2
+	if ( bAVX2 )
+	{
+		flAVX2 = BenchSinCosAVX2( pAngles, pSin, pCos, nFloats, nIterations );
+	}
+#endif
+	ReportBench( "SinCos", flScalar, flSSE, flAVX2 );
+
+	// normalize
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i < nFloats; ++i )
+		{
+			pScalarOut[i] = pScalar[i];
+			VectorNormalize( pScalarOut[i] );
+		}
+	}
+	timer.End();
+	flScalar = BenchMilliseconds( timer );
+
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i < nVectors; ++i )
+		{
+			pDest[i].VectorNormalize();
+		}
+	}
+	timer.End();
+	flSSE = BenchMilliseconds( timer );
+
+	flAVX2 = 0.0f;
+#ifdef MATHLIB_AVX2
+	if ( bAVX2 )
+	{
+		flAVX2 = BenchNormalizeAVX2( pDest, nVectors, nIterations );
+	}
+#endif
+	ReportBench( "VectorNormalize", flScalar, flSSE, flAVX2 );
+
+	// array add
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i < nFloats; ++i )
+		{
+			pScalarOut[i] += pScalar[i];
+		}
+	}
+	timer.End();
+	flScalar = BenchMilliseconds( timer );
+
+	timer.Start();
+	for ( int it = 0; it < nIterations; ++it )
+	{
+		for ( int i = 0; i < nVectors; ++i )
+		{
+			pDest[i] += pSrc[i];
+		}
+	}
+	timer.End();
+	flSSE = BenchMilliseconds( timer );
+
+	flAVX2 = 0.0f;
+#ifdef MATHLIB_AVX2
+	if ( bAVX2 )
+	{
+		timer.Start();
+		for ( int it = 0; it < nIterations; ++it )
+		{
+			FourVectors_AddArrays_AVX2( pDest, pSrc, nVectors );
+		}
+		timer.End();
+		flAVX2 = BenchMilliseconds( timer );
+	}
+#endif
+	ReportBench( "AddArrays", flScalar, flSSE, flAVX2 );
+
+	// the transcendental functions, accurate and fast tiers
+	float *pPositive = (float *)MemAlloc_AllocAligned( nFloats * sizeof( float ), 32 );
+	for ( int i = 0; i < nFloats; ++i )
+	{
+		pPositive[i] = 0.01f + ( i % 1000 ) * 0.37f;
+	}
+	float flEst;
+
+	TIME_BENCH_LOOP( 1, SinCos( pAngles[i], &pSin[i], &pCos[i] ) );
+	flScalar = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, fltx4 s; fltx4 c; SinCosSIMD( s, c, LoadAlignedSIMD( pAngles + i ) ); StoreAlignedSIMD( pSin + i, s ); StoreAlignedSIMD( pCos + i, c ) );
+	flSSE = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, fltx4 s; fltx4 c; SinCosEstSIMD( s, c, LoadAlignedSIMD( pAngles + i ) ); StoreAlignedSIMD( pSin + i, s ); StoreAlignedSIMD( pCos + i, c ) );
+	flEst = BenchMilliseconds( timer );
+	ReportTierBench( "SinCos", flScalar, flSSE, flEst );
+
+	TIME_BENCH_LOOP( 1, pSin[i] = atan2f( pAngles[i], pPositive[i] ) );
+	flScalar = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, StoreAlignedSIMD( pSin + i, ArcTan2SIMD( LoadAlignedSIMD( pAngles + i ), LoadAlignedSIMD( pPositive + i ) ) ) );
+	flSSE = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, StoreAlignedSIMD( pSin + i, ArcTan2EstSIMD( LoadAlignedSIMD( pAngles + i ), LoadAlignedSIMD( pPositive + i ) ) ) );
+	flEst = BenchMilliseconds( timer );
+	ReportTierBench( "ArcTan2", flScalar, flSSE, flEst );
+
+	TIME_BENCH_LOOP( 1, pSin[i] = exp2f( pAngles[i] ) );
+	flScalar = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, StoreAlignedSIMD( pSin + i, ExpSIMD( LoadAlignedSIMD( pAngles + i ) ) ) );
+	flSSE = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, StoreAlignedSIMD( pSin + i, ExpEstSIMD( LoadAlignedSIMD( pAngles + i ) ) ) );
+	flEst = BenchMilliseconds( timer );
+	ReportTierBench( "Exp (2^x)", flScalar, flSSE, flEst );
+
+	TIME_BENCH_LOOP( 1, pSin[i] = log2f( pPositive[i] ) );
+	flScalar = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, StoreAlignedSIMD( pSin + i, Log2SIMD( LoadAlignedSIMD( pPositive + i ) ) ) );
+	flSSE = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, StoreAlignedSIMD( pSin + i, Log2EstSIMD( LoadAlignedSIMD( pPositive + i ) ) ) );
+	flEst = BenchMilliseconds( timer );
+	ReportTierBench( "Log2", flScalar, flSSE, flEst );
+
+	TIME_BENCH_LOOP( 1, pSin[i] = powf( pPositive[i], pAngles[i] * 0.1f ) );
+	flScalar = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, StoreAlignedSIMD( pSin + i, PowSIMD( LoadAlignedSIMD( pPositive + i ), MulSIMD( LoadAlignedSIMD( pAngles + i ), ReplicateX4( 0.1f ) ) ) ) );
+	flSSE = BenchMilliseconds( timer );
+	TIME_BENCH_LOOP( 4, StoreAlignedSIMD( pSin + i, PowEstSIMD( LoadAlignedSIMD( pPositive + i ), MulSIMD( LoadAlignedSIMD( pAngles + i ), ReplicateX4( 0.1f ) ) ) ) );
+	flEst = BenchMilliseconds( timer );
+	ReportTierBench( "Pow", flScalar, flSSE, flEst );
+
+	MemAlloc_FreeAligned( pPositive );
+
+	MemAlloc_FreeAligned( pSrc );
+	MemAlloc_FreeAligned( pDest );
+	MemAlloc_FreeAligned( pAngles );
+	MemAlloc_FreeAligned( pSin );
+	MemAlloc_FreeAligned( pCos );
+	delete [] pScalar;
+	delete [] pScalarOut;
+}
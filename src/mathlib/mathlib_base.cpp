@@ -31,6 +31,15 @@
 
 #include "mathlib/ssemath.h"
 #include "mathlib/ssequaternion.h"
+#include "tier0/icommandline.h"
+
+#if !defined( _X360 ) && !defined( _PS3 )
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -3308,6 +3317,56 @@ static bool s_b3DNowEnabled = false;
 static bool s_bMMXEnabled = false;
 static bool s_bSSEEnabled = false;
 static bool s_bSSE2Enabled = false;
+static bool s_bAVX2Enabled = false;
+
+//-----------------------------------------------------------------------------
+// Does the processor have AVX2, and does the OS save the YMM registers?
+// tier0's CPUInformation only knows about AVX, so ask the processor.
+//-----------------------------------------------------------------------------
+static bool DetectAVX2()
+{
+#if !defined( _X360 ) && !defined( _PS3 )
+	unsigned int regs[4];		// eax, ebx, ecx, edx
+#ifdef _WIN32
+	__cpuid( (int *)regs, 0 );
+#else
+	__cpuid( 0, regs[0], regs[1], regs[2], regs[3] );
+#endif
+	if ( regs[0] < 7 )
+		return false;
+
+#ifdef _WIN32
+	__cpuid( (int *)regs, 1 );
+#else
+	__cpuid( 1, regs[0], regs[1], regs[2], regs[3] );
+#endif
+	const unsigned int osxsave = 1 << 27, avx = 1 << 28;
+	if ( ( regs[2] & ( osxsave | avx ) ) != ( osxsave | avx ) )
+		return false;
+
+	// which register state the OS saves
+	uint64 xcr0;
+#ifdef _WIN32
+	xcr0 = _xgetbv( 0 );
+#else
+	unsigned int xcr0Lo, xcr0Hi;
+	__asm__ __volatile__ ( "xgetbv" : "=a" ( xcr0Lo ), "=d" ( xcr0Hi ) : "c" ( 0 ) );
+	xcr0 = ( (uint64)xcr0Hi << 32 ) | xcr0Lo;
+#endif
+	if ( ( xcr0 & 0x6 ) != 0x6 )			// XMM and YMM
+		return false;
+
+#ifdef _WIN32
+	__cpuidex( (int *)regs, 7, 0 );
+#else
+	__cpuid_count( 7, 0, regs[0], regs[1], regs[2], regs[3] );
+#endif
+	const unsigned int avx2 = 1 << 5;
+	return ( regs[1] & avx2 ) != 0;
+#else
+	return false;
+#endif
+}
 
 void MathLib_Init( float gamma, float texGamma, float brightness, int overbright, bool bAllow3DNow, bool bAllowSSE, bool bAllowSSE2, bool bAllowMMX )
 {
@@ -3398,6 +3457,9 @@ void MathLib_Init( float gamma, float texGamma, float brightness, int overbright
 	{
 		s_bSSE2Enabled = false;
 	}
+
+	// the 8 wide paths, which need SSE2 for the rest of their work
+	s_bAVX2Enabled = s_bSSE2Enabled && DetectAVX2() && !CommandLine()->FindParm( "-noavx2" );
 #endif // !_X360
 
 	s_bMathlibInitialized = true;
@@ -3430,6 +3492,12 @@ bool MathLib_SSE2Enabled( void )
 	return s_bSSE2Enabled;
 }
 
+bool MathLib_AVX2Enabled( void )
+{
+	Assert( s_bMathlibInitialized );
+	return s_bAVX2Enabled;
+}
+
 float Approach( float target, float value, float speed )
 {
 	float delta = target - value;
@@ -13,6 +13,7 @@
 #include "mathlib/mathlib.h"
 #include "mathlib/simdvectormatrix.h"
 #include "mathlib/ssemath.h"
+#include "mathlib/avxmath.h"
 #include "tier0/dbg.h"
 
 void CSIMDVectorMatrix::CreateFromRGBA_FloatImageData(int srcwidth, int srcheight,
@@ -81,6 +82,13 @@ CSIMDVectorMatrix & CSIMDVectorMatrix::operator+=( CSIMDVectorMatrix const &src
 	Assert( m_nWidth == src.m_nWidth );
 	Assert( m_nHeight == src.m_nHeight );
 	int nv=NVectors();
+#ifdef MATHLIB_AVX2
+	if ( nv && MathLib_AVX2Enabled() )
+	{
+		FourVectors_AddArrays_AVX2( m_pData, src.m_pData, nv );
+		return *this;
+	}
+#endif
 	if ( nv )
 	{
 		FourVectors *srcv=src.m_pData;
@@ -96,6 +104,13 @@ CSIMDVectorMatrix & CSIMDVectorMatrix::operator+=( CSIMDVectorMatrix const &src
 CSIMDVectorMatrix & CSIMDVectorMatrix::operator*=( Vector const &src )
 {
 	int nv=NVectors();
+#ifdef MATHLIB_AVX2
+	if ( nv && MathLib_AVX2Enabled() )
+	{
+		FourVectors_ScaleArray_AVX2( m_pData, src, nv );
+		return *this;
+	}
+#endif
 	if ( nv )
 	{
 		FourVectors scalevalue;
@@ -0,0 +1,402 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: checks the transcendental functions in ssemath.h against the
+//			error bounds documented there.  Only built into the tests
+//			(tests/CMakeLists.txt), not into mathlib.
+//
+//===========================================================================//
+
+#include "mathlib/ssemath.h"
+#include "tier0/dbg.h"
+#include <float.h>
+#include <cmath>
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+static const double SIMD_LOG2E = 1.4426950408889634;
+
+// the error a result may have, whichever is largest
+struct SIMDErrorBound_t
+{
+	float m_flULP;							// units in the last place of the exact result
+	float m_flAbsolute;
+	float m_flRelative;
+	float m_flULPPerLog2;					// pow: ulp added per unit of |y log2(x)|
+	float m_flRelativePerY;					// pow: relative error added per unit of |y|
+};
+
+class CSIMDErrorStats
+{
+public:
+	CSIMDErrorStats( const char *pName, const SIMDErrorBound_t &bound ) : m_pName( pName ), m_Bound( bound )
+	{
+		m_flMaxULP = 0.0;
+		m_flMaxAbsolute = 0.0;
+		m_flMaxRelative = 0.0;
+		m_nSamples = 0;
+		m_nFailures = 0;
+		m_flWorstInput[0] = m_flWorstInput[1] = 0.0f;
+	}
+
+	void Add( float flResult, double flExact, float flInput0, float flInput1 = 0.0f )
+	{
+		++m_nSamples;
+		if ( std::isnan( flExact ) || fabs( flExact ) > FLT_MAX || fabs( flExact ) < FLT_MIN )
+		{
+			// the edges are checked separately
+			return;
+		}
+
+		double flError = fabs( (double)flResult - flExact );
+		if ( IS_NAN( flResult ) )
+		{
+			flError = FLT_MAX;
+		}
+
+		int nExponent;
+		frexp( flExact, &nExponent );
+		double flULPSize = ldexp( 1.0, nExponent - 24 );
+		double flULP = flError / flULPSize;
+		double flRelative = flError / fabs( flExact );
+
+		double flULPBound = m_Bound.m_flULP + m_Bound.m_flULPPerLog2 * fabs( log( fabs( flExact ) ) * SIMD_LOG2E );
+		double flRelativeBound = m_Bound.m_flRelative + m_Bound.m_flRelativePerY * fabs( flInput1 );
+
+		if ( flError <= flULPBound * flULPSize || flError <= m_Bound.m_flAbsolute || flRelative <= flRelativeBound )
+		{
+			// judged by the ulp bound only where the others don't cover it
+			if ( flError > m_Bound.m_flAbsolute && flRelative > flRelativeBound && flULP > m_flMaxULP )
+			{
+				m_flMaxULP = flULP;
+			}
+		}
+		else
+		{
+			if ( !m_nFailures || flULP > m_flMaxULP )
+			{
+				m_flWorstInput[0] = flInput0;
+				m_flWorstInput[1] = flInput1;
+			}
+			m_flMaxULP = MAX( m_flMaxULP, flULP );
+			++m_nFailures;
+		}
+
+		m_flMaxAbsolute = MAX( m_flMaxAbsolute, flError );
+		m_flMaxRelative = MAX( m_flMaxRelative, flRelative );
+	}
+
+	void Check( bool bOk, const char *pCase )
+	{
+		++m_nSamples;
+		if ( !bOk )
+		{
+			Msg( "  %s: wrong result for %s\n", m_pName, pCase );
+			++m_nFailures;
+		}
+	}
+
+	bool Report( void ) const
+	{
+		Msg( "  %-16s %8d samples   ulp %9.2f   abs %9.3g   rel %9.3g   %s\n", m_pName, m_nSamples,
+			m_flMaxULP, m_flMaxAbsolute, m_flMaxRelative, m_nFailures ? "FAILED" : "ok" );
+		if ( m_nFailures )
+		{
+			Msg( "    %d results out of bounds, the worst at (%.9g, %.9g)\n", m_nFailures, m_flWorstInput[0], m_flWorstInput[1] );
+		}
+		return m_nFailures == 0;
+	}
+
+private:
+	const char *m_pName;
+	SIMDErrorBound_t m_Bound;
+	double m_flMaxULP;
+	double m_flMaxAbsolute;
+	double m_flMaxRelative;
+	int m_nSamples;
+	int m_nFailures;
+	float m_flWorstInput[2];
+};
+
+// deterministic inputs, so a failure can be reproduced
+class CSIMDTestInputs
+{
+public:
+	CSIMDTestInputs( void ) : m_nSeed( 0x2545F491 ) {}
+
+	float Uniform( float flMin, float flMax )
+	{
+		m_nSeed = m_nSeed * 1664525 + 1013904223;
+		return flMin + ( flMax - flMin ) * ( ( m_nSeed >> 8 ) * ( 1.0f / 16777216.0f ) );
+	}
+
+	float LogUniform( float flMinLog2, float flMaxLog2 )
+	{
+		return exp2f( Uniform( flMinLog2, flMaxLog2 ) );
+	}
+
+private:
+	uint32 m_nSeed;
+};
+
+static const int SIMD_ACCURACY_SAMPLES = 1 << 18;
+
+static fltx4 LoadFour( const float *pInputs )
+{
+	return LoadUnalignedSIMD( pInputs );
+}
+
+// sine and cosine over the range, plus the last octant of every multiple of pi/4 up to it
+static bool CheckSinCos( bool bEst, float flRange, const SIMDErrorBound_t &bound )
+{
+	CSIMDErrorStats sinStats( bEst ? "SinEstSIMD" : "SinSIMD", bound );
+	CSIMDErrorStats cosStats( bEst ? "CosEstSIMD" : "CosSIMD", bound );
+	CSIMDTestInputs inputs;
+
+	for ( int i = 0; i < SIMD_ACCURACY_SAMPLES; i += 4 )
+	{
+		float x[4];
+		for ( int k = 0; k < 4; ++k )
+		{
+			x[k] = ( i & 4 ) ? inputs.Uniform( -flRange, flRange ) : inputs.Uniform( -2.0f * M_PI_F, 2.0f * M_PI_F );
+		}
+
+		fltx4 s, c;
+		if ( bEst )
+		{
+			SinCosEstSIMD( s, c, LoadFour( x ) );
+		}
+		else
+		{
+			SinCosSIMD( s, c, LoadFour( x ) );
+		}
+
+		for ( int k = 0; k < 4; ++k )
+		{
+			sinStats.Add( SubFloat( s, k ), sin( (double)x[k] ), x[k] );
+			cosStats.Add( SubFloat( c, k ), cos( (double)x[k] ), x[k] );
+		}
+	}
+
+	// the reduction is hardest right at the zeros
+	for ( float flAngle = 0.0f; flAngle < flRange; flAngle += M_PI_F * 0.25f )
+	{
+		float x[4] = { flAngle, -flAngle, nextafterf( flAngle, FLT_MAX ), nextafterf( flAngle, -FLT_MAX ) };
+		fltx4 s, c;
+		if ( bEst )
+		{
+			SinCosEstSIMD( s, c, LoadFour( x ) );
+		}
+		else
+		{
+			SinCosSIMD( s, c, LoadFour( x ) );
+		}
+
+		for ( int k = 0; k < 4; ++k )
+		{
+			sinStats.Add( SubFloat( s, k ), sin( (double)x[k] ), x[k] );
+			cosStats.Add( SubFloat( c, k ), cos( (double)x[k] ), x[k] );
+		}
+	}
+
+	bool bOk = sinStats.Report();
+	return cosStats.Report() && bOk;
+}
+
+static bool CheckArcSinCos( const SIMDErrorBound_t &bound )
+{
+	CSIMDErrorStats asinStats( "ArcSinSIMD", bound );
+	CSIMDErrorStats acosStats( "ArcCosSIMD", bound );
+	CSIMDTestInputs inputs;
+
+	for ( int i = 0; i < SIMD_ACCURACY_SAMPLES; i += 4 )
+	{
+		float x[4];
+		for ( int k = 0; k < 4; ++k )
+		{
+			x[k] = inputs.Uniform( -1.0f, 1.0f );
+		}
+		if ( i == 0 )
+		{
+			x[0] = 1.0f; x[1] = -1.0f; x[2] = 0.5f; x[3] = -0.5f;
+		}
+
+		fltx4 as = ArcSinSIMD( LoadFour( x ) );
+		fltx4 ac = ArcCosSIMD( LoadFour( x ) );
+		for ( int k = 0; k < 4; ++k )
+		{
+			asinStats.Add( SubFloat( as, k ), asin( (double)x[k] ), x[k] );
+			acosStats.Add( SubFloat( ac, k ), acos( (double)x[k] ), x[k] );
+		}
+	}
+
+	bool bOk = asinStats.Report();
+	return acosStats.Report() && bOk;
+}
+
+static bool CheckArcTan2( bool bEst, const SIMDErrorBound_t &bound )
+{
+	CSIMDErrorStats stats( bEst ? "ArcTan2EstSIMD" : "ArcTan2SIMD", bound );
+	CSIMDTestInputs inputs;
+
+	for ( int i = 0; i < SIMD_ACCURACY_SAMPLES; i += 4 )
+	{
+		float a[4], b[4];
+		for ( int k = 0; k < 4; ++k )
+		{
+			float flScale = inputs.LogUniform( -20.0f, 20.0f );
+			a[k] = inputs.Uniform( -flScale, flScale );
+			b[k] = inputs.Uniform( -flScale, flScale );
+		}
+
+		fltx4 r = bEst ? ArcTan2EstSIMD( LoadFour( a ), LoadFour( b ) ) : ArcTan2SIMD( LoadFour( a ), LoadFour( b ) );
+		for ( int k = 0; k < 4; ++k )
+		{
+			stats.Add( SubFloat( r, k ), atan2( (double)a[k], (double)b[k] ), a[k], b[k] );
+		}
+	}
+
+	// the axes
+	float a[4] = { 0.0f, 1.0f, 0.0f, -1.0f };
+	float b[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+	fltx4 r = bEst ? ArcTan2EstSIMD( LoadFour( a ), LoadFour( b ) ) : ArcTan2SIMD( LoadFour( a ), LoadFour( b ) );
+	stats.Check( SubFloat( r, 0 ) == 0.0f, "atan2(0,1)" );
+	stats.Check( fabs( SubFloat( r, 1 ) - M_PI_F * 0.5f ) < 1e-6f, "atan2(1,0)" );
+	stats.Check( SubFloat( r, 2 ) == 0.0f, "atan2(0,0)" );
+	stats.Check( fabs( SubFloat( r, 3 ) + M_PI_F * 0.5f ) < 1e-6f, "atan2(-1,0)" );
+
+	return stats.Report();
+}
+
+static bool CheckExp( bool bEst, const SIMDErrorBound_t &bound )
+{
+	CSIMDErrorStats stats( bEst ? "ExpEstSIMD" : "ExpSIMD", bound );
+	CSIMDTestInputs inputs;
+
+	for ( int i = 0; i < SIMD_ACCURACY_SAMPLES; i += 4 )
+	{
+		float x[4];
+		for ( int k = 0; k < 4; ++k )
+		{
+			x[k] = ( i & 4 ) ? inputs.Uniform( -126.0f, 128.0f ) : inputs.Uniform( -2.0f, 2.0f );
+		}
+
+		fltx4 r = bEst ? ExpEstSIMD( LoadFour( x ) ) : ExpSIMD( LoadFour( x ) );
+		for ( int k = 0; k < 4; ++k )
+		{
+			stats.Add( SubFloat( r, k ), exp2( (double)x[k] ), x[k] );
+		}
+	}
+
+	float x[4] = { 0.0f, 128.0f, -200.0f, 127.99f };
+	fltx4 r = bEst ? ExpEstSIMD( LoadFour( x ) ) : ExpSIMD( LoadFour( x ) );
+	stats.Check( SubFloat( r, 0 ) == 1.0f || bEst, "2^0" );
+	stats.Check( SubFloat( r, 1 ) > FLT_MAX, "2^128" );
+	stats.Check( SubFloat( r, 2 ) == 0.0f, "2^-200" );
+	stats.Check( SubFloat( r, 3 ) <= FLT_MAX && SubFloat( r, 3 ) > 1e38f, "2^127.99" );
+
+	return stats.Report();
+}
+
+static bool CheckLog2( bool bEst, const SIMDErrorBound_t &bound )
+{
+	CSIMDErrorStats stats( bEst ? "Log2EstSIMD" : "Log2SIMD", bound );
+	CSIMDTestInputs inputs;
+
+	for ( int i = 0; i < SIMD_ACCURACY_SAMPLES; i += 4 )
+	{
+		float x[4];
+		for ( int k = 0; k < 4; ++k )
+		{
+			x[k] = ( i & 4 ) ? inputs.LogUniform( -125.0f, 127.0f ) : inputs.Uniform( 0.5f, 2.0f );
+		}
+
+		fltx4 r = bEst ? Log2EstSIMD( LoadFour( x ) ) : Log2SIMD( LoadFour( x ) );
+		for ( int k = 0; k < 4; ++k )
+		{
+			stats.Add( SubFloat( r, k ), log( (double)x[k] ) * SIMD_LOG2E, x[k] );
+		}
+	}
+
+	float x[4] = { 1.0f, 0.0f, -1.0f, 8.0f };
+	fltx4 r = bEst ? Log2EstSIMD( LoadFour( x ) ) : Log2SIMD( LoadFour( x ) );
+	stats.Check( SubFloat( r, 0 ) == 0.0f, "log2(1)" );
+	stats.Check( SubFloat( r, 1 ) < -FLT_MAX, "log2(0)" );
+	stats.Check( IS_NAN( SubFloat( r, 2 ) ), "log2(-1)" );
+	stats.Check( SubFloat( r, 3 ) == 3.0f || bEst, "log2(8)" );
+
+	return stats.Report();
+}
+
+static bool CheckPow( bool bEst, const SIMDErrorBound_t &bound )
+{
+	CSIMDErrorStats stats( bEst ? "PowEstSIMD" : "PowSIMD", bound );
+	CSIMDTestInputs inputs;
+
+	for ( int i = 0; i < SIMD_ACCURACY_SAMPLES; i += 4 )
+	{
+		float x[4], y[4];
+		for ( int k = 0; k < 4; ++k )
+		{
+			x[k] = inputs.LogUniform( -10.0f, 10.0f );
+			y[k] = inputs.Uniform( -8.0f, 8.0f );
+		}
+
+		fltx4 r = bEst ? PowEstSIMD( LoadFour( x ), LoadFour( y ) ) : PowSIMD( LoadFour( x ), LoadFour( y ) );
+		for ( int k = 0; k < 4; ++k )
+		{
+			stats.Add( SubFloat( r, k ), pow( (double)x[k], (double)y[k] ), x[k], y[k] );
+		}
+	}
+
+	float x[4] = { 0.0f, 5.0f, 0.0f, 2.0f };
+	float y[4] = { 2.0f, 0.0f, 0.0f, 10.0f };
+	fltx4 r = bEst ? PowEstSIMD( LoadFour( x ), LoadFour( y ) ) : PowSIMD( LoadFour( x ), LoadFour( y ) );
+	stats.Check( SubFloat( r, 0 ) == 0.0f, "0^2" );
+	stats.Check( SubFloat( r, 1 ) == 1.0f, "5^0" );
+	stats.Check( SubFloat( r, 2 ) == 1.0f, "0^0" );
+	stats.Check( fabs( SubFloat( r, 3 ) - 1024.0f ) < ( bEst ? 0.1f : 0.001f ), "2^10" );
+
+	return stats.Report();
+}
+
+//-----------------------------------------------------------------------------
+// Sample every function over its range against the double precision C
+// library, and report the worst error. Returns false if any is past the
+// bound documented in ssemath.h.
+//-----------------------------------------------------------------------------
+bool MathLib_CheckSIMDAccuracy( void )
+{
+	//										  ulp	absolute	relative	ulp per log2	relative per y
+	const SIMDErrorBound_t sinCos		= {	2.0f,	5.97e-8f,	0.0f,		0.0f,			0.0f };		// 2^-24 absolute
+	const SIMDErrorBound_t arc			= {	3.0f,	0.0f,		0.0f,		0.0f,			0.0f };
+	const SIMDErrorBound_t exp2			= {	2.0f,	0.0f,		0.0f,		0.0f,			0.0f };
+	const SIMDErrorBound_t log2			= {	2.0f,	5.97e-8f,	0.0f,		0.0f,			0.0f };
+	const SIMDErrorBound_t pow			= {	2.0f,	0.0f,		0.0f,		2.0f,			0.0f };
+
+	const SIMDErrorBound_t sinCosEst	= {	0.0f,	2e-6f,		0.0f,		0.0f,			0.0f };
+	const SIMDErrorBound_t atanEst		= {	0.0f,	2e-5f,		0.0f,		0.0f,			0.0f };
+	const SIMDErrorBound_t expEst		= {	0.0f,	0.0f,		4e-6f,		0.0f,			0.0f };
+	const SIMDErrorBound_t log2Est		= {	0.0f,	1e-5f,		0.0f,		0.0f,			0.0f };
+	const SIMDErrorBound_t powEst		= {	0.0f,	0.0f,		4e-6f,		0.0f,			6e-6f };
+
+	Msg( "SIMD transcendental accuracy, against double precision:\n" );
+
+	bool bOk = true;
+	bOk = CheckSinCos( false, 8192.0f, sinCos ) && bOk;
+	bOk = CheckArcSinCos( arc ) && bOk;
+	bOk = CheckArcTan2( false, arc ) && bOk;
+	bOk = CheckExp( false, exp2 ) && bOk;
+	bOk = CheckLog2( false, log2 ) && bOk;
+	bOk = CheckPow( false, pow ) && bOk;
+
+	bOk = CheckSinCos( true, 8192.0f, sinCosEst ) && bOk;
+	bOk = CheckArcTan2( true, atanEst ) && bOk;
+	bOk = CheckExp( true, expEst ) && bOk;
+	bOk = CheckLog2( true, log2Est ) && bOk;
+	bOk = CheckPow( true, powEst ) && bOk;
+
+	Msg( bOk ? "All within bounds.\n" : "Some results are out of bounds!\n" );
+	return bOk;
+}
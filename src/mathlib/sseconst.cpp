@@ -6,6 +6,7 @@
 
 #include "mathlib/ssemath.h"
 #include "mathlib/ssequaternion.h"
+#include "mathlib/avxmath.h"
 
 const fltx4 Four_PointFives={0.5,0.5,0.5,0.5};
 #ifndef _X360
@@ -92,6 +93,18 @@ void FourVectors::RotateManyBy(FourVectors * RESTRICT pVectors, unsigned int num
 	if ( numVectors == 0 )
 		return;
 
+#ifdef MATHLIB_AVX2
+	// two FourVectors at a time
+	if ( MathLib_AVX2Enabled() )
+	{
+		int nDone = FourVectors_RotateManyBy_AVX2( pVectors, numVectors, rotationMatrix );
+		pVectors += nDone;
+		numVectors -= nDone;
+		if ( numVectors == 0 )
+			return;
+	}
+#endif
+
 	// Splat out each of the entries in the matrix to a fltx4. Do this
 	// in the order that we will need them, to hide latency. I'm
 	// avoiding making an array of them, so that they'll remain in 
@@ -377,6 +390,8 @@ void FourVectors_TransformManyGroupsOfEightBy(FourVectors * RESTRICT pVectors, u
 #undef COMPUTE_GROUP
 #undef WRITE_GROUP
 }
+#endif
+
 
 #ifdef _X360
 // Loop-scheduled code to process FourVectors in groups of eight quite efficiently. This is the version
@@ -689,6 +704,17 @@ void FourVectors::TransformManyBy(FourVectors * RESTRICT pVectors, unsigned int
 	}
 #endif
 
+#ifdef MATHLIB_AVX2
+	// two FourVectors at a time
+	if ( MathLib_AVX2Enabled() )
+	{
+		int nDone = FourVectors_TransformManyBy_AVX2( pVectors, numVectors, rotationMatrix, pOut );
+		numVectors -= nDone;
+		pVectors += nDone;
+		pOut += nDone;
+	}
+#endif
+
 	// any left over?
 	if (numVectors > 0)
 	{
@@ -729,8 +755,8 @@ void FourVectors::TransformManyBy(FourVectors * RESTRICT pVectors, unsigned int
 		{
 			// Trust in the compiler to schedule these operations correctly:
 			pOut->x = MaddSIMD(pVectors->z, matSplat02, MaddSIMD(pVectors->y, matSplat01, MaddSIMD(pVectors->x, matSplat00, matSplat03)));
-			pOut->y = MaddSIMD(pVectors->z, matSplat12, MaddSIMD(pVectors->y, matSplat11, MaddSIMD(pVectors->x, matSplat00, matSplat13)));
-			pOut->z = MaddSIMD(pVectors->z, matSplat22, MaddSIMD(pVectors->y, matSplat21, MaddSIMD(pVectors->x, matSplat00, matSplat23)));
+			pOut->y = MaddSIMD(pVectors->z, matSplat12, MaddSIMD(pVectors->y, matSplat11, MaddSIMD(pVectors->x, matSplat10, matSplat13)));
+			pOut->z = MaddSIMD(pVectors->z, matSplat22, MaddSIMD(pVectors->y, matSplat21, MaddSIMD(pVectors->x, matSplat20, matSplat23)));
 
 			++pOut;
 			++pVectors;
@@ -919,6 +945,16 @@ void FourVectors::TransformManyBy(FourVectors * RESTRICT pVectors, unsigned int
 	}
 #endif
 
+#ifdef MATHLIB_AVX2
+	// two FourVectors at a time
+	if ( MathLib_AVX2Enabled() )
+	{
+		int nDone = FourVectors_TransformManyBy_AVX2( pVectors, numVectors, rotationMatrix, pVectors );
+		numVectors -= nDone;
+		pVectors += nDone;
+	}
+#endif
+
 	// any left over?
 	if (numVectors > 0)
 	{
@@ -960,8 +996,8 @@ void FourVectors::TransformManyBy(FourVectors * RESTRICT pVectors, unsigned int
 			fltx4 resultX, resultY, resultZ;
 			// Trust in the compiler to schedule these operations correctly:
 			resultX = MaddSIMD(pVectors->z, matSplat02, MaddSIMD(pVectors->y, matSplat01, MaddSIMD(pVectors->x, matSplat00, matSplat03)));
-			resultY = MaddSIMD(pVectors->z, matSplat12, MaddSIMD(pVectors->y, matSplat11, MaddSIMD(pVectors->x, matSplat00, matSplat13)));
-			resultZ = MaddSIMD(pVectors->z, matSplat22, MaddSIMD(pVectors->y, matSplat21, MaddSIMD(pVectors->x, matSplat00, matSplat23)));
+			resultY = MaddSIMD(pVectors->z, matSplat12, MaddSIMD(pVectors->y, matSplat11, MaddSIMD(pVectors->x, matSplat10, matSplat13)));
+			resultZ = MaddSIMD(pVectors->z, matSplat22, MaddSIMD(pVectors->y, matSplat21, MaddSIMD(pVectors->x, matSplat20, matSplat23)));
 
 			pVectors->x = resultX;
 			pVectors->y = resultY;
@@ -974,8 +1010,6 @@ void FourVectors::TransformManyBy(FourVectors * RESTRICT pVectors, unsigned int
 }
 
 
-#endif
-
 // Transform many (horizontal) points in-place by a 3x4 matrix,
 // here already loaded onto three fltx4 registers but not transposed. 
 // The points must be stored as 16-byte aligned. They are points
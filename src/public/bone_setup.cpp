@@ -9,6 +9,7 @@
 #include "tier0/dbg.h"
 #include "mathlib/mathlib.h"
 #include "bone_setup.h"
+#include "studio_animvalue.h"
 #include <string.h>
 
 #include "collisionutils.h"
@@ -18,6 +19,7 @@
 #include "mathlib/ssequaternion.h"
 #include "bitvec.h"
 #include "datamanager.h"
+#include "utlmap.h"
 #include "convar.h"
 #include "tier0/tslist.h"
 #include "vphysics_interface.h"
@@ -344,37 +346,397 @@ void ExtractAnimValue( int frame, mstudioanimvalue_t *panimvalue, float scale, f
 		return;
 	}
 
-	int k = frame;
+	if ( !AnimValue_Extract( frame, panimvalue, scale, v1 ) )
+	{
+		Assert( 0 ); // running off the end of the animation stream is bad
+	}
+}
 
-	while (panimvalue->num.total <= k)
+//-----------------------------------------------------------------------------
+// Purpose: a block of animation (one section of an animation, all of its 
+//			bones) with its animvalue streams run length decoded into one 
+//			value per frame, so that a frame is read without walking the 
+//			stream.  The values stay quantized, and are scaled as 
+//			ExtractAnimValue() does.
+//
+//			Blocks are decoded once they have been used anim_decodecache_uses
+//			times, and evicted least recently used first when the cache is 
+//			over anim_decodecache_kb.  Only blocks stored in the model itself
+//			are decoded, since demand loaded animation blocks can move; the 
+//			cache is keyed by address, so it is flushed at level shutdown.
+//-----------------------------------------------------------------------------
+static ConVar anim_decodecache( "anim_decodecache", "1", FCVAR_REPLICATED, "Decode the animation streams of frequently used sequences into one value per frame." );
+static ConVar anim_decodecache_kb( "anim_decodecache_kb", "4096", FCVAR_REPLICATED, "Memory budget of the decoded animation cache, in KB." );
+static ConVar anim_decodecache_uses( "anim_decodecache_uses", "8", FCVAR_REPLICATED, "Number of times a block of animation is evaluated before it is decoded." );
+
+struct decodedanimparams_t
+{
+	const mstudioanim_t	*pAnim;
+	int					nFrames;
+	int					nBlocks;		// bones in the block
+	int					nChannels;		// animated rotation and position channels
+};
+
+// the decoded channels of one bone of a block
+struct decodedbone_t
+{
+	const short			*pChannel[6];	// rotation x y z, position x y z, or NULL if read from the stream
+	int					nFrames;
+};
+
+class CDecodedAnim
+{
+public:
+	// CDataManager interface
+	static CDecodedAnim *CreateResource( const decodedanimparams_t &params );
+	static unsigned int EstimatedSize( const decodedanimparams_t &params );
+	void DestroyResource();
+	CDecodedAnim *GetData() { return this; }
+	unsigned int Size() { return m_size; }
+
+	void GetBone( int iBlock, decodedbone_t &bone ) const;
+
+private:
+	int *Offsets() const { return (int *)( this + 1 ); }
+	short *Values() const { return (short *)( Offsets() + m_nBlocks * 6 ); }
+
+	unsigned int	m_size;
+	int				m_nFrames;
+	int				m_nBlocks;
+	// followed by the offset of each channel of each bone in the values (-1 if not decoded), then the values
+};
+
+static CDataManager<CDecodedAnim, decodedanimparams_t, CDecodedAnim *, CThreadFastMutex> g_DecodedAnimCache( 4096 * 1024 );
+
+struct decodedanimentry_t
+{
+	int			nUses;
+	memhandle_t	hDecoded;
+};
+
+// Use counts and handles, split by address so that threads setting up bones
+// for different animations don't wait on each other
+#define DECODED_ANIM_SHARDS	16
+
+struct decodedanimshard_t
+{
+	decodedanimshard_t() : m_Anims( DefLessFunc( const mstudioanim_t * ) ) {}
+
+	CUtlMap< const mstudioanim_t *, decodedanimentry_t > m_Anims;
+	CThreadFastMutex m_Mutex;
+	char m_Pad[64];
+};
+static decodedanimshard_t s_DecodedAnimShards[DECODED_ANIM_SHARDS];
+
+inline decodedanimshard_t &GetDecodedAnimShard( const mstudioanim_t *panim )
+{
+	uintp nAddress = (uintp)panim;
+	return s_DecodedAnimShards[ ( ( nAddress >> 4 ) ^ ( nAddress >> 12 ) ) % DECODED_ANIM_SHARDS ];
+}
+
+static CInterlockedInt s_nDecodedAnimHits;
+static CInterlockedInt s_nDecodedAnimMisses;
+static CInterlockedInt s_nDecodedAnimDecodes;
+
+inline bool IsRotationDecoded( const mstudioanim_t *panim )
+{
+	return !( panim->flags & ( STUDIO_ANIM_RAWROT | STUDIO_ANIM_RAWROT2 ) ) && ( panim->flags & STUDIO_ANIM_ANIMROT );
+}
+
+inline bool IsPositionDecoded( const mstudioanim_t *panim )
+{
+	return !( panim->flags & STUDIO_ANIM_RAWPOS ) && ( panim->flags & STUDIO_ANIM_ANIMPOS );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: empty streams are left to ExtractAnimValue(), which reads them as 
+//			zero.  So are streams that start with a single frame of data: the
+//			two frame ExtractAnimValue() reads that value for every frame, but
+//			the one frame version doesn't.
+//-----------------------------------------------------------------------------
+inline bool IsStreamDecodable( const mstudioanimvalue_t *panimvalue )
+{
+	return panimvalue && !( ( panimvalue->num.total == 1 ) && ( panimvalue->num.valid == 1 ) );
+}
+
+// -----------------------------------------------------------------
+unsigned int CDecodedAnim::EstimatedSize( const decodedanimparams_t &params )
+{
+	return ( sizeof(CDecodedAnim) + params.nBlocks * 6 * sizeof(int) + params.nChannels * params.nFrames * sizeof(short) + 3 ) & ~3;
+}
+
+CDecodedAnim *CDecodedAnim::CreateResource( const decodedanimparams_t &params )
+{
+	unsigned int size = EstimatedSize( params );
+	CDecodedAnim *pMem = (CDecodedAnim *)malloc( size );
+	pMem->m_size = size;
+	pMem->m_nFrames = params.nFrames;
+	pMem->m_nBlocks = params.nBlocks;
+
+	int *pOffsets = pMem->Offsets();
+	short *pValues = pMem->Values();
+	int nOffset = 0;
+
+	const mstudioanim_t *panim = params.pAnim;
+	for ( int iBlock = 0; iBlock < params.nBlocks; iBlock++, panim = panim->pNext() )
 	{
-		k -= panimvalue->num.total;
-		panimvalue += panimvalue->num.valid + 1;
-		if ( panimvalue->num.total == 0 )
+		for ( int j = 0; j < 6; j++ )
 		{
-			Assert( 0 ); // running off the end of the animation stream is bad
-			v1 = 0;
-			return;
+			pOffsets[iBlock * 6 + j] = -1;
+		}
+
+		if ( IsRotationDecoded( panim ) )
+		{
+			for ( int j = 0; j < 3; j++ )
+			{
+				const mstudioanimvalue_t *panimvalue = panim->pRotV()->pAnimvalue( j );
+				if ( IsStreamDecodable( panimvalue ) )
+				{
+					pOffsets[iBlock * 6 + j] = nOffset;
+					AnimValue_Decode( panimvalue, params.nFrames, pValues + nOffset );
+					nOffset += params.nFrames;
+				}
+			}
+		}
+
+		if ( IsPositionDecoded( panim ) )
+		{
+			for ( int j = 0; j < 3; j++ )
+			{
+				const mstudioanimvalue_t *panimvalue = panim->pPosV()->pAnimvalue( j );
+				if ( IsStreamDecodable( panimvalue ) )
+				{
+					pOffsets[iBlock * 6 + 3 + j] = nOffset;
+					AnimValue_Decode( panimvalue, params.nFrames, pValues + nOffset );
+					nOffset += params.nFrames;
+				}
+			}
 		}
 	}
-	if (panimvalue->num.valid > k)
+
+	Assert( nOffset <= params.nChannels * params.nFrames );
+	return pMem;
+}
+
+void CDecodedAnim::DestroyResource()
+{
+	free( this );
+}
+
+void CDecodedAnim::GetBone( int iBlock, decodedbone_t &bone ) const
+{
+	Assert( iBlock < m_nBlocks );
+	const int *pOffsets = Offsets() + iBlock * 6;
+	for ( int j = 0; j < 6; j++ )
 	{
-		v1 = panimvalue[k+1].value * scale;
+		bone.pChannel[j] = ( pOffsets[j] >= 0 ) ? Values() + pOffsets[j] : NULL;
+	}
+	bone.nFrames = m_nFrames;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: the number of frames in the block of animation that holds the 
+//			frame, as mstudioanimdesc_t::pAnim() finds it.  Returns false if 
+//			the block isn't stored in the model.  For sections this leaves 
+//			out the frame shared with the next section; frames past the end
+//			of a decoded block are read from the stream.
+//-----------------------------------------------------------------------------
+static bool GetDecodableFrameCount( const mstudioanimdesc_t &animdesc, int iFrame, int *pFrames )
+{
+	if ( animdesc.sectionframes == 0 )
+	{
+		*pFrames = animdesc.numframes;
+		return animdesc.animblock == 0;
+	}
+
+	int section;
+	if ( animdesc.numframes > animdesc.sectionframes && iFrame == animdesc.numframes - 1 )
+	{
+		// last frame on long anims is stored separately
+		section = ( animdesc.numframes / animdesc.sectionframes ) + 1;
+		*pFrames = 1;
 	}
 	else
 	{
-		// get last valid data block
-		v1 = panimvalue[panimvalue->num.valid].value * scale;
+		section = iFrame / animdesc.sectionframes;
+		*pFrames = MIN( animdesc.sectionframes, animdesc.numframes - section * animdesc.sectionframes );
+	}
+
+	return animdesc.pSection( section )->animblock == 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: return the decoded block of animation, locked, if it has been used 
+//			often enough to be decoded, or NULL.  Unlock with UnlockDecodedAnim().
+//-----------------------------------------------------------------------------
+static CDecodedAnim *LockDecodedAnim( const mstudioanimdesc_t &animdesc, int iFrame, const mstudioanim_t *panim, memhandle_t &hDecoded )
+{
+	hDecoded = INVALID_MEMHANDLE;
+
+	int nFrames;
+	if ( !panim || !anim_decodecache.GetBool() || !GetDecodableFrameCount( animdesc, iFrame, &nFrames ) )
+		return NULL;
+
+	decodedanimshard_t &shard = GetDecodedAnimShard( panim );
+	AUTO_LOCK( shard.m_Mutex );
+
+	unsigned short i = shard.m_Anims.Find( panim );
+	if ( i == shard.m_Anims.InvalidIndex() )
+	{
+		decodedanimentry_t entry;
+		entry.nUses = 0;
+		entry.hDecoded = INVALID_MEMHANDLE;
+		i = shard.m_Anims.Insert( panim, entry );
+	}
+
+	decodedanimentry_t &entry = shard.m_Anims[i];
+	entry.nUses++;
+
+	if ( entry.hDecoded != INVALID_MEMHANDLE )
+	{
+		CDecodedAnim *pDecoded = g_DecodedAnimCache.LockResource( entry.hDecoded );
+		if ( pDecoded )
+		{
+			++s_nDecodedAnimHits;
+			hDecoded = entry.hDecoded;
+			return pDecoded;
+		}
+
+		// evicted, it has to be used often enough again
+		entry.hDecoded = INVALID_MEMHANDLE;
+		entry.nUses = 1;
+	}
+
+	++s_nDecodedAnimMisses;
+
+	if ( entry.nUses < anim_decodecache_uses.GetInt() )
+		return NULL;
+
+	decodedanimparams_t params;
+	params.pAnim = panim;
+	params.nFrames = nFrames;
+	params.nBlocks = 0;
+	params.nChannels = 0;
+	for ( const mstudioanim_t *pBlock = panim; pBlock && pBlock->bone < 255; pBlock = pBlock->pNext() )
+	{
+		params.nBlocks++;
+		for ( int j = 0; j < 3; j++ )
+		{
+			params.nChannels += ( IsRotationDecoded( pBlock ) && IsStreamDecodable( pBlock->pRotV()->pAnimvalue( j ) ) ) ? 1 : 0;
+			params.nChannels += ( IsPositionDecoded( pBlock ) && IsStreamDecodable( pBlock->pPosV()->pAnimvalue( j ) ) ) ? 1 : 0;
+		}
+	}
+
+	unsigned int nTargetSize = (unsigned int)MAX( anim_decodecache_kb.GetInt(), 0 ) * 1024;
+	if ( g_DecodedAnimCache.TargetSize() != nTargetSize )
+	{
+		g_DecodedAnimCache.SetTargetSize( nTargetSize );
+	}
+
+	if ( CDecodedAnim::EstimatedSize( params ) > nTargetSize )
+		return NULL;
+
+	++s_nDecodedAnimDecodes;
+	entry.hDecoded = g_DecodedAnimCache.CreateResource( params, true );
+	hDecoded = entry.hDecoded;
+	return g_DecodedAnimCache.GetResource_NoLock( entry.hDecoded );
+}
+
+static void UnlockDecodedAnim( memhandle_t hDecoded )
+{
+	if ( hDecoded != INVALID_MEMHANDLE )
+	{
+		g_DecodedAnimCache.UnlockResource( hDecoded );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: forget every decoded block of animation; their addresses may be 
+//			reused by the next models that are loaded
+//-----------------------------------------------------------------------------
+void Studio_FlushDecodedAnimations()
+{
+	for ( int i = 0; i < DECODED_ANIM_SHARDS; i++ )
+	{
+		AUTO_LOCK( s_DecodedAnimShards[i].m_Mutex );
+		s_DecodedAnimShards[i].m_Anims.RemoveAll();
+	}
+
+	// a handle handed out after its shard was cleared just fails to lock
+	g_DecodedAnimCache.FlushAll();
+}
+
+#ifdef CLIENT_DLL
+CON_COMMAND( cl_anim_decodecache_report, "Report the use of the client decoded animation cache" )
+#else
+CON_COMMAND( anim_decodecache_report, "Report the use of the server decoded animation cache" )
+#endif
+{
+	int nHits = s_nDecodedAnimHits;
+	int nMisses = s_nDecodedAnimMisses;
+	int nLookups = nHits + nMisses;
+
+	int nBlocks = 0;
+	int nUsed = 0;
+	for ( int iShard = 0; iShard < DECODED_ANIM_SHARDS; iShard++ )
+	{
+		decodedanimshard_t &shard = s_DecodedAnimShards[iShard];
+		AUTO_LOCK( shard.m_Mutex );
+		FOR_EACH_MAP_FAST( shard.m_Anims, i )
+		{
+			if ( g_DecodedAnimCache.GetResource_NoLockNoLRUTouch( shard.m_Anims[i].hDecoded ) )
+			{
+				nBlocks++;
+			}
+		}
+		nUsed += shard.m_Anims.Count();
+	}
+	Msg( "%d of %d blocks of animation decoded, %u of %u KB\n", nBlocks, nUsed, g_DecodedAnimCache.UsedSize() / 1024, g_DecodedAnimCache.TargetSize() / 1024 );
+
+	Msg( "%d lookups, %d hits (%.1f%%), %d decodes, %d evicted or flushed\n", nLookups, nHits, nLookups ? 100.0f * nHits / nLookups : 0.0f, (int)s_nDecodedAnimDecodes, s_nDecodedAnimDecodes - nBlocks );
+
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "reset" ) )
+	{
+		s_nDecodedAnimHits = 0;
+		s_nDecodedAnimMisses = 0;
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: ExtractAnimValue() from a decoded channel, if the frames are in it
+//-----------------------------------------------------------------------------
+inline void ExtractAnimValue( int frame, const decodedbone_t *pDecoded, int iChannel, mstudioanimvalue_t *panimvalue, float scale, float &v1, float &v2 )
+{
+	const short *pValues = pDecoded ? pDecoded->pChannel[iChannel] : NULL;
+	if ( pValues && frame + 1 < pDecoded->nFrames )
+	{
+		v1 = pValues[frame] * scale;
+		v2 = pValues[frame + 1] * scale;
+		return;
+	}
+
+	ExtractAnimValue( frame, panimvalue, scale, v1, v2 );
+}
+
+inline void ExtractAnimValue( int frame, const decodedbone_t *pDecoded, int iChannel, mstudioanimvalue_t *panimvalue, float scale, float &v1 )
+{
+	const short *pValues = pDecoded ? pDecoded->pChannel[iChannel] : NULL;
+	if ( pValues && frame < pDecoded->nFrames )
+	{
+		v1 = pValues[frame] * scale;
+		return;
+	}
+
+	ExtractAnimValue( frame, panimvalue, scale, v1 );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: return a sub frame rotation for a single bone
 //-----------------------------------------------------------------------------
 void CalcBoneQuaternion( int frame, float s, 
 						const Quaternion &baseQuat, const RadianEuler &baseRot, const Vector &baseRotScale, 
 						int iBaseFlags, const Quaternion &baseAlignment, 
-						const mstudioanim_t *panim, Quaternion &q )
+						const mstudioanim_t *panim, Quaternion &q, const decodedbone_t *pDecoded = NULL )
 {
 	if ( panim->flags & STUDIO_ANIM_RAWROT )
 	{
@@ -410,9 +772,9 @@ void CalcBoneQuaternion( int frame, float s,
 		QuaternionAligned	q1, q2;
 		RadianEuler			angle1, angle2;
 
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 0 ), baseRotScale.x, angle1.x, angle2.x );
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 1 ), baseRotScale.y, angle1.y, angle2.y );
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 2 ), baseRotScale.z, angle1.z, angle2.z );
+		ExtractAnimValue( frame, pDecoded, 0, pValuesPtr->pAnimvalue( 0 ), baseRotScale.x, angle1.x, angle2.x );
+		ExtractAnimValue( frame, pDecoded, 1, pValuesPtr->pAnimvalue( 1 ), baseRotScale.y, angle1.y, angle2.y );
+		ExtractAnimValue( frame, pDecoded, 2, pValuesPtr->pAnimvalue( 2 ), baseRotScale.z, angle1.z, angle2.z );
 
 		if (!(panim->flags & STUDIO_ANIM_DELTA))
 		{
@@ -449,9 +811,9 @@ void CalcBoneQuaternion( int frame, float s,
 	{
 		RadianEuler			angle;
 
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 0 ), baseRotScale.x, angle.x );
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 1 ), baseRotScale.y, angle.y );
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 2 ), baseRotScale.z, angle.z );
+		ExtractAnimValue( frame, pDecoded, 0, pValuesPtr->pAnimvalue( 0 ), baseRotScale.x, angle.x );
+		ExtractAnimValue( frame, pDecoded, 1, pValuesPtr->pAnimvalue( 1 ), baseRotScale.y, angle.y );
+		ExtractAnimValue( frame, pDecoded, 2, pValuesPtr->pAnimvalue( 2 ), baseRotScale.z, angle.z );
 
 		if (!(panim->flags & STUDIO_ANIM_DELTA))
 		{
@@ -476,15 +838,15 @@ void CalcBoneQuaternion( int frame, float s,
 inline void CalcBoneQuaternion( int frame, float s, 
 						const mstudiobone_t *pBone,
 						const mstudiolinearbone_t *pLinearBones,
-						const mstudioanim_t *panim, Quaternion &q )
+						const mstudioanim_t *panim, Quaternion &q, const decodedbone_t *pDecoded = NULL )
 {
 	if (pLinearBones)
 	{
-		CalcBoneQuaternion( frame, s, pLinearBones->quat(panim->bone), pLinearBones->rot(panim->bone), pLinearBones->rotscale(panim->bone), pLinearBones->flags(panim->bone), pLinearBones->qalignment(panim->bone), panim, q );
+		CalcBoneQuaternion( frame, s, pLinearBones->quat(panim->bone), pLinearBones->rot(panim->bone), pLinearBones->rotscale(panim->bone), pLinearBones->flags(panim->bone), pLinearBones->qalignment(panim->bone), panim, q, pDecoded );
 	}
 	else
 	{
-		CalcBoneQuaternion( frame, s, pBone->quat, pBone->rot, pBone->rotscale, pBone->flags, pBone->qAlignment, panim, q );
+		CalcBoneQuaternion( frame, s, pBone->quat, pBone->rot, pBone->rotscale, pBone->flags, pBone->qAlignment, panim, q, pDecoded );
 	}
 }
 
@@ -497,7 +859,7 @@ inline void CalcBoneQuaternion( int frame, float s,
 //-----------------------------------------------------------------------------
 void CalcBonePosition(	int frame, float s,
 						const Vector &basePos, const Vector &baseBoneScale, 
-						const mstudioanim_t *panim, Vector &pos	)
+						const mstudioanim_t *panim, Vector &pos, const decodedbone_t *pDecoded = NULL )
 {
 	if (panim->flags & STUDIO_ANIM_RAWPOS)
 	{
@@ -527,7 +889,7 @@ void CalcBonePosition(	int frame, float s,
 		float v1, v2;
 		for (j = 0; j < 3; j++)
 		{
-			ExtractAnimValue( frame, pPosV->pAnimvalue( j ), baseBoneScale[j], v1, v2 );
+			ExtractAnimValue( frame, pDecoded, 3 + j, pPosV->pAnimvalue( j ), baseBoneScale[j], v1, v2 );
 			pos[j] = v1 * (1.0 - s) + v2 * s;
 		}
 	}
@@ -535,7 +897,7 @@ void CalcBonePosition(	int frame, float s,
 	{
 		for (j = 0; j < 3; j++)
 		{
-			ExtractAnimValue( frame, pPosV->pAnimvalue( j ), baseBoneScale[j], pos[j] );
+			ExtractAnimValue( frame, pDecoded, 3 + j, pPosV->pAnimvalue( j ), baseBoneScale[j], pos[j] );
 		}
 	}
 
@@ -553,20 +915,247 @@ void CalcBonePosition(	int frame, float s,
 inline void CalcBonePosition( int frame, float s, 
 						const mstudiobone_t *pBone,
 						const mstudiolinearbone_t *pLinearBones,
-						const mstudioanim_t *panim, Vector &pos )
+						const mstudioanim_t *panim, Vector &pos, const decodedbone_t *pDecoded = NULL )
 {
 	if (pLinearBones)
 	{
-		CalcBonePosition( frame, s, pLinearBones->pos(panim->bone), pLinearBones->posscale(panim->bone), panim, pos );
+		CalcBonePosition( frame, s, pLinearBones->pos(panim->bone), pLinearBones->posscale(panim->bone), panim, pos, pDecoded );
 	}
 	else
 	{
-		CalcBonePosition( frame, s, pBone->pos, pBone->posscale, panim, pos );
+		CalcBonePosition( frame, s, pBone->pos, pBone->posscale, panim, pos, pDecoded );
 	}
 }
 
 
 
+//-----------------------------------------------------------------------------
+// Purpose: the animated rotations of an animation as a structure of arrays, so
+//			that their euler angles can be turned into quaternions, blended and
+//			aligned four bones at a time.  Filled by AddBoneRotation(), written
+//			to the pose by CalcBoneRotations().
+//-----------------------------------------------------------------------------
+static ConVar anim_simdbones( "anim_simdbones", "1", FCVAR_REPLICATED, "Decode, blend and slerp the bones of an animation four at a time." );
+
+struct BoneRotationBatch_t
+{
+	int			nCount;
+	float		angle1[3][MAXSTUDIOBONES];		// this frame, x y z
+	float		angle2[3][MAXSTUDIOBONES];		// next frame
+	float		alignment[4][MAXSTUDIOBONES];	// x y z w of the alignment quaternion
+	unsigned	alignMask[MAXSTUDIOBONES];		// ~0 if the bone is aligned to it
+	int			bone[MAXSTUDIOBONES];			// index into the pose
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: CalcBoneQuaternion(), with the animated rotations left in the batch
+//-----------------------------------------------------------------------------
+static void AddBoneRotation( BoneRotationBatch_t &batch, int iBone, int frame, float s, 
+						const Quaternion &baseQuat, const RadianEuler &baseRot, const Vector &baseRotScale, 
+						int iBaseFlags, const Quaternion &baseAlignment, 
+						const mstudioanim_t *panim, Quaternion *q, const decodedbone_t *pDecoded = NULL )
+{
+	if ( !(panim->flags & STUDIO_ANIM_ANIMROT) || (panim->flags & (STUDIO_ANIM_RAWROT|STUDIO_ANIM_RAWROT2)) )
+	{
+		CalcBoneQuaternion( frame, s, baseQuat, baseRot, baseRotScale, iBaseFlags, baseAlignment, panim, q[iBone] );
+		return;
+	}
+
+	Assert( batch.nCount < MAXSTUDIOBONES );
+	int n = batch.nCount++;
+	batch.bone[n] = iBone;
+
+	mstudioanim_valueptr_t *pValuesPtr = panim->pRotV();
+	for ( int j = 0; j < 3; j++ )
+	{
+		if (s > 0.001f)
+		{
+			ExtractAnimValue( frame, pDecoded, j, pValuesPtr->pAnimvalue( j ), baseRotScale[j], batch.angle1[j][n], batch.angle2[j][n] );
+		}
+		else
+		{
+			ExtractAnimValue( frame, pDecoded, j, pValuesPtr->pAnimvalue( j ), baseRotScale[j], batch.angle1[j][n] );
+			batch.angle2[j][n] = batch.angle1[j][n];
+		}
+
+		if (!(panim->flags & STUDIO_ANIM_DELTA))
+		{
+			batch.angle1[j][n] += baseRot[j];
+			batch.angle2[j][n] += baseRot[j];
+		}
+	}
+
+	bool bAlign = !(panim->flags & STUDIO_ANIM_DELTA) && (iBaseFlags & BONE_FIXED_ALIGNMENT);
+	batch.alignMask[n] = bAlign ? ~0u : 0;
+	for ( int j = 0; j < 4; j++ )
+	{
+		batch.alignment[j][n] = baseAlignment[j];
+	}
+}
+
+inline void AddBoneRotation( BoneRotationBatch_t &batch, int iBone, int frame, float s, 
+						const mstudiobone_t *pBone,
+						const mstudiolinearbone_t *pLinearBones,
+						const mstudioanim_t *panim, Quaternion *q, const decodedbone_t *pDecoded = NULL )
+{
+	if (pLinearBones)
+	{
+		AddBoneRotation( batch, iBone, frame, s, pLinearBones->quat(panim->bone), pLinearBones->rot(panim->bone), pLinearBones->rotscale(panim->bone), pLinearBones->flags(panim->bone), pLinearBones->qalignment(panim->bone), panim, q, pDecoded );
+	}
+	else
+	{
+		AddBoneRotation( batch, iBone, frame, s, pBone->quat, pBone->rot, pBone->rotscale, pBone->flags, pBone->qAlignment, panim, q, pDecoded );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: AngleQuaternion() of four euler angles
+//-----------------------------------------------------------------------------
+static FORCEINLINE void AngleQuaternionSIMD( const fltx4 &x, const fltx4 &y, const fltx4 &z, fltx4 q[4] )
+{
+	fltx4 sr, sp, sy, cr, cp, cy;
+	SinCosSIMD( sy, cy, MulSIMD( z, Four_PointFives ) );
+	SinCosSIMD( sp, cp, MulSIMD( y, Four_PointFives ) );
+	SinCosSIMD( sr, cr, MulSIMD( x, Four_PointFives ) );
+
+	fltx4 srXcp = MulSIMD( sr, cp ), crXsp = MulSIMD( cr, sp );
+	q[0] = SubSIMD( MulSIMD( srXcp, cy ), MulSIMD( crXsp, sy ) );
+	q[1] = AddSIMD( MulSIMD( crXsp, cy ), MulSIMD( srXcp, sy ) );
+
+	fltx4 crXcp = MulSIMD( cr, cp ), srXsp = MulSIMD( sr, sp );
+	q[2] = SubSIMD( MulSIMD( crXcp, sy ), MulSIMD( srXsp, cy ) );
+	q[3] = AddSIMD( MulSIMD( crXcp, cy ), MulSIMD( srXsp, sy ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: QuaternionAlign() of four quaternions, only in the lanes of the mask
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionAlignSIMD( const fltx4 p[4], fltx4 q[4], const fltx4 &mask )
+{
+	fltx4 a = Four_Zeros, b = Four_Zeros;
+	for ( int j = 0; j < 4; j++ )
+	{
+		fltx4 d = SubSIMD( p[j], q[j] );
+		fltx4 e = AddSIMD( p[j], q[j] );
+		a = MaddSIMD( d, d, a );
+		b = MaddSIMD( e, e, b );
+	}
+
+	fltx4 flip = AndSIMD( CmpGtSIMD( a, b ), mask );
+	for ( int j = 0; j < 4; j++ )
+	{
+		q[j] = MaskedAssign( flip, NegSIMD( q[j] ), q[j] );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: QuaternionNormalize() of four quaternions
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionNormalizeSIMD( fltx4 q[4] )
+{
+	fltx4 radius = MulSIMD( q[0], q[0] );
+	radius = MaddSIMD( q[1], q[1], radius );
+	radius = MaddSIMD( q[2], q[2], radius );
+	radius = MaddSIMD( q[3], q[3], radius );
+
+	fltx4 nonZero = CmpGtSIMD( radius, Four_Zeros );
+	fltx4 iradius = DivSIMD( Four_Ones, SqrtSIMD( MaskedAssign( nonZero, radius, Four_Ones ) ) );
+	for ( int j = 0; j < 4; j++ )
+	{
+		q[j] = MulSIMD( q[j], iradius );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: the rest of CalcBoneQuaternion() for every rotation in the batch, 
+//			four at a time: convert, blend between the two frames, and align
+//-----------------------------------------------------------------------------
+static void CalcBoneRotations( BoneRotationBatch_t &batch, float s, Quaternion *q )
+{
+	int nCount = batch.nCount;
+	if ( nCount == 0 )
+		return;
+
+	// repeat the last rotation to fill the last group of four
+	for ( int n = nCount; n & 3; n++ )
+	{
+		for ( int j = 0; j < 3; j++ )
+		{
+			batch.angle1[j][n] = batch.angle1[j][nCount-1];
+			batch.angle2[j][n] = batch.angle2[j][nCount-1];
+		}
+		for ( int j = 0; j < 4; j++ )
+		{
+			batch.alignment[j][n] = batch.alignment[j][nCount-1];
+		}
+		batch.alignMask[n] = batch.alignMask[nCount-1];
+	}
+
+	bool bBlend = ( s > 0.001f );
+	fltx4 t = ReplicateX4( s );
+	fltx4 oneMinusT = ReplicateX4( 1.0f - s );
+
+	for ( int i = 0; i < nCount; i += 4 )
+	{
+		fltx4 x1 = LoadUnalignedSIMD( &batch.angle1[0][i] );
+		fltx4 y1 = LoadUnalignedSIMD( &batch.angle1[1][i] );
+		fltx4 z1 = LoadUnalignedSIMD( &batch.angle1[2][i] );
+
+		fltx4 q1[4];
+		AngleQuaternionSIMD( x1, y1, z1, q1 );
+
+		if ( bBlend )
+		{
+			fltx4 x2 = LoadUnalignedSIMD( &batch.angle2[0][i] );
+			fltx4 y2 = LoadUnalignedSIMD( &batch.angle2[1][i] );
+			fltx4 z2 = LoadUnalignedSIMD( &batch.angle2[2][i] );
+
+			// QuaternionBlend() where the frames differ
+			fltx4 same = AndSIMD( AndSIMD( CmpEqSIMD( x1, x2 ), CmpEqSIMD( y1, y2 ) ), CmpEqSIMD( z1, z2 ) );
+			fltx4 differ = AndNotSIMD( same, LoadAlignedSIMD( g_SIMD_AllOnesMask ) );
+			if ( TestSignSIMD( differ ) )
+			{
+				fltx4 q2[4];
+				AngleQuaternionSIMD( x2, y2, z2, q2 );
+				QuaternionAlignSIMD( q1, q2, LoadAlignedSIMD( g_SIMD_AllOnesMask ) );
+
+				fltx4 qt[4];
+				for ( int j = 0; j < 4; j++ )
+				{
+					qt[j] = AddSIMD( MulSIMD( oneMinusT, q1[j] ), MulSIMD( t, q2[j] ) );
+				}
+				QuaternionNormalizeSIMD( qt );
+
+				for ( int j = 0; j < 4; j++ )
+				{
+					q1[j] = MaskedAssign( differ, qt[j], q1[j] );
+				}
+			}
+		}
+
+		// align to unified bone
+		fltx4 alignment[4];
+		for ( int j = 0; j < 4; j++ )
+		{
+			alignment[j] = LoadUnalignedSIMD( &batch.alignment[j][i] );
+		}
+		QuaternionAlignSIMD( alignment, q1, LoadUnalignedSIMD( &batch.alignMask[i] ) );
+
+		for ( int k = 0; k < 4 && i + k < nCount; k++ )
+		{
+			Quaternion &qt = q[ batch.bone[i + k] ];
+			qt.x = SubFloat( q1[0], k );
+			qt.y = SubFloat( q1[1], k );
+			qt.z = SubFloat( q1[2], k );
+			qt.w = SubFloat( q1[3], k );
+			Assert( qt.IsValid() );
+		}
+	}
+
+	batch.nCount = 0;
+}
+
+
 void SetupSingleBoneMatrix( 
 	CStudioHdr *pOwnerHdr, 
 	int nSequence, 
@@ -960,8 +1549,17 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 		return;
 	}
 
+	bool bBatch = anim_simdbones.GetBool();
+	BoneRotationBatch_t batch;
+	batch.nCount = 0;
+
+	memhandle_t hDecoded;
+	CDecodedAnim *pDecodedAnim = LockDecodedAnim( animdesc, iFrame, panim, hDecoded );
+	decodedbone_t decoded;
+	const decodedbone_t *pDecoded = pDecodedAnim ? &decoded : NULL;
+
 	// FIXME: change encoding so that bone -1 is never the case
-	while (panim && panim->bone < 255)
+	for (int iBlock = 0; panim && panim->bone < 255; iBlock++)
 	{
 		int j = pAnimGroup->masterBone[panim->bone];
 		if ( j >= 0 && ( pStudioHdr->boneFlags(j) & boneMask ) )
@@ -970,8 +1568,20 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 
 			if (k >= 0 && pweight[k] > 0.0f)
 			{
-				CalcBoneQuaternion( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j] );
-				CalcBonePosition  ( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, pos[j] );
+				if ( pDecodedAnim )
+				{
+					pDecodedAnim->GetBone( iBlock, decoded );
+				}
+
+				if ( bBatch )
+				{
+					AddBoneRotation( batch, j, iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q, pDecoded );
+				}
+				else
+				{
+					CalcBoneQuaternion( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j], pDecoded );
+				}
+				CalcBonePosition  ( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, pos[j], pDecoded );
 #ifdef STUDIO_ENABLE_PERF_COUNTERS
 				pStudioHdr->m_nPerfAnimatedBones++;
 #endif
@@ -980,6 +1590,10 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 		panim = panim->pNext();
 	}
 
+	UnlockDecodedAnim( hDecoded );
+
+	CalcBoneRotations( batch, s, q );
+
 	// cross fade in previous zeroframe data
 	if (flStall > 0.0f)
 	{
@@ -1091,6 +1705,16 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		return;
 	}
 
+	bool bBatch = anim_simdbones.GetBool();
+	BoneRotationBatch_t batch;
+	batch.nCount = 0;
+
+	memhandle_t hDecoded;
+	CDecodedAnim *pDecodedAnim = LockDecodedAnim( animdesc, iFrame, panim, hDecoded );
+	decodedbone_t decoded;
+	const decodedbone_t *pDecoded = pDecodedAnim ? &decoded : NULL;
+	int iBlock = 0;
+
 	// BUGBUG: the sequence, the anim, and the model can have all different bone mappings.
 	for (int i = 0; i < pStudioHdr->numbones(); i++, pbone++, pweight++)
 	{
@@ -1098,14 +1722,27 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		{
 			if (*pweight > 0 && (pStudioHdr->boneFlags(i) & boneMask))
 			{
-				CalcBoneQuaternion( iLocalFrame, s, pbone, pLinearBones, panim, q[i] );
-				CalcBonePosition  ( iLocalFrame, s, pbone, pLinearBones, panim, pos[i] );
+				if ( pDecodedAnim )
+				{
+					pDecodedAnim->GetBone( iBlock, decoded );
+				}
+
+				if ( bBatch )
+				{
+					AddBoneRotation( batch, i, iLocalFrame, s, pbone, pLinearBones, panim, q, pDecoded );
+				}
+				else
+				{
+					CalcBoneQuaternion( iLocalFrame, s, pbone, pLinearBones, panim, q[i], pDecoded );
+				}
+				CalcBonePosition  ( iLocalFrame, s, pbone, pLinearBones, panim, pos[i], pDecoded );
 #ifdef STUDIO_ENABLE_PERF_COUNTERS
 				pStudioHdr->m_nPerfAnimatedBones++;
 				pStudioHdr->m_nPerfUsedBones++;
 #endif
 			}
 			panim = panim->pNext();
+			iBlock++;
 		}
 		else if (*pweight > 0 && (pStudioHdr->boneFlags(i) & boneMask))
 		{
@@ -1125,6 +1762,10 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		}
 	}
 
+	UnlockDecodedAnim( hDecoded );
+
+	CalcBoneRotations( batch, s, q );
+
 	// cross fade in previous zeroframe data
 	if (flStall > 0.0f)
 	{
@@ -1366,6 +2007,116 @@ void WorldSpaceSlerp(
 
 
 
+//-----------------------------------------------------------------------------
+// Purpose: the QuaternionSlerp() and position blend of SlerpBones(), four 
+//			bones at a time.  q1 = slerp( q2, q1, 1 - s2 ), pos1 = lerp( pos1, pos2, s2 )
+//-----------------------------------------------------------------------------
+static void SlerpBonesSIMD( 
+	const CStudioHdr *pStudioHdr,
+	Quaternion q1[MAXSTUDIOBONES], 
+	Vector pos1[MAXSTUDIOBONES], 
+	const QuaternionAligned q2[MAXSTUDIOBONES], 
+	const Vector pos2[MAXSTUDIOBONES], 
+	const float *pS2,
+	int nBoneCount )
+{
+	// the bones that blend, with the last one repeated to fill the last group of four
+	int *pBones = (int *)stackalloc( ( nBoneCount + 4 ) * sizeof(int) );
+	int nCount = 0;
+	for ( int i = 0; i < nBoneCount; i++ )
+	{
+		if ( pS2[i] > 0.0f )
+		{
+			pBones[nCount++] = i;
+		}
+	}
+
+	if ( nCount == 0 )
+		return;
+
+	for ( int n = nCount; n & 3; n++ )
+	{
+		pBones[n] = pBones[nCount-1];
+	}
+
+	const fltx4 epsilon = ReplicateX4( 0.000001f );
+
+	for ( int i = 0; i < nCount; i += 4 )
+	{
+		const int *b = &pBones[i];
+
+		ALIGN16 float s2[4] ALIGN16_POST;
+		ALIGN16 uint32 align[4] ALIGN16_POST;
+		for ( int k = 0; k < 4; k++ )
+		{
+			s2[k] = pS2[b[k]];
+			align[k] = ( pStudioHdr->boneFlags( b[k] ) & BONE_FIXED_ALIGNMENT ) ? 0 : ~0u;
+		}
+		fltx4 fl4S2 = LoadAlignedSIMD( s2 );
+		fltx4 fl4S1 = SubSIMD( Four_Ones, fl4S2 );
+
+		// p = q2, q = q1, as in QuaternionSlerp( q2[i], q1[i], s1, q3 )
+		fltx4 p[4] = { LoadAlignedSIMD( q2[b[0]].Base() ), LoadAlignedSIMD( q2[b[1]].Base() ), LoadAlignedSIMD( q2[b[2]].Base() ), LoadAlignedSIMD( q2[b[3]].Base() ) };
+		fltx4 q[4] = { LoadUnalignedSIMD( q1[b[0]].Base() ), LoadUnalignedSIMD( q1[b[1]].Base() ), LoadUnalignedSIMD( q1[b[2]].Base() ), LoadUnalignedSIMD( q1[b[3]].Base() ) };
+		TransposeSIMD( p[0], p[1], p[2], p[3] );
+		TransposeSIMD( q[0], q[1], q[2], q[3] );
+
+		QuaternionAlignSIMD( p, q, LoadAlignedSIMD( align ) );
+
+		fltx4 cosom = MulSIMD( p[0], q[0] );
+		cosom = MaddSIMD( p[1], q[1], cosom );
+		cosom = MaddSIMD( p[2], q[2], cosom );
+		cosom = MaddSIMD( p[3], q[3], cosom );
+
+		// lanes that are nearly opposite can only be the unaligned ones, and are done below
+		fltx4 opposite = CmpLeSIMD( AddSIMD( Four_Ones, cosom ), epsilon );
+		fltx4 slerp = AndNotSIMD( opposite, CmpGtSIMD( SubSIMD( Four_Ones, cosom ), epsilon ) );
+
+		fltx4 sclp = fl4S2;
+		fltx4 sclq = fl4S1;
+		if ( TestSignSIMD( slerp ) )
+		{
+			fltx4 omega = ArcCosSIMD( MaskedAssign( slerp, cosom, Four_Zeros ) );
+			fltx4 sinom = MaskedAssign( slerp, SinSIMD( omega ), Four_Ones );
+			fltx4 sinp = SinSIMD( MulSIMD( fl4S2, omega ) );
+			fltx4 sinq = SinSIMD( MulSIMD( fl4S1, omega ) );
+			sclp = MaskedAssign( slerp, DivSIMD( sinp, sinom ), sclp );
+			sclq = MaskedAssign( slerp, DivSIMD( sinq, sinom ), sclq );
+		}
+
+		fltx4 qt[4];
+		for ( int j = 0; j < 4; j++ )
+		{
+			qt[j] = AddSIMD( MulSIMD( sclp, p[j] ), MulSIMD( sclq, q[j] ) );
+		}
+		TransposeSIMD( qt[0], qt[1], qt[2], qt[3] );
+
+		FourVectors v1, v2;
+		v1.LoadAndSwizzle( pos1[b[0]], pos1[b[1]], pos1[b[2]], pos1[b[3]] );
+		v2.LoadAndSwizzle( pos2[b[0]], pos2[b[1]], pos2[b[2]], pos2[b[3]] );
+		v1 *= fl4S1;
+		v2 *= fl4S2;
+		v1 += v2;
+
+		int nOpposite = TestSignSIMD( opposite );
+		for ( int k = 0; k < 4 && i + k < nCount; k++ )
+		{
+			if ( nOpposite & ( 1 << k ) )
+			{
+				Quaternion q3;
+				QuaternionSlerpNoAlign( q2[b[k]], q1[b[k]], 1.0f - s2[k], q3 );
+				q1[b[k]] = q3;
+			}
+			else
+			{
+				StoreUnalignedSIMD( q1[b[k]].Base(), qt[k] );
+			}
+			pos1[b[k]] = v1.Vec( k );
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: blend together q1,pos1 with q2,pos2.  Return result in q1,pos1.  
 //			0 returns q1, pos1.  1 returns q2, pos2
@@ -1475,6 +2226,12 @@ void SlerpBones(
 		return;
 	}
 
+	if ( anim_simdbones.GetBool() )
+	{
+		SlerpBonesSIMD( pStudioHdr, q1, pos1, q2, pos2, pS2, nBoneCount );
+		return;
+	}
+
 	QuaternionAligned q3;
 	for (i = 0; i < nBoneCount; i++)
 	{
@@ -2868,6 +3625,280 @@ bool Studio_SolveIK( int iThigh, int iKnee, int iFoot, Vector &targetFoot, Vecto
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Studio_SolveIK() of four chains at a time.  The chains of a pose
+//			are solved together in SoA form: the knee direction of chains 
+//			without one is found first, one chain at a time, and the rest of
+//			the solution (reach limits, CIKSolver::solve() and realigning the
+//			thigh and knee matrices) is done four chains at once.
+//-----------------------------------------------------------------------------
+static ConVar anim_simdik( "anim_simdik", "1", FCVAR_REPLICATED, "Solve the IK chains of a pose four at a time." );
+
+static FORCEINLINE fltx4 DotSIMD( const FourVectors &a, const FourVectors &b )
+{
+	return AddSIMD( AddSIMD( MulSIMD( a.x, b.x ), MulSIMD( a.y, b.y ) ), MulSIMD( a.z, b.z ) );
+}
+
+static FORCEINLINE fltx4 LengthSIMD( const FourVectors &v )
+{
+	return SqrtSIMD( DotSIMD( v, v ) );
+}
+
+static FORCEINLINE FourVectors SubSIMD( const FourVectors &a, const FourVectors &b )
+{
+	FourVectors r = a;
+	r -= b;
+	return r;
+}
+
+static FORCEINLINE FourVectors ScaleSIMD( const FourVectors &v, const fltx4 &s )
+{
+	FourVectors r = v;
+	r *= s;
+	return r;
+}
+
+static FORCEINLINE FourVectors CrossSIMD( const FourVectors &a, const FourVectors &b )
+{
+	FourVectors r;
+	r.x = SubSIMD( MulSIMD( a.y, b.z ), MulSIMD( a.z, b.y ) );
+	r.y = SubSIMD( MulSIMD( a.z, b.x ), MulSIMD( a.x, b.z ) );
+	r.z = SubSIMD( MulSIMD( a.x, b.y ), MulSIMD( a.y, b.x ) );
+	return r;
+}
+
+static FORCEINLINE FourVectors MaskedAssign( const fltx4 &mask, const FourVectors &a, const FourVectors &b )
+{
+	FourVectors r;
+	r.x = MaskedAssign( mask, a.x, b.x );
+	r.y = MaskedAssign( mask, a.y, b.y );
+	r.z = MaskedAssign( mask, a.z, b.z );
+	return r;
+}
+
+// VectorNormalize(), which scales by the refined reciprocal square root estimate
+static FORCEINLINE void VectorNormalizeSIMD( FourVectors &v )
+{
+	fltx4 sqrlen = AddSIMD( DotSIMD( v, v ), ReplicateX4( 1.0e-10f ) );
+	fltx4 invlen = ReciprocalSqrtEstSIMD( sqrlen );
+	fltx4 t = MulSIMD( MulSIMD( invlen, invlen ), sqrlen );
+	t = MulSIMD( SubSIMD( Four_Threes, t ), Four_PointFives );
+	v *= MulSIMD( invlen, t );
+}
+
+// CIKSolver::normalize(), which divides by the length
+static FORCEINLINE void NormalizeSIMD( FourVectors &v )
+{
+	fltx4 norm = LengthSIMD( v );
+	v.x = DivSIMD( v.x, norm );
+	v.y = DivSIMD( v.y, norm );
+	v.z = DivSIMD( v.z, norm );
+}
+
+// Studio_AlignIKMatrix() of the rotation columns X Y Z
+static FORCEINLINE void AlignIKMatrixSIMD( FourVectors &X, FourVectors &Y, FourVectors &Z, const FourVectors &vAlignTo )
+{
+	X = vAlignTo;
+	VectorNormalizeSIMD( X );
+	Y = CrossSIMD( Z, X );
+	VectorNormalizeSIMD( Y );
+	Z = CrossSIMD( X, Y );
+}
+
+static FORCEINLINE void LoadColumnSIMD( matrix3x4_t *pBoneToWorld, const int iBone[4], int nColumn, FourVectors &v )
+{
+	for ( int i = 0; i < 4; i++ )
+	{
+		v.X( i ) = pBoneToWorld[ iBone[i] ][0][nColumn];
+		v.Y( i ) = pBoneToWorld[ iBone[i] ][1][nColumn];
+		v.Z( i ) = pBoneToWorld[ iBone[i] ][2][nColumn];
+	}
+}
+
+static FORCEINLINE void StoreColumn( matrix3x4_t &mat, int nColumn, const FourVectors &v, int i )
+{
+	mat[0][nColumn] = v.X( i );
+	mat[1][nColumn] = v.Y( i );
+	mat[2][nColumn] = v.Z( i );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Solve chains that have their knee targets, four at a time
+//-----------------------------------------------------------------------------
+static void SolveIKQuad( int nLanes, const int iThigh[4], const int iKnee[4], const int iFoot[4], 
+	const Vector targetFoot[4], const Vector targetKneePos[4], const Vector targetKneeDir[4], matrix3x4_t *pBoneToWorld, bool *pSolved[4] )
+{
+	FourVectors worldThigh, worldKnee, worldFoot;
+	LoadColumnSIMD( pBoneToWorld, iThigh, 3, worldThigh );
+	LoadColumnSIMD( pBoneToWorld, iKnee, 3, worldKnee );
+	LoadColumnSIMD( pBoneToWorld, iFoot, 3, worldFoot );
+
+	FourVectors target( targetFoot[0], targetFoot[1], targetFoot[2], targetFoot[3] );
+	FourVectors kneePos( targetKneePos[0], targetKneePos[1], targetKneePos[2], targetKneePos[3] );
+	FourVectors kneeDir( targetKneeDir[0], targetKneeDir[1], targetKneeDir[2], targetKneeDir[3] );
+
+	FourVectors ikFoot = SubSIMD( target, worldThigh );
+	FourVectors ikKnee = SubSIMD( kneePos, worldThigh );
+
+	fltx4 l1 = LengthSIMD( SubSIMD( worldKnee, worldThigh ) );
+	fltx4 l2 = LengthSIMD( SubSIMD( worldFoot, worldKnee ) );
+	fltx4 l12 = AddSIMD( l1, l2 );
+	fltx4 lMin = MinSIMD( l1, l2 );
+
+	// exaggerate knee targets for legs that are nearly straight
+	fltx4 d = MaxSIMD( l12, SubSIMD( LengthSIMD( ikFoot ), lMin ) );
+	d = MulSIMD( d, ReplicateX4( 100.0f ) );
+
+	FourVectors ikTargetKnee = ikKnee;
+	ikTargetKnee += ScaleSIMD( kneeDir, d );
+
+	// too far away?
+	fltx4 maxDist = MulSIMD( l12, ReplicateX4( KNEEMAX_EPSILON ) );
+	FourVectors farFoot = ikFoot;
+	VectorNormalizeSIMD( farFoot );
+	ikFoot = MaskedAssign( CmpGtSIMD( LengthSIMD( ikFoot ), maxDist ), ScaleSIMD( farFoot, maxDist ), ikFoot );
+
+	// too close?
+	fltx4 l1l2 = SubSIMD( l1, l2 );
+	fltx4 minDist = MaxSIMD( MulSIMD( MaxSIMD( l1l2, NegSIMD( l1l2 ) ), ReplicateX4( 1.15f ) ), MulSIMD( lMin, ReplicateX4( 0.15f ) ) );
+	FourVectors nearFoot = SubSIMD( worldFoot, worldThigh );
+	VectorNormalizeSIMD( nearFoot );
+	ikFoot = MaskedAssign( CmpLtSIMD( LengthSIMD( ikFoot ), minDist ), ScaleSIMD( nearFoot, minDist ), ikFoot );
+
+	// CIKSolver::solve()
+	FourVectors X = ikFoot;
+	NormalizeSIMD( X );
+	FourVectors Y = SubSIMD( ikTargetKnee, ScaleSIMD( X, DotSIMD( ikTargetKnee, X ) ) );
+	NormalizeSIMD( Y );
+	FourVectors Z = CrossSIMD( X, Y );
+
+	FourVectors R;
+	R.x = DotSIMD( X, ikFoot );
+	R.y = DotSIMD( Y, ikFoot );
+	R.z = DotSIMD( Z, ikFoot );
+	fltx4 r = LengthSIMD( R );
+	fltx4 A2 = MulSIMD( l1, l1 );
+	fltx4 dKnee = MulSIMD( AddSIMD( r, DivSIMD( SubSIMD( A2, MulSIMD( l2, l2 ) ), r ) ), Four_PointFives );
+	fltx4 eKnee = SqrtSIMD( SubSIMD( A2, MulSIMD( dKnee, dKnee ) ) );
+	ikKnee = ScaleSIMD( X, dKnee );
+	ikKnee += ScaleSIMD( Y, eKnee );
+
+	fltx4 solved = AndSIMD( CmpGtSIMD( dKnee, SubSIMD( r, l2 ) ), CmpLtSIMD( dKnee, l1 ) );
+
+	// build transformation matrices for thigh and knee
+	FourVectors thighX, thighY, thighZ, kneeX, kneeY, kneeZ;
+	LoadColumnSIMD( pBoneToWorld, iThigh, 2, thighZ );
+	LoadColumnSIMD( pBoneToWorld, iKnee, 2, kneeZ );
+	AlignIKMatrixSIMD( thighX, thighY, thighZ, ikKnee );
+	AlignIKMatrixSIMD( kneeX, kneeY, kneeZ, SubSIMD( ikFoot, ikKnee ) );
+
+	ikKnee += worldThigh;
+	ikFoot += worldThigh;
+
+	for ( int i = 0; i < nLanes; i++ )
+	{
+		*pSolved[i] = SubInt( solved, i ) != 0;
+		if ( !*pSolved[i] )
+			continue;
+
+		matrix3x4_t &mWorldThigh = pBoneToWorld[ iThigh[i] ];
+		matrix3x4_t &mWorldKnee = pBoneToWorld[ iKnee[i] ];
+		matrix3x4_t &mWorldFoot = pBoneToWorld[ iFoot[i] ];
+
+		StoreColumn( mWorldThigh, 0, thighX, i );
+		StoreColumn( mWorldThigh, 1, thighY, i );
+		StoreColumn( mWorldThigh, 2, thighZ, i );
+		StoreColumn( mWorldKnee, 0, kneeX, i );
+		StoreColumn( mWorldKnee, 1, kneeY, i );
+		StoreColumn( mWorldKnee, 2, kneeZ, i );
+		StoreColumn( mWorldKnee, 3, ikKnee, i );
+		StoreColumn( mWorldFoot, 3, ikFoot, i );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Studio_SolveIK() of each chain to its target foot position.  The 
+//			chains must not share bones.
+//-----------------------------------------------------------------------------
+void Studio_SolveIKChains( int nChains, mstudioikchain_t * const *ppChains, const Vector *pTargetFoot, matrix3x4_t *pBoneToWorld, bool *pSolved )
+{
+	if ( !anim_simdik.GetBool() )
+	{
+		for ( int i = 0; i < nChains; i++ )
+		{
+			Vector targetFoot = pTargetFoot[i];
+			pSolved[i] = Studio_SolveIK( ppChains[i], targetFoot, pBoneToWorld );
+		}
+		return;
+	}
+
+	int iThigh[4], iKnee[4], iFoot[4];
+	Vector targetFoot[4], targetKneePos[4], targetKneeDir[4];
+	bool *pLaneSolved[4];
+	int nLanes = 0;
+
+	for ( int i = 0; i < nChains; i++ )
+	{
+		mstudioikchain_t *pikchain = ppChains[i];
+		int n = nLanes;
+		iThigh[n] = pikchain->pLink( 0 )->bone;
+		iKnee[n] = pikchain->pLink( 1 )->bone;
+		iFoot[n] = pikchain->pLink( 2 )->bone;
+		targetFoot[n] = pTargetFoot[i];
+		MatrixPosition( pBoneToWorld[ iKnee[n] ], targetKneePos[n] );
+
+		if (pikchain->pLink(0)->kneeDir.LengthSqr() > 0.0)
+		{
+			// FIXME: knee length should be as long as the legs
+			VectorRotate( pikchain->pLink( 0 )->kneeDir, pBoneToWorld[ iThigh[n] ], targetKneeDir[n] );
+		}
+		else
+		{
+			// no specific knee direction preference, bend the way the knee already is
+			Vector worldThigh, worldFoot;
+			MatrixPosition( pBoneToWorld[ iThigh[n] ], worldThigh );
+			MatrixPosition( pBoneToWorld[ iFoot[n] ], worldFoot );
+
+			float l1 = (targetKneePos[n]-worldThigh).Length();
+			float l2 = (worldFoot-targetKneePos[n]).Length();
+			float l3 = (worldFoot-worldThigh).Length();
+
+			// leg too straight to figure out knee?
+			if (l3 > (l1 + l2) * KNEEMAX_EPSILON)
+			{
+				pSolved[i] = false;
+				continue;
+			}
+
+			Vector ikHalf = (worldFoot-worldThigh) * (l1 / l3);
+			targetKneeDir[n] = (targetKneePos[n] - worldThigh) - ikHalf;
+			VectorNormalize( targetKneeDir[n] );
+		}
+
+		pLaneSolved[n] = &pSolved[i];
+		if ( ++nLanes == 4 )
+		{
+			SolveIKQuad( nLanes, iThigh, iKnee, iFoot, targetFoot, targetKneePos, targetKneeDir, pBoneToWorld, pLaneSolved );
+			nLanes = 0;
+		}
+	}
+
+	if ( nLanes )
+	{
+		// fill the unused lanes with copies of the first
+		for ( int n = nLanes; n < 4; n++ )
+		{
+			iThigh[n] = iThigh[0];
+			iKnee[n] = iKnee[0];
+			iFoot[n] = iFoot[0];
+			targetFoot[n] = targetFoot[0];
+			targetKneePos[n] = targetKneePos[0];
+			targetKneeDir[n] = targetKneeDir[0];
+		}
+		SolveIKQuad( nLanes, iThigh, iKnee, iFoot, targetFoot, targetKneePos, targetKneeDir, pBoneToWorld, pLaneSolved );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -4195,6 +5226,37 @@ void CIKContext::SolveDependencies( Vector pos[], Quaternion q[], matrix3x4_t bo
 		}
 	}
 
+	// solve the chains with a target together, unless they share bones
+	mstudioikchain_t *pSolveChain[32];
+	Vector solveTarget[32];
+	bool bSolved[32];
+	int nSolve = 0;
+	bool bSharedBones = false;
+	CBoneBitList chainBones;
+
+	for (i = 0; i < m_pStudioHdr->numikchains(); i++)
+	{
+		if (chainResult[ i ].flWeight > 0.0)
+		{
+			mstudioikchain_t *pchain = m_pStudioHdr->pIKChain( i );
+			for (j = 0; j < 3; j++)
+			{
+				int bone = pchain->pLink( j )->bone;
+				bSharedBones = bSharedBones || chainBones.IsBoneMarked( bone );
+				chainBones.MarkBone( bone );
+			}
+			pSolveChain[ nSolve ] = pchain;
+			solveTarget[ nSolve ] = chainResult[ i ].pos;
+			nSolve++;
+		}
+	}
+
+	if (!bSharedBones)
+	{
+		Studio_SolveIKChains( nSolve, pSolveChain, solveTarget, boneToWorld, bSolved );
+	}
+
+	nSolve = 0;
 	for (i = 0; i < m_pStudioHdr->numikchains(); i++)
 	{
 		ikchainresult_t *pChainResult = &chainResult[ i ];
@@ -4208,7 +5270,9 @@ void CIKContext::SolveDependencies( Vector pos[], Quaternion q[], matrix3x4_t bo
 
 			// do exact IK solution
 			// FIXME: once per link!
-			if (Studio_SolveIK(pchain, pChainResult->pos, boneToWorld ))
+			bool bChainSolved = bSharedBones ? Studio_SolveIK(pchain, pChainResult->pos, boneToWorld ) : bSolved[ nSolve ];
+			nSolve++;
+			if (bChainSolved)
 			{
 				Vector p3;
 				MatrixGetColumn( boneToWorld[pchain->pLink( 2 )->bone], 3, p3 );
@@ -5843,14 +6907,7 @@ int Studio_FindAttachment( const CStudioHdr *pStudioHdr, const char *pAttachment
 {
 	if ( pStudioHdr && pStudioHdr->SequencesAvailable() )
 	{
-		// Extract the bone index from the name
-		for (int i = 0; i < pStudioHdr->GetNumAttachments(); i++)
-		{
-			if (!V_stricmp(pAttachmentName,((CStudioHdr *)pStudioHdr)->pAttachment(i).pszName( ))) 
-			{
-				return i;
-			}
-		}
+		return pStudioHdr->FindAttachment( pAttachmentName );
 	}
 
 	return -1;
@@ -266,6 +266,9 @@ bool Studio_SolveIK( int iThigh, int iKnee, int iFoot, Vector &targetFoot, matri
 
 bool Studio_SolveIK( int iThigh, int iKnee, int iFoot, Vector &targetFoot, Vector &targetKneePos, Vector &targetKneeDir, matrix3x4_t* pBoneToWorld );
 
+// solve several chains that don't share bones, four at a time
+void Studio_SolveIKChains( int nChains, mstudioikchain_t * const *ppChains, const Vector *pTargetFoot, matrix3x4_t *pBoneToWorld, bool *pSolved );
+
 
 
 class CIKContext 
@@ -439,6 +442,9 @@ memhandle_t Studio_CreateBoneCache( bonecacheparams_t &params );
 void Studio_DestroyBoneCache( memhandle_t cacheHandle );
 void Studio_InvalidateBoneCache( memhandle_t cacheHandle );
 
+// Forget the decoded animation of the models that are being unloaded
+void Studio_FlushDecodedAnimations();
+
 // Given a ray, trace for an intersection with this studiomodel.  Get the array of bones from StudioSetupHitboxBones
 bool TraceToStudio( class IPhysicsSurfaceProps *pProps, const Ray_t& ray, CStudioHdr *pStudioHdr, mstudiohitboxset_t *set, matrix3x4_t **hitboxbones, int fContentsMask, const Vector &vecOrigin, float flScale, trace_t &trace );
 
@@ -0,0 +1,239 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Game-side flattened view of a SendTable.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "dt_send_flat.h"
+#include "tier1/utlmap.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+struct SendFlatChangeKey_t
+{
+	int				m_Offset;
+	unsigned short	m_iProp;
+};
+
+static int __cdecl SortChangeKeys( const SendFlatChangeKey_t *pLeft, const SendFlatChangeKey_t *pRight )
+{
+	if ( pLeft->m_Offset != pRight->m_Offset )
+		return pLeft->m_Offset - pRight->m_Offset;
+	return (int)pLeft->m_iProp - (int)pRight->m_iProp;
+}
+
+static CUtlVector<SendFlatChangeKey_t> s_ChangeKeys;
+
+
+bool SendTable_IsNonModifiedPointerProxy( SendTableProxyFn fn )
+{
+	if ( fn == SendProxy_DataTableToDataTable || fn == SendProxy_SendLocalDataTable )
+		return true;
+
+	for ( CNonModifiedPointerProxy *p = *g_StandardSendProxies.m_ppNonModifiedPointerProxies; p; p = p->m_pNext )
+	{
+		if ( p->m_Fn == fn )
+			return true;
+	}
+	return false;
+}
+
+
+CSendTableFlat::CSendTableFlat( SendTable *pTable )
+{
+	m_pTable = pTable;
+
+	GatherExcludes( pTable );
+
+	s_ChangeKeys.RemoveAll();
+	Flatten( pTable, 0, true, -1, 0 );
+	Assert( m_Props.Count() < 0xFFFF );
+
+	s_ChangeKeys.Sort( SortChangeKeys );
+	m_ChangeOffsets.EnsureCapacity( s_ChangeKeys.Count() );
+	m_ChangeProps.EnsureCapacity( s_ChangeKeys.Count() );
+	for ( int i = 0; i < s_ChangeKeys.Count(); ++i )
+	{
+		m_ChangeOffsets.AddToTail( s_ChangeKeys[i].m_Offset );
+		m_ChangeProps.AddToTail( s_ChangeKeys[i].m_iProp );
+	}
+	s_ChangeKeys.Purge();
+	m_Excludes.Purge();
+}
+
+
+void CSendTableFlat::GatherExcludes( SendTable *pTable )
+{
+	for ( int i = 0; i < pTable->GetNumProps(); ++i )
+	{
+		SendProp *pProp = pTable->GetProp( i );
+		if ( pProp->IsExcludeProp() )
+		{
+			m_Excludes.AddToTail( pProp );
+		}
+		else if ( pProp->GetType() == DPT_DataTable && pProp->GetDataTable() )
+		{
+			GatherExcludes( pProp->GetDataTable() );
+		}
+	}
+}
+
+
+bool CSendTableFlat::IsExcluded( const SendTable *pTable, const SendProp *pProp ) const
+{
+	for ( int i = 0; i < m_Excludes.Count(); ++i )
+	{
+		const SendProp *pExclude = m_Excludes[i];
+		if ( !V_stricmp( pExclude->GetExcludeDTName(), pTable->GetName() ) &&
+			 !V_stricmp( pExclude->GetName(), pProp->GetName() ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void CSendTableFlat::AddChangeKey( int nOffset, int iProp )
+{
+	if ( nOffset < 0 )
+		return;
+
+	SendFlatChangeKey_t key;
+	key.m_Offset = nOffset;
+	key.m_iProp = (unsigned short)iProp;
+	s_ChangeKeys.AddToTail( key );
+}
+
+
+void CSendTableFlat::Flatten( SendTable *pTable, int nBaseOffset, bool bTracked, int iDataTable, int nLocalOffset )
+{
+	for ( int i = 0; i < pTable->GetNumProps(); ++i )
+	{
+		SendProp *pProp = pTable->GetProp( i );
+		if ( pProp->IsExcludeProp() || pProp->IsInsideArray() || IsExcluded( pTable, pProp ) )
+			continue;
+
+		// The engine flags array templates with SPROP_INSIDEARRAY when it initializes
+		// the table; do the same check here in case we run before it does.
+		if ( i + 1 < pTable->GetNumProps() && pTable->GetProp( i + 1 )->GetType() == DPT_Array && pProp->GetType() != DPT_Array )
+			continue;
+
+		// Array props carry no offset of their own; the engine reads the elements
+		// starting at the offset of the template prop that precedes them
+		const SendProp *pArrayElementProp = NULL;
+		if ( pProp->GetType() == DPT_Array )
+		{
+			pArrayElementProp = pProp->GetArrayProp() ? pProp->GetArrayProp() : ( i > 0 ? pTable->GetProp( i - 1 ) : NULL );
+		}
+		const SendProp *pOffsetProp = pArrayElementProp ? pArrayElementProp : pProp;
+
+		// SENDINFO_VECTORELEM props carry a negative offset until the engine fixes them up
+		bool bVectorElem = ( pProp->GetFlags() & SPROP_IS_A_VECTOR_ELEM ) != 0 || pProp->GetOffset() < 0;
+		int nOffset = nBaseOffset + abs( pOffsetProp->GetOffset() );
+		int nPropLocalOffset = nLocalOffset + abs( pOffsetProp->GetOffset() );
+
+		if ( pProp->GetType() == DPT_DataTable )
+		{
+			if ( pProp->GetDataTable() )
+			{
+				bool bChildTracked = bTracked && SendTable_IsNonModifiedPointerProxy( pProp->GetDataTableProxyFn() );
+				if ( pProp->GetDataTableProxyFn() == SendProxy_DataTableToDataTable )
+				{
+					Flatten( pProp->GetDataTable(), nOffset, bChildTracked, iDataTable, nPropLocalOffset );
+				}
+				else
+				{
+					int iChild = m_DataTables.AddToTail();
+					m_DataTables[iChild].m_pProp = pProp;
+					m_DataTables[iChild].m_iParent = iDataTable;
+					m_DataTables[iChild].m_LocalOffset = nPropLocalOffset;
+					Flatten( pProp->GetDataTable(), nOffset, bChildTracked, iChild, 0 );
+				}
+			}
+			continue;
+		}
+
+		int iProp = m_Props.AddToTail();
+		SendFlatProp_t &flat = m_Props[iProp];
+		flat.m_pProp = pProp;
+		flat.m_pArrayElementProp = pArrayElementProp;
+		flat.m_Offset = nOffset;
+		flat.m_bTracked = bTracked;
+		flat.m_iDataTable = iDataTable;
+		flat.m_LocalOffset = nPropLocalOffset;
+
+		if ( !bTracked )
+		{
+			m_UntrackedProps.AddToTail( (unsigned short)iProp );
+			continue;
+		}
+
+		if ( pProp->GetType() == DPT_Array )
+		{
+			// CNetworkArray reports the address of the element that changed
+			for ( int iElement = 0; iElement < pProp->GetNumElements(); ++iElement )
+			{
+				AddChangeKey( nOffset + iElement * pProp->GetElementStride(), iProp );
+			}
+		}
+		else if ( bVectorElem )
+		{
+			// CNetworkVector reports the address of the whole vector, which may
+			// sit one or two floats before this component
+			AddChangeKey( nOffset, iProp );
+			AddChangeKey( nOffset - (int)sizeof( float ), iProp );
+			AddChangeKey( nOffset - 2 * (int)sizeof( float ), iProp );
+		}
+		else
+		{
+			AddChangeKey( nOffset, iProp );
+		}
+	}
+}
+
+
+int CSendTableFlat::FindPropsAtOffset( int nOffset, const unsigned short **ppProps ) const
+{
+	// Lower bound
+	int nLow = 0;
+	int nHigh = m_ChangeOffsets.Count();
+	while ( nLow < nHigh )
+	{
+		int nMid = ( nLow + nHigh ) >> 1;
+		if ( m_ChangeOffsets[nMid] < nOffset )
+			nLow = nMid + 1;
+		else
+			nHigh = nMid;
+	}
+
+	int nCount = 0;
+	while ( nLow + nCount < m_ChangeOffsets.Count() && m_ChangeOffsets[nLow + nCount] == nOffset )
+	{
+		++nCount;
+	}
+
+	*ppProps = nCount ? &m_ChangeProps[nLow] : NULL;
+	return nCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Cache of flattened tables, built on first use
+//-----------------------------------------------------------------------------
+static CUtlMap<SendTable*, CSendTableFlat*> s_FlatTables( DefLessFunc( SendTable* ) );
+
+CSendTableFlat *SendTable_GetFlat( SendTable *pTable )
+{
+	unsigned short i = s_FlatTables.Find( pTable );
+	if ( i != s_FlatTables.InvalidIndex() )
+		return s_FlatTables[i];
+
+	CSendTableFlat *pFlat = new CSendTableFlat( pTable );
+	s_FlatTables.Insert( pTable, pFlat );
+	return pFlat;
+}
@@ -0,0 +1,101 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Game-side flattened view of a SendTable, used to map network var
+//			changes onto individual properties.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef DT_SEND_FLAT_H
+#define DT_SEND_FLAT_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "dt_send.h"
+#include "tier1/utlvector.h"
+
+
+// ------------------------------------------------------------------------ //
+// A leaf property of a SendTable after excludes are applied and all
+// datatables are walked. Offsets are from the base of the outermost struct.
+// ------------------------------------------------------------------------ //
+struct SendFlatProp_t
+{
+	const SendProp	*m_pProp;
+	const SendProp	*m_pArrayElementProp;	// DPT_Array only: the template prop for each element
+	int				m_Offset;				// DPT_Array: offset of the first element
+
+	// False if the prop was reached through a datatable proxy that modifies the
+	// data pointer. Changes to those props can't be mapped by offset, so they
+	// must always be treated as dirty.
+	bool			m_bTracked;
+
+	// Index of the innermost datatable proxy above this prop (-1 if none), and
+	// the prop's offset from the data that proxy returns.
+	int				m_iDataTable;
+	int				m_LocalOffset;
+};
+
+
+// ------------------------------------------------------------------------ //
+// A datatable prop whose proxy must be called at encode time, either because
+// it moves the data pointer or because it filters recipients. Datatables using
+// SendProxy_DataTableToDataTable are folded into their parent.
+// ------------------------------------------------------------------------ //
+struct SendFlatDataTable_t
+{
+	const SendProp	*m_pProp;
+	int				m_iParent;		// -1 if the parent is the outermost struct
+	int				m_LocalOffset;	// Offset of the datatable from its parent's data
+};
+
+
+class CSendTableFlat
+{
+public:
+	CSendTableFlat( SendTable *pTable );
+
+	SendTable*				GetTable() const					{ return m_pTable; }
+	int						GetNumProps() const					{ return m_Props.Count(); }
+	const SendFlatProp_t&	GetProp( int i ) const				{ return m_Props[i]; }
+
+	// Props reached through pointer-modifying proxies (see SendFlatProp_t::m_bTracked)
+	int						GetNumUntrackedProps() const		{ return m_UntrackedProps.Count(); }
+	int						GetUntrackedProp( int i ) const		{ return m_UntrackedProps[i]; }
+
+	// Datatable proxies, parents always come before their children
+	int							GetNumDataTables() const		{ return m_DataTables.Count(); }
+	const SendFlatDataTable_t&	GetDataTable( int i ) const		{ return m_DataTables[i]; }
+
+	// Returns how many props a change at nOffset (as passed to NetworkStateChanged)
+	// affects, and points *ppProps at their flattened indices.
+	int						FindPropsAtOffset( int nOffset, const unsigned short **ppProps ) const;
+
+private:
+	void					Flatten( SendTable *pTable, int nBaseOffset, bool bTracked, int iDataTable, int nLocalOffset );
+	bool					IsExcluded( const SendTable *pTable, const SendProp *pProp ) const;
+	void					GatherExcludes( SendTable *pTable );
+	void					AddChangeKey( int nOffset, int iProp );
+
+	SendTable				*m_pTable;
+	CUtlVector<SendFlatProp_t>	m_Props;
+	CUtlVector<SendFlatDataTable_t>	m_DataTables;
+	CUtlVector<const SendProp*>	m_Excludes;
+	CUtlVector<unsigned short>	m_UntrackedProps;
+
+	// Sorted by offset; m_ChangeProps[i] is the prop touched by a change at m_ChangeOffsets[i]
+	CUtlVector<int>				m_ChangeOffsets;
+	CUtlVector<unsigned short>	m_ChangeProps;
+};
+
+
+// Returns the (lazily built, cached) flattened view of a SendTable.
+CSendTableFlat *SendTable_GetFlat( SendTable *pTable );
+
+// True if the datatable proxy returns the same pointer it was given.
+bool SendTable_IsNonModifiedPointerProxy( SendTableProxyFn fn );
+
+
+#endif // DT_SEND_FLAT_H
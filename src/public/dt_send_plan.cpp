@@ -0,0 +1,456 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Precompiled encode plans for flattened SendTables.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "dt_send_plan.h"
+#include "tier1/bitbuf.h"
+#include "tier1/utlmap.h"
+#include "tier0/dbg.h"
+#include "mathlib/mathlib.h"
+#include "coordsize.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+//-----------------------------------------------------------------------------
+// Value encoders
+//-----------------------------------------------------------------------------
+static int GetPropEncoding( const SendProp *pProp )
+{
+	int flags = pProp->GetFlags();
+	switch ( pProp->GetType() )
+	{
+	case DPT_Int:
+		if ( flags & SPROP_VARINT )
+			return ( flags & SPROP_UNSIGNED ) ? SENDPLAN_ENCODE_UVARINT : SENDPLAN_ENCODE_VARINT;
+		return ( flags & SPROP_UNSIGNED ) ? SENDPLAN_ENCODE_UINT : SENDPLAN_ENCODE_INT;
+
+	case DPT_Float:
+	case DPT_Vector:
+	case DPT_VectorXY:
+		if ( flags & SPROP_COORD )
+			return SENDPLAN_ENCODE_FLOAT_COORD;
+		if ( flags & ( SPROP_COORD_MP | SPROP_COORD_MP_LOWPRECISION | SPROP_COORD_MP_INTEGRAL ) )
+			return SENDPLAN_ENCODE_FLOAT_COORD_MP;
+		if ( flags & SPROP_NOSCALE )
+			return SENDPLAN_ENCODE_FLOAT_NOSCALE;
+		if ( flags & SPROP_NORMAL )
+			return SENDPLAN_ENCODE_FLOAT_NORMAL;
+		// SPROP_ROUNDDOWN and SPROP_ROUNDUP need nothing here: SendPropFloat already
+		// pulled m_fHighValue down (or m_fLowValue up) by one step, and values past
+		// the range clamp to the end code like the engine's encoder does.
+		return SENDPLAN_ENCODE_FLOAT;
+
+	case DPT_String:
+		return SENDPLAN_ENCODE_STRING;
+
+	case DPT_Array:
+		return SENDPLAN_ENCODE_ARRAY;
+	}
+
+	Assert( !"GetPropEncoding: unsupported prop type" );
+	return SENDPLAN_ENCODE_INT;
+}
+
+
+static inline void EncodeInt( int encoding, int nBits, int nValue, bf_write *pOut )
+{
+	switch ( encoding )
+	{
+	case SENDPLAN_ENCODE_UINT:		pOut->WriteUBitLong( (unsigned int)nValue, nBits, false );	break;
+	case SENDPLAN_ENCODE_VARINT:	pOut->WriteSignedVarInt32( nValue );						break;
+	case SENDPLAN_ENCODE_UVARINT:	pOut->WriteVarInt32( (uint32)nValue );						break;
+	default:						pOut->WriteSBitLong( nValue, nBits );						break;
+	}
+}
+
+
+static inline void EncodeFloat( int encoding, int nBits, const SendProp *pProp, float flValue, bf_write *pOut )
+{
+	switch ( encoding )
+	{
+	case SENDPLAN_ENCODE_FLOAT_COORD:
+		pOut->WriteBitCoord( flValue );
+		break;
+
+	case SENDPLAN_ENCODE_FLOAT_COORD_MP:
+		pOut->WriteBitCoordMP( flValue, ( pProp->GetFlags() & SPROP_COORD_MP_INTEGRAL ) != 0, ( pProp->GetFlags() & SPROP_COORD_MP_LOWPRECISION ) != 0 );
+		break;
+
+	case SENDPLAN_ENCODE_FLOAT_NOSCALE:
+		pOut->WriteBitFloat( flValue );
+		break;
+
+	case SENDPLAN_ENCODE_FLOAT_NORMAL:
+		pOut->WriteBitNormal( flValue );
+		break;
+
+	default:
+		{
+			unsigned int nMax = ( nBits >= 32 ) ? 0xFFFFFFFF : ( ( 1u << nBits ) - 1 );
+			unsigned int ulValue;
+			if ( flValue < pProp->m_fLowValue )
+			{
+				ulValue = 0;
+			}
+			else if ( flValue > pProp->m_fHighValue )
+			{
+				ulValue = nMax;
+			}
+			else
+			{
+				float flRange = ( flValue - pProp->m_fLowValue ) * pProp->m_fHighLowMul;
+				ulValue = ( nBits <= 22 ) ? (unsigned int)FastFloatToSmallInt( flRange ) : (unsigned int)RoundFloatToUnsignedLong( flRange );
+				ulValue = MIN( ulValue, nMax );
+			}
+			pOut->WriteUBitLong( ulValue, nBits, false );
+		}
+		break;
+	}
+}
+
+
+static inline void EncodeString( const char *pString, bf_write *pOut )
+{
+	if ( !pString )
+		pString = "";
+
+	int len = MIN( V_strlen( pString ), DT_MAX_STRING_BUFFERSIZE - 1 );
+	pOut->WriteUBitLong( len, DT_MAX_STRING_BITS );
+	pOut->WriteBits( pString, len * 8 );
+}
+
+
+static inline void EncodeValue( int type, int encoding, int nBits, const SendProp *pProp, const DVariant &var, bf_write *pOut )
+{
+	switch ( type )
+	{
+	case DPT_Int:
+		EncodeInt( encoding, nBits, var.m_Int, pOut );
+		break;
+
+	case DPT_Float:
+		EncodeFloat( encoding, nBits, pProp, var.m_Float, pOut );
+		break;
+
+	case DPT_Vector:
+		EncodeFloat( encoding, nBits, pProp, var.m_Vector[0], pOut );
+		EncodeFloat( encoding, nBits, pProp, var.m_Vector[1], pOut );
+		if ( encoding == SENDPLAN_ENCODE_FLOAT_NORMAL )
+		{
+			// Normals only send the sign of z
+			pOut->WriteOneBit( var.m_Vector[2] <= -NORMAL_RESOLUTION );
+		}
+		else
+		{
+			EncodeFloat( encoding, nBits, pProp, var.m_Vector[2], pOut );
+		}
+		break;
+
+	case DPT_VectorXY:
+		EncodeFloat( encoding, nBits, pProp, var.m_Vector[0], pOut );
+		EncodeFloat( encoding, nBits, pProp, var.m_Vector[1], pOut );
+		break;
+
+	case DPT_String:
+		EncodeString( var.m_pString, pOut );
+		break;
+
+	default:
+		Assert( !"EncodeValue: unsupported prop type" );
+		break;
+	}
+}
+
+
+static int GetArrayLength( const SendProp *pArrayProp, const void *pStructBase, int objectID )
+{
+	int nElements = pArrayProp->GetNumElements();
+	if ( pArrayProp->GetArrayLengthProxy() )
+	{
+		nElements = clamp( pArrayProp->GetArrayLengthProxy()( pStructBase, objectID ), 0, pArrayProp->GetNumElements() );
+	}
+	return nElements;
+}
+
+
+//-----------------------------------------------------------------------------
+// Compiling
+//-----------------------------------------------------------------------------
+static SendPlanLoad_t GetPropLoad( const SendProp *pProp )
+{
+	if ( pProp->GetType() == DPT_Array )
+		return SENDPLAN_LOAD_ARRAY;
+
+	SendVarProxyFn fn = pProp->GetProxyFn();
+	if ( fn == g_StandardSendProxies.m_Int8ToInt32 )		return SENDPLAN_LOAD_INT8;
+	if ( fn == g_StandardSendProxies.m_Int16ToInt32 )		return SENDPLAN_LOAD_INT16;
+	if ( fn == g_StandardSendProxies.m_Int32ToInt32 )		return SENDPLAN_LOAD_INT32;
+	if ( fn == g_StandardSendProxies.m_UInt8ToInt32 )		return SENDPLAN_LOAD_UINT8;
+	if ( fn == g_StandardSendProxies.m_UInt16ToInt32 )		return SENDPLAN_LOAD_UINT16;
+	if ( fn == g_StandardSendProxies.m_UInt32ToInt32 )		return SENDPLAN_LOAD_UINT32;
+	if ( fn == g_StandardSendProxies.m_FloatToFloat )		return SENDPLAN_LOAD_FLOAT;
+	if ( fn == g_StandardSendProxies.m_VectorToVector )		return SENDPLAN_LOAD_VECTOR;
+	if ( fn == SendProxy_AngleToFloat )						return SENDPLAN_LOAD_ANGLE;
+	if ( fn == SendProxy_QAngles )							return SENDPLAN_LOAD_QANGLES;
+	if ( fn == SendProxy_VectorXYToVectorXY )				return SENDPLAN_LOAD_VECTORXY;
+	if ( fn == SendProxy_StringToString )					return SENDPLAN_LOAD_STRING;
+	return SENDPLAN_LOAD_PROXY;
+}
+
+
+CSendTablePlan::CSendTablePlan( CSendTableFlat *pFlat )
+{
+	m_pFlat = pFlat;
+	m_nProps = pFlat->GetNumProps();
+	m_nCustomProxies = 0;
+	m_nUnsupportedProps = 0;
+
+	m_nDataTables = pFlat->GetNumDataTables();
+	AssertMsg2( m_nDataTables <= MAX_DATATABLE_PROXIES, "CSendTablePlan: %s has more than %d datatable proxies", pFlat->GetTable()->GetName(), MAX_DATATABLE_PROXIES );
+	m_nDataTables = MIN( m_nDataTables, MAX_DATATABLE_PROXIES );
+
+	m_DataTableParents.EnsureCount( m_nDataTables );
+	m_DataTableOffsets.EnsureCount( m_nDataTables );
+	for ( int i = 0; i < m_nDataTables; ++i )
+	{
+		m_DataTableParents[i] = (short)pFlat->GetDataTable( i ).m_iParent;
+		m_DataTableOffsets[i] = pFlat->GetDataTable( i ).m_LocalOffset;
+	}
+
+	for ( int i = 0; i < m_nProps; ++i )
+	{
+		const SendFlatProp_t &flat = pFlat->GetProp( i );
+		AddSlot( flat.m_pProp, flat.m_LocalOffset, flat.m_iDataTable );
+	}
+
+	// Array element templates go after the props so prop indices and slots match
+	for ( int i = 0; i < m_nProps; ++i )
+	{
+		const SendFlatProp_t &flat = pFlat->GetProp( i );
+		if ( m_Types[i] == DPT_Array && flat.m_pArrayElementProp )
+		{
+			m_ArrayElements[i] = (unsigned short)AddSlot( flat.m_pArrayElementProp, 0, m_DataTables[i] );
+		}
+	}
+}
+
+
+int CSendTablePlan::AddSlot( const SendProp *pProp, int nOffset, int iDataTable )
+{
+	SendPlanLoad_t load = GetPropLoad( pProp );
+	if ( load == SENDPLAN_LOAD_PROXY )
+	{
+		++m_nCustomProxies;
+	}
+
+	if ( pProp->GetFlags() & SPROP_XYZE )
+	{
+		++m_nUnsupportedProps;
+	}
+
+	int nBits = ( pProp->GetType() == DPT_Array ) ? pProp->GetNumArrayLengthBits() : pProp->m_nBits;
+	Assert( nBits >= 0 && nBits <= 0xFF );
+
+	int iSlot = m_Offsets.AddToTail( nOffset );
+	m_DataTables.AddToTail( (short)( iDataTable < m_nDataTables ? iDataTable : SHRT_MAX ) );
+	m_Loads.AddToTail( (unsigned char)load );
+	m_Encodings.AddToTail( (unsigned char)GetPropEncoding( pProp ) );
+	m_Types.AddToTail( (unsigned char)pProp->GetType() );
+	m_Bits.AddToTail( (unsigned char)nBits );
+	m_ArrayElements.AddToTail( 0xFFFF );
+	m_Props.AddToTail( pProp );
+	return iSlot;
+}
+
+
+//-----------------------------------------------------------------------------
+// Datatables
+//-----------------------------------------------------------------------------
+void CSendTablePlan::SetupDataTables( const void *pStruct, int objectID, SendPlanDataTables_t *pTables ) const
+{
+	pTables->m_nValidMask = 0;
+
+	// Parents come before children, so each parent is already resolved
+	for ( int i = 0; i < m_nDataTables; ++i )
+	{
+		pTables->m_pData[i] = NULL;
+
+		int iParent = m_DataTableParents[i];
+		const void *pParentData = pStruct;
+		if ( iParent >= 0 )
+		{
+			if ( !( pTables->m_nValidMask & ( 1u << iParent ) ) )
+				continue;
+			pParentData = pTables->m_pData[iParent];
+		}
+
+		const SendProp *pProp = m_pFlat->GetDataTable( i ).m_pProp;
+		CSendProxyRecipients &recipients = pTables->m_Recipients[i];
+		recipients.SetAllRecipients();
+
+		const void *pData = pProp->GetDataTableProxyFn()( pProp, pParentData, (const unsigned char*)pParentData + m_DataTableOffsets[i], &recipients, objectID );
+		if ( !pData )
+			continue;
+
+		if ( iParent >= 0 )
+		{
+			recipients.m_Bits.And( pTables->m_Recipients[iParent].m_Bits, &recipients.m_Bits );
+		}
+
+		pTables->m_pData[i] = pData;
+		pTables->m_nValidMask |= ( 1u << i );
+	}
+}
+
+
+uint32 CSendTablePlan::GetRecipientMask( const SendPlanDataTables_t &tables, int iClient ) const
+{
+	uint32 nMask = 0;
+	for ( int i = 0; i < m_nDataTables; ++i )
+	{
+		if ( ( tables.m_nValidMask & ( 1u << i ) ) && tables.m_Recipients[i].m_Bits.IsBitSet( iClient ) )
+		{
+			nMask |= ( 1u << i );
+		}
+	}
+	return nMask;
+}
+
+
+inline const void *CSendTablePlan::GetStructBase( int iSlot, const void *pStruct, const SendPlanDataTables_t &tables ) const
+{
+	int iDataTable = m_DataTables[iSlot];
+	if ( iDataTable < 0 )
+		return pStruct;
+	if ( iDataTable >= m_nDataTables )
+		return NULL;
+	return tables.m_pData[iDataTable];
+}
+
+
+//-----------------------------------------------------------------------------
+// Compiled path
+//-----------------------------------------------------------------------------
+void CSendTablePlan::EncodeSlot( int iSlot, const void *pStructBase, const void *pData, int iElement, int objectID, bf_write *pOut ) const
+{
+	DVariant var;
+	switch ( m_Loads[iSlot] )
+	{
+	case SENDPLAN_LOAD_INT8:		var.m_Int = *(const char*)pData;					break;
+	case SENDPLAN_LOAD_INT16:		var.m_Int = *(const short*)pData;					break;
+	case SENDPLAN_LOAD_INT32:		var.m_Int = *(const int*)pData;						break;
+	case SENDPLAN_LOAD_UINT8:		var.m_Int = *(const unsigned char*)pData;			break;
+	case SENDPLAN_LOAD_UINT16:		var.m_Int = *(const unsigned short*)pData;			break;
+	case SENDPLAN_LOAD_UINT32:		var.m_Int = (int)*(const unsigned int*)pData;		break;
+	case SENDPLAN_LOAD_FLOAT:		var.m_Float = *(const float*)pData;					break;
+	case SENDPLAN_LOAD_ANGLE:		var.m_Float = anglemod( *(const float*)pData );		break;
+	case SENDPLAN_LOAD_STRING:		var.m_pString = (const char*)pData;					break;
+
+	case SENDPLAN_LOAD_VECTOR:
+	case SENDPLAN_LOAD_VECTORXY:
+		{
+			const float *v = (const float*)pData;
+			var.m_Vector[0] = v[0];
+			var.m_Vector[1] = v[1];
+			var.m_Vector[2] = ( m_Loads[iSlot] == SENDPLAN_LOAD_VECTOR ) ? v[2] : 0.0f;
+		}
+		break;
+
+	case SENDPLAN_LOAD_QANGLES:
+		{
+			const float *v = (const float*)pData;
+			var.m_Vector[0] = anglemod( v[0] );
+			var.m_Vector[1] = anglemod( v[1] );
+			var.m_Vector[2] = anglemod( v[2] );
+		}
+		break;
+
+	default:
+		{
+			const SendProp *pProp = m_Props[iSlot];
+			pProp->GetProxyFn()( pProp, pStructBase, pData, &var, iElement, objectID );
+		}
+		break;
+	}
+
+	EncodeValue( m_Types[iSlot], m_Encodings[iSlot], m_Bits[iSlot], m_Props[iSlot], var, pOut );
+}
+
+
+void CSendTablePlan::EncodeArray( int iSlot, const void *pStructBase, const void *pData, int objectID, bf_write *pOut ) const
+{
+	const SendProp *pArrayProp = m_Props[iSlot];
+	int nElements = GetArrayLength( pArrayProp, pStructBase, objectID );
+	pOut->WriteUBitLong( nElements, m_Bits[iSlot] );
+
+	int iElementSlot = m_ArrayElements[iSlot];
+	if ( iElementSlot == 0xFFFF )
+		return;
+
+	int nStride = pArrayProp->GetElementStride();
+	for ( int iElement = 0; iElement < nElements; ++iElement )
+	{
+		EncodeSlot( iElementSlot, pStructBase, (const unsigned char*)pData + iElement * nStride, iElement, objectID, pOut );
+	}
+}
+
+
+int CSendTablePlan::Encode( const void *pStruct, int objectID, const SendPlanDataTables_t &tables, uint32 nDataTableMask,
+	const CVarBitVec *pProps, bf_write *pOut ) const
+{
+	nDataTableMask &= tables.m_nValidMask;
+
+	int nWritten = 0;
+	int iLastProp = -1;
+	for ( int i = 0; i < m_nProps; ++i )
+	{
+		if ( pProps && !pProps->IsBitSet( i ) )
+			continue;
+
+		int iDataTable = m_DataTables[i];
+		if ( iDataTable >= 0 && ( iDataTable >= m_nDataTables || !( nDataTableMask & ( 1u << iDataTable ) ) ) )
+			continue;
+
+		const void *pStructBase = GetStructBase( i, pStruct, tables );
+		const void *pData = (const unsigned char*)pStructBase + m_Offsets[i];
+
+		pOut->WriteOneBit( 1 );
+		pOut->WriteUBitVar( i - iLastProp - 1 );
+		iLastProp = i;
+
+		if ( m_Loads[i] == SENDPLAN_LOAD_ARRAY )
+		{
+			EncodeArray( i, pStructBase, pData, objectID, pOut );
+		}
+		else
+		{
+			EncodeSlot( i, pStructBase, pData, 0, objectID, pOut );
+		}
+		++nWritten;
+	}
+
+	pOut->WriteOneBit( 0 );
+	return nWritten;
+}
+
+
+//-----------------------------------------------------------------------------
+// Cache of compiled plans, built on first use
+//-----------------------------------------------------------------------------
+static CUtlMap<SendTable*, CSendTablePlan*> s_Plans( DefLessFunc( SendTable* ) );
+
+CSendTablePlan *SendTable_GetPlan( SendTable *pTable )
+{
+	unsigned short i = s_Plans.Find( pTable );
+	if ( i != s_Plans.InvalidIndex() )
+		return s_Plans[i];
+
+	CSendTablePlan *pPlan = new CSendTablePlan( SendTable_GetFlat( pTable ) );
+	s_Plans.Insert( pTable, pPlan );
+	return pPlan;
+}
@@ -0,0 +1,136 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Precompiled encode plans for flattened SendTables. A plan stores
+//			each prop as a few bytes in parallel arrays so the encoder can
+//			walk them without chasing SendProp pointers, and reads the
+//			standard proxies (ints, floats, vectors, strings) inline. Only
+//			custom proxies are still called through their function pointer.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef DT_SEND_PLAN_H
+#define DT_SEND_PLAN_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "dt_send_flat.h"
+#include "bitvec.h"
+
+class bf_write;
+
+
+// How a plan slot gets its value from the object.
+enum SendPlanLoad_t
+{
+	SENDPLAN_LOAD_PROXY = 0,		// Call the SendProp's proxy
+	SENDPLAN_LOAD_INT8,
+	SENDPLAN_LOAD_INT16,
+	SENDPLAN_LOAD_INT32,
+	SENDPLAN_LOAD_UINT8,
+	SENDPLAN_LOAD_UINT16,
+	SENDPLAN_LOAD_UINT32,
+	SENDPLAN_LOAD_FLOAT,
+	SENDPLAN_LOAD_ANGLE,
+	SENDPLAN_LOAD_VECTOR,
+	SENDPLAN_LOAD_QANGLES,
+	SENDPLAN_LOAD_VECTORXY,
+	SENDPLAN_LOAD_STRING,
+	SENDPLAN_LOAD_ARRAY,			// Elements are loaded by the slot's element template
+};
+
+// How a plan slot writes its value.
+enum SendPlanEncoding_t
+{
+	SENDPLAN_ENCODE_INT = 0,
+	SENDPLAN_ENCODE_UINT,
+	SENDPLAN_ENCODE_VARINT,
+	SENDPLAN_ENCODE_UVARINT,
+	SENDPLAN_ENCODE_FLOAT,			// Quantized into [m_fLowValue, m_fHighValue]
+	SENDPLAN_ENCODE_FLOAT_COORD,
+	SENDPLAN_ENCODE_FLOAT_COORD_MP,
+	SENDPLAN_ENCODE_FLOAT_NOSCALE,
+	SENDPLAN_ENCODE_FLOAT_NORMAL,
+	SENDPLAN_ENCODE_STRING,
+	SENDPLAN_ENCODE_ARRAY,
+};
+
+
+// ------------------------------------------------------------------------ //
+// Results of running an object's datatable proxies: where each proxied
+// datatable's data lives and which clients may see it.
+// ------------------------------------------------------------------------ //
+struct SendPlanDataTables_t
+{
+	const void				*m_pData[MAX_DATATABLE_PROXIES];
+	CSendProxyRecipients	m_Recipients[MAX_DATATABLE_PROXIES];
+
+	// Bit n is set if datatable n returned data
+	uint32					m_nValidMask;
+};
+
+
+class CSendTablePlan
+{
+public:
+	CSendTablePlan( CSendTableFlat *pFlat );
+
+	CSendTableFlat*			GetFlat() const					{ return m_pFlat; }
+	int						GetNumProps() const				{ return m_nProps; }
+	int						GetNumDataTables() const		{ return m_nDataTables; }
+
+	// False if the table has props the plan can't write the way the engine
+	// does (SPROP_XYZE vectors). Such tables must go through the engine.
+	bool					CanEncode() const				{ return m_nUnsupportedProps == 0; }
+
+	// True if the plan calls no SendVarProxyFn at all.
+	bool					IsFullyInlined() const			{ return m_nCustomProxies == 0; }
+	int						GetNumCustomProxies() const		{ return m_nCustomProxies; }
+
+	// Runs the datatable proxies for one object.
+	void					SetupDataTables( const void *pStruct, int objectID, SendPlanDataTables_t *pTables ) const;
+
+	// Mask of the datatables iClient receives (a subset of pTables->m_nValidMask).
+	uint32					GetRecipientMask( const SendPlanDataTables_t &tables, int iClient ) const;
+
+	// Writes the props of one object. Props under a datatable that isn't in
+	// nDataTableMask are skipped, and if pProps is given only the props it has
+	// set are written. Returns the number of props written.
+	int						Encode( const void *pStruct, int objectID, const SendPlanDataTables_t &tables, uint32 nDataTableMask,
+								const CVarBitVec *pProps, bf_write *pOut ) const;
+
+private:
+	int						AddSlot( const SendProp *pProp, int nOffset, int iDataTable );
+	void					EncodeSlot( int iSlot, const void *pStructBase, const void *pData, int iElement, int objectID, bf_write *pOut ) const;
+	void					EncodeArray( int iSlot, const void *pStructBase, const void *pData, int objectID, bf_write *pOut ) const;
+	const void*				GetStructBase( int iSlot, const void *pStruct, const SendPlanDataTables_t &tables ) const;
+
+	CSendTableFlat			*m_pFlat;
+	int						m_nProps;
+	int						m_nDataTables;
+	int						m_nCustomProxies;
+	int						m_nUnsupportedProps;
+
+	// One slot per flattened prop, followed by one slot per array element template.
+	CUtlVector<int>				m_Offsets;			// From the base of the slot's datatable
+	CUtlVector<short>			m_DataTables;		// -1 for the outermost struct
+	CUtlVector<unsigned char>	m_Loads;			// SendPlanLoad_t
+	CUtlVector<unsigned char>	m_Encodings;		// SendPlanEncoding_t
+	CUtlVector<unsigned char>	m_Types;			// SendPropType
+	CUtlVector<unsigned char>	m_Bits;				// Value bits, or length bits for arrays
+	CUtlVector<unsigned short>	m_ArrayElements;	// DPT_Array only: slot of the element template
+	CUtlVector<const SendProp*>	m_Props;			// Ranges and custom proxies
+
+	// Parents of each datatable (see SendFlatDataTable_t)
+	CUtlVector<short>			m_DataTableParents;
+	CUtlVector<int>				m_DataTableOffsets;
+};
+
+
+// Returns the (lazily compiled, cached) encode plan for a SendTable.
+CSendTablePlan *SendTable_GetPlan( SendTable *pTable );
+
+
+#endif // DT_SEND_PLAN_H
@@ -26,15 +26,27 @@ ConVar cl_jiggle_bone_debug_pitch_constraints( "cl_jiggle_bone_debug_pitch_const
 ConVar cl_jiggle_bone_framerate_cutoff( "cl_jiggle_bone_framerate_cutoff", "20", 0, "Skip jiggle bone simulation if framerate drops below this value (frames/second)" );
 
 
+//-----------------------------------------------------------------------------
+CJiggleBones::CJiggleBones( void )
+{
+	m_updateInterval = 0.0f;
+}
+
+
 //-----------------------------------------------------------------------------
 JiggleData * CJiggleBones::GetJiggleData( int bone, float currenttime, const Vector &initBasePos, const Vector &initTipPos )
 {
-	FOR_EACH_LL( m_jiggleBoneState, it )
+	if ( bone < 0 || bone >= MAXSTUDIOBONES )
+		return NULL;
+
+	if ( bone < m_jiggleBoneIndex.Count() && m_jiggleBoneIndex[ bone ] >= 0 )
 	{
-		if ( m_jiggleBoneState[it].bone == bone )
-		{
-			return &m_jiggleBoneState[it];
-		}
+		return &m_jiggleBoneState[ m_jiggleBoneIndex[ bone ] ];
+	}
+
+	while ( m_jiggleBoneIndex.Count() <= bone )
+	{
+		m_jiggleBoneIndex.AddToTail( -1 );
 	}
 
 	JiggleData data;
@@ -44,9 +56,8 @@ JiggleData * CJiggleBones::GetJiggleData( int bone, float currenttime, const Vec
 	data.useGoalMatrixCount = 0;
 	data.useJiggleBoneCount = 16;
 
-	int idx = m_jiggleBoneState.AddToHead( data );
-	if ( idx == m_jiggleBoneState.InvalidIndex() )
-		return NULL;
+	int idx = m_jiggleBoneState.AddToTail( data );
+	m_jiggleBoneIndex[ bone ] = idx;
 
 	return &m_jiggleBoneState[idx];
 }
@@ -59,6 +70,13 @@ JiggleData * CJiggleBones::GetJiggleData( int bone, float currenttime, const Vec
  */
 void CJiggleBones::BuildJiggleTransformations( int boneIndex, float currenttime, const mstudiojigglebone_t *jiggleInfo, const matrix3x4_t &goalMX, matrix3x4_t &boneMX, bool coordSystemIsFlipped )
 {
+	if ( m_updateInterval < 0.0f )
+	{
+		// too far away to be worth simulating - just use goal matrix
+		boneMX = goalMX;
+		return;
+	}
+
 	Vector goalBasePosition;
 	MatrixPosition( goalMX, goalBasePosition );
 
@@ -90,6 +108,13 @@ void CJiggleBones::BuildJiggleTransformations( int boneIndex, float currenttime,
 		data->lastLeft = goalLeft;
 	}
 
+	// not due for an update yet - hold the bone where it was relative to its goal
+	if ( data->hasHoldMX && currenttime - data->lastUpdate < m_updateInterval )
+	{
+		ConcatTransforms( goalMX, data->holdMX, boneMX );
+		return;
+	}
+
 	// limit maximum deltaT to avoid simulation blowups
 	// if framerate is too low, skip jigglebones altogether, since movement will be too
 	// large between frames to simulate with a simple Euler integration
@@ -762,6 +787,15 @@ void CJiggleBones::BuildJiggleTransformations( int boneIndex, float currenttime,
 		boneMX = goalMX;
 	}
 
+	// keep the result relative to the goal for the frames until the next update
+	data->hasHoldMX = ( m_updateInterval > 0.0f );
+	if ( data->hasHoldMX )
+	{
+		matrix3x4_t invGoalMX;
+		MatrixInvert( goalMX, invGoalMX );
+		ConcatTransforms( invGoalMX, boneMX, data->holdMX );
+	}
+
 #ifdef CLIENT_DLL
 	// debug display for client only so server doesn't try to also draw it
 	if ( cl_jiggle_bone_debug.GetBool() )
@@ -44,6 +44,8 @@ struct JiggleData
 		boingVelDir.Init();
 		boingSpeed = 0.0f;
 		boingTime = 0.0f;
+
+		hasHoldMX = false;
 	}
 
 	int bone;
@@ -68,15 +70,31 @@ struct JiggleData
 	
 	int useGoalMatrixCount;	// Count of times we need to fast draw using goal matrix.
 	int useJiggleBoneCount; // Count of times we need to draw using real jiggly bones.
+
+	matrix3x4_t holdMX;		// bone relative to its goal at the last update, for the frames in between
+	bool hasHoldMX;
 };
 
 class CJiggleBones
 {
 public:
+	CJiggleBones( void );
+
 	JiggleData * GetJiggleData( int bone, float currenttime, const Vector &initBasePos, const Vector &initTipPos );
 	void BuildJiggleTransformations( int boneIndex, float currentime, const mstudiojigglebone_t *jiggleParams, const matrix3x4_t &goalMX, matrix3x4_t &boneMX, bool coordSystemIsFlipped = false );
 
-	CUtlLinkedList< JiggleData >	m_jiggleBoneState;
+	/**
+	 * Simulate the jiggle bones at most once every 'interval' seconds, and hold them where they
+	 * were relative to their goal in between. A negative interval doesn't simulate at all and
+	 * uses the goal matrix, zero simulates every frame.
+	 */
+	void SetUpdateInterval( float interval )	{ m_updateInterval = interval; }
+
+	CUtlVector< JiggleData >	m_jiggleBoneState;
+	CUtlVector< short >			m_jiggleBoneIndex;	// index into m_jiggleBoneState of each bone, or -1
+
+private:
+	float m_updateInterval;
 };
 
 
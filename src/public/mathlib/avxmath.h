@@ -0,0 +1,440 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: - defines fltx8, eight packed floats in an AVX register, and
+//			  EightVectors, the 8-wide companions of fltx4 and FourVectors.
+//
+//	The rest of the code is built for SSE2, so:
+//	- only call 8-wide code when MathLib_AVX2Enabled() returns true
+//	- declare every function that uses fltx8 with AVX2_TARGET, or gcc and
+//	  clang won't emit the instructions (and won't inline these into it)
+//	- never make a global or static fltx8, since it would be initialized
+//	  on processors without AVX
+//
+//	The operations overload the fltx4 ones where the arguments tell them
+//	apart (AddSIMD, CmpGtSIMD, MaskedAssign, ...), and have an 8 in their
+//	name where they don't (ReplicateX8, LoadAlignedSIMD8, ...).
+//	The code is built for AVX2 without FMA, so MaddSIMD() and MsubSIMD()
+//	round twice just like the fltx4 ones, and the compiler can't fuse them.
+//	The 8 wide array functions then give the same bits as the 4 wide ones
+//	on every processor.
+//
+//===========================================================================//
+#ifndef AVXMATH_H
+#define AVXMATH_H
+
+#include "mathlib/ssemath.h"
+
+#if !defined( _X360 ) && !defined( _PS3 ) && ( USE_STDC_FOR_SIMD == 0 )
+#define MATHLIB_AVX2 1
+#endif
+
+#ifdef MATHLIB_AVX2
+
+#include <immintrin.h>
+
+#ifdef COMPILER_MSVC
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__(( target( "avx2" ) ))
+#endif
+
+#define FORCEINLINE_AVX2 FORCEINLINE AVX2_TARGET
+
+typedef __m256 fltx8;
+typedef __m256 bi32x8;
+typedef __m256i i32x8;
+
+typedef union
+{
+	fltx8	m256;
+	float	m256_f32[8];
+	uint32	m256_u32[8];
+} fltx8_union;
+
+//---------------------------------------------------------------------
+// Loads, stores and lanes
+//---------------------------------------------------------------------
+
+FORCEINLINE_AVX2 fltx8 LoadAlignedSIMD8( const float *pSIMD )					// 32 byte aligned
+{
+	return _mm256_load_ps( pSIMD );
+}
+
+FORCEINLINE_AVX2 fltx8 LoadUnalignedSIMD8( const float *pSIMD )
+{
+	return _mm256_loadu_ps( pSIMD );
+}
+
+FORCEINLINE_AVX2 fltx8 LoadUnalignedSIMD8( const uint32 *pSIMD )				// masks
+{
+	return _mm256_castsi256_ps( _mm256_loadu_si256( (const __m256i *)pSIMD ) );
+}
+
+FORCEINLINE_AVX2 void StoreAlignedSIMD( float *pSIMD, const fltx8 &a )
+{
+	_mm256_store_ps( pSIMD, a );
+}
+
+FORCEINLINE_AVX2 void StoreUnalignedSIMD( float *pSIMD, const fltx8 &a )
+{
+	_mm256_storeu_ps( pSIMD, a );
+}
+
+FORCEINLINE_AVX2 fltx8 ReplicateX8( float flValue )
+{
+	return _mm256_set1_ps( flValue );
+}
+
+FORCEINLINE_AVX2 fltx8 Eight_Zeros( void )
+{
+	return _mm256_setzero_ps();
+}
+
+// lanes 0-3 from lo, 4-7 from hi
+FORCEINLINE_AVX2 fltx8 CombineSIMD8( const fltx4 &lo, const fltx4 &hi )
+{
+	return _mm256_insertf128_ps( _mm256_castps128_ps256( lo ), hi, 1 );
+}
+
+FORCEINLINE_AVX2 fltx4 LowerSIMD8( const fltx8 &a )
+{
+	return _mm256_castps256_ps128( a );
+}
+
+FORCEINLINE_AVX2 fltx4 UpperSIMD8( const fltx8 &a )
+{
+	return _mm256_extractf128_ps( a, 1 );
+}
+
+FORCEINLINE float SubFloat( const fltx8 &a, int idx )
+{
+	return ( (const fltx8_union &)a ).m256_f32[idx];
+}
+
+FORCEINLINE float &SubFloat( fltx8 &a, int idx )
+{
+	return ( (fltx8_union &)a ).m256_f32[idx];
+}
+
+FORCEINLINE uint32 SubInt( const fltx8 &a, int idx )
+{
+	return ( (const fltx8_union &)a ).m256_u32[idx];
+}
+
+//---------------------------------------------------------------------
+// Arithmetic
+//---------------------------------------------------------------------
+
+FORCEINLINE_AVX2 fltx8 AddSIMD( const fltx8 &a, const fltx8 &b )				// a+b
+{
+	return _mm256_add_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 SubSIMD( const fltx8 &a, const fltx8 &b )				// a-b
+{
+	return _mm256_sub_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 MulSIMD( const fltx8 &a, const fltx8 &b )				// a*b
+{
+	return _mm256_mul_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 DivSIMD( const fltx8 &a, const fltx8 &b )				// a/b
+{
+	return _mm256_div_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 MaddSIMD( const fltx8 &a, const fltx8 &b, const fltx8 &c )	// a*b + c
+{
+	return _mm256_add_ps( _mm256_mul_ps( a, b ), c );
+}
+
+FORCEINLINE_AVX2 fltx8 MsubSIMD( const fltx8 &a, const fltx8 &b, const fltx8 &c )	// c - a*b
+{
+	return _mm256_sub_ps( c, _mm256_mul_ps( a, b ) );
+}
+
+FORCEINLINE_AVX2 fltx8 MinSIMD( const fltx8 &a, const fltx8 &b )				// min(a,b)
+{
+	return _mm256_min_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 MaxSIMD( const fltx8 &a, const fltx8 &b )				// max(a,b)
+{
+	return _mm256_max_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 SqrtSIMD( const fltx8 &a )								// sqrt(a)
+{
+	return _mm256_sqrt_ps( a );
+}
+
+FORCEINLINE_AVX2 fltx8 ReciprocalSqrtEstSIMD( const fltx8 &a )					// 1/sqrt(a), more or less
+{
+	return _mm256_rsqrt_ps( a );
+}
+
+FORCEINLINE_AVX2 fltx8 ReciprocalSqrtSIMD( const fltx8 &a )					// 1/sqrt(a), one Newton-Raphson step
+{
+	fltx8 guess = _mm256_rsqrt_ps( a );
+	fltx8 t = _mm256_mul_ps( _mm256_mul_ps( guess, guess ), a );
+	t = _mm256_sub_ps( _mm256_set1_ps( 3.0f ), t );
+	return _mm256_mul_ps( _mm256_mul_ps( guess, _mm256_set1_ps( 0.5f ) ), t );
+}
+
+FORCEINLINE_AVX2 fltx8 ReciprocalSIMD( const fltx8 &a )						// 1/a, one Newton-Raphson step
+{
+	fltx8 guess = _mm256_rcp_ps( a );
+	return _mm256_mul_ps( guess, MsubSIMD( a, guess, _mm256_set1_ps( 2.0f ) ) );
+}
+
+FORCEINLINE_AVX2 fltx8 NegSIMD( const fltx8 &a )								// negate: -a
+{
+	return _mm256_xor_ps( a, _mm256_set1_ps( -0.0f ) );
+}
+
+FORCEINLINE_AVX2 fltx8 fabs( const fltx8 &a )									// |a|
+{
+	return _mm256_andnot_ps( _mm256_set1_ps( -0.0f ), a );
+}
+
+FORCEINLINE_AVX2 fltx8 FloorSIMD( const fltx8 &a )
+{
+	return _mm256_floor_ps( a );
+}
+
+//---------------------------------------------------------------------
+// Masks and comparisons. A mask lane is all ones where the test is true.
+//---------------------------------------------------------------------
+
+FORCEINLINE_AVX2 fltx8 AndSIMD( const fltx8 &a, const fltx8 &b )				// a & b
+{
+	return _mm256_and_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 AndNotSIMD( const fltx8 &a, const fltx8 &b )			// ~a & b
+{
+	return _mm256_andnot_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 OrSIMD( const fltx8 &a, const fltx8 &b )				// a | b
+{
+	return _mm256_or_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 XorSIMD( const fltx8 &a, const fltx8 &b )				// a ^ b
+{
+	return _mm256_xor_ps( a, b );
+}
+
+FORCEINLINE_AVX2 fltx8 CmpEqSIMD( const fltx8 &a, const fltx8 &b )				// (a==b) ? ~0:0
+{
+	return _mm256_cmp_ps( a, b, _CMP_EQ_OQ );
+}
+
+FORCEINLINE_AVX2 fltx8 CmpGtSIMD( const fltx8 &a, const fltx8 &b )				// (a>b) ? ~0:0
+{
+	return _mm256_cmp_ps( a, b, _CMP_GT_OQ );
+}
+
+FORCEINLINE_AVX2 fltx8 CmpGeSIMD( const fltx8 &a, const fltx8 &b )				// (a>=b) ? ~0:0
+{
+	return _mm256_cmp_ps( a, b, _CMP_GE_OQ );
+}
+
+FORCEINLINE_AVX2 fltx8 CmpLtSIMD( const fltx8 &a, const fltx8 &b )				// (a<b) ? ~0:0
+{
+	return _mm256_cmp_ps( a, b, _CMP_LT_OQ );
+}
+
+FORCEINLINE_AVX2 fltx8 CmpLeSIMD( const fltx8 &a, const fltx8 &b )				// (a<=b) ? ~0:0
+{
+	return _mm256_cmp_ps( a, b, _CMP_LE_OQ );
+}
+
+FORCEINLINE_AVX2 fltx8 MaskedAssign( const fltx8 &ReplacementMask, const fltx8 &NewValue, const fltx8 &OldValue )
+{
+	return _mm256_blendv_ps( OldValue, NewValue, ReplacementMask );
+}
+
+// bit n is the sign of lane n
+FORCEINLINE_AVX2 int TestSignSIMD( const fltx8 &a )
+{
+	return _mm256_movemask_ps( a );
+}
+
+FORCEINLINE_AVX2 bool IsAnyNegative( const fltx8 &a )
+{
+	return _mm256_movemask_ps( a ) != 0;
+}
+
+//---------------------------------------------------------------------
+// Transcendentals
+//---------------------------------------------------------------------
+
+// sine and cosine, to a couple of ulp for |radians| up to a few thousand
+FORCEINLINE_AVX2 void SinCosSIMD( fltx8 &sine, fltx8 &cosine, const fltx8 &radians )
+{
+	fltx8 x = fabs( radians );
+
+	// the octant, rounded up to even, and the angle from it in [-pi/4,pi/4]
+	__m256i j = _mm256_cvttps_epi32( _mm256_mul_ps( x, _mm256_set1_ps( 1.27323954473516f ) ) );		// 4/pi
+	j = _mm256_and_si256( _mm256_add_epi32( j, _mm256_set1_epi32( 1 ) ), _mm256_set1_epi32( ~1 ) );
+	fltx8 y = _mm256_cvtepi32_ps( j );
+
+	x = MsubSIMD( y, _mm256_set1_ps( 0.78515625f ), x );
+	x = MsubSIMD( y, _mm256_set1_ps( 2.4187564849853515625e-4f ), x );
+	x = MsubSIMD( y, _mm256_set1_ps( 3.77489497744594108e-8f ), x );
+	fltx8 z = _mm256_mul_ps( x, x );
+
+	// the cosine and sine polynomials on [-pi/4,pi/4]
+	fltx8 c = _mm256_set1_ps( 2.443315711809948e-5f );
+	c = MaddSIMD( c, z, _mm256_set1_ps( -1.388731625493765e-3f ) );
+	c = MaddSIMD( c, z, _mm256_set1_ps( 4.166664568298827e-2f ) );
+	c = _mm256_mul_ps( _mm256_mul_ps( c, z ), z );
+	c = MsubSIMD( z, _mm256_set1_ps( 0.5f ), c );
+	c = _mm256_add_ps( c, _mm256_set1_ps( 1.0f ) );
+
+	fltx8 s = _mm256_set1_ps( -1.9515295891e-4f );
+	s = MaddSIMD( s, z, _mm256_set1_ps( 8.3321608736e-3f ) );
+	s = MaddSIMD( s, z, _mm256_set1_ps( -1.6666654611e-1f ) );
+	s = MaddSIMD( _mm256_mul_ps( s, z ), x, x );
+
+	// octants 2, 3, 6 and 7 swap the polynomials
+	fltx8 swap = _mm256_castsi256_ps( _mm256_cmpeq_epi32( _mm256_and_si256( j, _mm256_set1_epi32( 2 ) ), _mm256_set1_epi32( 2 ) ) );
+	fltx8 sinPoly = _mm256_blendv_ps( s, c, swap );
+	fltx8 cosPoly = _mm256_blendv_ps( c, s, swap );
+
+	// the sine flips in octants 4-7 and for negative angles, the cosine in octants 2-5
+	fltx8 signBit = _mm256_set1_ps( -0.0f );
+	fltx8 sinSign = _mm256_castsi256_ps( _mm256_slli_epi32( _mm256_and_si256( j, _mm256_set1_epi32( 4 ) ), 29 ) );
+	sinSign = _mm256_xor_ps( sinSign, _mm256_and_ps( radians, signBit ) );
+	fltx8 cosSign = _mm256_castsi256_ps( _mm256_slli_epi32( _mm256_andnot_si256( _mm256_sub_epi32( j, _mm256_set1_epi32( 2 ) ), _mm256_set1_epi32( 4 ) ), 29 ) );
+
+	sine = _mm256_xor_ps( sinPoly, sinSign );
+	cosine = _mm256_xor_ps( cosPoly, cosSign );
+}
+
+//---------------------------------------------------------------------
+// EightVectors holds 8 independent vectors in structure of arrays form,
+// like FourVectors.
+//---------------------------------------------------------------------
+class ALIGN32 EightVectors
+{
+public:
+	fltx8 x, y, z;
+
+	EightVectors() = default;
+
+	FORCEINLINE_AVX2 void operator+=( const EightVectors &b )
+	{
+		x = AddSIMD( x, b.x );
+		y = AddSIMD( y, b.y );
+		z = AddSIMD( z, b.z );
+	}
+
+	FORCEINLINE_AVX2 void operator-=( const EightVectors &b )
+	{
+		x = SubSIMD( x, b.x );
+		y = SubSIMD( y, b.y );
+		z = SubSIMD( z, b.z );
+	}
+
+	FORCEINLINE_AVX2 void operator*=( const EightVectors &b )						// per component scale
+	{
+		x = MulSIMD( x, b.x );
+		y = MulSIMD( y, b.y );
+		z = MulSIMD( z, b.z );
+	}
+
+	FORCEINLINE_AVX2 void operator*=( const fltx8 &scale )
+	{
+		x = MulSIMD( x, scale );
+		y = MulSIMD( y, scale );
+		z = MulSIMD( z, scale );
+	}
+
+	FORCEINLINE_AVX2 void operator*=( float scale )
+	{
+		*this *= ReplicateX8( scale );
+	}
+
+	FORCEINLINE_AVX2 fltx8 operator*( const EightVectors &b ) const				// 8 dot products
+	{
+		return MaddSIMD( z, b.z, MaddSIMD( y, b.y, MulSIMD( x, b.x ) ) );
+	}
+
+	FORCEINLINE_AVX2 fltx8 length2( void ) const									// squared lengths
+	{
+		return (*this) * (*this);
+	}
+
+	FORCEINLINE_AVX2 fltx8 length( void ) const
+	{
+		return SqrtSIMD( length2() );
+	}
+
+	FORCEINLINE_AVX2 void VectorNormalize( void )									// zero length stays zero
+	{
+		fltx8 mag_sq = length2();
+		fltx8 nonZero = CmpGtSIMD( mag_sq, Eight_Zeros() );
+		*this *= AndSIMD( nonZero, ReciprocalSqrtSIMD( mag_sq ) );
+	}
+
+	FORCEINLINE_AVX2 void DuplicateVector( const Vector &v )
+	{
+		x = ReplicateX8( v.x );
+		y = ReplicateX8( v.y );
+		z = ReplicateX8( v.z );
+	}
+
+	// lanes 0-3 from a, 4-7 from b
+	FORCEINLINE_AVX2 void LoadFourVectors( const FourVectors &a, const FourVectors &b )
+	{
+		x = CombineSIMD8( a.x, b.x );
+		y = CombineSIMD8( a.y, b.y );
+		z = CombineSIMD8( a.z, b.z );
+	}
+
+	FORCEINLINE_AVX2 void StoreFourVectors( FourVectors &a, FourVectors &b ) const
+	{
+		a.x = LowerSIMD8( x );	b.x = UpperSIMD8( x );
+		a.y = LowerSIMD8( y );	b.y = UpperSIMD8( y );
+		a.z = LowerSIMD8( z );	b.z = UpperSIMD8( z );
+	}
+
+	FORCEINLINE Vector Vec( int idx ) const
+	{
+		return Vector( SubFloat( x, idx ), SubFloat( y, idx ), SubFloat( z, idx ) );
+	}
+} ALIGN32_POST;
+
+FORCEINLINE_AVX2 EightVectors CrossProduct( const EightVectors &a, const EightVectors &b )
+{
+	EightVectors result;
+	result.x = MsubSIMD( a.z, b.y, MulSIMD( a.y, b.z ) );
+	result.y = MsubSIMD( a.x, b.z, MulSIMD( a.z, b.x ) );
+	result.z = MsubSIMD( a.y, b.x, MulSIMD( a.x, b.y ) );
+	return result;
+}
+
+//---------------------------------------------------------------------
+// Kernels in mathlib/avxmath.cpp, called by the 4-wide code
+//---------------------------------------------------------------------
+
+// these do pairs of FourVectors, and return how many they did
+int FourVectors_RotateManyBy_AVX2( FourVectors * RESTRICT pVectors, unsigned int numVectors, const matrix3x4_t &rotationMatrix );
+int FourVectors_TransformManyBy_AVX2( const FourVectors *pVectors, unsigned int numVectors, const matrix3x4_t &rotationMatrix, FourVectors *pOut );	// pOut may be pVectors
+
+// dst += src, and dst *= (sx,sy,sz) over whole arrays of FourVectors
+void FourVectors_AddArrays_AVX2( FourVectors * RESTRICT pDest, const FourVectors * RESTRICT pSrc, int numVectors );
+void FourVectors_ScaleArray_AVX2( FourVectors * RESTRICT pDest, const Vector &scale, int numVectors );
+
+#endif // MATHLIB_AVX2
+
+// Time the scalar, 4-wide and 8-wide versions of the mathlib kernels, and Msg() the results.
+// The "[benchmark]" case in tests/test_mathlib_simd.cpp runs it.
+void MathLib_RunSIMDBenchmarks( int nIterations );
+
+#endif // AVXMATH_H
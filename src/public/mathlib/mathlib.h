@@ -1755,6 +1755,7 @@ bool MathLib_3DNowEnabled( void );
 bool MathLib_MMXEnabled( void );
 bool MathLib_SSEEnabled( void );
 bool MathLib_SSE2Enabled( void );
+bool MathLib_AVX2Enabled( void );		// fltx8 code in mathlib/avxmath.h can run
 
 float Approach( float target, float value, float speed );
 float ApproachAngle( float target, float value, float speed );
@@ -2036,67 +2036,6 @@ FORCEINLINE fltx4 Dot4SIMD( const fltx4 &a, const fltx4 &b )
 	return ReplicateX4( flDot );
 }
 
-//TODO: implement as four-way Taylor series (see xbox implementation)
-FORCEINLINE fltx4 SinSIMD( const fltx4 &radians )
-{
-	fltx4 result;
-	SubFloat( result, 0 ) = sin( SubFloat( radians, 0 ) );
-	SubFloat( result, 1 ) = sin( SubFloat( radians, 1 ) );
-	SubFloat( result, 2 ) = sin( SubFloat( radians, 2 ) );
-	SubFloat( result, 3 ) = sin( SubFloat( radians, 3 ) );
-	return result;
-}
-
-FORCEINLINE void SinCos3SIMD( fltx4 &sine, fltx4 &cosine, const fltx4 &radians )
-{
-	// FIXME: Make a fast SSE version
-	SinCos( SubFloat( radians, 0 ), &SubFloat( sine, 0 ), &SubFloat( cosine, 0 ) );
-	SinCos( SubFloat( radians, 1 ), &SubFloat( sine, 1 ), &SubFloat( cosine, 1 ) );
-	SinCos( SubFloat( radians, 2 ), &SubFloat( sine, 2 ), &SubFloat( cosine, 2 ) );
-}
-
-FORCEINLINE void SinCosSIMD( fltx4 &sine, fltx4 &cosine, const fltx4 &radians )				// a*b + c
-{
-	// FIXME: Make a fast SSE version
-	SinCos( SubFloat( radians, 0 ), &SubFloat( sine, 0 ), &SubFloat( cosine, 0 ) );
-	SinCos( SubFloat( radians, 1 ), &SubFloat( sine, 1 ), &SubFloat( cosine, 1 ) );
-	SinCos( SubFloat( radians, 2 ), &SubFloat( sine, 2 ), &SubFloat( cosine, 2 ) );
-	SinCos( SubFloat( radians, 3 ), &SubFloat( sine, 3 ), &SubFloat( cosine, 3 ) );
-}
-
-//TODO: implement as four-way Taylor series (see xbox implementation)
-FORCEINLINE fltx4 ArcSinSIMD( const fltx4 &sine )
-{
-	// FIXME: Make a fast SSE version
-	fltx4 result;
-	SubFloat( result, 0 ) = asin( SubFloat( sine, 0 ) );
-	SubFloat( result, 1 ) = asin( SubFloat( sine, 1 ) );
-	SubFloat( result, 2 ) = asin( SubFloat( sine, 2 ) );
-	SubFloat( result, 3 ) = asin( SubFloat( sine, 3 ) );
-	return result;
-}
-
-FORCEINLINE fltx4 ArcCosSIMD( const fltx4 &cs )
-{
-	fltx4 result;
-	SubFloat( result, 0 ) = acos( SubFloat( cs, 0 ) );
-	SubFloat( result, 1 ) = acos( SubFloat( cs, 1 ) );
-	SubFloat( result, 2 ) = acos( SubFloat( cs, 2 ) );
-	SubFloat( result, 3 ) = acos( SubFloat( cs, 3 ) );
-	return result;
-}
-
-// tan^1(a/b) .. ie, pass sin in as a and cos in as b
-FORCEINLINE fltx4 ArcTan2SIMD( const fltx4 &a, const fltx4 &b )
-{
-	fltx4 result;
-	SubFloat( result, 0 ) = atan2( SubFloat( a, 0 ), SubFloat( b, 0 ) );
-	SubFloat( result, 1 ) = atan2( SubFloat( a, 1 ), SubFloat( b, 1 ) );
-	SubFloat( result, 2 ) = atan2( SubFloat( a, 2 ), SubFloat( b, 2 ) );
-	SubFloat( result, 3 ) = atan2( SubFloat( a, 3 ), SubFloat( b, 3 ) );
-	return result;
-}
-
 FORCEINLINE fltx4 NegSIMD(const fltx4 &a) // negate: -a
 {
 	return SubSIMD(LoadZeroSIMD(),a);
@@ -2280,17 +2219,416 @@ FORCEINLINE fltx4 ReciprocalSaturateSIMD( const fltx4 & a )
 	return ret;
 }
 
-// CHRISG: is it worth doing integer bitfiddling for this?
+//---------------------------------------------------------------------
+// Transcendental functions
+//
+// Each comes in two tiers, named like SqrtSIMD and SqrtEstSIMD:
+//	- FooSIMD is the accurate tier, meant to stand in for the C library
+//	  function on every lane.
+//	- FooEstSIMD is the fast tier, for effects, noise and anything else
+//	  that only needs about 16 bits.
+// The error bounds are against the double precision C library, and
+// MathLib_CheckSIMDAccuracy(), run by the source15_tests suite, samples
+// each function to check them:
+//
+//	SinSIMD, CosSIMD, SinCosSIMD	  2 ulp, or 2^-24 absolute near zero
+//	ArcSinSIMD, ArcCosSIMD			  3 ulp
+//	ArcTan2SIMD						  3 ulp
+//	ExpSIMD (2^x)					  2 ulp
+//	Log2SIMD						  2 ulp, or 2^-24 absolute near x = 1
+//	PowSIMD							  2 ulp, plus 2 ulp per unit of |y log2(x)|
+//
+//	SinEstSIMD, CosEstSIMD, SinCosEstSIMD	2e-6 absolute, for |x| < 8192
+//	ArcTan2EstSIMD					  2e-5 absolute
+//	ExpEstSIMD						  4e-6 relative
+//	Log2EstSIMD						  1e-5 absolute
+//	PowEstSIMD						  4e-6 relative, plus 6e-6 per unit of |y|
+//
+// For e^x and ln(x), scale by 1/ln(2) and ln(2). Results below FLT_MIN are
+// flushed to zero, and inputs below FLT_MIN are read as zero.
+//
+// The bounds hold under -ffast-math too. gcc writes the intrinsics as
+// vector operators, so fast math would reassociate the range reductions
+// and turn divps and sqrtps into reciprocal estimates. The helpers below
+// keep those steps as written.
+//---------------------------------------------------------------------
+
+#if defined( GNUC )
+// the compiler can't move arithmetic across this
+FORCEINLINE fltx4 SIMDOrdered( fltx4 a )
+{
+	__asm__( "" : "+x" ( a ) );
+	return a;
+}
+
+FORCEINLINE fltx4 SIMDDivExact( fltx4 a, const fltx4 &b )
+{
+	__asm__( "divps %1, %0" : "+x" ( a ) : "xm" ( b ) );
+	return a;
+}
+
+FORCEINLINE fltx4 SIMDSqrtExact( const fltx4 &a )
+{
+	fltx4 result;
+	__asm__( "sqrtps %1, %0" : "=x" ( result ) : "xm" ( a ) );
+	return result;
+}
+#else
+// msvc leaves intrinsics alone, even with /fp:fast
+FORCEINLINE fltx4 SIMDOrdered( const fltx4 &a )
+{
+	return a;
+}
+
+FORCEINLINE fltx4 SIMDDivExact( const fltx4 &a, const fltx4 &b )
+{
+	return _mm_div_ps( a, b );
+}
+
+FORCEINLINE fltx4 SIMDSqrtExact( const fltx4 &a )
+{
+	return _mm_sqrt_ps( a );
+}
+#endif
+
+FORCEINLINE fltx4 SIMDIntToFloatBits( const __m128i &a )
+{
+	return _mm_castsi128_ps( a );
+}
+
+FORCEINLINE __m128i SIMDFloatBitsToInt( const fltx4 &a )
+{
+	return _mm_castps_si128( a );
+}
+
+FORCEINLINE fltx4 SIMDInfinity( void )
+{
+	return SIMDIntToFloatBits( _mm_set1_epi32( 0x7f800000 ) );
+}
+
+// 2^n for integer n in [-126,127]
+FORCEINLINE fltx4 SIMDPow2Int( const __m128i &n )
+{
+	return SIMDIntToFloatBits( _mm_slli_epi32( _mm_add_epi32( n, _mm_set1_epi32( 127 ) ), 23 ) );
+}
+
+// reduce the angle to [-pi/4,pi/4] and return the octant it came from, rounded up to even
+FORCEINLINE __m128i SIMDReduceOctant( fltx4 &x, const fltx4 &absRadians )
+{
+	__m128i j = _mm_cvttps_epi32( MulSIMD( absRadians, _mm_set1_ps( 1.27323954473516f ) ) );		// 4/pi
+	j = _mm_and_si128( _mm_add_epi32( j, _mm_set1_epi32( 1 ) ), _mm_set1_epi32( ~1 ) );
+	fltx4 y = _mm_cvtepi32_ps( j );
+
+	// pi/4 in three parts, so the first two products are exact
+	x = SIMDOrdered( SubSIMD( absRadians, MulSIMD( y, _mm_set1_ps( 0.78515625f ) ) ) );
+	x = SIMDOrdered( SubSIMD( x, MulSIMD( y, _mm_set1_ps( 2.4187564849853515625e-4f ) ) ) );
+	x = SubSIMD( x, MulSIMD( y, _mm_set1_ps( 3.77489497744594108e-8f ) ) );
+	return j;
+}
+
+// sin and cos of the reduced angle, swapped and signed for its octant
+FORCEINLINE void SIMDSinCosOctant( fltx4 &sine, fltx4 &cosine, const fltx4 &sinPoly, const fltx4 &cosPoly, const __m128i &j, const fltx4 &radians )
+{
+	// octants 2, 3, 6 and 7 swap the polynomials
+	fltx4 swap = SIMDIntToFloatBits( _mm_cmpeq_epi32( _mm_and_si128( j, _mm_set1_epi32( 2 ) ), _mm_set1_epi32( 2 ) ) );
+	fltx4 s = MaskedAssign( swap, cosPoly, sinPoly );
+	fltx4 c = MaskedAssign( swap, sinPoly, cosPoly );
+
+	// the sine flips in octants 4-7 and for negative angles, the cosine in octants 2-5
+	fltx4 sinSign = SIMDIntToFloatBits( _mm_slli_epi32( _mm_and_si128( j, _mm_set1_epi32( 4 ) ), 29 ) );
+	sinSign = XorSIMD( sinSign, AndSIMD( radians, LoadAlignedSIMD( g_SIMD_signmask ) ) );
+	fltx4 cosSign = SIMDIntToFloatBits( _mm_slli_epi32( _mm_andnot_si128( _mm_sub_epi32( j, _mm_set1_epi32( 2 ) ), _mm_set1_epi32( 4 ) ), 29 ) );
+
+	sine = XorSIMD( s, sinSign );
+	cosine = XorSIMD( c, cosSign );
+}
+
+FORCEINLINE void SinCosSIMD( fltx4 &sine, fltx4 &cosine, const fltx4 &radians )
+{
+	fltx4 absRadians = AndSIMD( radians, LoadAlignedSIMD( g_SIMD_clear_signmask ) );
+	if ( TestSignSIMD( CmpGtSIMD( absRadians, _mm_set1_ps( 8192.0f ) ) ) )
+	{
+		// the reduction runs out of bits of pi
+		SinCos( SubFloat( radians, 0 ), &SubFloat( sine, 0 ), &SubFloat( cosine, 0 ) );
+		SinCos( SubFloat( radians, 1 ), &SubFloat( sine, 1 ), &SubFloat( cosine, 1 ) );
+		SinCos( SubFloat( radians, 2 ), &SubFloat( sine, 2 ), &SubFloat( cosine, 2 ) );
+		SinCos( SubFloat( radians, 3 ), &SubFloat( sine, 3 ), &SubFloat( cosine, 3 ) );
+		return;
+	}
+
+	fltx4 x;
+	__m128i j = SIMDReduceOctant( x, absRadians );
+	fltx4 z = MulSIMD( x, x );
+
+	fltx4 c = MaddSIMD( _mm_set1_ps( 2.443315711809948e-5f ), z, _mm_set1_ps( -1.388731625493765e-3f ) );
+	c = MaddSIMD( c, z, _mm_set1_ps( 4.166664568298827e-2f ) );
+	c = MulSIMD( MulSIMD( c, z ), z );
+	c = SubSIMD( c, MulSIMD( z, Four_PointFives ) );
+	c = AddSIMD( c, Four_Ones );
+
+	fltx4 s = MaddSIMD( _mm_set1_ps( -1.9515295891e-4f ), z, _mm_set1_ps( 8.3321608736e-3f ) );
+	s = MaddSIMD( s, z, _mm_set1_ps( -1.6666654611e-1f ) );
+	s = MaddSIMD( MulSIMD( s, z ), x, x );
+
+	SIMDSinCosOctant( sine, cosine, s, c, j, radians );
+}
+
+FORCEINLINE void SinCos3SIMD( fltx4 &sine, fltx4 &cosine, const fltx4 &radians )
+{
+	SinCosSIMD( sine, cosine, radians );
+}
+
+FORCEINLINE fltx4 SinSIMD( const fltx4 &radians )
+{
+	fltx4 sine, cosine;
+	SinCosSIMD( sine, cosine, radians );
+	return sine;
+}
+
+FORCEINLINE fltx4 CosSIMD( const fltx4 &radians )
+{
+	fltx4 sine, cosine;
+	SinCosSIMD( sine, cosine, radians );
+	return cosine;
+}
+
+FORCEINLINE void SinCosEstSIMD( fltx4 &sine, fltx4 &cosine, const fltx4 &radians )
+{
+	fltx4 x;
+	__m128i j = SIMDReduceOctant( x, AndSIMD( radians, LoadAlignedSIMD( g_SIMD_clear_signmask ) ) );
+	fltx4 z = MulSIMD( x, x );
+
+	fltx4 c = MaddSIMD( _mm_set1_ps( -1.35978256e-3f ), z, _mm_set1_ps( 4.16562948e-2f ) );
+	c = MaddSIMD( c, z, _mm_set1_ps( -4.99998948e-1f ) );
+	c = MaddSIMD( c, z, Four_Ones );
+
+	fltx4 s = MaddSIMD( _mm_set1_ps( 8.16460937e-3f ), z, _mm_set1_ps( -1.66634586e-1f ) );
+	s = MaddSIMD( MulSIMD( s, z ), x, x );
+
+	SIMDSinCosOctant( sine, cosine, s, c, j, radians );
+}
+
+FORCEINLINE fltx4 SinEstSIMD( const fltx4 &radians )
+{
+	fltx4 sine, cosine;
+	SinCosEstSIMD( sine, cosine, radians );
+	return sine;
+}
+
+FORCEINLINE fltx4 CosEstSIMD( const fltx4 &radians )
+{
+	fltx4 sine, cosine;
+	SinCosEstSIMD( sine, cosine, radians );
+	return cosine;
+}
+
+// asin of sqrt(z) = a, for a in [0,0.5]
+FORCEINLINE fltx4 SIMDArcSinPoly( const fltx4 &a, const fltx4 &z )
+{
+	fltx4 p = MaddSIMD( _mm_set1_ps( 4.2163199048e-2f ), z, _mm_set1_ps( 2.4181311049e-2f ) );
+	p = MaddSIMD( p, z, _mm_set1_ps( 4.5470025998e-2f ) );
+	p = MaddSIMD( p, z, _mm_set1_ps( 7.4953002686e-2f ) );
+	p = MaddSIMD( p, z, _mm_set1_ps( 1.6666752422e-1f ) );
+	return AddSIMD( SIMDOrdered( MulSIMD( MulSIMD( p, z ), a ) ), a );
+}
+
+FORCEINLINE fltx4 ArcSinSIMD( const fltx4 &sine )
+{
+	fltx4 a = AndSIMD( sine, LoadAlignedSIMD( g_SIMD_clear_signmask ) );
+
+	// above 0.5, asin(a) = pi/2 - 2 asin(sqrt((1-a)/2))
+	fltx4 isLarge = CmpGtSIMD( a, Four_PointFives );
+	fltx4 zLarge = MulSIMD( Four_PointFives, SubSIMD( Four_Ones, a ) );
+	fltx4 z = MaskedAssign( isLarge, zLarge, MulSIMD( a, a ) );
+	fltx4 x = MaskedAssign( isLarge, SIMDSqrtExact( zLarge ), a );
+
+	fltx4 p = SIMDArcSinPoly( x, z );
+	p = MaskedAssign( isLarge, SubSIMD( _mm_set1_ps( M_PI_F * 0.5f ), AddSIMD( p, p ) ), p );
+	return OrSIMD( p, AndSIMD( sine, LoadAlignedSIMD( g_SIMD_signmask ) ) );
+}
+
+FORCEINLINE fltx4 ArcCosSIMD( const fltx4 &cs )
+{
+	fltx4 a = AndSIMD( cs, LoadAlignedSIMD( g_SIMD_clear_signmask ) );
+	fltx4 isNegative = CmpLtSIMD( cs, Four_Zeros );
+
+	// above 0.5, acos(a) = 2 asin(sqrt((1-a)/2)), and acos(-a) = pi - acos(a)
+	fltx4 isLarge = CmpGtSIMD( a, Four_PointFives );
+	fltx4 zLarge = MulSIMD( Four_PointFives, SubSIMD( Four_Ones, a ) );
+	fltx4 z = MaskedAssign( isLarge, zLarge, MulSIMD( cs, cs ) );
+	fltx4 x = MaskedAssign( isLarge, SIMDSqrtExact( zLarge ), cs );
+
+	fltx4 p = SIMDArcSinPoly( AndSIMD( x, LoadAlignedSIMD( g_SIMD_clear_signmask ) ), z );
+	fltx4 large = AddSIMD( p, p );
+	large = MaskedAssign( isNegative, SubSIMD( _mm_set1_ps( M_PI_F ), large ), large );
+	fltx4 small = SubSIMD( _mm_set1_ps( M_PI_F * 0.5f ), XorSIMD( p, AndSIMD( cs, LoadAlignedSIMD( g_SIMD_signmask ) ) ) );
+	return MaskedAssign( isLarge, large, small );
+}
+
+// tan^1(a/b) .. ie, pass sin in as a and cos in as b
+FORCEINLINE fltx4 ArcTan2SIMD( const fltx4 &a, const fltx4 &b )
+{
+	fltx4 absA = AndSIMD( a, LoadAlignedSIMD( g_SIMD_clear_signmask ) );
+	fltx4 absB = AndSIMD( b, LoadAlignedSIMD( g_SIMD_clear_signmask ) );
+
+	// atan(a/b) = pi/2 + atan(-b/a) past tan(3pi/8), and pi/4 + atan((a-b)/(a+b)) past tan(pi/8)
+	fltx4 isSteep = CmpGtSIMD( absA, MulSIMD( absB, _mm_set1_ps( 2.414213562373095f ) ) );
+	fltx4 isMid = AndNotSIMD( isSteep, CmpGtSIMD( absA, MulSIMD( absB, _mm_set1_ps( 0.4142135623730950f ) ) ) );
+	fltx4 num = MaskedAssign( isSteep, NegSIMD( absB ), MaskedAssign( isMid, SubSIMD( absA, absB ), absA ) );
+	fltx4 den = MaskedAssign( isSteep, absA, MaskedAssign( isMid, AddSIMD( absA, absB ), absB ) );
+	fltx4 offset = MaskedAssign( isSteep, _mm_set1_ps( M_PI_F * 0.5f ), AndSIMD( isMid, _mm_set1_ps( M_PI_F * 0.25f ) ) );
+
+	// 0/0 is 0, not NaN
+	fltx4 isZero = CmpEqSIMD( den, Four_Zeros );
+	fltx4 x = SIMDDivExact( num, MaskedAssign( isZero, Four_Ones, den ) );
+	fltx4 z = MulSIMD( x, x );
+
+	fltx4 p = MaddSIMD( _mm_set1_ps( 8.05374449538e-2f ), z, _mm_set1_ps( -1.38776856032e-1f ) );
+	p = MaddSIMD( p, z, _mm_set1_ps( 1.99777106478e-1f ) );
+	p = MaddSIMD( p, z, _mm_set1_ps( -3.33329491539e-1f ) );
+	fltx4 result = AddSIMD( offset, MaddSIMD( MulSIMD( p, z ), x, x ) );
+
+	// quadrants 2 and 3, then the sign of a
+	result = MaskedAssign( CmpLtSIMD( b, Four_Zeros ), SubSIMD( _mm_set1_ps( M_PI_F ), result ), result );
+	return OrSIMD( result, AndSIMD( a, LoadAlignedSIMD( g_SIMD_signmask ) ) );
+}
+
+FORCEINLINE fltx4 ArcTan2EstSIMD( const fltx4 &a, const fltx4 &b )
+{
+	fltx4 absA = AndSIMD( a, LoadAlignedSIMD( g_SIMD_clear_signmask ) );
+	fltx4 absB = AndSIMD( b, LoadAlignedSIMD( g_SIMD_clear_signmask ) );
+	fltx4 isSteep = CmpGtSIMD( absA, absB );
+	fltx4 den = MaxSIMD( absA, absB );
+	fltx4 x = MulSIMD( MinSIMD( absA, absB ), ReciprocalSIMD( MaskedAssign( CmpEqSIMD( den, Four_Zeros ), Four_Ones, den ) ) );
+	fltx4 z = MulSIMD( x, x );
+
+	// Abramowitz and Stegun 4.4.47
+	fltx4 p = MaddSIMD( _mm_set1_ps( 0.0208351f ), z, _mm_set1_ps( -0.0851330f ) );
+	p = MaddSIMD( p, z, _mm_set1_ps( 0.1801410f ) );
+	p = MaddSIMD( p, z, _mm_set1_ps( -0.3302995f ) );
+	p = MaddSIMD( p, z, _mm_set1_ps( 0.9998660f ) );
+	fltx4 result = MulSIMD( p, x );
+
+	result = MaskedAssign( isSteep, SubSIMD( _mm_set1_ps( M_PI_F * 0.5f ), result ), result );
+	result = MaskedAssign( CmpLtSIMD( b, Four_Zeros ), SubSIMD( _mm_set1_ps( M_PI_F ), result ), result );
+	return OrSIMD( result, AndSIMD( a, LoadAlignedSIMD( g_SIMD_signmask ) ) );
+}
+
+// split x in [-126,128] into the nearest integer i and the rest, in [-0.5,0.5], whatever the rounding mode
+FORCEINLINE fltx4 SIMDSplitPower( const fltx4 &x, __m128i &i )
+{
+	i = _mm_sub_epi32( _mm_cvttps_epi32( AddSIMD( x, _mm_set1_ps( 128.5f ) ) ), _mm_set1_epi32( 128 ) );
+	return SubSIMD( x, _mm_cvtepi32_ps( i ) );
+}
+
+// 2^i p for i in [-126,128], where 2^128 needs two steps
+FORCEINLINE fltx4 SIMDScaleByPow2( const fltx4 &p, const __m128i &i )
+{
+	__m128i is128 = _mm_cmpeq_epi32( i, _mm_set1_epi32( 128 ) );
+	fltx4 result = MulSIMD( p, SIMDPow2Int( _mm_add_epi32( i, is128 ) ) );
+	return MaskedAssign( SIMDIntToFloatBits( is128 ), AddSIMD( result, result ), result );
+}
+
 // 2^x for all values (the antilog)
 FORCEINLINE fltx4 ExpSIMD( const fltx4 &toPower )
 {
-	fltx4 retval;
-	SubFloat( retval, 0 ) = powf( 2, SubFloat(toPower, 0) );
-	SubFloat( retval, 1 ) = powf( 2, SubFloat(toPower, 1) );
-	SubFloat( retval, 2 ) = powf( 2, SubFloat(toPower, 2) );
-	SubFloat( retval, 3 ) = powf( 2, SubFloat(toPower, 3) );
+	// 2^i 2^f, for f in [-0.5,0.5]
+	__m128i i;
+	fltx4 f = SIMDSplitPower( MinSIMD( MaxSIMD( toPower, _mm_set1_ps( -126.0f ) ), _mm_set1_ps( 128.0f ) ), i );
 
-	return retval;
+	fltx4 p = MaddSIMD( _mm_set1_ps( 1.535336188319500e-4f ), f, _mm_set1_ps( 1.339887440266574e-3f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( 9.618437357674640e-3f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( 5.550332471162809e-2f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( 2.402264791363012e-1f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( 6.931472028550421e-1f ) );
+	p = MaddSIMD( p, f, Four_Ones );
+	fltx4 result = SIMDScaleByPow2( p, i );
+
+	// flush to zero below FLT_MIN, and keep NaN
+	result = AndNotSIMD( CmpLtSIMD( toPower, _mm_set1_ps( -126.0f ) ), result );
+	return OrSIMD( result, _mm_cmpunord_ps( toPower, toPower ) );
+}
+
+FORCEINLINE fltx4 ExpEstSIMD( const fltx4 &toPower )
+{
+	__m128i i;
+	fltx4 f = SIMDSplitPower( MinSIMD( MaxSIMD( toPower, _mm_set1_ps( -126.0f ) ), _mm_set1_ps( 128.0f ) ), i );
+
+	fltx4 p = MaddSIMD( _mm_set1_ps( 9.58284414e-3f ), f, _mm_set1_ps( 5.59064392e-2f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( 2.40240989e-1f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( 6.93124191e-1f ) );
+	p = MaddSIMD( p, f, Four_Ones );
+	return AndNotSIMD( CmpLtSIMD( toPower, _mm_set1_ps( -126.0f ) ), SIMDScaleByPow2( p, i ) );
+}
+
+// split x into 2^e m, for m in [sqrt(1/2),sqrt(2)), and return m - 1
+FORCEINLINE fltx4 SIMDSplitExponent( const fltx4 &x, fltx4 &e )
+{
+	__m128i bits = SIMDFloatBitsToInt( x );
+	__m128i exponent = _mm_sub_epi32( _mm_srli_epi32( bits, 23 ), _mm_set1_epi32( 127 ) );
+	fltx4 m = OrSIMD( SIMDIntToFloatBits( _mm_and_si128( bits, _mm_set1_epi32( 0x007fffff ) ) ), Four_Ones );
+
+	fltx4 isHigh = CmpGtSIMD( m, _mm_set1_ps( 1.41421356237f ) );
+	m = MaskedAssign( isHigh, MulSIMD( m, Four_PointFives ), m );
+	e = SubSIMD( _mm_cvtepi32_ps( exponent ), AndSIMD( isHigh, _mm_set1_ps( -1.0f ) ) );
+	return SubSIMD( m, Four_Ones );
+}
+
+// log2(0) is -inf, log2 of a negative number or NaN is NaN, and log2(inf) is inf
+FORCEINLINE fltx4 SIMDLog2Special( const fltx4 &x, const fltx4 &result )
+{
+	fltx4 r = MaskedAssign( CmpLtSIMD( x, _mm_set1_ps( FLT_MIN ) ), NegSIMD( SIMDInfinity() ), result );
+	r = MaskedAssign( CmpEqSIMD( x, SIMDInfinity() ), x, r );
+	return OrSIMD( r, _mm_cmpnge_ps( x, Four_Zeros ) );			// not x >= 0, so negative or NaN
+}
+
+FORCEINLINE fltx4 Log2SIMD( const fltx4 &x )
+{
+	fltx4 e;
+	fltx4 f = SIMDSplitExponent( x, e );
+	fltx4 z = MulSIMD( f, f );
+
+	fltx4 y = MaddSIMD( _mm_set1_ps( 7.0376836292e-2f ), f, _mm_set1_ps( -1.1514610310e-1f ) );
+	y = MaddSIMD( y, f, _mm_set1_ps( 1.1676998740e-1f ) );
+	y = MaddSIMD( y, f, _mm_set1_ps( -1.2420140846e-1f ) );
+	y = MaddSIMD( y, f, _mm_set1_ps( 1.4249322787e-1f ) );
+	y = MaddSIMD( y, f, _mm_set1_ps( -1.6668057665e-1f ) );
+	y = MaddSIMD( y, f, _mm_set1_ps( 2.0000714765e-1f ) );
+	y = MaddSIMD( y, f, _mm_set1_ps( -2.4999993993e-1f ) );
+	y = MaddSIMD( y, f, _mm_set1_ps( 3.3333331174e-1f ) );
+	y = MulSIMD( MulSIMD( y, f ), z );
+	y = SubSIMD( y, MulSIMD( z, Four_PointFives ) );
+
+	// ln(1+f) = f + y, times log2(e) = 1 + 0.44269504088896340736 to keep the low bits
+	fltx4 log2e = _mm_set1_ps( 0.44269504088896340736f );
+	fltx4 result = AddSIMD( MaddSIMD( y, log2e, MulSIMD( f, log2e ) ), AddSIMD( y, f ) );
+	return SIMDLog2Special( x, AddSIMD( result, e ) );
+}
+
+FORCEINLINE fltx4 Log2EstSIMD( const fltx4 &x )
+{
+	fltx4 e;
+	fltx4 f = SIMDSplitExponent( x, e );
+
+	fltx4 p = MaddSIMD( _mm_set1_ps( -0.211525681f ), f, _mm_set1_ps( 0.319825043f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( -0.365856294f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( 0.479671361f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( -0.721223488f ) );
+	p = MaddSIMD( p, f, _mm_set1_ps( 1.442703026f ) );
+	return SIMDLog2Special( x, MaddSIMD( p, f, e ) );
+}
+
+// x^y for x >= 0. Negative x gives NaN, and x^0 is 1.
+FORCEINLINE fltx4 PowSIMD( const fltx4 &x, const fltx4 &y )
+{
+	fltx4 result = ExpSIMD( MulSIMD( y, Log2SIMD( x ) ) );
+	return MaskedAssign( CmpEqSIMD( y, Four_Zeros ), Four_Ones, result );
+}
+
+FORCEINLINE fltx4 PowEstSIMD( const fltx4 &x, const fltx4 &y )
+{
+	fltx4 result = ExpEstSIMD( MulSIMD( y, Log2EstSIMD( x ) ) );
+	return MaskedAssign( CmpEqSIMD( y, Four_Zeros ), Four_Ones, result );
 }
 
 // Clamps the components of a vector to a specified minimum and maximum range.
@@ -2474,6 +2812,78 @@ FORCEINLINE void ConvertStoreAsIntsSIMD(intx4 * RESTRICT pDest, const fltx4 &vSr
 #endif
 
 
+#if USE_STDC_FOR_SIMD || defined( _X360 )
+
+//---------------------------------------------------------------------
+// The rest of the transcendental functions, one lane at a time where the
+// SSE path has them in SIMD. See the Intel/SSE implementation for the tiers.
+//---------------------------------------------------------------------
+
+FORCEINLINE fltx4 CosSIMD( const fltx4 &radians )
+{
+	fltx4 sine, cosine;
+	SinCosSIMD( sine, cosine, radians );
+	return cosine;
+}
+
+FORCEINLINE void SinCosEstSIMD( fltx4 &sine, fltx4 &cosine, const fltx4 &radians )
+{
+	SinCosSIMD( sine, cosine, radians );
+}
+
+FORCEINLINE fltx4 SinEstSIMD( const fltx4 &radians )
+{
+	return SinSIMD( radians );
+}
+
+FORCEINLINE fltx4 CosEstSIMD( const fltx4 &radians )
+{
+	return CosSIMD( radians );
+}
+
+FORCEINLINE fltx4 ArcTan2EstSIMD( const fltx4 &a, const fltx4 &b )
+{
+	return ArcTan2SIMD( a, b );
+}
+
+FORCEINLINE fltx4 ExpEstSIMD( const fltx4 &toPower )
+{
+	return ExpSIMD( toPower );
+}
+
+FORCEINLINE fltx4 Log2SIMD( const fltx4 &x )
+{
+	fltx4 result;
+	SubFloat( result, 0 ) = log( SubFloat( x, 0 ) ) * 1.44269504088896f;
+	SubFloat( result, 1 ) = log( SubFloat( x, 1 ) ) * 1.44269504088896f;
+	SubFloat( result, 2 ) = log( SubFloat( x, 2 ) ) * 1.44269504088896f;
+	SubFloat( result, 3 ) = log( SubFloat( x, 3 ) ) * 1.44269504088896f;
+	return result;
+}
+
+FORCEINLINE fltx4 Log2EstSIMD( const fltx4 &x )
+{
+	return Log2SIMD( x );
+}
+
+FORCEINLINE fltx4 PowSIMD( const fltx4 &x, const fltx4 &y )
+{
+	fltx4 result;
+	SubFloat( result, 0 ) = powf( SubFloat( x, 0 ), SubFloat( y, 0 ) );
+	SubFloat( result, 1 ) = powf( SubFloat( x, 1 ), SubFloat( y, 1 ) );
+	SubFloat( result, 2 ) = powf( SubFloat( x, 2 ), SubFloat( y, 2 ) );
+	SubFloat( result, 3 ) = powf( SubFloat( x, 3 ), SubFloat( y, 3 ) );
+	return result;
+}
+
+FORCEINLINE fltx4 PowEstSIMD( const fltx4 &x, const fltx4 &y )
+{
+	return PowSIMD( x, y );
+}
+
+#endif
+
+
 
 /// class FourVectors stores 4 independent vectors for use in SIMD processing. These vectors are
 /// stored in the format x x x x y y y y z z z z so that they can be efficiently SIMD-accelerated.
@@ -3013,6 +3423,11 @@ inline fltx4 PowSIMD( const fltx4 & x, float exponent )
 	return Pow_FixedPoint_Exponent_SIMD(x,(int) (4.0*exponent));
 }
 
+// sample the transcendental functions and report their worst error against the bounds
+// documented with them. returns false if any is out of bounds. only the tests build
+// sseaccuracy.cpp, it is not part of the mathlib library.
+bool MathLib_CheckSIMDAccuracy( void );
+
 
 
 // random number generation - generate 4 random numbers quickly.
@@ -10,6 +10,7 @@
 #include "datacache/idatacache.h"
 #include "datacache/imdlcache.h"
 #include "convar.h"
+#include "tier1/utlmap.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -746,6 +747,8 @@ void CStudioHdr::Init( const studiohdr_t *pStudioHdr, IMDLCache *mdlcache )
 
 	m_pVModel = NULL;
 	m_pStudioHdrCache.RemoveAll();
+	m_pNameToIndex = NULL;
+	m_nNameToIndexGeneration = 0;
 
 	if (m_pStudioHdr == NULL)
 	{
@@ -1924,3 +1927,225 @@ void CStudioHdr::CActivityToSequenceMapping::SetValidationPair( const CStudioHdr
 	m_expectedPStudioHdr = pstudiohdr->GetRenderHdr();
 	m_expectedVModel = pstudiohdr->GetVirtualModel();
 }
+
+
+//-----------------------------------------------------------------------------
+//	CODE PERTAINING TO NAME->INDEX MAPPING SUBCLASS
+//-----------------------------------------------------------------------------
+
+int CStudioHdr::CNameToIndexMapping::NumNames( CStudioHdr *pstudiohdr, NameTable_t table )
+{
+	switch ( table )
+	{
+	case NAME_TABLE_SEQUENCE:
+	case NAME_TABLE_ACTIVITY:
+		return pstudiohdr->GetNumSeq();
+	case NAME_TABLE_ATTACHMENT:
+		return pstudiohdr->GetNumAttachments();
+	case NAME_TABLE_POSEPARAM:
+		return pstudiohdr->GetNumPoseParameters();
+	default:
+		Assert( 0 );
+		return 0;
+	}
+}
+
+const char *CStudioHdr::CNameToIndexMapping::GetName( CStudioHdr *pstudiohdr, NameTable_t table, int i )
+{
+	switch ( table )
+	{
+	case NAME_TABLE_SEQUENCE:
+		return pstudiohdr->pSeqdesc( i ).pszLabel();
+	case NAME_TABLE_ACTIVITY:
+		return pstudiohdr->pSeqdesc( i ).pszActivityName();
+	case NAME_TABLE_ATTACHMENT:
+		return pstudiohdr->pAttachment( i ).pszName();
+	case NAME_TABLE_POSEPARAM:
+		return pstudiohdr->pPoseParameter( i ).pszName();
+	default:
+		Assert( 0 );
+		return "";
+	}
+}
+
+// The old way; used until the model's include models are available, since the
+// counts and names can still change underneath us until then.
+int CStudioHdr::CNameToIndexMapping::FindLinear( CStudioHdr *pstudiohdr, NameTable_t table, const char *pszName )
+{
+	int nCount = NumNames( pstudiohdr, table );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		if ( !V_stricmp( GetName( pstudiohdr, table, i ), pszName ) )
+			return i;
+	}
+	return -1;
+}
+
+// The mappings are shared by every CStudioHdr of a model, keyed by its studiohdr_t and
+// virtual model. A mapping that goes stale is swapped out rather than changed, since
+// other threads may still be reading it, and kept on the retired list until ResetMappings().
+struct NameToIndexKey_t
+{
+	const studiohdr_t		*m_pStudioHdr;
+	const virtualmodel_t	*m_pVModel;
+};
+
+static bool NameToIndexKeyLessFunc( const NameToIndexKey_t &lhs, const NameToIndexKey_t &rhs )
+{
+	if ( lhs.m_pStudioHdr != rhs.m_pStudioHdr )
+		return lhs.m_pStudioHdr < rhs.m_pStudioHdr;
+	return lhs.m_pVModel < rhs.m_pVModel;
+}
+
+static CUtlMap< NameToIndexKey_t, CStudioHdr::CNameToIndexMapping * > s_NameToIndexMappings( NameToIndexKeyLessFunc );
+static CUtlVector< CStudioHdr::CNameToIndexMapping * > s_RetiredNameToIndexMappings;
+static CThreadFastMutex s_NameToIndexMutex;
+static volatile int s_nNameToIndexGeneration = 1;		// a CStudioHdr's cached mapping is good for this generation only
+
+CStudioHdr::CNameToIndexMapping::CNameToIndexMapping( CStudioHdr *pstudiohdr )
+{
+	m_pExpectedPStudioHdr = pstudiohdr->GetRenderHdr();
+	m_pExpectedVModel = pstudiohdr->GetVirtualModel();
+	m_nExpectedChecksum = m_pExpectedPStudioHdr->checksum;
+
+	for ( int i = 0; i < NAME_TABLE_COUNT; i++ )
+	{
+		BuildTable( pstudiohdr, (NameTable_t)i );
+	}
+}
+
+bool CStudioHdr::CNameToIndexMapping::IsValidFor( CStudioHdr *pstudiohdr ) const
+{
+	if ( m_pExpectedPStudioHdr != pstudiohdr->GetRenderHdr() ||
+		m_pExpectedVModel != pstudiohdr->GetVirtualModel() ||
+		m_nExpectedChecksum != m_pExpectedPStudioHdr->checksum )
+		return false;
+
+	for ( int i = 0; i < NAME_TABLE_COUNT; i++ )
+	{
+		if ( m_nEntries[i] != NumNames( pstudiohdr, (NameTable_t)i ) )
+			return false;
+	}
+	return true;
+}
+
+void CStudioHdr::CNameToIndexMapping::BuildTable( CStudioHdr *pstudiohdr, NameTable_t table )
+{
+	Table_t &t = m_Tables[table];
+	int nCount = NumNames( pstudiohdr, table );
+
+	// keep the load factor at or under one half so probe chains stay short
+	int nSlots = 4;
+	while ( nSlots < nCount * 2 )
+	{
+		nSlots <<= 1;
+	}
+
+	t.m_Slots.SetCount( nSlots );
+	for ( int i = 0; i < nSlots; i++ )
+	{
+		t.m_Slots[i].hash = 0;
+		t.m_Slots[i].index = -1;
+	}
+	t.m_nMask = nSlots - 1;
+
+	for ( int i = 0; i < nCount; i++ )
+	{
+		const char *pszName = GetName( pstudiohdr, table, i );
+		unsigned int hash = HashStringCaseless( pszName );
+		unsigned int nSlot = hash & t.m_nMask;
+
+		bool bDuplicate = false;
+		while ( t.m_Slots[nSlot].index != -1 )
+		{
+			// the linear search returned the first match, so only the first of a name goes in
+			if ( t.m_Slots[nSlot].hash == hash && !V_stricmp( GetName( pstudiohdr, table, t.m_Slots[nSlot].index ), pszName ) )
+			{
+				bDuplicate = true;
+				break;
+			}
+			nSlot = ( nSlot + 1 ) & t.m_nMask;
+		}
+
+		if ( !bDuplicate )
+		{
+			t.m_Slots[nSlot].hash = hash;
+			t.m_Slots[nSlot].index = i;
+		}
+	}
+
+	m_nEntries[table] = nCount;
+}
+
+const CStudioHdr::CNameToIndexMapping *CStudioHdr::CNameToIndexMapping::FindMapping( CStudioHdr *pstudiohdr )
+{
+	NameToIndexKey_t key;
+	key.m_pStudioHdr = pstudiohdr->GetRenderHdr();
+	key.m_pVModel = pstudiohdr->GetVirtualModel();
+
+	AUTO_LOCK( s_NameToIndexMutex );
+
+	unsigned short i = s_NameToIndexMappings.Find( key );
+	if ( i != s_NameToIndexMappings.InvalidIndex() && s_NameToIndexMappings[i]->IsValidFor( pstudiohdr ) )
+		return s_NameToIndexMappings[i];
+
+	// build the whole mapping before anyone can see it
+	CNameToIndexMapping *pMapping = new CNameToIndexMapping( pstudiohdr );
+	ThreadMemoryBarrier();
+
+	if ( i == s_NameToIndexMappings.InvalidIndex() )
+	{
+		s_NameToIndexMappings.Insert( key, pMapping );
+	}
+	else
+	{
+		s_RetiredNameToIndexMappings.AddToTail( s_NameToIndexMappings[i] );
+		s_NameToIndexMappings[i] = pMapping;
+	}
+	return pMapping;
+}
+
+int CStudioHdr::CNameToIndexMapping::FindInTable( CStudioHdr *pstudiohdr, NameTable_t table, const char *pszName ) const
+{
+	const Table_t &t = m_Tables[table];
+	unsigned int hash = HashStringCaseless( pszName );
+	for ( unsigned int nSlot = hash & t.m_nMask; t.m_Slots[nSlot].index != -1; nSlot = ( nSlot + 1 ) & t.m_nMask )
+	{
+		if ( t.m_Slots[nSlot].hash == hash && !V_stricmp( GetName( pstudiohdr, table, t.m_Slots[nSlot].index ), pszName ) )
+			return t.m_Slots[nSlot].index;
+	}
+
+	return -1;
+}
+
+int CStudioHdr::CNameToIndexMapping::Find( const CStudioHdr *pconststudiohdr, NameTable_t table, const char *pszName )
+{
+	Assert( table >= 0 && table < NAME_TABLE_COUNT );
+
+	CStudioHdr *pstudiohdr = const_cast< CStudioHdr * >( pconststudiohdr );
+	if ( !pstudiohdr->IsValid() || !pszName )
+		return -1;
+
+	if ( !pstudiohdr->SequencesAvailable() )
+		return FindLinear( pstudiohdr, table, pszName );
+
+	// the generation goes first: after a reset the cached mapping has been freed
+	const CNameToIndexMapping *pMapping = pstudiohdr->m_pNameToIndex;
+	if ( !pMapping || pstudiohdr->m_nNameToIndexGeneration != s_nNameToIndexGeneration || !pMapping->IsValidFor( pstudiohdr ) )
+	{
+		pMapping = FindMapping( pstudiohdr );
+		pstudiohdr->m_pNameToIndex = pMapping;
+		pstudiohdr->m_nNameToIndexGeneration = s_nNameToIndexGeneration;
+	}
+
+	return pMapping->FindInTable( pstudiohdr, table, pszName );
+}
+
+void CStudioHdr::CNameToIndexMapping::ResetMappings( void )
+{
+	AUTO_LOCK( s_NameToIndexMutex );
+
+	s_NameToIndexMappings.PurgeAndDeleteElements();
+	s_RetiredNameToIndexMappings.PurgeAndDeleteElements();
+	++s_nNameToIndexGeneration;
+}
@@ -2815,6 +2815,102 @@ public:
 		m_ActivityToSequence.Reinitialize(this);
 	}
 
+public:
+
+	// Maps sequence, activity, attachment and pose parameter names to their indices. The
+	// game looks these up by name all the time (LookupSequence, LookupAttachment, the pose
+	// parameter lookups in the anim states), and the old code walked every entry with a
+	// stricmp, which gets expensive on player and NPC models with hundreds of sequences.
+	//
+	// There is one mapping per model, keyed by its studiohdr_t and virtual model, and every
+	// CStudioHdr of that model shares it; most of them are declared on the stack for a
+	// lookup or two. A mapping is built the first time the model is asked for a name, and
+	// never changes once published: if the model's names change underneath it, a new one is
+	// built and swapped in. Names are compared caselessly and the first entry with a given
+	// name wins, matching the linear searches these replace.
+	class CNameToIndexMapping /* final */
+	{
+	public:
+		enum NameTable_t
+		{
+			NAME_TABLE_SEQUENCE = 0,	// sequence label -> sequence index
+			NAME_TABLE_ACTIVITY,		// activity name -> first sequence with that activity
+			NAME_TABLE_ATTACHMENT,		// attachment name -> attachment index
+			NAME_TABLE_POSEPARAM,		// pose parameter name -> pose parameter index
+
+			NAME_TABLE_COUNT
+		};
+
+		/// Returns the index for a name, or -1 if there isn't one.
+		static int Find( const CStudioHdr *pstudiohdr, NameTable_t table, const char *pszName );
+
+		/// Free every mapping. Only call this when nothing can be looking names up, such
+		/// as at level shutdown; their models' memory may be reused by the next level.
+		static void ResetMappings( void );
+
+	private:
+		// One open addressed slot. The hash is kept so that most probes that miss never
+		// have to touch the string in the model data.
+		struct Slot_t
+		{
+			unsigned int	hash;
+			int				index;	// -1 if the slot is empty
+		};
+
+		struct Table_t
+		{
+			Table_t() : m_nMask( 0 ) {}
+
+			CUtlVector< Slot_t > m_Slots;
+			unsigned int	m_nMask;
+		};
+
+		CNameToIndexMapping( CStudioHdr *pstudiohdr );
+
+		static int			NumNames( CStudioHdr *pstudiohdr, NameTable_t table );
+		static const char	*GetName( CStudioHdr *pstudiohdr, NameTable_t table, int i );
+		static int			FindLinear( CStudioHdr *pstudiohdr, NameTable_t table, const char *pszName );
+		static const CNameToIndexMapping *FindMapping( CStudioHdr *pstudiohdr );
+
+		void				BuildTable( CStudioHdr *pstudiohdr, NameTable_t table );
+		bool				IsValidFor( CStudioHdr *pstudiohdr ) const;
+		int					FindInTable( CStudioHdr *pstudiohdr, NameTable_t table, const char *pszName ) const;
+
+		Table_t				m_Tables[NAME_TABLE_COUNT];
+		int					m_nEntries[NAME_TABLE_COUNT];	// number of names each table was built from
+		const studiohdr_t	*m_pExpectedPStudioHdr;
+		const virtualmodel_t *m_pExpectedVModel;
+		int					m_nExpectedChecksum;
+	};
+
+	// the shared mapping this CStudioHdr last used, and the ResetMappings() generation it came from
+	mutable const CNameToIndexMapping *m_pNameToIndex;
+	mutable int			m_nNameToIndexGeneration;
+
+	/// Sequence with the given label, or -1.
+	inline int FindSequenceByName( const char *pszLabel ) const
+	{
+		return CNameToIndexMapping::Find( this, CNameToIndexMapping::NAME_TABLE_SEQUENCE, pszLabel );
+	}
+
+	/// First sequence whose activity is named pszActivity (ie "ACT_IDLE"), or -1.
+	inline int FindSequenceByActivityName( const char *pszActivity ) const
+	{
+		return CNameToIndexMapping::Find( this, CNameToIndexMapping::NAME_TABLE_ACTIVITY, pszActivity );
+	}
+
+	/// Attachment with the given name, or -1.
+	inline int FindAttachment( const char *pszName ) const
+	{
+		return CNameToIndexMapping::Find( this, CNameToIndexMapping::NAME_TABLE_ATTACHMENT, pszName );
+	}
+
+	/// Pose parameter with the given name, or -1.
+	inline int FindPoseParameter( const char *pszName ) const
+	{
+		return CNameToIndexMapping::Find( this, CNameToIndexMapping::NAME_TABLE_POSEPARAM, pszName );
+	}
+
 #ifdef STUDIO_ENABLE_PERF_COUNTERS
 public:
 	inline void			ClearPerfCounters( void )
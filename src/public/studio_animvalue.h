@@ -0,0 +1,81 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Reading the run length encoded animation value streams of a
+//			studio model (mstudioanimvalue_t).
+//
+//			A stream is a list of runs.  Each run is a header giving the
+//			number of frames it covers (total) and the number of values
+//			stored after it (valid); frames past the valid values repeat the
+//			last one.  A run with a total of zero ends the stream.
+//
+//			These are templated on the stream element type so they don't
+//			need studio.h, and can be tested on their own.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef STUDIO_ANIMVALUE_H
+#define STUDIO_ANIMVALUE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+//-----------------------------------------------------------------------------
+// Purpose: the value of the stream at frame, scaled.  Returns false (and sets
+//			v1 to zero) if the stream ends before the frame.
+//-----------------------------------------------------------------------------
+template< class ANIMVALUE >
+inline bool AnimValue_Extract( int frame, const ANIMVALUE *panimvalue, float scale, float &v1 )
+{
+	int k = frame;
+
+	while (panimvalue->num.total <= k)
+	{
+		k -= panimvalue->num.total;
+		panimvalue += panimvalue->num.valid + 1;
+		if ( panimvalue->num.total == 0 )
+		{
+			v1 = 0;
+			return false;
+		}
+	}
+	if (panimvalue->num.valid > k)
+	{
+		v1 = panimvalue[k+1].value * scale;
+	}
+	else
+	{
+		// get last valid data block
+		v1 = panimvalue[panimvalue->num.valid].value * scale;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: expand a stream into nFrames unscaled values, the value
+//			AnimValue_Extract() returns for each frame
+//-----------------------------------------------------------------------------
+template< class ANIMVALUE >
+inline void AnimValue_Decode( const ANIMVALUE *panimvalue, int nFrames, short *pValues )
+{
+	int frame = 0;
+
+	while ( frame < nFrames && panimvalue->num.total != 0 )
+	{
+		int valid = panimvalue->num.valid;
+		for ( int k = 0; k < panimvalue->num.total && frame < nFrames; k++ )
+		{
+			// past the valid data the last valid value repeats
+			pValues[frame++] = panimvalue[ ( k < valid ? k : valid - 1 ) + 1 ].value;
+		}
+		panimvalue += valid + 1;
+	}
+
+	// running off the end of the animation stream reads zero
+	for ( ; frame < nFrames; frame++ )
+	{
+		pValues[frame] = 0;
+	}
+}
+
+#endif // STUDIO_ANIMVALUE_H
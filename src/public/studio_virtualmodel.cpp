@@ -9,10 +9,11 @@
 #include <limits.h>
 #include "studio.h"
 #include "tier1/utlmap.h"
-#include "tier1/utldict.h"
+#include "tier1/utlhashtable.h"
 #include "tier1/utlbuffer.h"
 #include "filesystem.h"
 #include "tier0/icommandline.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -23,29 +24,50 @@ extern IFileSystem *		g_pFileSystem;
 // Purpose:
 //-----------------------------------------------------------------------------
 
-// a string table to speed up searching for sequences in the current virtual model
+// Name -> master index tables for the virtual model being assembled. Every include model
+// merges its sequences, animations, attachments, pose parameters and transition nodes into
+// the root by name, and checking each of them against everything merged so far made the
+// assembly quadratic; player and NPC models with hundreds of sequences hitched noticeably
+// the first time they were seen. The names point into the studiohdrs of the groups, which
+// stay loaded for the life of the virtual model.
+typedef CUtlHashtable< const char *, int, CaselessStringHashFunctor, CaselessStringEqualFunctor > ModelNameTable_t;
+
 struct modellookup_t
 {
-	CUtlDict<short,short> seqTable;
-	CUtlDict<short,short> animTable;
+	ModelNameTable_t seqTable;
+	ModelNameTable_t animTable;
+	ModelNameTable_t attachmentTable;
+	ModelNameTable_t poseTable;
+	ModelNameTable_t nodeTable;
+	ModelNameTable_t baseBoneTable;		// bones of the root model, built on first use
 };
 
-static CUtlVector<modellookup_t> g_ModelLookup;
-static int g_ModelLookupIndex = -1;
+// Per thread, so that different models can be assembled on different threads at once
+// (each virtual model is already guarded by its own lock).
+static CTHREADLOCALPTR( modellookup_t ) g_pModelLookup;
 
 inline bool HasLookupTable()
 {
-	return g_ModelLookupIndex >= 0 ? true : false;
+	return g_pModelLookup != NULL;
+}
+
+inline modellookup_t *GetLookupTables()
+{
+	return g_pModelLookup;
 }
 
-inline CUtlDict<short,short> *GetSeqTable()
+// Returns the master index stored for a name, or notFound.
+static inline int FindInTable( const ModelNameTable_t &table, const char *pszName, int notFound )
 {
-	return &g_ModelLookup[g_ModelLookupIndex].seqTable;
+	UtlHashHandle_t h = table.Find( pszName );
+	return ( h != table.InvalidHandle() ) ? table.Element( h ) : notFound;
 }
 
-inline CUtlDict<short,short> *GetAnimTable()
+// Remembers where a name ended up. Names already in the table keep the first index, which
+// is the entry the linear searches this replaced would have found.
+static inline void AddToTable( ModelNameTable_t &table, const char *pszName, int index )
 {
-	return &g_ModelLookup[g_ModelLookupIndex].animTable;
+	table.Insert( pszName, index );
 }
 
 class CModelLookupContext
@@ -55,26 +77,41 @@ public:
 	~CModelLookupContext();
 
 private:
-	int		m_lookupIndex;
+	modellookup_t	*m_pLookup;
+	modellookup_t	*m_pPrevLookup;
+	const studiohdr_t *m_pStudioHdr;
+	CFastTimer		m_Timer;
 };
 
 CModelLookupContext::CModelLookupContext(int group, const studiohdr_t *pStudioHdr)
 {
-	m_lookupIndex = -1;
+	m_pLookup = NULL;
+	m_pPrevLookup = NULL;
+	m_pStudioHdr = pStudioHdr;
 	if ( group == 0 && pStudioHdr->numincludemodels )
 	{
-		m_lookupIndex = g_ModelLookup.AddToTail();
-		g_ModelLookupIndex = g_ModelLookup.Count()-1;
+		// an include model may need its own virtual model while this one is being built,
+		// so contexts nest
+		m_pLookup = new modellookup_t;
+		m_pPrevLookup = g_pModelLookup;
+		g_pModelLookup = m_pLookup;
+		m_Timer.Start();
 	}
 }
 
 CModelLookupContext::~CModelLookupContext()
 {
-	if ( m_lookupIndex >= 0 )
+	if ( m_pLookup )
 	{
-		Assert(m_lookupIndex == (g_ModelLookup.Count()-1));
-		g_ModelLookup.FastRemove(m_lookupIndex);
-		g_ModelLookupIndex = g_ModelLookup.Count()-1;
+		Assert( g_pModelLookup == m_pLookup );
+		g_pModelLookup = m_pPrevLookup;
+
+		m_Timer.End();
+		DevMsg( 2, "Assembled virtual model %s: %d include models, %d sequences, %d animations in %.2f ms\n",
+			m_pStudioHdr->pszName(), m_pStudioHdr->numincludemodels, m_pLookup->seqTable.Count(), m_pLookup->animTable.Count(),
+			m_Timer.GetDuration().GetMillisecondsF() );
+
+		delete m_pLookup;
 	}
 }
 
@@ -161,12 +198,7 @@ void virtualmodel_t::AppendSequences( int group, const studiohdr_t *pStudioHdr )
 
 		if ( HasLookupTable() )
 		{
-			k = numCheck;
-			short index = GetSeqTable()->Find( s1 );
-			if ( index != GetSeqTable()->InvalidIndex() )
-			{
-				k = GetSeqTable()->Element(index);
-			}
+			k = FindInTable( GetLookupTables()->seqTable, s1, numCheck );
 		}
 		else
 		{
@@ -209,7 +241,7 @@ void virtualmodel_t::AppendSequences( int group, const studiohdr_t *pStudioHdr )
 		{
 			const studiohdr_t *hdr = m_group[ seq[j].group ].GetStudioHdr();
 			const char *s1 = hdr->pLocalSeqdesc( seq[j].index )->pszLabel();
-			GetSeqTable()->Insert( s1, j );
+			AddToTable( GetLookupTables()->seqTable, s1, j );
 		}
 	}
 
@@ -248,12 +280,7 @@ void virtualmodel_t::AppendAnimations( int group, const studiohdr_t *pStudioHdr
 		char *s1 = pStudioHdr->pLocalAnimdesc( j )->pszName();
 		if ( HasLookupTable() )
 		{
-			k = numCheck;
-			short index = GetAnimTable()->Find( s1 );
-			if ( index != GetAnimTable()->InvalidIndex() )
-			{
-				k = GetAnimTable()->Element(index);
-			}
+			k = FindInTable( GetLookupTables()->animTable, s1, numCheck );
 		}
 		else
 		{
@@ -283,7 +310,7 @@ void virtualmodel_t::AppendAnimations( int group, const studiohdr_t *pStudioHdr
 		for ( j = numCheck; j < anim.Count(); j++ )
 		{
 			const char *s1 = m_group[ anim[j].group ].GetStudioHdr()->pLocalAnimdesc( anim[j].index )->pszName();
-			GetAnimTable()->Insert( s1, j );
+			AddToTable( GetLookupTables()->animTable, s1, j );
 		}
 	}
 
@@ -321,14 +348,35 @@ void virtualmodel_t::AppendBonemap( int group, const studiohdr_t *pStudioHdr )
 		{
 			m_group[ group ].boneMap[ j ] = -1;
 		}
+
+		// every include model is matched against the same root skeleton, so hash it once
+		ModelNameTable_t *pBoneTable = NULL;
+		if ( HasLookupTable() )
+		{
+			pBoneTable = &GetLookupTables()->baseBoneTable;
+			if ( pBoneTable->Count() == 0 )
+			{
+				for (k = 0; k < pBaseStudioHdr->numbones; k++)
+				{
+					AddToTable( *pBoneTable, pBaseStudioHdr->pBone( k )->pszName(), k );
+				}
+			}
+		}
+
 		for (j = 0; j < pStudioHdr->numbones; j++)
 		{
-			// NOTE: studiohdr has a bone table - using the table is ~5% faster than this for alyx.mdl on a P4/3.2GHz
-			for (k = 0; k < pBaseStudioHdr->numbones; k++)
+			if ( pBoneTable )
 			{
-				if (stricmp( pStudioHdr->pBone( j )->pszName(), pBaseStudioHdr->pBone( k )->pszName() ) == 0)
+				k = FindInTable( *pBoneTable, pStudioHdr->pBone( j )->pszName(), pBaseStudioHdr->numbones );
+			}
+			else
+			{
+				for (k = 0; k < pBaseStudioHdr->numbones; k++)
 				{
-					break;
+					if (stricmp( pStudioHdr->pBone( j )->pszName(), pBaseStudioHdr->pBone( k )->pszName() ) == 0)
+					{
+						break;
+					}
 				}
 			}
 			if (k < pBaseStudioHdr->numbones)
@@ -389,13 +437,20 @@ void virtualmodel_t::AppendAttachments( int group, const studiohdr_t *pStudioHdr
 		
 		
 		char *s1 = pStudioHdr->pLocalAttachment( j )->pszName();
-		for (k = 0; k < numCheck; k++)
+		if ( HasLookupTable() )
 		{
-			char *s2 = m_group[ attachment[k].group ].GetStudioHdr()->pLocalAttachment( attachment[k].index )->pszName();
-
-			if (stricmp( s1, s2 ) == 0)
+			k = FindInTable( GetLookupTables()->attachmentTable, s1, numCheck );
+		}
+		else
+		{
+			for (k = 0; k < numCheck; k++)
 			{
-				break;
+				char *s2 = m_group[ attachment[k].group ].GetStudioHdr()->pLocalAttachment( attachment[k].index )->pszName();
+
+				if (stricmp( s1, s2 ) == 0)
+				{
+					break;
+				}
 			}
 		}
 		// no duplication
@@ -427,6 +482,15 @@ void virtualmodel_t::AppendAttachments( int group, const studiohdr_t *pStudioHdr
 		m_group[ group ].masterAttachment[ j ] = k;
 	}
 
+	if ( HasLookupTable() )
+	{
+		for ( j = numCheck; j < attachment.Count(); j++ )
+		{
+			const char *s1 = m_group[ attachment[j].group ].GetStudioHdr()->pLocalAttachment( attachment[j].index )->pszName();
+			AddToTable( GetLookupTables()->attachmentTable, s1, j );
+		}
+	}
+
 	m_attachment = attachment;
 }
 
@@ -452,13 +516,20 @@ void virtualmodel_t::AppendPoseParameters( int group, const studiohdr_t *pStudio
 	for (j = 0; j < pStudioHdr->numlocalposeparameters; j++)
 	{
 		char *s1 = pStudioHdr->pLocalPoseParameter( j )->pszName();
-		for (k = 0; k < numCheck; k++)
+		if ( HasLookupTable() )
 		{
-			char *s2 = m_group[ pose[k].group ].GetStudioHdr()->pLocalPoseParameter( pose[k].index )->pszName();
-
-			if (stricmp( s1, s2 ) == 0)
+			k = FindInTable( GetLookupTables()->poseTable, s1, numCheck );
+		}
+		else
+		{
+			for (k = 0; k < numCheck; k++)
 			{
-				break;
+				char *s2 = m_group[ pose[k].group ].GetStudioHdr()->pLocalPoseParameter( pose[k].index )->pszName();
+
+				if (stricmp( s1, s2 ) == 0)
+				{
+					break;
+				}
 			}
 		}
 		if (k == numCheck)
@@ -483,6 +554,15 @@ void virtualmodel_t::AppendPoseParameters( int group, const studiohdr_t *pStudio
 		m_group[ group ].masterPose[ j ] = k;
 	}
 
+	if ( HasLookupTable() )
+	{
+		for ( j = numCheck; j < pose.Count(); j++ )
+		{
+			const char *s1 = m_group[ pose[j].group ].GetStudioHdr()->pLocalPoseParameter( pose[j].index )->pszName();
+			AddToTable( GetLookupTables()->poseTable, s1, j );
+		}
+	}
+
 	m_pose = pose;
 }
 
@@ -508,13 +588,20 @@ void virtualmodel_t::AppendNodes( int group, const studiohdr_t *pStudioHdr )
 	for (j = 0; j < pStudioHdr->numlocalnodes; j++)
 	{
 		char *s1 = pStudioHdr->pszLocalNodeName( j );
-		for (k = 0; k < numCheck; k++)
+		if ( HasLookupTable() )
 		{
-			char *s2 = m_group[ node[k].group ].GetStudioHdr()->pszLocalNodeName( node[k].index );
-
-			if (stricmp( s1, s2 ) == 0)
+			k = FindInTable( GetLookupTables()->nodeTable, s1, numCheck );
+		}
+		else
+		{
+			for (k = 0; k < numCheck; k++)
 			{
-				break;
+				char *s2 = m_group[ node[k].group ].GetStudioHdr()->pszLocalNodeName( node[k].index );
+
+				if (stricmp( s1, s2 ) == 0)
+				{
+					break;
+				}
 			}
 		}
 		// no duplication
@@ -529,6 +616,15 @@ void virtualmodel_t::AppendNodes( int group, const studiohdr_t *pStudioHdr )
 		m_group[ group ].masterNode[ j ] = k;
 	}
 
+	if ( HasLookupTable() )
+	{
+		for ( j = numCheck; j < node.Count(); j++ )
+		{
+			const char *s1 = m_group[ node[j].group ].GetStudioHdr()->pszLocalNodeName( node[j].index );
+			AddToTable( GetLookupTables()->nodeTable, s1, j );
+		}
+	}
+
 	m_node = node;
 }
 
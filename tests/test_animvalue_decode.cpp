@@ -0,0 +1,114 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit tests for the animation value stream decoder
+//          Decoding a whole stream must read the same values as extracting
+//          each frame from the run length encoded stream
+//
+//=============================================================================
+
+#include <catch2/catch_test_macros.hpp>
+#include "studio_animvalue.h"
+#include <random>
+#include <vector>
+
+// Same layout as mstudioanimvalue_t in studio.h
+union TestAnimValue
+{
+	struct
+	{
+		unsigned char valid;
+		unsigned char total;
+	} num;
+	short value;
+};
+
+static TestAnimValue MakeHeader(int valid, int total) {
+	TestAnimValue header;
+	header.num.valid = (unsigned char)valid;
+	header.num.total = (unsigned char)total;
+	return header;
+}
+
+static TestAnimValue MakeValue(short value) {
+	TestAnimValue v;
+	v.value = value;
+	return v;
+}
+
+// Appends random runs covering at least nFrames frames, then the terminator
+static std::vector<TestAnimValue> MakeRandomStream(std::mt19937 &rng, int nFrames) {
+	std::vector<TestAnimValue> stream;
+	std::uniform_int_distribution<int> totalDist(1, 255);
+	std::uniform_int_distribution<int> valueDist(-32768, 32767);
+
+	int covered = 0;
+	while (covered < nFrames) {
+		int total = totalDist(rng);
+		int valid = std::uniform_int_distribution<int>(1, total)(rng);
+		stream.push_back(MakeHeader(valid, total));
+		for (int i = 0; i < valid; i++) {
+			stream.push_back(MakeValue((short)valueDist(rng)));
+		}
+		covered += total;
+	}
+	stream.push_back(MakeHeader(0, 0));
+	return stream;
+}
+
+static void RequireDecodeMatchesExtract(const std::vector<TestAnimValue> &stream, int nFrames) {
+	std::vector<short> decoded(nFrames);
+	AnimValue_Decode(stream.data(), nFrames, decoded.data());
+
+	for (int frame = 0; frame < nFrames; frame++) {
+		float extracted;
+		AnimValue_Extract(frame, stream.data(), 1.0f, extracted);
+		REQUIRE((float)decoded[frame] == extracted);
+	}
+}
+
+TEST_CASE("AnimValue_Decode matches AnimValue_Extract on random streams", "[animvalue]") {
+	std::mt19937 rng(12345);
+	std::uniform_int_distribution<int> framesDist(1, 1000);
+
+	for (int i = 0; i < 200; i++) {
+		int nFrames = framesDist(rng);
+		std::vector<TestAnimValue> stream = MakeRandomStream(rng, nFrames);
+		RequireDecodeMatchesExtract(stream, nFrames);
+	}
+}
+
+TEST_CASE("AnimValue_Decode repeats the last valid value of a run", "[animvalue]") {
+	// 2 values over 5 frames, then 1 value over 3 frames
+	std::vector<TestAnimValue> stream = {
+		MakeHeader(2, 5), MakeValue(10), MakeValue(20),
+		MakeHeader(1, 3), MakeValue(-7),
+		MakeHeader(0, 0),
+	};
+
+	std::vector<short> decoded(8);
+	AnimValue_Decode(stream.data(), 8, decoded.data());
+
+	const short expected[8] = { 10, 20, 20, 20, 20, -7, -7, -7 };
+	for (int frame = 0; frame < 8; frame++) {
+		REQUIRE(decoded[frame] == expected[frame]);
+	}
+	RequireDecodeMatchesExtract(stream, 8);
+}
+
+TEST_CASE("AnimValue_Decode reads zero past the end of the stream", "[animvalue]") {
+	std::vector<TestAnimValue> stream = {
+		MakeHeader(1, 2), MakeValue(42),
+		MakeHeader(0, 0),
+	};
+
+	std::vector<short> decoded(4);
+	AnimValue_Decode(stream.data(), 4, decoded.data());
+	REQUIRE(decoded[0] == 42);
+	REQUIRE(decoded[1] == 42);
+	REQUIRE(decoded[2] == 0);
+	REQUIRE(decoded[3] == 0);
+
+	float extracted = 1.0f;
+	REQUIRE_FALSE(AnimValue_Extract(3, stream.data(), 1.0f, extracted));
+	REQUIRE(extracted == 0.0f);
+}
@@ -0,0 +1,126 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit tests for the mathlib SIMD layer
+//          The array transforms, which take the 8-wide path when the
+//          processor has AVX2, must match the scalar transforms and give
+//          the same bits on both paths, and the transcendental functions
+//          must stay within the error bounds documented in ssemath.h
+//          The benchmark is hidden, run it with: source15_tests "[benchmark]"
+//
+//=============================================================================
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include "mathlib/mathlib.h"
+#include "mathlib/ssemath.h"
+#include "mathlib/avxmath.h"
+#include <vector>
+
+using Catch::Matchers::WithinAbs;
+
+static const int TEST_VECTOR_COUNT = 37;		// odd, so the 8-wide paths leave one for the 4-wide code
+
+static void MakeTestVectors(std::vector<FourVectors> &vectors, std::vector<Vector> &scalars) {
+	vectors.resize(TEST_VECTOR_COUNT);
+	scalars.resize(TEST_VECTOR_COUNT * 4);
+	for (int i = 0; i < TEST_VECTOR_COUNT * 4; i++) {
+		Vector v((i % 97) - 48.0f, (i % 31) * 0.5f, (i % 13) - 6.5f);
+		scalars[i] = v;
+		vectors[i >> 2].X(i & 3) = v.x;
+		vectors[i >> 2].Y(i & 3) = v.y;
+		vectors[i >> 2].Z(i & 3) = v.z;
+	}
+}
+
+static void RequireVectorsMatch(const std::vector<FourVectors> &vectors, const std::vector<Vector> &scalars) {
+	for (int i = 0; i < TEST_VECTOR_COUNT * 4; i++) {
+		REQUIRE_THAT(vectors[i >> 2].X(i & 3), WithinAbs(scalars[i].x, 0.001f));
+		REQUIRE_THAT(vectors[i >> 2].Y(i & 3), WithinAbs(scalars[i].y, 0.001f));
+		REQUIRE_THAT(vectors[i >> 2].Z(i & 3), WithinAbs(scalars[i].z, 0.001f));
+	}
+}
+
+TEST_CASE("FourVectors array transforms match the scalar transforms", "[mathlib][simd]") {
+	MathLib_Init();
+
+	matrix3x4_t mat;
+	AngleMatrix(QAngle(30.0f, 45.0f, 60.0f), Vector(10.0f, -20.0f, 30.0f), mat);
+
+	std::vector<FourVectors> vectors;
+	std::vector<Vector> scalars;
+	MakeTestVectors(vectors, scalars);
+
+	SECTION("RotateManyBy") {
+		FourVectors::RotateManyBy(vectors.data(), TEST_VECTOR_COUNT, mat);
+		for (Vector &v : scalars) {
+			Vector in = v;
+			VectorRotate(in, mat, v);
+		}
+		RequireVectorsMatch(vectors, scalars);
+	}
+
+	SECTION("TransformManyBy into another array") {
+		std::vector<FourVectors> out(TEST_VECTOR_COUNT);
+		FourVectors::TransformManyBy(vectors.data(), TEST_VECTOR_COUNT, mat, out.data());
+		for (Vector &v : scalars) {
+			Vector in = v;
+			VectorTransform(in, mat, v);
+		}
+		RequireVectorsMatch(out, scalars);
+	}
+
+	SECTION("TransformManyBy in place") {
+		FourVectors::TransformManyBy(vectors.data(), TEST_VECTOR_COUNT, mat);
+		for (Vector &v : scalars) {
+			Vector in = v;
+			VectorTransform(in, mat, v);
+		}
+		RequireVectorsMatch(vectors, scalars);
+	}
+}
+
+TEST_CASE("The 8-wide array transforms give the same bits as the 4-wide ones", "[mathlib][simd]") {
+	MathLib_Init();
+
+	matrix3x4_t mat;
+	AngleMatrix(QAngle(-17.0f, 123.0f, 41.0f), Vector(0.1f, 1000.3f, -77.7f), mat);
+
+	// the same vectors in every entry; the first 36 take the 8-wide path
+	// when the processor has AVX2, the last one always takes the 4-wide path
+	std::vector<FourVectors> vectors(TEST_VECTOR_COUNT);
+	for (FourVectors &v : vectors) {
+		for (int i = 0; i < 4; i++) {
+			v.X(i) = 1.0f / 3.0f + i * 17.1f;
+			v.Y(i) = -2.0f / 7.0f - i * 5.3f;
+			v.Z(i) = 1234.567f / (i + 1);
+		}
+	}
+	std::vector<FourVectors> rotated = vectors;
+	std::vector<FourVectors> transformed(TEST_VECTOR_COUNT);
+	FourVectors::RotateManyBy(rotated.data(), TEST_VECTOR_COUNT, mat);
+	FourVectors::TransformManyBy(vectors.data(), TEST_VECTOR_COUNT, mat, transformed.data());
+
+	const FourVectors &rotatedLast = rotated[TEST_VECTOR_COUNT - 1];
+	const FourVectors &transformedLast = transformed[TEST_VECTOR_COUNT - 1];
+	for (int n = 0; n < TEST_VECTOR_COUNT - 1; n++) {
+		for (int i = 0; i < 4; i++) {
+			REQUIRE(rotated[n].X(i) == rotatedLast.X(i));
+			REQUIRE(rotated[n].Y(i) == rotatedLast.Y(i));
+			REQUIRE(rotated[n].Z(i) == rotatedLast.Z(i));
+			REQUIRE(transformed[n].X(i) == transformedLast.X(i));
+			REQUIRE(transformed[n].Y(i) == transformedLast.Y(i));
+			REQUIRE(transformed[n].Z(i) == transformedLast.Z(i));
+		}
+	}
+}
+
+TEST_CASE("SIMD transcendental functions stay within their error bounds", "[mathlib][simd]") {
+	// samples every function against the double precision C library, and
+	// Msg()s the worst error of each
+	REQUIRE(MathLib_CheckSIMDAccuracy());
+}
+
+TEST_CASE("mathlib SIMD benchmark", "[.][benchmark][mathlib]") {
+	MathLib_Init();
+	MathLib_RunSIMDBenchmarks(1000);
+}